@@ -43,9 +43,13 @@ long myst_syscall(long n, long params[6])
 {
     static pthread_once_t _once = PTHREAD_ONCE_INIT;
 
-    /* create the itimer thread on demand (only if needed) */
-    if (n == SYS_setitimer)
+    /* create the itimer thread on demand (only if needed); the kernel lets
+     * one such thread service the timers and keeps the others on standby */
+    if (n == SYS_setitimer || n == SYS_timer_create ||
+        n == SYS_timerfd_create)
+    {
         pthread_once(&_once, _create_itimer_thread);
+    }
 
     if (n == SYS_fork)
     {
@@ -180,6 +180,21 @@ struct thread_args
 /* internal musl function */
 extern int __clone(int (*func)(void*), void* stack, int flags, void* arg, ...);
 
+long myst_syscall(long n, long params[6]);
+
+/* like __clone() (see enter.c) but also passes SYS_myst_clone options */
+static int _clone(
+    int (*fn)(void*),
+    void* stack,
+    int flags,
+    void* arg,
+    long options)
+{
+    long args[7] = {(long)fn, (long)stack, (long)flags, (long)arg};
+    long params[6] = {(long)args, options};
+    return myst_syscall(SYS_myst_clone, params);
+}
+
 static bool _within(const void* data, size_t size, const void* ptr)
 {
     const uint8_t* start = data;
@@ -389,6 +404,7 @@ myst_fork(void)
         void* sp = NULL;
         void* bp = NULL;
         const int clone_flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+        long clone_options = 0;
         long tmp_ret;
         struct pthread* child_pthread;
         void* parent_stack;
@@ -433,7 +449,14 @@ myst_fork(void)
         args->unmap_on_exit.mmap_ptr = child_pthread->map_base;
         args->unmap_on_exit.mmap_ptr_size = mmap_rounded_size;
 
-        if ((tmp_ret = __clone(_child_func, sp, clone_flags, args)) < 0)
+        /* in wait mode, the kernel suspends this thread in the clone until
+         * the child execs or exits (so the child may borrow descriptors) */
+        if (fork_mode == myst_fork_pseudo_wait_for_exit_exec)
+            clone_options = MYST_CLONE_WAIT_EXEC_EXIT;
+
+        tmp_ret = _clone(_child_func, sp, clone_flags, args, clone_options);
+
+        if (tmp_ret < 0)
         {
             munmap(child_pthread->map_base, child_pthread->map_size);
             free(args);
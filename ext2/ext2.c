@@ -10,11 +10,15 @@
 #include <time.h>
 
 #include <myst/clock.h>
+#include <myst/dcache.h>
 #include <myst/eraise.h>
 #include <myst/ext2.h>
 #include <myst/hex.h>
+#include <myst/list.h>
+#include <myst/mutex.h>
 #include <myst/paths.h>
 #include <myst/round.h>
+#include <myst/rwlock.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
 #include <myst/thread.h>
@@ -56,9 +60,93 @@ struct myst_file
     int fdflags;        /* file descriptor flags: FD_CLOEXEC */
     char realpath[EXT2_PATH_MAX];
     ext2_dir_t dir;
+    myst_mutex_t mutex; /* guards the offset and the inode copy */
     _Atomic(size_t) use_count;
 };
 
+/*
+**==============================================================================
+**
+** Locking:
+**
+** The directory tree is guarded by the tree lock. Path lookups take it shared
+** and operations that change the tree or that rewrite the inode of a path
+** (creating, linking, unlinking, renaming, truncating, changing ownership or
+** mode) take it exclusive. Operations on open files take it shared too, since
+** the on-disk inode is written back as a whole. The lock is released before
+** delegating an operation to another file system.
+**
+** The data of each inode is guarded by one of the inode locks (chosen by
+** inode number), which readers take shared and writers take exclusive. The
+** file offset and the inode copy within an open file are guarded by
+** file->mutex.
+**
+** The block and inode allocators (the in-memory bitmaps and reserved blocks,
+** the group descriptors, the super block and the inode references) are
+** guarded by the alloc mutex and the block device (whose caches are not
+** thread-safe) by the dev mutex. The inode cache has a mutex of its own.
+**
+** The lock order is: tree, file->mutex, inode, alloc, icache, dev.
+**
+**==============================================================================
+*/
+
+#define EXT2_INODE_LOCKS 64
+
+struct ext2_locks
+{
+    myst_rwlock_t tree;
+    myst_rwlock_t inodes[EXT2_INODE_LOCKS];
+    myst_mutex_t alloc;
+    myst_mutex_t dev;
+};
+
+static int _locks_new(struct ext2_locks** locks_out)
+{
+    int ret = 0;
+    struct ext2_locks* locks;
+
+    if (!(locks = calloc(1, sizeof(struct ext2_locks))))
+        ERAISE(-ENOMEM);
+
+    myst_rwlock_init(&locks->tree);
+
+    for (size_t i = 0; i < EXT2_INODE_LOCKS; i++)
+        myst_rwlock_init(&locks->inodes[i]);
+
+    myst_mutex_init(&locks->alloc);
+    myst_mutex_init(&locks->dev);
+
+    *locks_out = locks;
+
+done:
+    return ret;
+}
+
+static myst_rwlock_t* _inode_lock(const ext2_t* ext2, ext2_ino_t ino)
+{
+    return &ext2->locks->inodes[ino % EXT2_INODE_LOCKS];
+}
+
+/* lock an open file for reading or writing (see the lock order above) */
+static void _lock_file(ext2_t* ext2, myst_file_t* file, bool write)
+{
+    myst_rwlock_rdlock(&ext2->locks->tree);
+    myst_mutex_lock(&file->mutex);
+
+    if (write)
+        myst_rwlock_wrlock(_inode_lock(ext2, file->ino));
+    else
+        myst_rwlock_rdlock(_inode_lock(ext2, file->ino));
+}
+
+static void _unlock_file(ext2_t* ext2, myst_file_t* file)
+{
+    myst_rwlock_unlock(_inode_lock(ext2, file->ino));
+    myst_mutex_unlock(&file->mutex);
+    myst_rwlock_unlock(&ext2->locks->tree);
+}
+
 MYST_UNUSED
 static bool _valid_ino(const ext2_t* ext2, ext2_ino_t ino)
 {
@@ -68,9 +156,12 @@ static bool _valid_ino(const ext2_t* ext2, ext2_ino_t ino)
 static void _inode_ref(ext2_t* ext2, ext2_ino_t ino)
 {
     assert(_valid_ino(ext2, ino));
+    myst_mutex_lock(&ext2->locks->alloc);
     ext2->inode_refs[ino - 1].nopens++;
+    myst_mutex_unlock(&ext2->locks->alloc);
 }
 
+/* the caller holds the alloc mutex */
 static ext2_ino_t _inode_unref(ext2_t* ext2, ext2_ino_t ino)
 {
     assert(_valid_ino(ext2, ino));
@@ -214,6 +305,16 @@ static ssize_t _read(myst_blkdev_t* dev, size_t offset, void* data, size_t size)
         const size_t n = size / blksz;
         ptr = (uint8_t*)data;
 
+        /* transfer all of the blocks at once if the device can */
+        if (dev->get_blocks)
+        {
+            if (dev->get_blocks(dev, blkno, ptr, n) != 0)
+                goto done;
+
+            ret = size;
+            goto done;
+        }
+
         for (i = 0; i < n; i++)
         {
             if (dev->get(dev, i + blkno, ptr) != 0)
@@ -291,6 +392,16 @@ static ssize_t _write(
         const size_t n = size / blksz;
         ptr = (uint8_t*)data;
 
+        /* transfer all of the blocks at once if the device can */
+        if (dev->put_blocks)
+        {
+            if (dev->put_blocks(dev, blkno, ptr, n) != 0)
+                goto done;
+
+            ret = size;
+            goto done;
+        }
+
         for (i = 0; i < n; i++)
         {
             if (dev->put(dev, i + blkno, ptr) != 0)
@@ -344,6 +455,53 @@ done:
     return ret;
 }
 
+/* device access is serialized since the block devices cache sectors */
+static ssize_t _dev_read(
+    const ext2_t* ext2,
+    size_t offset,
+    void* data,
+    size_t size)
+{
+    ssize_t ret;
+
+    myst_mutex_lock(&ext2->locks->dev);
+    ret = _read(ext2->dev, offset, data, size);
+    myst_mutex_unlock(&ext2->locks->dev);
+
+    return ret;
+}
+
+/* partial sectors are rewritten (read-modify-write) under the same lock */
+static ssize_t _dev_write(
+    const ext2_t* ext2,
+    size_t offset,
+    const void* data,
+    size_t size)
+{
+    ssize_t ret;
+
+    myst_mutex_lock(&ext2->locks->dev);
+    ret = _write(ext2->dev, offset, data, size);
+    myst_mutex_unlock(&ext2->locks->dev);
+
+    return ret;
+}
+
+/* write back the blocks cached by the device (if it caches any) */
+static int _dev_flush(const ext2_t* ext2)
+{
+    int ret = 0;
+
+    if (ext2->dev->flush)
+    {
+        myst_mutex_lock(&ext2->locks->dev);
+        ret = (*ext2->dev->flush)(ext2->dev);
+        myst_mutex_unlock(&ext2->locks->dev);
+    }
+
+    return ret;
+}
+
 const uint8_t ext2_count_bits_table[] = {
     0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4,
     2, 3, 3, 4, 3, 4, 4, 5, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
@@ -459,7 +617,7 @@ static int _write_block(
 #endif
 
     /* Write the block */
-    if (_write(ext2->dev, offset, block->data, block->size) != block->size)
+    if (_dev_write(ext2, offset, block->data, block->size) != block->size)
     {
         ERAISE(-EIO);
     }
@@ -485,7 +643,7 @@ static int _write_group(const ext2_t* ext2, uint32_t grpno)
     const size_t offset = _blk_offset(blkno, ext2->block_size) + (grpno * size);
 
     /* Read the block */
-    if (_write(ext2->dev, offset, &ext2->groups[grpno], size) != size)
+    if (_dev_write(ext2, offset, &ext2->groups[grpno], size) != size)
     {
         ERAISE(-EIO);
     }
@@ -500,11 +658,13 @@ static int _write_super_block(const ext2_t* ext2)
     int ret = 0;
     const size_t size = sizeof(ext2_super_block_t);
 
-    /* Read the superblock */
-    if (_write(ext2->dev, EXT2_BASE_OFFSET, &ext2->sb, size) != size)
-    {
+    /* Write the superblock (the allocators update its counts) */
+    myst_mutex_lock(&ext2->locks->alloc);
+    ret = _dev_write(ext2, EXT2_BASE_OFFSET, &ext2->sb, size) != size;
+    myst_mutex_unlock(&ext2->locks->alloc);
+
+    if (ret)
         ERAISE(-EIO);
-    }
 
     ret = 0;
 
@@ -534,348 +694,639 @@ done:
 }
 #endif
 
-static int _write_block_bitmap(
-    const ext2_t* ext2,
-    uint32_t group_index,
-    const ext2_block_t* block)
+/*
+**==============================================================================
+**
+** block and inode allocation:
+**
+** The bitmaps of a group are read into memory the first time the allocators
+** search that group, and they stay there. The allocators update them together
+** with the free counts of the group descriptors and the super block, which are
+** already in memory, and only mark them dirty. _alloc_flush() writes the dirty
+** metadata back as a batch (on fsync and when the file system is released).
+** Groups whose free count is zero are skipped without looking at their
+** bitmaps.
+**
+** Blocks are searched for from a goal (the block after the previous block of
+** the file), so files are laid out contiguously. Appending to a file reserves
+** the next few free blocks after the one it allocates, in a window for that
+** inode, so concurrent appends to several files do not interleave. A window
+** is returned to the bitmaps when the file is closed, truncated, or freed, and
+** before the metadata is written back, so the device never records it.
+**
+** All of this is guarded by the alloc mutex.
+**
+**==============================================================================
+*/
+
+/* the blocks an append allocates (the first one and the reserved ones) */
+#define ALLOC_WINDOW_BLOCKS 8
+
+/* the number of windows (a power of two) */
+#define ALLOC_WINDOWS 64
+
+typedef struct alloc_group
+{
+    uint8_t* blocks; /* the block bitmap (null until loaded) */
+    uint8_t* inodes; /* the inode bitmap (null until loaded) */
+    bool blocks_dirty;
+    bool inodes_dirty;
+    bool desc_dirty; /* the group descriptor */
+} alloc_group_t;
+
+typedef struct alloc_window
 {
-    int ret = 0;
-    uint32_t bitmap_size_bytes;
-
-    bitmap_size_bytes = ext2->sb.s_blocks_per_group / 8;
-
-    if (block->size != bitmap_size_bytes)
-        ERAISE(-EINVAL);
+    ext2_ino_t ino;
+    uint32_t blkno; /* the next reserved block */
+    uint32_t count; /* the number of reserved blocks */
+} alloc_window_t;
 
-    if (group_index > ext2->group_count)
-        ERAISE(-EINVAL);
+struct ext2_alloc
+{
+    alloc_group_t* groups;
+    bool sb_dirty;
+    alloc_window_t windows[ALLOC_WINDOWS];
+};
 
-    ECHECK(
-        _write_block(ext2, ext2->groups[group_index].bg_block_bitmap, block));
+static uint32_t _block_bitmap_size(const ext2_t* ext2)
+{
+    return ext2->sb.s_blocks_per_group / 8;
+}
 
-done:
-    return ret;
+static uint32_t _inode_bitmap_size(const ext2_t* ext2)
+{
+    return ext2->sb.s_inodes_per_group / 8;
 }
 
-static int _write_group_with_bitmap(
-    ext2_t* ext2,
-    uint32_t grpno,
-    ext2_block_t* bitmap)
+static int _alloc_new(const ext2_t* ext2, struct ext2_alloc** alloc_out)
 {
     int ret = 0;
+    struct ext2_alloc* alloc;
 
-    /* Write the group */
-    ECHECK(_write_group(ext2, grpno));
+    if (!(alloc = calloc(1, sizeof(struct ext2_alloc))))
+        ERAISE(-ENOMEM);
 
-    /* Write the bitmap */
-    ECHECK(_write_block_bitmap(ext2, grpno, bitmap));
+    if (!(alloc->groups = calloc(ext2->group_count, sizeof(alloc_group_t))))
+    {
+        free(alloc);
+        ERAISE(-ENOMEM);
+    }
 
-    ret = 0;
+    *alloc_out = alloc;
 
 done:
     return ret;
 }
 
-/* comparison function for qsort */
-static int _put_blkno(ext2_t* ext2, uint32_t blkno)
+static void _alloc_free(const ext2_t* ext2, struct ext2_alloc* alloc)
+{
+    for (uint32_t i = 0; i < ext2->group_count; i++)
+    {
+        free(alloc->groups[i].blocks);
+        free(alloc->groups[i].inodes);
+    }
+
+    free(alloc->groups);
+    free(alloc);
+}
+
+/* read a bitmap into memory */
+static int _load_bitmap(
+    const ext2_t* ext2,
+    uint32_t blkno,
+    uint32_t size,
+    uint8_t** bitmap_out)
 {
     int ret = 0;
-    const uint32_t grpno = _blkno_to_grpno(ext2, blkno);
-    const uint32_t lblkno = _blkno_to_lblkno(ext2, blkno);
-    ext2_block_t* bitmap;
+    ext2_block_t* block;
+    uint8_t* bitmap = NULL;
 
-    if (!(bitmap = malloc(sizeof(ext2_block_t))))
+    if (!(block = malloc(sizeof(ext2_block_t))))
         ERAISE(-ENOMEM);
 
-#ifdef CHECK
-    ECHECK(_check_blkno(ext2, blkno, grpno, lblkno));
-#endif
-
-    /* read the block bitmap */
-    ECHECK(ext2_read_block_bitmap(ext2, grpno, bitmap));
+    ECHECK(ext2_read_block(ext2, blkno, block));
 
-#ifdef CHECK
-    /* be sure the bit for this block number is actually set */
-    if (!_test_bit(bitmap.data, bitmap.size, lblkno))
+    if (block->size < size)
         ERAISE(-EINVAL);
-#endif
-
-    /* clear the bit for the block number */
-    _clear_bit(bitmap->data, bitmap->size, lblkno);
-
-    /* update the block count in the super block */
-    ext2->sb.s_free_blocks_count++;
-
-    /* update the group block count */
-    ext2->groups[grpno].bg_free_blocks_count++;
 
-    /* write the group and bitmap */
-    ECHECK(_write_group_with_bitmap(ext2, grpno, bitmap));
+    if (!(bitmap = malloc(size)))
+        ERAISE(-ENOMEM);
 
-    /* ATTN: minimize super block writes */
-    /* update super block. */
-    ECHECK(_write_super_block(ext2));
+    memcpy(bitmap, block->data, size);
+    *bitmap_out = bitmap;
+    bitmap = NULL;
 
 done:
 
+    if (block)
+        free(block);
+
     if (bitmap)
         free(bitmap);
 
     return ret;
 }
 
-static int _get_blkno(ext2_t* ext2, uint32_t* blkno)
+static int _get_block_bitmap(
+    const ext2_t* ext2,
+    uint32_t grpno,
+    uint8_t** bitmap)
 {
     int ret = 0;
-    struct locals
-    {
-        ext2_block_t bitmap;
-    };
-    struct locals* locals = NULL;
-    uint32_t grpno;
-
-    if (!(locals = malloc(sizeof(struct locals))))
-        ERAISE(-ENOMEM);
-
-    /* Clear any block number */
-    *blkno = 0;
-
-    /* Use brute force search for a free block */
-    for (grpno = 0; grpno < ext2->group_count; grpno++)
-    {
-        uint32_t lblkno;
-
-        /* Read the bitmap */
-
-        ECHECK(ext2_read_block_bitmap(ext2, grpno, &locals->bitmap));
-
-        /* Scan the bitmap, looking for free bit */
-        {
-            const uint8_t* p;
-
-            /* skip over full (0xff) bytes */
-            p = myst_memcchr(locals->bitmap.data, 0xff, locals->bitmap.size);
-
-            if (!p)
-                continue;
-
-            lblkno = (p - locals->bitmap.data) * 8;
-
-            for (; lblkno < locals->bitmap.size * 8; lblkno++)
-            {
-                if (!ext2_test_bit(
-                        locals->bitmap.data, locals->bitmap.size, lblkno))
-                {
-                    _set_bit(locals->bitmap.data, locals->bitmap.size, lblkno);
-                    *blkno = _make_blkno(ext2, grpno, lblkno);
-                    break;
-                }
-            }
-        }
-
-        if (*blkno)
-            break;
-    }
+    alloc_group_t* group = &ext2->alloc->groups[grpno];
 
-    /* If no free blocks found */
-    if (!*blkno)
-        ERAISE(-ENOSPC);
-
-    /* Write the superblock */
-    {
-        ext2->sb.s_free_blocks_count--;
-        ECHECK(_write_super_block(ext2));
-    }
-
-    /* Write the group */
+    if (!group->blocks)
     {
-        ext2->groups[grpno].bg_free_blocks_count--;
-        ECHECK(_write_group(ext2, grpno));
+        ECHECK(_load_bitmap(
+            ext2,
+            ext2->groups[grpno].bg_block_bitmap,
+            _block_bitmap_size(ext2),
+            &group->blocks));
     }
 
-    /* Write the bitmap */
-    ECHECK(_write_block_bitmap(ext2, grpno, &locals->bitmap));
+    *bitmap = group->blocks;
 
 done:
-
-    if (locals)
-        free(locals);
-
     return ret;
 }
 
-static int _read_super_block(myst_blkdev_t* dev, ext2_super_block_t* sb)
+static int _get_inode_bitmap(
+    const ext2_t* ext2,
+    uint32_t grpno,
+    uint8_t** bitmap)
 {
     int ret = 0;
+    alloc_group_t* group = &ext2->alloc->groups[grpno];
 
-    /* Read the superblock */
-    if (_read(dev, EXT2_BASE_OFFSET, sb, sizeof(ext2_super_block_t)) !=
-        sizeof(ext2_super_block_t))
+    if (!group->inodes)
     {
-        ERAISE(-EIO);
+        ECHECK(_load_bitmap(
+            ext2,
+            ext2->groups[grpno].bg_inode_bitmap,
+            _inode_bitmap_size(ext2),
+            &group->inodes));
     }
 
-    ret = 0;
+    *bitmap = group->inodes;
 
 done:
     return ret;
 }
 
-static ext2_group_desc_t* _read_groups(const ext2_t* ext2)
+/* find the first zero bit at or after start (or return nbits) */
+static uint32_t _find_zero_bit(
+    const uint8_t* data,
+    uint32_t nbits,
+    uint32_t start)
 {
-    int ret = 0;
-    ext2_group_desc_t* groups = NULL;
-    uint32_t groups_size = 0;
-    uint32_t blkno;
+    const uint32_t size = nbits / 8;
+    uint32_t i = start;
+    const uint8_t* p;
 
-    /* Allocate the groups list */
+    /* check the bits up to the next byte boundary */
+    for (; i < nbits && (i % 8); i++)
     {
-        groups_size = ext2->group_count * sizeof(ext2_group_desc_t);
-
-        if (!(groups = (ext2_group_desc_t*)malloc(groups_size)))
-        {
-            ERAISE(-ENOMEM);
-        }
+        if (!ext2_test_bit(data, size, i))
+            return i;
     }
 
-    /* Determine the block where group table starts */
-    if (ext2->block_size == 1024)
-        blkno = 2;
-    else
-        blkno = 1;
-
-    /* Read the block */
-    if (_read(
-            ext2->dev,
-            _blk_offset(blkno, ext2->block_size),
-            groups,
-            groups_size) != groups_size)
-    {
-        ERAISE(-EIO);
-    }
+    if (i >= nbits)
+        return nbits;
 
-done:
+    /* skip over full (0xff) bytes */
+    if (!(p = myst_memcchr(data + i / 8, 0xff, size - i / 8)))
+        return nbits;
 
-    if (ret)
+    for (i = (p - data) * 8; i < nbits; i++)
     {
-        if (groups)
-        {
-            free(groups);
-            groups = NULL;
-        }
+        if (!ext2_test_bit(data, size, i))
+            return i;
     }
 
-    return groups;
+    return nbits;
 }
 
-static uint32_t _ino_to_grpno(const ext2_t* ext2, ext2_ino_t ino)
+static void _take_block(
+    ext2_t* ext2,
+    uint32_t grpno,
+    uint8_t* bitmap,
+    uint32_t lblkno)
 {
-#ifdef CHECK
-    assert(ino != 0);
-#endif
-
-    return (ino - 1) / ext2->sb.s_inodes_per_group;
+    _set_bit(bitmap, _block_bitmap_size(ext2), lblkno);
+    ext2->sb.s_free_blocks_count--;
+    ext2->groups[grpno].bg_free_blocks_count--;
+    ext2->alloc->groups[grpno].blocks_dirty = true;
+    ext2->alloc->groups[grpno].desc_dirty = true;
+    ext2->alloc->sb_dirty = true;
 }
 
-static uint32_t _ino_to_lino(const ext2_t* ext2, ext2_ino_t ino)
+static void _release_block(
+    ext2_t* ext2,
+    uint32_t grpno,
+    uint8_t* bitmap,
+    uint32_t lblkno)
 {
-#ifdef CHECK
-    assert(ino != 0);
-#endif
-
-    return (ino - 1) % ext2->sb.s_inodes_per_group;
+    _clear_bit(bitmap, _block_bitmap_size(ext2), lblkno);
+    ext2->sb.s_free_blocks_count++;
+    ext2->groups[grpno].bg_free_blocks_count++;
+    ext2->alloc->groups[grpno].blocks_dirty = true;
+    ext2->alloc->groups[grpno].desc_dirty = true;
+    ext2->alloc->sb_dirty = true;
 }
 
-static int _write_inode_bitmap(
-    const ext2_t* ext2,
-    uint32_t group_index,
-    const ext2_block_t* block)
+/* return the reserved blocks of a window (the caller holds alloc) */
+static void _discard_window(ext2_t* ext2, alloc_window_t* window)
 {
-    int ret = 0;
-    uint32_t bitmap_size_bytes;
+    for (uint32_t i = 0; i < window->count; i++)
+    {
+        const uint32_t blkno = window->blkno + i;
+        const uint32_t grpno = _blkno_to_grpno(ext2, blkno);
+        uint8_t* bitmap = ext2->alloc->groups[grpno].blocks;
 
-    bitmap_size_bytes = ext2->sb.s_inodes_per_group / 8;
+        _release_block(ext2, grpno, bitmap, _blkno_to_lblkno(ext2, blkno));
+    }
 
-    if (block->size != bitmap_size_bytes)
-        ERAISE(-EINVAL);
+    window->ino = 0;
+    window->blkno = 0;
+    window->count = 0;
+}
 
-    if (group_index > ext2->group_count)
-        ERAISE(-EINVAL);
+static bool _discard_windows(ext2_t* ext2)
+{
+    bool found = false;
+
+    for (size_t i = 0; i < ALLOC_WINDOWS; i++)
+    {
+        alloc_window_t* window = &ext2->alloc->windows[i];
 
-    ECHECK(
-        _write_block(ext2, ext2->groups[group_index].bg_inode_bitmap, block));
+        if (window->count)
+        {
+            _discard_window(ext2, window);
+            found = true;
+        }
+    }
 
-done:
-    return ret;
+    return found;
 }
 
-static int _get_ino(ext2_t* ext2, ext2_ino_t* ino)
+/* search for a free block from the goal (the caller holds alloc) */
+static int _search_blkno(ext2_t* ext2, uint32_t goal, uint32_t* blkno)
 {
     int ret = 0;
-    uint32_t grpno;
-    struct locals
+    const uint32_t nbits = _block_bitmap_size(ext2) * 8;
+    uint32_t first = 0;
+    uint32_t start = 0;
+
+    *blkno = 0;
+
+    if (goal && _blkno_to_grpno(ext2, goal) < ext2->group_count)
     {
-        ext2_block_t bitmap;
-    };
-    struct locals* locals = NULL;
+        first = _blkno_to_grpno(ext2, goal);
+        start = _blkno_to_lblkno(ext2, goal);
+    }
 
-    if (!(locals = malloc(sizeof(struct locals))))
-        ERAISE(-ENOMEM);
+    /* the goal group from the goal, the others, then the goal group again */
+    for (uint32_t n = 0; n <= ext2->group_count; n++)
+    {
+        const uint32_t grpno = (first + n) % ext2->group_count;
+        uint8_t* bitmap;
+        uint32_t lblkno;
 
-    /* Clear the node number */
-    *ino = 0;
+        if (ext2->groups[grpno].bg_free_blocks_count == 0)
+            continue;
+
+        ECHECK(_get_block_bitmap(ext2, grpno, &bitmap));
+
+        lblkno = _find_zero_bit(bitmap, nbits, n == 0 ? start : 0);
+
+        if (lblkno == nbits)
+            continue;
+
+        _take_block(ext2, grpno, bitmap, lblkno);
+        *blkno = _make_blkno(ext2, grpno, lblkno);
+        goto done;
+    }
+
+    ERAISE(-ENOSPC);
+
+done:
+    return ret;
+}
+
+/* allocate a block near the goal (the caller holds alloc) */
+static int _alloc_blkno(ext2_t* ext2, uint32_t goal, uint32_t* blkno)
+{
+    int ret = 0;
 
-    /* Use brute force search for a free inode number */
-    for (grpno = 0; grpno < ext2->group_count; grpno++)
+    /* the windows may hold the last free blocks */
+    if ((ret = _search_blkno(ext2, goal, blkno)) == -ENOSPC &&
+        _discard_windows(ext2))
     {
-        uint32_t lino;
-        const uint8_t* p;
+        ret = _search_blkno(ext2, goal, blkno);
+    }
 
-        /* Read the bitmap */
-        ECHECK(ext2_read_inode_bitmap(ext2, grpno, &locals->bitmap));
+    ECHECK(ret);
 
-        /* skip over full (0xff) bytes */
-        p = myst_memcchr(locals->bitmap.data, 0xff, locals->bitmap.size);
+done:
+    return ret;
+}
 
-        if (p)
-            lino = (p - locals->bitmap.data) * 8;
-        else
-            lino = locals->bitmap.size * 8;
+static int _put_blkno(ext2_t* ext2, uint32_t blkno)
+{
+    int ret = 0;
+    const uint32_t grpno = _blkno_to_grpno(ext2, blkno);
+    const uint32_t lblkno = _blkno_to_lblkno(ext2, blkno);
+    uint8_t* bitmap;
+
+    myst_mutex_lock(&ext2->locks->alloc);
+
+#ifdef CHECK
+    ECHECK(_check_blkno(ext2, blkno, grpno, lblkno));
+#endif
+
+    if (grpno >= ext2->group_count)
+        ERAISE(-EINVAL);
 
-        /* Scan the bitmap, looking for free bit */
-        for (; lino < locals->bitmap.size * 8; lino++)
+    ECHECK(_get_block_bitmap(ext2, grpno, &bitmap));
+
+#ifdef CHECK
+    /* be sure the bit for this block number is actually set */
+    if (!ext2_test_bit(bitmap, _block_bitmap_size(ext2), lblkno))
+        ERAISE(-EINVAL);
+#endif
+
+    _release_block(ext2, grpno, bitmap, lblkno);
+
+done:
+
+    myst_mutex_unlock(&ext2->locks->alloc);
+
+    return ret;
+}
+
+static int _get_blkno(ext2_t* ext2, uint32_t* blkno)
+{
+    int ret = 0;
+
+    myst_mutex_lock(&ext2->locks->alloc);
+    ret = _alloc_blkno(ext2, 0, blkno);
+    myst_mutex_unlock(&ext2->locks->alloc);
+
+    return ret;
+}
+
+/* write back the dirty bitmaps, group descriptors, and super block */
+static int _alloc_flush(ext2_t* ext2)
+{
+    int ret = 0;
+    const uint32_t block_size = ext2->block_size;
+
+    myst_mutex_lock(&ext2->locks->alloc);
+
+    /* the device never records the reserved blocks */
+    _discard_windows(ext2);
+
+    for (uint32_t grpno = 0; grpno < ext2->group_count; grpno++)
+    {
+        alloc_group_t* group = &ext2->alloc->groups[grpno];
+        const ext2_group_desc_t* desc = &ext2->groups[grpno];
+
+        if (group->blocks_dirty)
         {
-            if (!ext2_test_bit(locals->bitmap.data, locals->bitmap.size, lino))
-            {
-                _set_bit(locals->bitmap.data, locals->bitmap.size, lino);
-                *ino = ext2_make_ino(ext2, grpno, lino);
-                break;
-            }
+            const uint32_t size = _block_bitmap_size(ext2);
+            const uint64_t offset =
+                _blk_offset(desc->bg_block_bitmap, block_size);
+
+            if (_dev_write(ext2, offset, group->blocks, size) != size)
+                ERAISE(-EIO);
+
+            group->blocks_dirty = false;
         }
 
-        if (*ino)
-            break;
+        if (group->inodes_dirty)
+        {
+            const uint32_t size = _inode_bitmap_size(ext2);
+            const uint64_t offset =
+                _blk_offset(desc->bg_inode_bitmap, block_size);
+
+            if (_dev_write(ext2, offset, group->inodes, size) != size)
+                ERAISE(-EIO);
+
+            group->inodes_dirty = false;
+        }
+
+        if (group->desc_dirty)
+        {
+            ECHECK(_write_group(ext2, grpno));
+            group->desc_dirty = false;
+        }
     }
 
-    /* If no free inode numbers */
-    if (!*ino)
-        ERAISE(-ENOSPC);
+    if (ext2->alloc->sb_dirty)
+    {
+        ECHECK(_write_super_block(ext2));
+        ext2->alloc->sb_dirty = false;
+    }
 
-    /* Write the superblock */
-    ext2->sb.s_free_inodes_count--;
-    ERAISE(_write_super_block(ext2));
+done:
 
-    /* Write the group */
-    ext2->groups[grpno].bg_free_inodes_count--;
-    ECHECK(_write_group(ext2, grpno));
+    myst_mutex_unlock(&ext2->locks->alloc);
 
-    /* Write the bitmap */
-    ECHECK(_write_inode_bitmap(ext2, grpno, &locals->bitmap));
+    return ret;
+}
+
+static int _read_super_block(myst_blkdev_t* dev, ext2_super_block_t* sb)
+{
+    int ret = 0;
+
+    /* Read the superblock */
+    if (_read(dev, EXT2_BASE_OFFSET, sb, sizeof(ext2_super_block_t)) !=
+        sizeof(ext2_super_block_t))
+    {
+        ERAISE(-EIO);
+    }
+
+    ret = 0;
 
 done:
+    return ret;
+}
 
-    if (locals)
-        free(locals);
+static ext2_group_desc_t* _read_groups(const ext2_t* ext2)
+{
+    int ret = 0;
+    ext2_group_desc_t* groups = NULL;
+    uint32_t groups_size = 0;
+    uint32_t blkno;
+
+    /* Allocate the groups list */
+    {
+        groups_size = ext2->group_count * sizeof(ext2_group_desc_t);
+
+        if (!(groups = (ext2_group_desc_t*)malloc(groups_size)))
+        {
+            ERAISE(-ENOMEM);
+        }
+    }
+
+    /* Determine the block where group table starts */
+    if (ext2->block_size == 1024)
+        blkno = 2;
+    else
+        blkno = 1;
+
+    /* Read the block */
+    if (_read(
+            ext2->dev,
+            _blk_offset(blkno, ext2->block_size),
+            groups,
+            groups_size) != groups_size)
+    {
+        ERAISE(-EIO);
+    }
+
+done:
+
+    if (ret)
+    {
+        if (groups)
+        {
+            free(groups);
+            groups = NULL;
+        }
+    }
+
+    return groups;
+}
+
+static uint32_t _ino_to_grpno(const ext2_t* ext2, ext2_ino_t ino)
+{
+#ifdef CHECK
+    assert(ino != 0);
+#endif
+
+    return (ino - 1) / ext2->sb.s_inodes_per_group;
+}
+
+static uint32_t _ino_to_lino(const ext2_t* ext2, ext2_ino_t ino)
+{
+#ifdef CHECK
+    assert(ino != 0);
+#endif
+
+    return (ino - 1) % ext2->sb.s_inodes_per_group;
+}
+
+/* allocate a block for a file near the goal, reserving the ones after it */
+static int _get_data_blkno(
+    ext2_t* ext2,
+    ext2_ino_t ino,
+    uint32_t goal,
+    uint32_t* blkno)
+{
+    int ret = 0;
+    alloc_window_t* window = &ext2->alloc->windows[ino & (ALLOC_WINDOWS - 1)];
+
+    myst_mutex_lock(&ext2->locks->alloc);
+
+    /* take the next block of the window if this is an append */
+    if (window->ino == ino && window->count && window->blkno == goal)
+    {
+        *blkno = window->blkno++;
+        window->count--;
+        goto done;
+    }
+
+    if (window->count)
+        _discard_window(ext2, window);
+
+    /* place the first block of a file in the group of its inode */
+    if (goal == 0)
+        goal = _make_blkno(ext2, _ino_to_grpno(ext2, ino), 0);
+
+    ECHECK(_alloc_blkno(ext2, goal, blkno));
+
+    /* reserve the free blocks that follow (within the group) */
+    {
+        const uint32_t grpno = _blkno_to_grpno(ext2, *blkno);
+        const uint32_t nbits = _block_bitmap_size(ext2) * 8;
+        uint8_t* bitmap = ext2->alloc->groups[grpno].blocks;
+        uint32_t lblkno = _blkno_to_lblkno(ext2, *blkno) + 1;
+
+        window->ino = ino;
+        window->blkno = *blkno + 1;
+        window->count = 0;
+
+        while (window->count < ALLOC_WINDOW_BLOCKS - 1 && lblkno < nbits &&
+               !ext2_test_bit(bitmap, nbits / 8, lblkno))
+        {
+            _take_block(ext2, grpno, bitmap, lblkno++);
+            window->count++;
+        }
+    }
+
+done:
+
+    myst_mutex_unlock(&ext2->locks->alloc);
+
+    return ret;
+}
+
+/* return the blocks reserved for the appends to this file */
+static void _put_data_blknos(ext2_t* ext2, ext2_ino_t ino)
+{
+    alloc_window_t* window = &ext2->alloc->windows[ino & (ALLOC_WINDOWS - 1)];
+
+    myst_mutex_lock(&ext2->locks->alloc);
+
+    if (window->ino == ino && window->count)
+        _discard_window(ext2, window);
+
+    myst_mutex_unlock(&ext2->locks->alloc);
+}
+
+static int _get_ino(ext2_t* ext2, ext2_ino_t* ino)
+{
+    int ret = 0;
+    const uint32_t nbits = _inode_bitmap_size(ext2) * 8;
+
+    myst_mutex_lock(&ext2->locks->alloc);
+
+    /* Clear the node number */
+    *ino = 0;
+
+    for (uint32_t grpno = 0; grpno < ext2->group_count; grpno++)
+    {
+        alloc_group_t* group = &ext2->alloc->groups[grpno];
+        uint8_t* bitmap;
+        uint32_t lino;
+
+        /* skip full groups without reading their bitmaps */
+        if (ext2->groups[grpno].bg_free_inodes_count == 0)
+            continue;
+
+        ECHECK(_get_inode_bitmap(ext2, grpno, &bitmap));
+
+        if ((lino = _find_zero_bit(bitmap, nbits, 0)) == nbits)
+            continue;
+
+        _set_bit(bitmap, nbits / 8, lino);
+        ext2->sb.s_free_inodes_count--;
+        ext2->groups[grpno].bg_free_inodes_count--;
+        group->inodes_dirty = true;
+        group->desc_dirty = true;
+        ext2->alloc->sb_dirty = true;
+
+        *ino = ext2_make_ino(ext2, grpno, lino);
+        goto done;
+    }
+
+    /* If no free inode numbers */
+    ERAISE(-ENOSPC);
+
+done:
+
+    myst_mutex_unlock(&ext2->locks->alloc);
 
     return ret;
 }
@@ -883,53 +1334,43 @@ done:
 static int _put_ino(ext2_t* ext2, ext2_ino_t ino)
 {
     int ret = 0;
+    const uint32_t nbits = _inode_bitmap_size(ext2) * 8;
+    alloc_group_t* group;
     uint32_t grpno;
     uint32_t lino;
-    struct locals
-    {
-        ext2_block_t bitmap;
-    };
-    struct locals* locals = NULL;
+    uint8_t* bitmap;
 
-    if (!(locals = malloc(sizeof(struct locals))))
-        ERAISE(-ENOMEM);
+    myst_mutex_lock(&ext2->locks->alloc);
 
     /* get the group number from the inode number */
     if ((grpno = _ino_to_grpno(ext2, ino)) >= ext2->group_count)
         ERAISE(-EINVAL);
 
-    /* read the inode bitmap for this group */
-    ECHECK(ext2_read_inode_bitmap(ext2, grpno, &locals->bitmap));
-
     /* get the logical inode number from the inode number */
-    if ((lino = _ino_to_lino(ext2, ino)) >= (locals->bitmap.size * 8))
-    {
+    if ((lino = _ino_to_lino(ext2, ino)) >= nbits)
         ERAISE(-EINVAL);
-    }
 
-    /* clear the bitmap bit */
-    _clear_bit(locals->bitmap.data, locals->bitmap.size, lino);
+    ECHECK(_get_inode_bitmap(ext2, grpno, &bitmap));
 
-    /* update the global inode count and write the superblock */
+    /* clear the bitmap bit and update the counts */
+    _clear_bit(bitmap, nbits / 8, lino);
     ext2->sb.s_free_inodes_count++;
-    ERAISE(_write_super_block(ext2));
-
-    /* update the group inode count and write the group */
     ext2->groups[grpno].bg_free_inodes_count++;
-    ECHECK(_write_group(ext2, grpno));
 
-    /* Write the bitmap */
-    ECHECK(_write_inode_bitmap(ext2, grpno, &locals->bitmap));
+    group = &ext2->alloc->groups[grpno];
+    group->inodes_dirty = true;
+    group->desc_dirty = true;
+    ext2->alloc->sb_dirty = true;
 
 done:
 
-    if (locals)
-        free(locals);
+    myst_mutex_unlock(&ext2->locks->alloc);
 
     return ret;
 }
 
-static int _write_inode(
+/* write an inode to the device (see _write_inode()) */
+static int _store_inode(
     const ext2_t* ext2,
     ext2_ino_t ino,
     const ext2_inode_t* inode)
@@ -953,8 +1394,8 @@ static int _write_inode(
     offset = _blk_offset(group->bg_inode_table, ext2->block_size) +
              ((uint64_t)lino * (uint64_t)inode_size);
 
-    /* Read the inode */
-    if (_write(ext2->dev, offset, inode, inode_size) != inode_size)
+    /* Write the inode */
+    if (_dev_write(ext2, offset, inode, inode_size) != inode_size)
         ERAISE(-ENOSPC);
 
     ret = 0;
@@ -963,6 +1404,402 @@ done:
     return ret;
 }
 
+/* read an inode from the device (see ext2_read_inode()) */
+static int _load_inode(const ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
+{
+    int ret = 0;
+    uint32_t lino = _ino_to_lino(ext2, ino);
+    uint32_t grpno = _ino_to_grpno(ext2, ino);
+    const ext2_group_desc_t* group = &ext2->groups[grpno];
+    uint32_t inode_size = ext2->sb.s_inode_size;
+    uint64_t offset;
+
+    /* Check the reverse mapping */
+    {
+        ext2_ino_t tmp;
+        tmp = ext2_make_ino(ext2, grpno, lino);
+        assert(tmp == ino);
+    }
+
+    offset = _blk_offset(group->bg_inode_table, ext2->block_size) +
+             ((uint64_t)lino * (uint64_t)inode_size);
+
+    /* Read the inode */
+    if (_dev_read(ext2, offset, inode, inode_size) != inode_size)
+        ERAISE(-EIO);
+
+done:
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** inode cache:
+**
+** Inodes are read from the device once and then served from the cache, which
+** also absorbs inode writes: _write_inode() only updates the cached copy and
+** marks it dirty. Dirty inodes are written back when evicted, on fsync and
+** sync, and when the file system is released.
+**
+** Open files pin their inodes so that they are never evicted. The pins only
+** decide what may be evicted, so a pin lost to a failed allocation costs a
+** device read later but never a stale inode.
+**
+** Each cached inode also remembers a few runs of contiguous logical blocks
+** (including holes) together with the physical block of the first, so that
+** mapping file blocks rarely reads the indirect blocks. The runs are dropped
+** whenever blocks are added to or removed from the inode.
+**
+**==============================================================================
+*/
+
+/* the number of chains (a power of two) */
+#define ICACHE_NCHAINS 1024
+
+/* the number of unpinned inodes kept in the cache */
+#define ICACHE_MAX_INODES 4096
+
+/* the number of block runs kept for each inode */
+#define ICACHE_RUNS 4
+
+typedef struct icache_run
+{
+    size_t logical;    /* the first logical block */
+    uint32_t physical; /* its physical block (zero for a hole) */
+    size_t count;      /* zero if unused */
+} icache_run_t;
+
+typedef struct icache_entry icache_entry_t;
+
+struct icache_entry
+{
+    myst_list_node_t base; /* LRU list (the head is most recently used) */
+    icache_entry_t* next;  /* hash chain */
+    ext2_ino_t ino;
+    size_t pins;
+    bool dirty;
+    icache_run_t runs[ICACHE_RUNS];
+    size_t next_run; /* the run to replace next */
+    ext2_inode_t inode;
+};
+
+struct ext2_icache
+{
+    myst_mutex_t lock;
+    icache_entry_t* chains[ICACHE_NCHAINS];
+    myst_list_t lru;
+};
+
+static icache_entry_t** _icache_chain(struct ext2_icache* icache, uint32_t ino)
+{
+    return &icache->chains[ino & (ICACHE_NCHAINS - 1)];
+}
+
+static icache_entry_t* _icache_find(struct ext2_icache* icache, uint32_t ino)
+{
+    for (icache_entry_t* p = *_icache_chain(icache, ino); p; p = p->next)
+    {
+        if (p->ino == ino)
+        {
+            if (icache->lru.head != &p->base)
+            {
+                myst_list_remove(&icache->lru, &p->base);
+                myst_list_prepend(&icache->lru, &p->base);
+            }
+
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+static void _icache_remove(struct ext2_icache* icache, icache_entry_t* entry)
+{
+    icache_entry_t** pp = _icache_chain(icache, entry->ino);
+
+    for (; *pp; pp = &(*pp)->next)
+    {
+        if (*pp == entry)
+        {
+            *pp = entry->next;
+            break;
+        }
+    }
+
+    myst_list_remove(&icache->lru, &entry->base);
+}
+
+static int _icache_write_back(const ext2_t* ext2, icache_entry_t* entry)
+{
+    int ret = 0;
+
+    if (entry->dirty)
+    {
+        ECHECK(_store_inode(ext2, entry->ino, &entry->inode));
+        entry->dirty = false;
+    }
+
+done:
+    return ret;
+}
+
+/* evict the least recently used unpinned inodes beyond the limit */
+static int _icache_evict(const ext2_t* ext2)
+{
+    int ret = 0;
+    struct ext2_icache* icache = ext2->icache;
+    myst_list_node_t* p = icache->lru.tail;
+
+    while (p && icache->lru.size > ICACHE_MAX_INODES)
+    {
+        icache_entry_t* entry = (icache_entry_t*)p;
+        p = p->prev;
+
+        if (entry->pins == 0)
+        {
+            ECHECK(_icache_write_back(ext2, entry));
+            _icache_remove(icache, entry);
+            free(entry);
+        }
+    }
+
+done:
+    return ret;
+}
+
+/* add an inode to the cache (the caller holds the cache lock) */
+static int _icache_insert(
+    const ext2_t* ext2,
+    ext2_ino_t ino,
+    const ext2_inode_t* inode,
+    icache_entry_t** entry_out)
+{
+    int ret = 0;
+    struct ext2_icache* icache = ext2->icache;
+    icache_entry_t** chain = _icache_chain(icache, ino);
+    icache_entry_t* entry;
+
+    if (!(entry = calloc(1, sizeof(icache_entry_t))))
+        ERAISE(-ENOMEM);
+
+    entry->ino = ino;
+    memcpy(&entry->inode, inode, ext2->sb.s_inode_size);
+    entry->next = *chain;
+    *chain = entry;
+    myst_list_prepend(&icache->lru, &entry->base);
+
+    /* the new entry is the most recently used so it is not evicted */
+    ECHECK(_icache_evict(ext2));
+
+    if (entry_out)
+        *entry_out = entry;
+
+done:
+    return ret;
+}
+
+static int _icache_new(struct ext2_icache** icache_out)
+{
+    int ret = 0;
+    struct ext2_icache* icache;
+
+    if (!(icache = calloc(1, sizeof(struct ext2_icache))))
+        ERAISE(-ENOMEM);
+
+    myst_mutex_init(&icache->lock);
+
+    *icache_out = icache;
+
+done:
+    return ret;
+}
+
+/* write back every dirty inode */
+static int _icache_flush(const ext2_t* ext2)
+{
+    int ret = 0;
+    struct ext2_icache* icache = ext2->icache;
+
+    myst_mutex_lock(&icache->lock);
+
+    for (myst_list_node_t* p = icache->lru.head; p; p = p->next)
+        ECHECK(_icache_write_back(ext2, (icache_entry_t*)p));
+
+done:
+    myst_mutex_unlock(&icache->lock);
+    return ret;
+}
+
+static void _icache_free(struct ext2_icache* icache)
+{
+    myst_list_free(&icache->lru);
+    free(icache);
+}
+
+/* read an inode through the cache */
+static int _icache_read(const ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
+{
+    int ret = 0;
+    struct ext2_icache* icache = ext2->icache;
+    icache_entry_t* entry;
+
+    myst_mutex_lock(&icache->lock);
+
+    if ((entry = _icache_find(icache, ino)))
+    {
+        memcpy(inode, &entry->inode, ext2->sb.s_inode_size);
+    }
+    else
+    {
+        ECHECK(_load_inode(ext2, ino, inode));
+
+        /* the cache is only an optimization */
+        _icache_insert(ext2, ino, inode, NULL);
+    }
+
+done:
+    myst_mutex_unlock(&icache->lock);
+    return ret;
+}
+
+/* keep the inode of an open file in the cache until it is unpinned */
+static void _icache_pin(const ext2_t* ext2, ext2_ino_t ino, bool pin)
+{
+    struct ext2_icache* icache = ext2->icache;
+    icache_entry_t* entry;
+
+    myst_mutex_lock(&icache->lock);
+
+    if ((entry = _icache_find(icache, ino)))
+    {
+        if (pin)
+            entry->pins++;
+        else if (entry->pins)
+            entry->pins--;
+    }
+
+    myst_mutex_unlock(&icache->lock);
+}
+
+/* find the cached run holding this logical block */
+static bool _icache_get_run(
+    const ext2_t* ext2,
+    ext2_ino_t ino,
+    size_t index,
+    uint32_t* blkno,
+    size_t* count)
+{
+    struct ext2_icache* icache = ext2->icache;
+    icache_entry_t* entry;
+    bool found = false;
+
+    myst_mutex_lock(&icache->lock);
+
+    if ((entry = _icache_find(icache, ino)))
+    {
+        for (size_t i = 0; i < ICACHE_RUNS; i++)
+        {
+            const icache_run_t* run = &entry->runs[i];
+
+            if (index >= run->logical && index - run->logical < run->count)
+            {
+                const size_t offset = index - run->logical;
+
+                *blkno = run->physical ? run->physical + offset : 0;
+                *count = run->count - offset;
+                found = true;
+                break;
+            }
+        }
+    }
+
+    myst_mutex_unlock(&icache->lock);
+
+    return found;
+}
+
+static void _icache_add_run(
+    const ext2_t* ext2,
+    ext2_ino_t ino,
+    size_t logical,
+    uint32_t physical,
+    size_t count)
+{
+    struct ext2_icache* icache = ext2->icache;
+    icache_entry_t* entry;
+
+    myst_mutex_lock(&icache->lock);
+
+    if ((entry = _icache_find(icache, ino)))
+    {
+        icache_run_t* run = &entry->runs[entry->next_run];
+
+        run->logical = logical;
+        run->physical = physical;
+        run->count = count;
+        entry->next_run = (entry->next_run + 1) % ICACHE_RUNS;
+    }
+
+    myst_mutex_unlock(&icache->lock);
+}
+
+/* forget the runs of an inode whose block map is changing */
+static void _icache_clear_runs(const ext2_t* ext2, ext2_ino_t ino)
+{
+    struct ext2_icache* icache = ext2->icache;
+    icache_entry_t* entry;
+
+    myst_mutex_lock(&icache->lock);
+
+    if ((entry = _icache_find(icache, ino)))
+        memset(entry->runs, 0, sizeof(entry->runs));
+
+    myst_mutex_unlock(&icache->lock);
+}
+
+/* update the cached inode (written back later) */
+static int _write_inode(
+    const ext2_t* ext2,
+    ext2_ino_t ino,
+    const ext2_inode_t* inode)
+{
+    int ret = 0;
+    struct ext2_icache* icache = ext2->icache;
+    icache_entry_t* entry;
+
+    myst_mutex_lock(&icache->lock);
+
+    if ((entry = _icache_find(icache, ino)))
+    {
+        /* the direct blocks (or an inline symlink) may have changed */
+        if (memcmp(
+                entry->inode.i_block,
+                inode->i_block,
+                sizeof(inode->i_block)) != 0)
+        {
+            memset(entry->runs, 0, sizeof(entry->runs));
+        }
+
+        memcpy(&entry->inode, inode, ext2->sb.s_inode_size);
+        entry->dirty = true;
+    }
+    else if (_icache_insert(ext2, ino, inode, &entry) == 0)
+    {
+        entry->dirty = true;
+    }
+    else
+    {
+        /* write through when the inode cannot be cached */
+        ECHECK(_store_inode(ext2, ino, inode));
+    }
+
+done:
+    myst_mutex_unlock(&icache->lock);
+    return ret;
+}
+
 static int _load_file(
     ext2_t* ext2,
     myst_file_t* file,
@@ -1203,16 +2040,60 @@ static int _load_dirent(
 
     ECHECK((_load_file_by_ino(ext2, dino, &data, &size)));
 
-    if (!(p = _find_dirent(name, data, size)))
-        ERAISE(-ENOENT);
+    if (!(p = _find_dirent(name, data, size)))
+        ERAISE(-ENOENT);
+
+    memcpy(ent, p, _dirent_size(p));
+
+done:
+
+    if (data)
+        free(data);
+
+    return ret;
+}
+
+/* the dentry cache value of a directory entry (see myst_dcache_insert()) */
+static uint64_t _dentry_value(const ext2_dirent_t* ent)
+{
+    return (uint64_t)ent->file_type << 32 | ent->inode;
+}
+
+/* find the inode number and type of the named entry of a directory, trying
+ * the dentry cache first (the caller holds the tree lock, which keeps the
+ * directory from changing while a looked-up entry is cached) */
+static int _lookup_dirent(
+    ext2_t* ext2,
+    ext2_ino_t dino,
+    const char* name,
+    ext2_dirent_t* ent,
+    ext2_ino_t* ino,
+    uint8_t* file_type)
+{
+    int ret = 0;
+    uint64_t value;
+
+    if (!myst_dcache_lookup(ext2, dino, name, &value))
+    {
+        if ((ret = _load_dirent(ext2, dino, name, ent)) == 0)
+            value = _dentry_value(ent);
+        else if (ret == -ENOENT)
+            value = 0;
+        else
+            ERAISE(ret);
 
-    memcpy(ent, p, _dirent_size(p));
+        myst_dcache_insert(ext2, dino, name, value);
+        ret = 0;
+    }
 
-done:
+    /* a negative entry */
+    if (value == 0)
+        ERAISE_QUIET(-ENOENT);
 
-    if (data)
-        free(data);
+    *ino = (ext2_ino_t)value;
+    *file_type = (uint8_t)(value >> 32);
 
+done:
     return ret;
 }
 
@@ -1240,6 +2121,7 @@ static int _path_to_ino_recursive(
         ext2_inode_t current_inode;
         ext2_dirent_t ent;
         ext2_ino_t ino;
+        uint8_t file_type;
         const char* toks[32];
     };
     struct locals* locals = NULL;
@@ -1284,12 +2166,17 @@ static int _path_to_ino_recursive(
         if (!S_ISDIR(locals->current_inode.i_mode))
             ERAISE(-ENOTDIR);
 
-        ECHECK(_load_dirent(ext2, current_ino, locals->toks[i], &locals->ent));
-        assert(locals->ent.inode != 0);
-        locals->ino = locals->ent.inode;
+        ECHECK(_lookup_dirent(
+            ext2,
+            current_ino,
+            locals->toks[i],
+            &locals->ent,
+            &locals->ino,
+            &locals->file_type));
+        assert(locals->ino != 0);
 
         /* if this is a symbolic link */
-        if (locals->ent.file_type == EXT2_FT_SYMLINK)
+        if (locals->file_type == EXT2_FT_SYMLINK)
         {
             /* only check follow tag on final element */
             if (i + 1 != ntoks || follow == FOLLOW)
@@ -1659,11 +2546,35 @@ static size_t _inode_get_num_blocks(ext2_t* ext2, ext2_inode_t* inode)
     return (_inode_get_size(inode) + ext2->block_size - 1) / ext2->block_size;
 }
 
-static int _inode_get_blkno(
+/* the length of the run of blocks in table[pos...n) that follows table[pos]
+ * (consecutive physical blocks or a hole) */
+static size_t _run_length(const uint32_t* table, size_t pos, size_t n)
+{
+    const uint32_t first = table[pos];
+    size_t count = 1;
+
+    while (pos + count < n)
+    {
+        const uint32_t next = table[pos + count];
+
+        if (first ? next != first + count : next != 0)
+            break;
+
+        count++;
+    }
+
+    return count;
+}
+
+/* map a logical block to a physical block (zero for a hole) and return the
+ * number of blocks from there on that map contiguously (or are holes too) */
+static int _inode_get_run(
     ext2_t* ext2,
+    ext2_ino_t ino,
     ext2_inode_t* inode,
     size_t index,
-    uint32_t* blkno_out)
+    uint32_t* blkno_out,
+    size_t* count_out)
 {
     int ret = 0;
     size_t blknos_per_block = ext2->block_size / sizeof(uint32_t);
@@ -1675,16 +2586,24 @@ static int _inode_get_blkno(
     size_t triple_indirect_count = double_indirect_count * blknos_per_block;
     size_t triple_indirect_max = double_indirect_max + triple_indirect_count;
     ext2_block_t* block = NULL;
+    const uint32_t* data;
+    size_t count = 1;
+
+    *blkno_out = 0;
+
+    if (_icache_get_run(ext2, ino, index, blkno_out, count_out))
+        return 0;
 
     if (!(block = malloc(sizeof(ext2_block_t))))
         ERAISE(-ENOMEM);
 
-    *blkno_out = 0;
+    data = (const uint32_t*)block->data;
 
     /* handle direct block numbers */
     if (index < direct_max)
     {
         *blkno_out = inode->i_block[index];
+        count = _run_length(inode->i_block, index, direct_max);
         goto done;
     }
 
@@ -1693,14 +2612,17 @@ static int _inode_get_blkno(
     {
         const size_t i = index - direct_max;
         const uint32_t blkno = inode->i_block[EXT2_SINGLE_INDIRECT_BLOCK];
-        const uint32_t* data = (const uint32_t*)block->data;
 
         if (blkno == 0)
+        {
+            count = single_indirect_count - i;
             goto done;
+        }
 
         ECHECK(ext2_read_block(ext2, blkno, block));
 
         *blkno_out = data[i];
+        count = _run_length(data, i, blknos_per_block);
         goto done;
     }
 
@@ -1711,21 +2633,27 @@ static int _inode_get_blkno(
         const size_t i = n / blknos_per_block;
         const size_t j = n % blknos_per_block;
         uint32_t blkno;
-        const uint32_t* data = (const uint32_t*)block->data;
 
         assert(n <= double_indirect_count);
 
         if ((blkno = inode->i_block[EXT2_DOUBLE_INDIRECT_BLOCK]) == 0)
+        {
+            count = double_indirect_count - n;
             goto done;
+        }
 
         ECHECK(ext2_read_block(ext2, blkno, block));
 
         if ((blkno = data[i]) == 0)
+        {
+            count = blknos_per_block - j;
             goto done;
+        }
 
         ECHECK(ext2_read_block(ext2, blkno, block));
 
         *blkno_out = data[j];
+        count = _run_length(data, j, blknos_per_block);
         goto done;
     }
 
@@ -1737,37 +2665,63 @@ static int _inode_get_blkno(
         const size_t j = (n / blknos_per_block) % blknos_per_block;
         const size_t k = n % blknos_per_block;
         uint32_t blkno;
-        const uint32_t* data = (const uint32_t*)block->data;
 
         assert(n <= triple_indirect_max);
 
         if ((blkno = inode->i_block[EXT2_TRIPLE_INDIRECT_BLOCK]) == 0)
+        {
+            count = triple_indirect_count - n;
             goto done;
+        }
 
         ECHECK(ext2_read_block(ext2, blkno, block));
 
         if ((blkno = data[i]) == 0)
+        {
+            count = double_indirect_count - (n % double_indirect_count);
             goto done;
+        }
 
         ECHECK(ext2_read_block(ext2, blkno, block));
 
         if ((blkno = data[j]) == 0)
+        {
+            count = blknos_per_block - k;
             goto done;
+        }
 
         ECHECK(ext2_read_block(ext2, blkno, block));
 
         *blkno_out = data[k];
+        count = _run_length(data, k, blknos_per_block);
         goto done;
     }
 
 done:
 
+    if (ret == 0)
+    {
+        _icache_add_run(ext2, ino, index, *blkno_out, count);
+        *count_out = count;
+    }
+
     if (block)
         free(block);
 
     return ret;
 }
 
+static int _inode_get_blkno(
+    ext2_t* ext2,
+    ext2_ino_t ino,
+    ext2_inode_t* inode,
+    size_t index,
+    uint32_t* blkno_out)
+{
+    size_t count;
+    return _inode_get_run(ext2, ino, inode, index, blkno_out, &count);
+}
+
 static int _inode_add_blkno(
     ext2_t* ext2,
     ext2_ino_t ino,
@@ -1795,6 +2749,9 @@ static int _inode_add_blkno(
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    /* the cached block runs no longer hold */
+    _icache_clear_runs(ext2, ino);
+
     if (new_blkno == 0)
         ERAISE(-EINVAL);
 
@@ -2070,6 +3027,9 @@ static int _inode_put_blkno(
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    /* the cached block runs no longer hold */
+    _icache_clear_runs(ext2, ino);
+
     /* handle direct block numbers */
     if (index < direct_max)
     {
@@ -2329,13 +3289,17 @@ static int _ftruncate(ext2_t* ext2, myst_file_t* file, off_t length, bool isdir)
         for (size_t i = first; i < num_blocks; i++)
             ECHECK(_inode_put_blkno(ext2, file->ino, &file->inode, i));
 
+        /* the reserved blocks no longer follow the end of the file */
+        _put_data_blknos(ext2, file->ino);
+
         /* Fill the last partial block with zeros */
         if (first > 0)
         {
             uint32_t blkno;
 
             /* get the block number of the last block */
-            ECHECK(_inode_get_blkno(ext2, &file->inode, first - 1, &blkno));
+            ECHECK(_inode_get_blkno(
+                ext2, file->ino, &file->inode, first - 1, &blkno));
 
             if (blkno != 0)
             {
@@ -2458,6 +3422,8 @@ static int _remove_dirent(
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_dcache_invalidate(ext2, ino, filename);
+
     /* load the directory file contents */
     ECHECK(_load_file_by_inode(ext2, ino, inode, &data, &size));
 
@@ -2768,6 +3734,9 @@ static int _add_dirent(
     size_t size = 0;
     myst_buf_t buf = MYST_BUF_INITIALIZER;
 
+    /* drop any negative entry */
+    myst_dcache_invalidate(ext2, ino, filename);
+
     /* Load the directory file */
     ECHECK(_load_file_by_inode(ext2, ino, inode, &data, &size));
 
@@ -2926,6 +3895,13 @@ static int _inode_free(ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
         ECHECK(_inode_put_blkno(ext2, ino, inode, i));
     }
 
+    /* return the blocks reserved for appending to it */
+    _put_data_blknos(ext2, ino);
+
+    /* the number of a removed directory may be reused */
+    if (S_ISDIR(inode->i_mode))
+        myst_dcache_invalidate_fs(ext2);
+
     /* return the inode to the free list */
     ECHECK(_put_ino(ext2, ino));
 
@@ -2936,6 +3912,7 @@ done:
 static int _inode_unlink(ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
 {
     int ret = 0;
+    bool locked = false;
 
     assert(inode->i_links_count >= 1);
 
@@ -2944,6 +3921,10 @@ static int _inode_unlink(ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
     {
         assert(_valid_ino(ext2, ino));
 
+        /* keep the inode references stable */
+        myst_mutex_lock(&ext2->locks->alloc);
+        locked = true;
+
         /* if the inode is open */
         if (ext2->inode_refs[ino - 1].nopens > 0)
         {
@@ -2966,6 +3947,10 @@ static int _inode_unlink(ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
     }
 
 done:
+
+    if (locked)
+        myst_mutex_unlock(&ext2->locks->alloc);
+
     return ret;
 }
 
@@ -3181,8 +4166,8 @@ int ext2_read_block(const ext2_t* ext2, uint32_t blkno, ext2_block_t* block)
     block->size = ext2->block_size;
 
     /* Read the block */
-    if (_read(
-            ext2->dev,
+    if (_dev_read(
+            ext2,
             _blk_offset(blkno, ext2->block_size),
             block->data,
             block->size) != block->size)
@@ -3200,28 +4185,11 @@ done:
 int ext2_read_inode(const ext2_t* ext2, ext2_ino_t ino, ext2_inode_t* inode)
 {
     int ret = 0;
-    uint32_t lino = _ino_to_lino(ext2, ino);
-    uint32_t grpno = _ino_to_grpno(ext2, ino);
-    const ext2_group_desc_t* group = &ext2->groups[grpno];
-    uint32_t inode_size = ext2->sb.s_inode_size;
-    uint64_t offset;
 
     if (ino == 0)
         ERAISE(-EINVAL);
 
-    /* Check the reverse mapping */
-    {
-        ext2_ino_t tmp;
-        tmp = ext2_make_ino(ext2, grpno, lino);
-        assert(tmp == ino);
-    }
-
-    offset = _blk_offset(group->bg_inode_table, ext2->block_size) +
-             ((uint64_t)lino * (uint64_t)inode_size);
-
-    /* Read the inode */
-    if (_read(ext2->dev, offset, inode, inode_size) != inode_size)
-        ERAISE(-EIO);
+    ECHECK(_icache_read(ext2, ino, inode));
 
 done:
     return ret;
@@ -3242,9 +4210,26 @@ int ext2_read_block_bitmap(
 
     bitmap_size_bytes = ext2->sb.s_blocks_per_group / 8;
 
-    if (group_index > ext2->group_count)
+    if (group_index >= ext2->group_count)
         ERAISE(-EINVAL);
 
+    /* the allocators may hold changes not yet written back */
+    myst_mutex_lock(&ext2->locks->alloc);
+
+    if (ext2->alloc->groups[group_index].blocks)
+    {
+        memcpy(
+            block->data,
+            ext2->alloc->groups[group_index].blocks,
+            bitmap_size_bytes);
+        block->size = bitmap_size_bytes;
+    }
+
+    myst_mutex_unlock(&ext2->locks->alloc);
+
+    if (block->size)
+        goto done;
+
     ECHECK(ext2_read_block(
         ext2, ext2->groups[group_index].bg_block_bitmap, block));
 
@@ -3270,9 +4255,26 @@ int ext2_read_inode_bitmap(
 
     bitmap_size_bytes = ext2->sb.s_inodes_per_group / 8;
 
-    if (group_index > ext2->group_count)
+    if (group_index >= ext2->group_count)
         ERAISE(-EINVAL);
 
+    /* the allocators may hold changes not yet written back */
+    myst_mutex_lock(&ext2->locks->alloc);
+
+    if (ext2->alloc->groups[group_index].inodes)
+    {
+        memcpy(
+            block->data,
+            ext2->alloc->groups[group_index].inodes,
+            bitmap_size_bytes);
+        block->size = bitmap_size_bytes;
+    }
+
+    myst_mutex_unlock(&ext2->locks->alloc);
+
+    if (block->size)
+        goto done;
+
     ECHECK(ext2_read_block(
         ext2, ext2->groups[group_index].bg_inode_bitmap, block));
 
@@ -3341,6 +4343,7 @@ int ext2_open(
     void* dir_data = NULL;
     size_t dir_size = 0;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
     struct locals
     {
         ext2_inode_t inode;
@@ -3367,6 +4370,14 @@ int ext2_open(
     if ((flags & O_NOFOLLOW))
         follow = NOFOLLOW;
 
+    /* creating or truncating changes the tree */
+    if ((flags & (O_CREAT | O_TRUNC)))
+        myst_rwlock_wrlock(&ext2->locks->tree);
+    else
+        myst_rwlock_rdlock(&ext2->locks->tree);
+
+    locked = true;
+
     r = _path_to_inode(
         ext2,
         path,
@@ -3380,6 +4391,9 @@ int ext2_open(
 
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate open operation to target filesystem */
         ECHECK((*tfs->fs_open)(
             tfs, locals->suffix, flags, mode, fs_out, file_out));
@@ -3461,6 +4475,7 @@ int ext2_open(
         file->access = (flags & (O_RDONLY | O_RDWR | O_WRONLY));
         file->operating = (flags & O_APPEND);
         file->use_count = 1;
+        myst_mutex_init(&file->mutex);
     }
 
     /* truncate the file if requested and if not zero-sized */
@@ -3490,12 +4505,16 @@ int ext2_open(
 
     /* Increment the reference count for this inode number */
     _inode_ref(ext2, file->ino);
+    _icache_pin(ext2, file->ino, true);
 
     *file_out = file;
     file = NULL;
 
 done:
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     if (locals)
         free(locals);
 
@@ -3519,6 +4538,7 @@ int64_t ext2_read(myst_fs_t* fs, myst_file_t* file, void* data, uint64_t size)
     size_t num_blocks;
     bool eof = false;
     ext2_block_t* block = NULL;
+    bool locked = false;
 
     if (!(block = malloc(sizeof(ext2_block_t))))
         ERAISE(-ENOMEM);
@@ -3531,6 +4551,9 @@ int64_t ext2_read(myst_fs_t* fs, myst_file_t* file, void* data, uint64_t size)
     if (file->access == O_WRONLY)
         ERAISE(-EBADF);
 
+    _lock_file(ext2, file, false);
+    locked = true;
+
     /* refresh the inode */
     ECHECK((ext2_read_inode(ext2, file->ino, &file->inode)));
 
@@ -3542,13 +4565,50 @@ int64_t ext2_read(myst_fs_t* fs, myst_file_t* file, void* data, uint64_t size)
 
     num_blocks = _inode_get_num_blocks(ext2, &file->inode);
 
-    /* Read the data block-by-block */
+    /* Read the data block-by-block (or run-by-run) */
     for (i = first; i < num_blocks && r > 0 && !eof; i++)
     {
         uint32_t offset;
         uint32_t blkno;
+        size_t count;
+
+        ECHECK(_inode_get_run(
+            ext2, file->ino, &file->inode, i, &blkno, &count));
 
-        ECHECK(_inode_get_blkno(ext2, &file->inode, i, &blkno));
+        /* read whole blocks of a run straight into the caller's buffer */
+        if (file->offset % ext2->block_size == 0)
+        {
+            const uint64_t fsize = _inode_get_size(&file->inode);
+            const uint64_t t = fsize > file->offset ? fsize - file->offset : 0;
+            size_t n = _min_size(_min_size(r, t) / ext2->block_size, count);
+
+            n = _min_size(n, num_blocks - i);
+
+            if (n > 0)
+            {
+                const size_t bytes = n * ext2->block_size;
+
+                if (blkno == 0)
+                    memset(end, 0, bytes);
+                else if (
+                    _dev_read(
+                        ext2,
+                        _blk_offset(blkno, ext2->block_size),
+                        end,
+                        bytes) != (ssize_t)bytes)
+                {
+                    ERAISE(-EIO);
+                }
+
+                r -= bytes;
+                end += bytes;
+                file->offset += bytes;
+
+                /* the loop advances past the last block of the run */
+                i += n - 1;
+                continue;
+            }
+        }
 
         /* handle holes */
         if (blkno == 0)
@@ -3589,6 +4649,9 @@ int64_t ext2_read(myst_fs_t* fs, myst_file_t* file, void* data, uint64_t size)
 
 done:
 
+    if (locked)
+        _unlock_file(ext2, file);
+
     if (block)
         free(block);
 
@@ -3613,6 +4676,7 @@ int64_t ext2_write(
         ext2_block_t block;
     };
     struct locals* locals = NULL;
+    bool locked = false;
 
     /* check parameters */
     if (!_ext2_valid(ext2) || !_file_valid(file) || (!data && size))
@@ -3629,6 +4693,9 @@ int64_t ext2_write(
     if (size == 0)
         goto done;
 
+    _lock_file(ext2, file, true);
+    locked = true;
+
     /* refresh inode */
     ECHECK((ext2_read_inode(ext2, file->ino, &file->inode)));
 
@@ -3646,14 +4713,51 @@ int64_t ext2_write(
     {
         uint32_t block_offset;
         bool found_blkno = false;
+        size_t count;
 
         /* get the block number for the i-th data block */
-        ECHECK(_inode_get_blkno(ext2, &file->inode, i, &blkno));
+        ECHECK(_inode_get_run(
+            ext2, file->ino, &file->inode, i, &blkno, &count));
+
+        /* write whole blocks of a run straight from the caller's buffer */
+        if (blkno != 0 && file->offset % ext2->block_size == 0 &&
+            r >= ext2->block_size)
+        {
+            const size_t n = _min_size(r / ext2->block_size, count);
+            const size_t bytes = n * ext2->block_size;
+            const uint64_t offset = _blk_offset(blkno, ext2->block_size);
+
+            /* the blocks belong to the file (not to be released below) */
+            blkno = 0;
+
+            if (_dev_write(ext2, offset, p, bytes) != (ssize_t)bytes)
+                ERAISE(-EIO);
+
+            file->offset += bytes;
+            r -= bytes;
+            p += bytes;
+
+            /* the loop advances past the last block of the run */
+            i += n - 1;
+            continue;
+        }
 
         /* if the block number is zero, create a new block */
         if (blkno == 0)
         {
-            ECHECK(_get_blkno(ext2, &blkno));
+            uint32_t goal = 0;
+
+            /* place it after the previous block of the file */
+            if (i > 0)
+            {
+                ECHECK(_inode_get_blkno(
+                    ext2, file->ino, &file->inode, i - 1, &goal));
+
+                if (goal)
+                    goal++;
+            }
+
+            ECHECK(_get_data_blkno(ext2, file->ino, goal, &blkno));
             _init_block(&locals->block, ext2->block_size);
         }
         else
@@ -3714,6 +4818,9 @@ done:
     if (blkno != 0)
         _put_blkno(ext2, blkno);
 
+    if (locked)
+        _unlock_file(ext2, file);
+
     if (locals)
         free(locals);
 
@@ -3725,10 +4832,14 @@ off_t ext2_lseek(myst_fs_t* fs, myst_file_t* file, off_t offset, int whence)
     off_t ret = 0;
     ext2_t* ext2 = (ext2_t*)fs;
     off_t new_offset;
+    bool locked = false;
 
     if (!_ext2_valid(ext2) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    _lock_file(ext2, file, false);
+    locked = true;
+
     switch (whence)
     {
         case SEEK_SET:
@@ -3758,6 +4869,9 @@ off_t ext2_lseek(myst_fs_t* fs, myst_file_t* file, off_t offset, int whence)
 
 done:
 
+    if (locked)
+        _unlock_file(ext2, file);
+
     return ret;
 }
 
@@ -3765,6 +4879,7 @@ int ext2_close(myst_fs_t* fs, myst_file_t* file)
 {
     int ret = 0;
     ext2_t* ext2 = (ext2_t*)fs;
+    bool locked = false;
 
     /* check parameters */
     if (!_ext2_valid(ext2) || !_file_valid(file))
@@ -3778,6 +4893,10 @@ int ext2_close(myst_fs_t* fs, myst_file_t* file)
 
         /* ATTN:TIMESTAMPS */
 
+        myst_rwlock_rdlock(&ext2->locks->tree);
+        myst_mutex_lock(&ext2->locks->alloc);
+        locked = true;
+
         /* Decrement the inode reference count */
         if (_inode_unref(ext2, file->ino) == 0)
         {
@@ -3792,6 +4911,9 @@ int ext2_close(myst_fs_t* fs, myst_file_t* file)
                 ECHECK(_inode_free(ext2, file->ino, &inode));
                 ext2->inode_refs[file->ino - 1].free = 0;
             }
+
+            _icache_pin(ext2, file->ino, false);
+            _put_data_blknos(ext2, file->ino);
         }
 
         /* release the file object */
@@ -3799,12 +4921,20 @@ int ext2_close(myst_fs_t* fs, myst_file_t* file)
     }
 
 done:
+
+    if (locked)
+    {
+        myst_mutex_unlock(&ext2->locks->alloc);
+        myst_rwlock_unlock(&ext2->locks->tree);
+    }
+
     return ret;
 }
 
 int ext2_access(myst_fs_t* fs, const char* pathname, int mode)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     myst_fs_t* tfs;
     struct locals
@@ -3822,6 +4952,9 @@ int ext2_access(myst_fs_t* fs, const char* pathname, int mode)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_rdlock(&ext2->locks->tree);
+    locked = true;
+
     if (mode != F_OK && !(mode & (R_OK | W_OK | X_OK)))
         ERAISE(-EINVAL);
 
@@ -3838,6 +4971,9 @@ int ext2_access(myst_fs_t* fs, const char* pathname, int mode)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK((ret = tfs->fs_access(tfs, locals->suffix, mode)));
         goto done;
@@ -3860,12 +4996,16 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
 int ext2_link(myst_fs_t* fs, const char* oldpath, const char* newpath)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     ext2_ino_t dino;
     ext2_ino_t ino;
@@ -3888,6 +5028,9 @@ int ext2_link(myst_fs_t* fs, const char* oldpath, const char* newpath)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    locked = true;
+
     /* find inode for oldpath */
     ECHECK(_path_to_inode(
         ext2,
@@ -3901,6 +5044,9 @@ int ext2_link(myst_fs_t* fs, const char* oldpath, const char* newpath)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK((*tfs->fs_link)(tfs, locals->suffix, newpath));
         goto done;
@@ -3944,12 +5090,16 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
 int ext2_unlink(myst_fs_t* fs, const char* path)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     ext2_ino_t ino;
     ext2_ino_t dino;
@@ -3972,6 +5122,9 @@ int ext2_unlink(myst_fs_t* fs, const char* path)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    locked = true;
+
     /* load the inode */
     ECHECK(_path_to_inode(
         ext2,
@@ -3985,6 +5138,9 @@ int ext2_unlink(myst_fs_t* fs, const char* path)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK((*tfs->fs_unlink)(tfs, locals->suffix));
         goto done;
@@ -4009,12 +5165,16 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
 int ext2_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     ext2_ino_t ino;
     ext2_ino_t dino;
@@ -4040,6 +5200,9 @@ int ext2_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    locked = true;
+
     /* Split linkpath into directory and filename */
     ECHECK(_split_path(linkpath, locals->dirname, locals->filename));
 
@@ -4056,6 +5219,9 @@ int ext2_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* append filename and delegate operation to target filesystem */
         if (myst_strlcat(locals->suffix, "/", PATH_MAX) >= PATH_MAX)
             ERAISE_QUIET(-ENAMETOOLONG);
@@ -4101,6 +5267,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
@@ -4111,6 +5280,7 @@ ssize_t ext2_readlink(
     size_t bufsiz)
 {
     ssize_t ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     ext2_ino_t ino;
     void* data = NULL;
@@ -4129,6 +5299,9 @@ ssize_t ext2_readlink(
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_rdlock(&ext2->locks->tree);
+    locked = true;
+
     ECHECK(_path_to_inode(
         ext2,
         pathname,
@@ -4141,6 +5314,9 @@ ssize_t ext2_readlink(
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_readlink(tfs, locals->suffix, buf, bufsiz));
         goto done;
@@ -4163,12 +5339,16 @@ done:
     if (data)
         free(data);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
 int ext2_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     struct locals
     {
@@ -4201,6 +5381,9 @@ int ext2_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    locked = true;
+
     /* Split oldpath and newpath */
     ECHECK(_split_path(newpath, locals->new_dirname, locals->new_filename));
     ECHECK(_split_path(oldpath, locals->old_dirname, locals->old_filename));
@@ -4218,6 +5401,9 @@ int ext2_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_rename(tfs, locals->suffix, newpath));
         goto done;
@@ -4325,6 +5511,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
@@ -4336,6 +5525,8 @@ int ext2_fstat(myst_fs_t* fs, myst_file_t* file, struct stat* statbuf)
     if (!_ext2_valid(ext2) || !_file_valid(file) || !statbuf)
         ERAISE(-EINVAL);
 
+    _lock_file(ext2, file, false);
+
     memset(statbuf, 0, sizeof(struct stat));
     statbuf->st_dev = 0; /* ATTN: ignore device number */
     statbuf->st_ino = file->ino;
@@ -4351,6 +5542,8 @@ int ext2_fstat(myst_fs_t* fs, myst_file_t* file, struct stat* statbuf)
     statbuf->st_ctim.tv_sec = file->inode.i_ctime;
     statbuf->st_mtim.tv_sec = file->inode.i_mtime;
 
+    _unlock_file(ext2, file);
+
 done:
     return ret;
 }
@@ -4358,6 +5551,7 @@ done:
 int ext2_stat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
 {
     int64_t ret = 0;
+    bool locked = false;
     ext2_ino_t ino;
     ext2_t* ext2 = (ext2_t*)fs;
     myst_fs_t* tfs = NULL;
@@ -4374,6 +5568,9 @@ int ext2_stat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_rdlock(&ext2->locks->tree);
+    locked = true;
+
     ECHECK(_path_to_inode(
         ext2,
         pathname,
@@ -4386,6 +5583,9 @@ int ext2_stat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_stat(tfs, locals->suffix, statbuf));
         goto done;
@@ -4398,12 +5598,16 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
 int ext2_lstat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
 {
     int64_t ret = 0;
+    bool locked = false;
     ext2_ino_t ino;
     ext2_t* ext2 = (ext2_t*)fs;
     myst_fs_t* tfs = NULL;
@@ -4420,6 +5624,9 @@ int ext2_lstat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_rdlock(&ext2->locks->tree);
+    locked = true;
+
     ECHECK(_path_to_inode(
         ext2,
         pathname,
@@ -4432,6 +5639,9 @@ int ext2_lstat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_lstat(tfs, locals->suffix, statbuf));
         goto done;
@@ -4444,6 +5654,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
@@ -4455,7 +5668,10 @@ int ext2_ftruncate(myst_fs_t* fs, myst_file_t* file, off_t length)
     if (!_ext2_valid(ext2) || !_file_valid(file))
         ERAISE(-EINVAL);
 
-    ECHECK(_ftruncate(ext2, file, length, false));
+    _lock_file(ext2, file, true);
+    ret = _ftruncate(ext2, file, length, false);
+    _unlock_file(ext2, file);
+    ECHECK(ret);
 
 done:
     return ret;
@@ -4464,6 +5680,7 @@ done:
 int ext2_truncate(myst_fs_t* fs, const char* path, off_t length)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     ext2_ino_t ino;
     myst_fs_t* tfs = NULL;
@@ -4482,6 +5699,9 @@ int ext2_truncate(myst_fs_t* fs, const char* path, off_t length)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    locked = true;
+
     /* find the inode of the file */
     ECHECK(_path_to_inode(
         ext2,
@@ -4495,6 +5715,9 @@ int ext2_truncate(myst_fs_t* fs, const char* path, off_t length)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_truncate(tfs, locals->suffix, length));
         goto done;
@@ -4522,12 +5745,16 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
 int ext2_mkdir(myst_fs_t* fs, const char* path, mode_t mode)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     struct locals* locals = NULL;
     ext2_ino_t dir_ino;
@@ -4550,6 +5777,9 @@ int ext2_mkdir(myst_fs_t* fs, const char* path, mode_t mode)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    locked = true;
+
     /* Reject S_IFMT bits */
     if ((mode & S_IFMT))
         ERAISE(-EINVAL);
@@ -4570,6 +5800,9 @@ int ext2_mkdir(myst_fs_t* fs, const char* path, mode_t mode)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* append basename and delegate operation to target filesystem */
         if (myst_strlcat(locals->suffix, "/", PATH_MAX) >= PATH_MAX)
             ERAISE_QUIET(-ENAMETOOLONG);
@@ -4610,12 +5843,16 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
 int ext2_rmdir(myst_fs_t* fs, const char* path)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     ext2_ino_t dino;
     ext2_ino_t ino;
@@ -4640,6 +5877,9 @@ int ext2_rmdir(myst_fs_t* fs, const char* path)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    locked = true;
+
     /* load the inode */
     ECHECK(_path_to_inode(
         ext2,
@@ -4653,6 +5893,9 @@ int ext2_rmdir(myst_fs_t* fs, const char* path)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_rmdir(tfs, locals->suffix));
         goto done;
@@ -4701,12 +5944,12 @@ int ext2_rmdir(myst_fs_t* fs, const char* path)
         _file_clear(&locals->file);
     }
 
+    /* drop the entries within the directory (its number may be reused) */
+    myst_dcache_invalidate_fs(ext2);
+
     /* return the inode to the free list */
     ECHECK(_put_ino(ext2, ino));
 
-    /* update the super block */
-    ECHECK(_write_super_block(ext2));
-
 done:
 
     if (locals)
@@ -4715,6 +5958,9 @@ done:
     if (data)
         free(data);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
@@ -4736,7 +5982,10 @@ int ext2_opendir(myst_fs_t* fs, const char* path, ext2_dir_t** dir_out)
         ERAISE(-ENOMEM);
 
     /* load the blocks for this inode into memory */
-    ECHECK((_load_file_by_path(ext2, path, &dir->data, &dir->size)));
+    myst_rwlock_rdlock(&ext2->locks->tree);
+    ret = _load_file_by_path(ext2, path, &dir->data, &dir->size);
+    myst_rwlock_unlock(&ext2->locks->tree);
+    ECHECK(ret);
 
     /* set pointer to current directory */
     dir->next = dir->data;
@@ -4875,7 +6124,10 @@ static ssize_t _ext2_readv(
     if (!_ext2_valid(ext2) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    /* hold the locks across the vector (the nested calls lock recursively) */
+    _lock_file(ext2, file, false);
     ret = myst_fdops_readv(&fs->fdops, file, iov, iovcnt);
+    _unlock_file(ext2, file);
     ECHECK(ret);
 
 done:
@@ -4894,7 +6146,10 @@ static ssize_t _ext2_writev(
     if (!_ext2_valid(ext2) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    /* hold the locks across the vector (the nested calls lock recursively) */
+    _lock_file(ext2, file, true);
     ret = myst_fdops_writev(&fs->fdops, file, iov, iovcnt);
+    _unlock_file(ext2, file);
     ECHECK(ret);
 
 done:
@@ -4963,7 +6218,9 @@ static int _ext2_mount(myst_fs_t* fs, const char* source, const char* target)
     if (strlen(target) >= sizeof(ext2->target))
         ERAISE(-ENAMETOOLONG);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
     myst_strlcpy(ext2->target, target, sizeof(ext2->target));
+    myst_rwlock_unlock(&ext2->locks->tree);
 
 done:
     return ret;
@@ -5013,11 +6270,14 @@ static ssize_t _ext2_pread(
     if (S_ISDIR(file->inode.i_mode))
         ERAISE(-EISDIR);
 
+    /* the file offset is borrowed below */
+    _lock_file(ext2, file, false);
     old_offset = file->offset;
     file->offset = offset;
 
     n = ext2_read(fs, file, buf, count);
     file->offset = old_offset;
+    _unlock_file(ext2, file);
     ECHECK(n);
     ret = n;
 
@@ -5046,6 +6306,9 @@ static ssize_t _ext2_pwrite(
     if (offset < 0)
         ERAISE(-EINVAL);
 
+    /* the file offset is borrowed below */
+    _lock_file(ext2, file, true);
+
     /* save the original offset */
     old_offset = file->offset;
 
@@ -5060,6 +6323,7 @@ static ssize_t _ext2_pwrite(
 
     /* restore the original offset */
     file->offset = old_offset;
+    _unlock_file(ext2, file);
 
     ECHECK(n);
     ret = n;
@@ -5217,6 +6481,7 @@ static int _ext2_getdents64(
     ext2_t* ext2 = (ext2_t*)fs;
     size_t n = count / sizeof(struct dirent);
     size_t bytes = 0;
+    bool locked = false;
 
     if (!_ext2_valid(ext2) || !_file_valid(file) || !dirp)
         ERAISE(-EINVAL);
@@ -5227,6 +6492,9 @@ static int _ext2_getdents64(
     if (count == 0)
         goto done;
 
+    _lock_file(ext2, file, false);
+    locked = true;
+
     /* If file was not opened with O_DIRECTORY, file->dir.data will not have
      * been populated */
     if (file->dir.data == NULL)
@@ -5268,6 +6536,10 @@ static int _ext2_getdents64(
     ret = (int)bytes;
 
 done:
+
+    if (locked)
+        _unlock_file(ext2, file);
+
     return ret;
 }
 
@@ -5292,6 +6564,7 @@ done:
 static int _ext2_statfs(myst_fs_t* fs, const char* path, struct statfs* buf)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     myst_fs_t* tfs = NULL;
     struct locals
@@ -5307,6 +6580,9 @@ static int _ext2_statfs(myst_fs_t* fs, const char* path, struct statfs* buf)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_rdlock(&ext2->locks->tree);
+    locked = true;
+
     /* Check if path exists */
     ECHECK(_path_to_inode(
         ext2,
@@ -5320,6 +6596,9 @@ static int _ext2_statfs(myst_fs_t* fs, const char* path, struct statfs* buf)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_statfs(tfs, locals->suffix, buf));
         goto done;
@@ -5331,6 +6610,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
@@ -5355,10 +6637,14 @@ static int _ext2_futimens(
 {
     int ret = 0;
     ext2_t* ext2 = (ext2_t*)fs;
+    bool locked = false;
 
     if (!_ext2_valid(ext2) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    _lock_file(ext2, file, true);
+    locked = true;
+
     if (times)
     {
         switch (times[0].tv_nsec)
@@ -5397,10 +6683,15 @@ static int _ext2_futimens(
     {
         /* set to current time */
         _update_timestamps(&file->inode, ACCESS | MODIFY);
-        ECHECK(_write_inode(ext2, file->ino, &file->inode));
     }
 
+    ECHECK(_write_inode(ext2, file->ino, &file->inode));
+
 done:
+
+    if (locked)
+        _unlock_file(ext2, file);
+
     return ret;
 }
 
@@ -5440,6 +6731,7 @@ static int _ext2_chown(
     gid_t group)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     struct locals
     {
@@ -5455,6 +6747,9 @@ static int _ext2_chown(
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    locked = true;
+
     /* Check if path exists */
     ECHECK(_path_to_inode(
         ext2,
@@ -5468,6 +6763,9 @@ static int _ext2_chown(
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK((ret = tfs->fs_chown(tfs, locals->suffix, owner, group)));
         goto done;
@@ -5483,6 +6781,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
@@ -5494,10 +6795,16 @@ static int _ext2_fchown(
 {
     int ret = 0;
     ext2_t* ext2 = (ext2_t*)fs;
+    bool locked = false;
 
-    if (!_ext2_valid(ext2) || !file)
+    if (!_ext2_valid(ext2) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    /* the owner and mode are checked by path lookups */
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    myst_mutex_lock(&file->mutex);
+    locked = true;
+
     /* refresh the inode */
     ECHECK((ext2_read_inode(ext2, file->ino, &file->inode)));
 
@@ -5507,6 +6814,13 @@ static int _ext2_fchown(
     ECHECK(_write_inode(ext2, file->ino, &file->inode));
 
 done:
+
+    if (locked)
+    {
+        myst_mutex_unlock(&file->mutex);
+        myst_rwlock_unlock(&ext2->locks->tree);
+    }
+
     return ret;
 }
 
@@ -5517,6 +6831,7 @@ static int _ext2_lchown(
     gid_t group)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     struct locals
     {
@@ -5532,6 +6847,9 @@ static int _ext2_lchown(
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    locked = true;
+
     /* Check if path exists */
     ECHECK(_path_to_inode(
         ext2,
@@ -5545,6 +6863,9 @@ static int _ext2_lchown(
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK((ret = tfs->fs_lchown(tfs, locals->suffix, owner, group)));
         goto done;
@@ -5560,6 +6881,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
@@ -5593,6 +6917,7 @@ done:
 static int _ext2_chmod(myst_fs_t* fs, const char* pathname, mode_t mode)
 {
     int ret = 0;
+    bool locked = false;
     ext2_t* ext2 = (ext2_t*)fs;
     struct locals
     {
@@ -5608,6 +6933,9 @@ static int _ext2_chmod(myst_fs_t* fs, const char* pathname, mode_t mode)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    locked = true;
+
     /* Check if path exists */
     ECHECK(_path_to_inode(
         ext2,
@@ -5621,6 +6949,9 @@ static int _ext2_chmod(myst_fs_t* fs, const char* pathname, mode_t mode)
         &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ext2->locks->tree);
+        locked = false;
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_chmod(tfs, locals->suffix, mode)));
         goto done;
@@ -5636,6 +6967,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ext2->locks->tree);
+
     return ret;
 }
 
@@ -5643,10 +6977,16 @@ static int _ext2_fchmod(myst_fs_t* fs, myst_file_t* file, mode_t mode)
 {
     int ret = 0;
     ext2_t* ext2 = (ext2_t*)fs;
+    bool locked = false;
 
-    if (!_ext2_valid(ext2) || !file)
+    if (!_ext2_valid(ext2) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    /* the owner and mode are checked by path lookups */
+    myst_rwlock_wrlock(&ext2->locks->tree);
+    myst_mutex_lock(&file->mutex);
+    locked = true;
+
     /* refresh the inode */
     ECHECK((ext2_read_inode(ext2, file->ino, &file->inode)));
 
@@ -5656,19 +6996,43 @@ static int _ext2_fchmod(myst_fs_t* fs, myst_file_t* file, mode_t mode)
     ECHECK(_write_inode(ext2, file->ino, &file->inode));
 
 done:
+
+    if (locked)
+    {
+        myst_mutex_unlock(&file->mutex);
+        myst_rwlock_unlock(&ext2->locks->tree);
+    }
+
     return ret;
 }
 
-static int _ext2_fsync_and_fdatasync(myst_fs_t* fs, myst_file_t* file)
+int ext2_sync(myst_fs_t* fs)
 {
     int ret = 0;
     ext2_t* ext2 = (ext2_t*)fs;
 
-    if (!_ext2_valid(ext2) || !file)
+    if (!_ext2_valid(ext2))
+        ERAISE(-EINVAL);
+
+    /* write back the cached inodes, the allocation metadata, and then the
+     * blocks the device caches */
+    ECHECK(_icache_flush(ext2));
+    ECHECK(_alloc_flush(ext2));
+    ECHECK(_dev_flush(ext2));
+
+done:
+
+    return ret;
+}
+
+static int _ext2_fsync_and_fdatasync(myst_fs_t* fs, myst_file_t* file)
+{
+    int ret = 0;
+
+    if (!file)
         ERAISE(-EINVAL);
 
-    /* Changes to ext2 files are ephemeral, and are not written
-     to back to the on-disk image. So we treat fsync and fdatasync as a NOP */
+    ECHECK(ext2_sync(fs));
 
 done:
 
@@ -5769,6 +7133,12 @@ int ext2_create(
     if (!(ext2 = (ext2_t*)calloc(1, sizeof(ext2_t))))
         ERAISE(-ENOMEM);
 
+    /* Allocate the locks */
+    ECHECK(_locks_new(&ext2->locks));
+
+    /* Allocate the inode cache */
+    ECHECK(_icache_new(&ext2->icache));
+
     /* Read the superblock */
     ECHECK(_read_super_block(dev, &ext2->sb));
 
@@ -5815,6 +7185,9 @@ int ext2_create(
     if (!(ext2->groups = _read_groups(ext2)))
         ERAISE(-EIO);
 
+    /* Allocate the in-memory allocation state of the groups */
+    ECHECK(_alloc_new(ext2, &ext2->alloc));
+
     /* Read the root inode */
     if ((ret = ext2_read_inode(ext2, EXT2_ROOT_INO, &ext2->root_inode)))
         ERAISE(-EIO);
@@ -5828,6 +7201,15 @@ done:
 
     if (ext2)
     {
+        if (ext2->locks)
+            free(ext2->locks);
+
+        if (ext2->icache)
+            _icache_free(ext2->icache);
+
+        if (ext2->alloc)
+            _alloc_free(ext2, ext2->alloc);
+
         if (ext2->inode_refs)
             free(ext2->inode_refs);
 
@@ -5840,6 +7222,11 @@ done:
     return ret;
 }
 
+bool myst_is_ext2fs(const myst_fs_t* fs)
+{
+    return fs && fs->fs_open == ext2_open && _ext2_valid((const ext2_t*)fs);
+}
+
 int ext2_set_wrapper_fs(myst_fs_t* fs, myst_fs_t* wrapper_fs)
 {
     int ret = 0;
@@ -5862,12 +7249,34 @@ int ext2_release(myst_fs_t* fs)
     if (!_ext2_valid(ext2))
         ERAISE(-EINVAL);
 
+    /* write back the dirty inodes while the groups are still loaded */
+    if (ext2->icache)
+    {
+        ret = _icache_flush(ext2);
+        _icache_free(ext2->icache);
+    }
+
+    if (ext2->alloc)
+    {
+        int r = _alloc_flush(ext2);
+
+        if (r && !ret)
+            ret = r;
+
+        _alloc_free(ext2, ext2->alloc);
+    }
+
     if (ext2->groups)
         free(ext2->groups);
 
     if (ext2->inode_refs)
         free(ext2->inode_refs);
 
+    if (ext2->locks)
+        free(ext2->locks);
+
+    myst_dcache_invalidate_fs(ext2);
+
     if (ext2->dev)
         (*ext2->dev->close)(ext2->dev);
 
@@ -21,6 +21,26 @@ struct myst_blkdev
     int (*get)(myst_blkdev_t* dev, uint64_t blkno, void* data);
 
     int (*put)(myst_blkdev_t* dev, uint64_t blkno, const void* data);
+
+    /* optional: write back the blocks this device holds (may be null) */
+    int (*flush)(myst_blkdev_t* dev);
+
+    /* optional: hint that these blocks will be read soon (may be null) */
+    int (*readahead)(myst_blkdev_t* dev, uint64_t blkno, size_t count);
+
+    /* optional: read count consecutive blocks at once (may be null) */
+    int (*get_blocks)(
+        myst_blkdev_t* dev,
+        uint64_t blkno,
+        void* data,
+        size_t count);
+
+    /* optional: write count consecutive blocks at once (may be null) */
+    int (*put_blocks)(
+        myst_blkdev_t* dev,
+        uint64_t blkno,
+        const void* data,
+        size_t count);
 };
 
 int myst_rawblkdev_open(
@@ -44,4 +64,24 @@ int myst_verityblkdev_open(
     size_t roothash_size,
     myst_blkdev_t** blkdev);
 
+typedef struct myst_cacheblkdev_stats
+{
+    size_t hits;       /* reads served from the cache */
+    size_t misses;     /* reads passed to the underlying device */
+    size_t evictions;  /* blocks dropped to make room for others */
+    size_t writebacks; /* dirty blocks written to the underlying device */
+    size_t readaheads; /* blocks read before they were asked for */
+} myst_cacheblkdev_stats_t;
+
+/* a write-back cache of at most max_blocks blocks of the given device (which
+ * is closed along with the cache) */
+int myst_cacheblkdev_open(
+    myst_blkdev_t* dev,
+    size_t max_blocks,
+    myst_blkdev_t** blkdev);
+
+int myst_cacheblkdev_stats(
+    myst_blkdev_t* blkdev,
+    myst_cacheblkdev_stats_t* stats);
+
 #endif /* _MYST_BLKDEV_H */
@@ -14,6 +14,11 @@ struct clock_ctrl
     volatile long now;
     unsigned long interval;
     volatile int done;
+
+    /* the TSC read alongside now; (now, tsc) pairs are published under seq,
+     * which is odd while the host clock thread updates them */
+    volatile unsigned long seq;
+    volatile unsigned long tsc;
 };
 
 int myst_setup_clock(struct clock_ctrl*);
@@ -0,0 +1,44 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_DCACHE_H
+#define _MYST_DCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* the kernel-wide directory entry cache
+ *
+ * Maps (file system, parent directory, name) to the value the file system
+ * looked up for that name, which is typically an inode number. A value of
+ * zero is a negative entry, recording that the name does not exist. The
+ * cache is bounded and evicts the least recently used entries of a chain.
+ *
+ * File systems insert entries only while holding the lock that excludes
+ * changes to the directory and invalidate the entries they change.
+ */
+
+/* find an entry (false if the name is not cached) */
+bool myst_dcache_lookup(
+    const void* fs,
+    uint64_t parent,
+    const char* name,
+    uint64_t* value);
+
+/* add or replace an entry (value is zero for a negative entry) */
+void myst_dcache_insert(
+    const void* fs,
+    uint64_t parent,
+    const char* name,
+    uint64_t value);
+
+/* drop the entry for this name (if any) */
+void myst_dcache_invalidate(const void* fs, uint64_t parent, const char* name);
+
+/* drop every entry of this file system */
+void myst_dcache_invalidate_fs(const void* fs);
+
+/* drop every entry (a mount may hide cached names) */
+void myst_dcache_flush(void);
+
+#endif /* _MYST_DCACHE_H */
@@ -75,6 +75,10 @@ struct myst_eventfddev
     int (*target_fd)(myst_eventfddev_t* eventfddev, myst_eventfd_t* eventfd);
 
     int (*get_events)(myst_eventfddev_t* eventfddev, myst_eventfd_t* eventfd);
+
+    struct myst_poll_wq* (*get_wq)(
+        myst_eventfddev_t* eventfddev,
+        myst_eventfd_t* eventfd);
 };
 
 myst_eventfddev_t* myst_eventfddev_get(void);
@@ -27,6 +27,11 @@
 
 #define EXT2_MAX_BLOCK_SIZE (8 * 1024)
 
+/* the default and the largest Ext2CacheKB settings: the size of the block
+ * cache of each mounted ext2 file system */
+#define EXT2_DEFAULT_CACHE_KB (8 * 1024)
+#define EXT2_MAX_CACHE_KB (1024 * 1024)
+
 /* Offset of super block from start of file system */
 #define EXT2_BASE_OFFSET 1024
 
@@ -220,6 +225,9 @@ struct ext2
     myst_mount_resolve_callback_t resolve;
     myst_fs_t* wrapper_fs;
     ext2_inode_ref_t* inode_refs;
+    struct ext2_locks* locks; /* see ext2.c */
+    struct ext2_icache* icache; /* see ext2.c */
+    struct ext2_alloc* alloc; /* see ext2.c */
 };
 
 /*
@@ -237,8 +245,14 @@ int ext2_create(
 
 int ext2_set_wrapper_fs(myst_fs_t* fs, myst_fs_t* wrapper_fs);
 
+bool myst_is_ext2fs(const myst_fs_t* fs);
+
 int ext2_release(myst_fs_t* fs);
 
+/* write back the cached inodes, the allocation metadata and the cached
+ * blocks of the device (as sync() does) */
+int ext2_sync(myst_fs_t* fs);
+
 /*
 **==============================================================================
 **
@@ -46,6 +46,15 @@ struct myst_fdops
 
     /* returns POLLIN | POLLOUT | POLLERR */
     int (*fd_get_events)(void* device, void* object);
+
+    /* optional: the wake queue of an object with internal events (see
+     * myst/poll.h) or null if its readiness changes are not published */
+    struct myst_poll_wq* (*fd_get_wq)(void* device, void* object);
+
+    /* optional: the events of an object with a target fd that are due to
+     * input buffered in the kernel (added to the events from the host), or
+     * -ENOTSUP if it does not buffer; changes are published via fd_get_wq */
+    int (*fd_get_buffered_events)(void* device, void* object);
 };
 
 ssize_t myst_fdops_readv(
@@ -15,12 +15,24 @@
 #include <myst/fs.h>
 #include <myst/inotifydev.h>
 #include <myst/pipedev.h>
+#include <myst/signalfddev.h>
 #include <myst/sockdev.h>
 #include <myst/spinlock.h>
+#include <myst/timerfddev.h>
 #include <myst/ttydev.h>
 
+/* the default RLIMIT_NOFILE soft limit */
 #define MYST_FDTABLE_SIZE 1024
 
+/* the largest RLIMIT_NOFILE (same as the Linux fs.nr_open default) */
+#define MYST_FDTABLE_MAX_SIZE (1024 * 1024)
+
+/* the table grows by this many entries at a time */
+#define MYST_FDTABLE_CHUNK_SIZE 1024
+
+#define MYST_FDTABLE_NUM_CHUNKS \
+    (MYST_FDTABLE_MAX_SIZE / MYST_FDTABLE_CHUNK_SIZE)
+
 typedef enum myst_fdtable_type
 {
     MYST_FDTABLE_TYPE_NONE,
@@ -31,18 +43,63 @@ typedef enum myst_fdtable_type
     MYST_FDTABLE_TYPE_EPOLL,
     MYST_FDTABLE_TYPE_INOTIFY,
     MYST_FDTABLE_TYPE_EVENTFD,
+    MYST_FDTABLE_TYPE_TIMERFD,
+    MYST_FDTABLE_TYPE_SIGNALFD,
 } myst_fdtable_type_t;
 
 typedef struct myst_fdtable_entry
 {
     myst_fdtable_type_t type;
+
+    /* odd while the entry is being updated (see myst_fdtable_get()) */
+    uint32_t seq;
+
     void* device; /* example: myst_fs_t */
     void* object; /* example: myst_file_t */
 } myst_fdtable_entry_t;
 
+typedef struct myst_fdtable_chunk
+{
+    myst_fdtable_entry_t entries[MYST_FDTABLE_CHUNK_SIZE];
+
+    /* one bit per entry: set if the entry is in use */
+    uint64_t used[MYST_FDTABLE_CHUNK_SIZE / 64];
+
+    /* one bit per entry: set if the object belongs to the parent's table */
+    uint64_t borrowed[MYST_FDTABLE_CHUNK_SIZE / 64];
+
+    /* the number of entries in use */
+    size_t count;
+} myst_fdtable_chunk_t;
+
 typedef struct myst_fdtable
 {
-    myst_fdtable_entry_t entries[MYST_FDTABLE_SIZE];
+    /* chunks are allocated on demand as higher descriptors are assigned;
+     * once published, a chunk is not freed until the table is freed */
+    myst_fdtable_chunk_t* chunks[MYST_FDTABLE_NUM_CHUNKS];
+
+    /* one bit per chunk: set if every entry of the chunk is in use */
+    uint64_t full[MYST_FDTABLE_NUM_CHUNKS / 64];
+
+    /* one bit per chunk: set if any entry of the chunk is in use */
+    uint64_t nonempty[MYST_FDTABLE_NUM_CHUNKS / 64];
+
+    /* descriptors must be less than this (RLIMIT_NOFILE soft limit) */
+    size_t limit;
+
+    /* the number of descriptors in use */
+    size_t count;
+
+    /* copy-on-write sharing (see myst_fdtable_clone()): a cloned table
+     * borrows the objects of its parent's table (cow_parent) until it execs
+     * or changes them; the parent keeps a list of the tables that borrow
+     * from it (cow_children) */
+    size_t nborrowed;
+    struct myst_fdtable* cow_parent;
+    struct myst_fdtable* cow_children;
+    struct myst_fdtable* cow_prev;
+    struct myst_fdtable* cow_next;
+
     myst_spinlock_t lock;
 } myst_fdtable_t;
 
@@ -77,8 +134,16 @@ int myst_fdtable_dup(
     int newfd,
     int flags); /* O_CLOEXEC */
 
+/* returns 1 if the object was borrowed from the parent's table, in which case
+ * the caller must not close it */
 int myst_fdtable_remove(myst_fdtable_t* fdtable, int fd);
 
+/* give fd its own object before changing its per-descriptor state (such as
+ * FD_CLOEXEC), so that the change is not seen through a shared table */
+int myst_fdtable_unshare(myst_fdtable_t* fdtable, int fd);
+
+/* lookups do not take the table lock: they read a consistent snapshot of the
+ * entry, while assign, dup and remove update entries under the lock */
 int myst_fdtable_get(
     myst_fdtable_t* fdtable,
     int fd,
@@ -156,6 +221,27 @@ MYST_INLINE int myst_fdtable_get_eventfd(
     return myst_fdtable_get(fdtable, fd, type, (void**)device, (void**)eventfd);
 }
 
+MYST_INLINE int myst_fdtable_get_timerfd(
+    myst_fdtable_t* fdtable,
+    int fd,
+    myst_timerfddev_t** device,
+    myst_timerfd_t** timerfd)
+{
+    const myst_fdtable_type_t type = MYST_FDTABLE_TYPE_TIMERFD;
+    return myst_fdtable_get(fdtable, fd, type, (void**)device, (void**)timerfd);
+}
+
+MYST_INLINE int myst_fdtable_get_signalfd(
+    myst_fdtable_t* fdtable,
+    int fd,
+    myst_signalfddev_t** device,
+    myst_signalfd_t** signalfd)
+{
+    const myst_fdtable_type_t type = MYST_FDTABLE_TYPE_SIGNALFD;
+    return myst_fdtable_get(
+        fdtable, fd, type, (void**)device, (void**)signalfd);
+}
+
 int myst_fdtable_get_any(
     myst_fdtable_t* fdtable,
     int fd,
@@ -166,17 +252,28 @@ int myst_fdtable_get_any(
 /* get the fdtable for the current thread */
 myst_fdtable_t* myst_fdtable_current(void);
 
-int myst_fdtable_clone(myst_fdtable_t* fdtable, myst_fdtable_t** fdtable_out);
+/* clone fdtable; if borrow is true, the clone borrows the objects of fdtable
+ * (copy-on-write), which requires that nothing else runs in the process that
+ * owns fdtable until the clone is freed or execs; otherwise the clone gets
+ * duplicates of the objects */
+int myst_fdtable_clone(
+    myst_fdtable_t* fdtable,
+    bool borrow,
+    myst_fdtable_t** fdtable_out);
 
 MYST_INLINE bool myst_valid_fd(int fd)
 {
-    return fd >= 0 && fd < MYST_FDTABLE_SIZE;
+    return fd >= 0 && fd < MYST_FDTABLE_MAX_SIZE;
 }
 
 int myst_fdtable_list(const myst_fdtable_t* fdtable);
 
 long myst_fdtable_sync(myst_fdtable_t* fdtable);
 
+/* returns the number of descriptors still available */
 ssize_t myst_fdtable_count(const myst_fdtable_t* fdtable);
 
+/* set the RLIMIT_NOFILE soft limit */
+int myst_fdtable_set_limit(myst_fdtable_t* fdtable, size_t limit);
+
 #endif /* _MYST_FDTABLE_H */
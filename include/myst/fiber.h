@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_FIBER_H
+#define _MYST_FIBER_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <myst/defs.h>
+
+/*
+**==============================================================================
+**
+** M:N fiber scheduler:
+**
+**     When the number of threads exceeds what the target can back one-to-one
+**     (the number of TCS's for SGX), new kernel threads are created as fibers
+**     and multiplexed onto a fixed set of carrier threads. Each fiber is
+**     pinned to one carrier and only switches inside the kernel, at the
+**     points where a host thread would otherwise block: waiting on its
+**     thread event, sleeping, or polling the host.
+**
+**     A fiber's thread event is the fiber address tagged with the low bit,
+**     so myst_tcall_wait() and friends can route fiber events to the
+**     scheduler rather than to the host.
+**
+**==============================================================================
+*/
+
+/* upper bound for the MaxFibers setting */
+#define MYST_MAX_FIBERS 4096
+
+/* upper bound for the FiberCarrierThreads setting */
+#define MYST_MAX_FIBER_CARRIERS 64
+
+/* cookies passed to myst_tcall_create_thread() for carrier threads */
+#define MYST_FIBER_CARRIER_COOKIE 0xffffffff00000000
+
+typedef struct myst_fiber myst_fiber_t;
+
+typedef struct myst_thread myst_thread_t;
+
+MYST_INLINE bool myst_is_fiber_event(uint64_t event)
+{
+    return (event & 1) ? true : false;
+}
+
+MYST_INLINE bool myst_is_fiber_carrier_cookie(uint64_t cookie)
+{
+    return (cookie & MYST_FIBER_CARRIER_COOKIE) == MYST_FIBER_CARRIER_COOKIE;
+}
+
+/* Decide how to back a new kernel thread, given the current number of
+ * threads: returns 0 for a host thread, 1 for a fiber, or -EAGAIN */
+int myst_fiber_select(size_t num_threads);
+
+/* start the given thread on a fiber (the thread is run by myst_run_fiber) */
+long myst_fiber_create(myst_thread_t* thread);
+
+/* entry point for carrier threads (called from myst_run_thread) */
+long myst_fiber_run_carrier(uint64_t cookie, uint64_t event, pid_t target_tid);
+
+/* return the calling fiber or null if the caller is a host-backed thread */
+myst_fiber_t* myst_fiber_self(void);
+
+/* the number of live fibers */
+size_t myst_fiber_count(void);
+
+/* event operations for fiber events (see myst_tcall_wait()) */
+long myst_fiber_wait(uint64_t event, const struct timespec* timeout);
+
+long myst_fiber_wake(uint64_t event);
+
+/* park the calling fiber for the given time; returns -EINTR (and the time
+ * left in rem if not null) when a signal arrives or the kernel shuts down */
+long myst_fiber_sleep(const struct timespec* req, struct timespec* rem);
+
+/* put the calling fiber at the back of its carrier's run queue */
+long myst_fiber_yield(void);
+
+/* poll the host without blocking the carrier thread: the fiber parks until
+ * its carrier, idle in one host poll over the fds of all its parked fibers,
+ * sees the fds ready; returns -EINTR on signals and myst_fiber_poll_wake() */
+long myst_fiber_poll(struct pollfd* fds, nfds_t nfds, int timeout);
+
+/* interrupt the fibers parked in myst_fiber_poll() (the counterpart of the
+ * target waker that myst_tcall_poll_wake() writes for host threads) */
+long myst_fiber_poll_wake(void);
+
+/* park the calling fiber until the target fd is ready (returns 1) or the
+ * timeout in milliseconds expires (returns 0); returns -EINTR on signals */
+long myst_fiber_wait_host(int tfd, short events, int timeout);
+
+/* park the calling fiber until the given (blocking) target fd is ready */
+long myst_fiber_wait_fd(int tfd, short events);
+
+/* wake the parked fibers and stop the carrier threads once all fibers have
+ * exited (gives up on fibers that do not exit within a few seconds) */
+void myst_fiber_shutdown(void);
+
+#endif /* _MYST_FIBER_H */
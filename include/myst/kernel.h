@@ -207,6 +207,26 @@ typedef struct myst_kernel_args
      */
     bool unhandled_syscall_enosys;
 
+    // From the ThreadStackCacheSize setting: the number of exited C-runtime
+    // thread mappings (stack, guard page and TLS) kept for reuse.
+    size_t thread_stack_cache_size;
+
+    // From the FiberCarrierThreads, FiberThreshold, and MaxFibers settings:
+    // the number of enclave threads that run fibers (zero disables fibers),
+    // the number of host-backed threads after which new threads become
+    // fibers (zero means all but the carriers), and the fiber limit.
+    size_t fiber_carriers;
+    size_t fiber_threshold;
+    size_t max_fibers;
+
+    // From the SocketReadAheadKB setting: the size in bytes of the buffer
+    // that small TCP receives read ahead into (zero disables read-ahead).
+    size_t socket_read_ahead_size;
+
+    // From the Ext2CacheKB setting: the size in bytes of the block cache of
+    // each mounted ext2 file system (zero selects the default).
+    size_t ext2_cache_size;
+
 } myst_kernel_args_t;
 
 typedef int (*myst_kernel_entry_t)(myst_kernel_args_t* args);
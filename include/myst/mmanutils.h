@@ -76,6 +76,19 @@ int myst_mman_pids_set(const void* addr, size_t length, pid_t pid);
 /* return the length in bytes that are owned by the given process */
 ssize_t myst_mman_pids_test(const void* addr, size_t length, pid_t pid);
 
+/* keep the mapping of an exited C-runtime thread for reuse (see
+ * ThreadStackCacheSize); returns zero if the cache took the region */
+int myst_stack_cache_put(void* addr, size_t length);
+
+/* return a cached mapping for an anonymous mmap() request or zero if none */
+long myst_stack_cache_mmap(void* addr, size_t length, int prot, int flags);
+
+/* note that the joining thread will unmap the mapping containing td */
+void myst_stack_cache_expect(pid_t pid, const void* td);
+
+/* cache the region if it is the mapping of an exited thread (see above) */
+int myst_stack_cache_munmap(void* addr, size_t length);
+
 void myst_mman_lock(void);
 
 void myst_mman_unlock(void);
@@ -23,4 +23,7 @@ int myst_teardown_auto_mounts();
 /* Use mounter to resolve this path to a target path */
 int myst_mount_resolve(const char* path, char suffix[PATH_MAX], myst_fs_t** fs);
 
+/* Write back the caches of every mounted file system (for sync) */
+int myst_mount_sync(void);
+
 #endif /* _MYST_MOUNT_H */
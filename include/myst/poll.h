@@ -0,0 +1,110 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_POLL_H
+#define _MYST_POLL_H
+
+#include <myst/spinlock.h>
+#include <myst/thread.h>
+
+/*
+**==============================================================================
+**
+** poll wait queue:
+**
+**     Objects whose readiness is computed in the kernel (their fd_get_events()
+**     returns an event mask rather than -ENOTSUP) have no host descriptor for
+**     the host poll to watch. Such objects must call myst_poll_wake() after
+**     any change that may make them ready (data written, peer closed, etc.).
+**
+**     A thread blocked in poll(), select(), or epoll_wait() registers itself
+**     on the wait queue and then sleeps in the host poll. myst_poll_wake()
+**     interrupts the sleepers with myst_tcall_poll_wake() and they re-scan
+**     their descriptors. The call is cheap when nobody is waiting.
+**
+**     myst_tcall_poll_wake() interrupts every thread in the host poll, so
+**     objects with a wake queue (see below) do not use the poll wait queue:
+**     the pollers register on the wake queues of the objects they watch, and
+**     only a wake of such a queue interrupts the host poll.
+**
+**==============================================================================
+*/
+
+/* wake the threads waiting in the poll wait queue */
+void myst_poll_wake(void);
+
+/* return the current wait-queue sequence number (taken before a scan) */
+uint64_t myst_poll_seq(void);
+
+/* register the calling thread as a waiter: returns false (and does not
+ * register) if myst_poll_wake() was called since seq was obtained */
+bool myst_poll_wait_begin(uint64_t seq);
+
+/* unregister the calling thread: returns true if woken since seq */
+bool myst_poll_wait_end(uint64_t seq);
+
+/*
+**==============================================================================
+**
+** object wake queues:
+**
+**     An object with internal events may also keep a wake queue (returned by
+**     its fd_get_wq()) so that poll and epoll can track its readiness without
+**     scanning. The object calls myst_poll_wq_wake() instead of
+**     myst_poll_wake(); this runs the callback of every registered waiter
+**     (with the queue locked, so callbacks may only take spinlocks) and then
+**     interrupts the host poll only if a callback returned true (a thread that
+**     it concerns sleeps in the host poll). Before the object that owns the
+**     queue is freed, it must call myst_poll_wq_release(), which detaches any
+**     remaining waiters.
+**
+**     A waiter registers, and then checks that myst_poll_seq() did not change
+**     since its scan (every notification increments it before running the
+**     callbacks), so a change between the scan and the registration is not
+**     missed.
+**
+**==============================================================================
+*/
+
+typedef struct myst_poll_wq myst_poll_wq_t;
+
+typedef struct myst_poll_waiter myst_poll_waiter_t;
+
+/* returns true if the host poll must be interrupted */
+typedef bool (*myst_poll_callback_t)(myst_poll_waiter_t* waiter);
+
+struct myst_poll_waiter
+{
+    myst_poll_waiter_t* prev;
+    myst_poll_waiter_t* next;
+    myst_poll_wq_t* wq; /* null when not registered */
+    myst_poll_callback_t callback;
+};
+
+struct myst_poll_wq
+{
+    myst_spinlock_t lock;
+    myst_poll_waiter_t* head;
+};
+
+void myst_poll_wq_add(
+    myst_poll_wq_t* wq,
+    myst_poll_waiter_t* waiter,
+    myst_poll_callback_t callback);
+
+/* unregister the waiter (no-op if the queue was released) */
+void myst_poll_wq_remove(myst_poll_waiter_t* waiter);
+
+/* run the callbacks of the waiters: returns true if any callback did (then
+ * the caller must call myst_tcall_poll_wake() once it may make host calls) */
+bool myst_poll_wq_notify(myst_poll_wq_t* wq);
+
+/* run the callbacks of the waiters and interrupt the host poll if needed */
+void myst_poll_wq_wake(myst_poll_wq_t* wq);
+
+void myst_poll_wq_release(myst_poll_wq_t* wq);
+
+/* release the per-thread poll buffers */
+void myst_poll_free_buffers(myst_thread_t* thread);
+
+#endif /* _MYST_POLL_H */
@@ -51,12 +51,22 @@ int myst_init_ramfs(
     myst_mount_resolve_callback_t resolve_cb,
     myst_fs_t** fs_out);
 
+bool myst_is_ramfs(const myst_fs_t* fs);
+
 int myst_ramfs_set_buf(
     myst_fs_t* fs,
     const char* pathname,
     const void* buf,
     size_t buf_size);
 
+/* load a CPIO archive onto the given directory: the entries are created as
+ * they are looked up and file data refers to the archive (which is kept) */
+int myst_ramfs_load_cpio(
+    myst_fs_t* fs,
+    const char* pathname,
+    const void* data,
+    size_t size);
+
 int myst_create_virtual_file(
     myst_fs_t* fs,
     const char* pathname,
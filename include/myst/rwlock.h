@@ -0,0 +1,53 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_RWLOCK_H
+#define _MYST_RWLOCK_H
+
+#include <myst/cond.h>
+#include <myst/mutex.h>
+#include <myst/thread.h>
+
+/* reader/writer lock type
+ *
+ * Readers acquire and release the lock with atomic operations on the state
+ * word; the mutex and condition are only used to wait. Writers are preferred:
+ * once a writer waits, new readers wait behind it, so a stream of readers
+ * cannot starve writers. A thread that already holds a shared acquisition
+ * (of any rwlock) does not wait for waiting writers though, so a thread may
+ * take the lock shared more than once. The writer may also lock recursively
+ * (shared or exclusive), in which case the nested acquisitions count as
+ * exclusive ones.
+ */
+typedef struct myst_rwlock
+{
+    uint64_t state; /* readers, MYST_RWLOCK_WRITER, MYST_RWLOCK_WAITING */
+    myst_mutex_t mutex;
+    myst_cond_t cond;
+    size_t nwriters; /* writers waiting (guarded by mutex) */
+    size_t nwaiters; /* threads waiting on cond */
+    myst_thread_t* writer;
+    size_t depth;
+} myst_rwlock_t;
+
+/* a writer holds the lock */
+#define MYST_RWLOCK_WRITER ((uint64_t)1)
+
+/* writers are waiting for the lock */
+#define MYST_RWLOCK_WAITING ((uint64_t)2)
+
+/* the state increment of each reader */
+#define MYST_RWLOCK_READER ((uint64_t)4)
+
+int myst_rwlock_init(myst_rwlock_t* rw);
+
+int myst_rwlock_rdlock(myst_rwlock_t* rw);
+
+int myst_rwlock_wrlock(myst_rwlock_t* rw);
+
+/* release a shared or an exclusive acquisition */
+int myst_rwlock_unlock(myst_rwlock_t* rw);
+
+int myst_rwlock_destroy(myst_rwlock_t* rw);
+
+#endif /* _MYST_RWLOCK_H */
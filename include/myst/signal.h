@@ -30,6 +30,13 @@ long myst_signal_deliver(
     unsigned signum,
     siginfo_t* siginfo);
 
+/* remove the lowest pending signal in mask from the thread's queue; returns
+ * the signal number or -EAGAIN if none is pending */
+long myst_signal_dequeue(
+    myst_thread_t* thread,
+    uint64_t mask,
+    siginfo_t* siginfo);
+
 long myst_signal_sigpending(sigset_t* set, unsigned size);
 
 long myst_signal_clone(myst_thread_t* parent, myst_thread_t* child);
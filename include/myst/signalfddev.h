@@ -0,0 +1,97 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_SIGNALFDDEV_H
+#define _MYST_SIGNALFDDEV_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <myst/fdops.h>
+
+typedef struct myst_thread myst_thread_t;
+
+typedef struct myst_signalfddev myst_signalfddev_t;
+
+typedef struct myst_signalfd myst_signalfd_t;
+
+struct myst_signalfddev
+{
+    myst_fdops_t fdops;
+
+    int (*sd_signalfd)(
+        myst_signalfddev_t* dev,
+        const sigset_t* mask,
+        int flags,
+        myst_signalfd_t** obj);
+
+    int (*sd_set_mask)(
+        myst_signalfddev_t* dev,
+        myst_signalfd_t* obj,
+        const sigset_t* mask);
+
+    ssize_t (*sd_read)(
+        myst_signalfddev_t* dev,
+        myst_signalfd_t* obj,
+        void* buf,
+        size_t count);
+
+    ssize_t (*sd_write)(
+        myst_signalfddev_t* dev,
+        myst_signalfd_t* obj,
+        const void* buf,
+        size_t count);
+
+    ssize_t (*sd_readv)(
+        myst_signalfddev_t* dev,
+        myst_signalfd_t* obj,
+        const struct iovec* iov,
+        int iovcnt);
+
+    ssize_t (*sd_writev)(
+        myst_signalfddev_t* dev,
+        myst_signalfd_t* obj,
+        const struct iovec* iov,
+        int iovcnt);
+
+    int (*sd_fstat)(
+        myst_signalfddev_t* dev,
+        myst_signalfd_t* obj,
+        struct stat* statbuf);
+
+    int (*sd_fcntl)(
+        myst_signalfddev_t* dev,
+        myst_signalfd_t* obj,
+        int cmd,
+        long arg);
+
+    int (*sd_ioctl)(
+        myst_signalfddev_t* dev,
+        myst_signalfd_t* obj,
+        unsigned long request,
+        long arg);
+
+    int (*sd_dup)(
+        myst_signalfddev_t* dev,
+        const myst_signalfd_t* obj,
+        myst_signalfd_t** obj_out);
+
+    int (*sd_close)(myst_signalfddev_t* dev, myst_signalfd_t* obj);
+
+    int (*sd_target_fd)(myst_signalfddev_t* dev, myst_signalfd_t* obj);
+
+    int (*sd_get_events)(myst_signalfddev_t* dev, myst_signalfd_t* obj);
+
+    struct myst_poll_wq* (*sd_get_wq)(
+        myst_signalfddev_t* dev,
+        myst_signalfd_t* obj);
+};
+
+myst_signalfddev_t* myst_signalfddev_get(void);
+
+/* called by myst_signal_deliver() after queuing a signal for the thread */
+void myst_signalfd_notify(myst_thread_t* thread, unsigned signum);
+
+#endif /* _MYST_SIGNALFDDEV_H */
@@ -159,8 +159,17 @@ struct myst_sockdev
     int (*sd_target_fd)(myst_sockdev_t* sd, myst_sock_t* sock);
 
     int (*sd_get_events)(myst_sockdev_t* sd, myst_sock_t* sock);
+
+    /* optional: change the mode of a socket that has no host descriptor */
+    int (*sd_fchmod)(myst_sockdev_t* sd, myst_sock_t* sock, mode_t mode);
 };
 
 myst_sockdev_t* myst_sockdev_get(void);
 
+/* AF_UNIX sockets (implemented within the kernel) */
+myst_sockdev_t* myst_udsdev_get(void);
+
+/* the largest SocketReadAheadKB setting */
+#define MYST_MAX_SOCKET_READ_AHEAD_KB 1024
+
 #endif /* _MYST_SOCKDEV_H */
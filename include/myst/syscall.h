@@ -216,7 +216,8 @@ long myst_syscall_clone(
     void* arg,
     pid_t* ptid,
     void* newtls,
-    pid_t* ctid);
+    pid_t* ctid,
+    long options); /* MYST_CLONE_WAIT_EXEC_EXIT */
 
 long myst_syscall_futex(
     int* uaddr,
@@ -287,8 +288,48 @@ long myst_syscall_setitimer(
 
 int myst_syscall_getitimer(int which, struct itimerval* curr_value);
 
+long myst_syscall_timer_create(
+    clockid_t clockid,
+    struct sigevent* sevp,
+    int* timerid);
+
+long myst_syscall_timer_settime(
+    int timerid,
+    int flags,
+    const struct itimerspec* new_value,
+    struct itimerspec* old_value);
+
+long myst_syscall_timer_gettime(int timerid, struct itimerspec* curr_value);
+
+long myst_syscall_timer_getoverrun(int timerid);
+
+long myst_syscall_timer_delete(int timerid);
+
+long myst_syscall_timerfd_create(clockid_t clockid, int flags);
+
+long myst_syscall_timerfd_settime(
+    int fd,
+    int flags,
+    const struct itimerspec* new_value,
+    struct itimerspec* old_value);
+
+long myst_syscall_timerfd_gettime(int fd, struct itimerspec* curr_value);
+
+long myst_syscall_signalfd(
+    int fd,
+    const sigset_t* mask,
+    size_t sizemask,
+    int flags);
+
+/* disarm the itimers and POSIX timers of an exiting process */
+void myst_release_process_timers(pid_t pid);
+
 long myst_syscall_fsync(int fd);
 
+long myst_syscall_sync(void);
+
+long myst_syscall_syncfs(int fd);
+
 long myst_syscall_uname(struct utsname* buf);
 
 long myst_syscall_getuid();
@@ -30,6 +30,11 @@ enum
     SYS_fork_wait_exec_exit,
 };
 
+/* SYS_myst_clone option (second parameter): the caller stays suspended from
+ * a CLONE_VFORK clone until the child execs or exits, so the child may borrow
+ * the caller's descriptors meanwhile (see myst_fdtable_clone) */
+#define MYST_CLONE_WAIT_EXEC_EXIT 1
+
 /* Used for SYS_myst_get_fork_info parameter */
 typedef enum
 {
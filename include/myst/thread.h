@@ -328,6 +328,24 @@ struct myst_thread
     // will wake it up. pause_futex=0 means futex unavailable; 1 means
     // available.
     int pause_futex;
+
+    /* the latest monotonic clock value returned to this thread (keeps
+     * CLOCK_MONOTONIC from going backward without a global lock) */
+    long monotime_last;
+
+    /* the number of shared acquisitions of reader/writer locks held by this
+     * thread (see kernel/rwlock.c) */
+    size_t rwlock_nshared;
+
+    /* buffers reused by poll() across calls (see kernel/poll.c) */
+    struct
+    {
+        struct pollfd* tfds;
+        size_t* tindices;
+        struct myst_poll_wq** wqs;
+        struct myst_poll_waiter* waiters;
+        size_t capacity;
+    } poll;
 };
 
 MYST_INLINE bool myst_valid_thread(const myst_thread_t* thread)
@@ -459,6 +477,9 @@ MYST_INLINE myst_process_t* myst_find_process(myst_thread_t* thread)
 
 long myst_run_thread(uint64_t cookie, uint64_t event, pid_t target_tid);
 
+/* run a thread created by myst_fiber_create() (called on the fiber) */
+long myst_run_fiber(myst_thread_t* thread, uint64_t event, pid_t target_tid);
+
 pid_t myst_generate_tid(void);
 
 pid_t myst_gettid(void);
@@ -484,6 +505,9 @@ myst_process_t* myst_find_process_from_pid(pid_t pid, bool include_zombies);
 
 void myst_fork_exec_futex_wake(myst_process_t* process);
 
+/* suspend the calling thread until its vfork child execs or exits */
+void myst_fork_exec_futex_wait(myst_thread_t* thread);
+
 size_t myst_kill_thread_group();
 
 bool myst_have_child_forked_processes(myst_process_t* process);
@@ -513,10 +537,7 @@ MYST_INLINE void myst_thread_sig_handler_install(
     void* sig_fn_arg)
 {
     myst_thread_t* thread = myst_thread_self();
-    if (thread->signal.thread_sig_handler)
-        sig_handler->previous = thread->signal.thread_sig_handler->previous;
-    else
-        sig_handler->previous = NULL;
+    sig_handler->previous = thread->signal.thread_sig_handler;
     sig_handler->signal_fn = sig_fn;
     sig_handler->signal_fn_arg = sig_fn_arg;
     thread->signal.thread_sig_handler = sig_handler;
@@ -0,0 +1,73 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_TIMER_H
+#define _MYST_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+**==============================================================================
+**
+** kernel timers:
+**
+**     Timers are kept in a min-heap ordered by deadline. A single timer
+**     thread (entered with SYS_myst_run_itimer) sleeps until the earliest
+**     deadline, pops the expired timers and runs their callbacks (on the
+**     timer thread, without any timer locks held). Each process that uses
+**     timers enters a thread; all but one stand by, and one of them takes
+**     over when the servicing thread exits with its process.
+**
+**     Deadlines are absolute CLOCK_MONOTONIC times in nanoseconds.
+**
+**==============================================================================
+*/
+
+typedef struct myst_timer myst_timer_t;
+
+typedef void (*myst_timer_callback_t)(myst_timer_t* timer, void* arg);
+
+struct myst_timer
+{
+    uint64_t deadline;
+    size_t index; /* one-based position in the heap (zero if disarmed) */
+    myst_timer_callback_t callback;
+    void* arg;
+};
+
+void myst_timer_init(
+    myst_timer_t* timer,
+    myst_timer_callback_t callback,
+    void* arg);
+
+/* arm (or re-arm) the timer to expire at the given deadline */
+int myst_timer_arm(myst_timer_t* timer, uint64_t deadline);
+
+/* disarm the timer without waiting for a running callback; returns true if
+ * the timer was armed */
+bool myst_timer_disarm(myst_timer_t* timer);
+
+/* disarm the timer and wait for its callback to finish if it is running;
+ * returns true if the timer was armed */
+bool myst_timer_cancel(myst_timer_t* timer);
+
+bool myst_timer_armed(myst_timer_t* timer);
+
+/* the current CLOCK_MONOTONIC time in nanoseconds */
+uint64_t myst_timer_now(void);
+
+/* convert a timer value of the given clock (CLOCK_REALTIME, CLOCK_MONOTONIC,
+ * or CLOCK_BOOTTIME) to a deadline (absolute values in the past yield now) */
+uint64_t myst_timer_deadline(
+    clockid_t clockid,
+    const struct timespec* value,
+    bool absolute);
+
+/* service the timers, or stand by until the servicing thread exits (never
+ * returns) */
+long myst_run_timers(void);
+
+#endif /* _MYST_TIMER_H */
@@ -0,0 +1,99 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _MYST_TIMERFDDEV_H
+#define _MYST_TIMERFDDEV_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include <myst/fdops.h>
+
+typedef struct myst_timerfddev myst_timerfddev_t;
+
+typedef struct myst_timerfd myst_timerfd_t;
+
+struct myst_timerfddev
+{
+    myst_fdops_t fdops;
+
+    int (*td_timerfd_create)(
+        myst_timerfddev_t* dev,
+        clockid_t clockid,
+        int flags,
+        myst_timerfd_t** obj);
+
+    int (*td_settime)(
+        myst_timerfddev_t* dev,
+        myst_timerfd_t* obj,
+        int flags,
+        const struct itimerspec* new_value,
+        struct itimerspec* old_value);
+
+    int (*td_gettime)(
+        myst_timerfddev_t* dev,
+        myst_timerfd_t* obj,
+        struct itimerspec* curr_value);
+
+    ssize_t (*td_read)(
+        myst_timerfddev_t* dev,
+        myst_timerfd_t* obj,
+        void* buf,
+        size_t count);
+
+    ssize_t (*td_write)(
+        myst_timerfddev_t* dev,
+        myst_timerfd_t* obj,
+        const void* buf,
+        size_t count);
+
+    ssize_t (*td_readv)(
+        myst_timerfddev_t* dev,
+        myst_timerfd_t* obj,
+        const struct iovec* iov,
+        int iovcnt);
+
+    ssize_t (*td_writev)(
+        myst_timerfddev_t* dev,
+        myst_timerfd_t* obj,
+        const struct iovec* iov,
+        int iovcnt);
+
+    int (*td_fstat)(
+        myst_timerfddev_t* dev,
+        myst_timerfd_t* obj,
+        struct stat* statbuf);
+
+    int (*td_fcntl)(
+        myst_timerfddev_t* dev,
+        myst_timerfd_t* obj,
+        int cmd,
+        long arg);
+
+    int (*td_ioctl)(
+        myst_timerfddev_t* dev,
+        myst_timerfd_t* obj,
+        unsigned long request,
+        long arg);
+
+    int (*td_dup)(
+        myst_timerfddev_t* dev,
+        const myst_timerfd_t* obj,
+        myst_timerfd_t** obj_out);
+
+    int (*td_close)(myst_timerfddev_t* dev, myst_timerfd_t* obj);
+
+    int (*td_target_fd)(myst_timerfddev_t* dev, myst_timerfd_t* obj);
+
+    int (*td_get_events)(myst_timerfddev_t* dev, myst_timerfd_t* obj);
+
+    struct myst_poll_wq* (*td_get_wq)(
+        myst_timerfddev_t* dev,
+        myst_timerfd_t* obj);
+};
+
+myst_timerfddev_t* myst_timerfddev_get(void);
+
+#endif /* _MYST_TIMERFDDEV_H */
@@ -0,0 +1,259 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/dcache.h>
+#include <myst/spinlock.h>
+
+/* the number of chains (a power of two) */
+#define DCACHE_NCHAINS 1024
+
+/* the longest chain (older entries are evicted beyond this) */
+#define DCACHE_MAX_CHAIN 8
+
+typedef struct dentry dentry_t;
+
+struct dentry
+{
+    dentry_t* next;
+    const void* fs;
+    uint64_t parent;
+    uint64_t hash;
+    uint64_t value;
+    char name[];
+};
+
+typedef struct chain
+{
+    dentry_t* head;
+    size_t count;
+} chain_t;
+
+static chain_t _chains[DCACHE_NCHAINS];
+static myst_spinlock_t _lock = MYST_SPINLOCK_INITIALIZER;
+
+/* FNV-1a over the name, seeded with the file system and parent */
+static uint64_t _hash(const void* fs, uint64_t parent, const char* name)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    hash = (hash ^ (uint64_t)fs) * 0x100000001b3;
+    hash = (hash ^ parent) * 0x100000001b3;
+
+    for (const uint8_t* p = (const uint8_t*)name; *p; p++)
+    {
+        hash ^= *p;
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+static chain_t* _chain(uint64_t hash)
+{
+    return &_chains[hash & (DCACHE_NCHAINS - 1)];
+}
+
+/* find the entry and return the link that points to it (or null) */
+static dentry_t** _find(
+    chain_t* chain,
+    const void* fs,
+    uint64_t parent,
+    uint64_t hash,
+    const char* name)
+{
+    for (dentry_t** pp = &chain->head; *pp; pp = &(*pp)->next)
+    {
+        dentry_t* p = *pp;
+
+        if (p->hash == hash && p->fs == fs && p->parent == parent &&
+            strcmp(p->name, name) == 0)
+        {
+            return pp;
+        }
+    }
+
+    return NULL;
+}
+
+static void _free_list(dentry_t* p)
+{
+    while (p)
+    {
+        dentry_t* next = p->next;
+        free(p);
+        p = next;
+    }
+}
+
+bool myst_dcache_lookup(
+    const void* fs,
+    uint64_t parent,
+    const char* name,
+    uint64_t* value)
+{
+    const uint64_t hash = _hash(fs, parent, name);
+    chain_t* chain = _chain(hash);
+    dentry_t** pp;
+    bool found = false;
+
+    myst_spin_lock(&_lock);
+
+    if ((pp = _find(chain, fs, parent, hash, name)))
+    {
+        dentry_t* p = *pp;
+
+        /* move to the front (the back is evicted first) */
+        *pp = p->next;
+        p->next = chain->head;
+        chain->head = p;
+
+        *value = p->value;
+        found = true;
+    }
+
+    myst_spin_unlock(&_lock);
+
+    return found;
+}
+
+void myst_dcache_insert(
+    const void* fs,
+    uint64_t parent,
+    const char* name,
+    uint64_t value)
+{
+    const uint64_t hash = _hash(fs, parent, name);
+    chain_t* chain = _chain(hash);
+    const size_t len = strlen(name);
+    dentry_t* dentry;
+    dentry_t* evicted = NULL;
+    dentry_t** pp;
+
+    /* the cache is only an optimization */
+    if (!(dentry = malloc(sizeof(dentry_t) + len + 1)))
+        return;
+
+    dentry->fs = fs;
+    dentry->parent = parent;
+    dentry->hash = hash;
+    dentry->value = value;
+    memcpy(dentry->name, name, len + 1);
+
+    myst_spin_lock(&_lock);
+    {
+        /* replace any existing entry */
+        if ((pp = _find(chain, fs, parent, hash, name)))
+        {
+            evicted = *pp;
+            *pp = evicted->next;
+            evicted->next = NULL;
+            chain->count--;
+        }
+
+        dentry->next = chain->head;
+        chain->head = dentry;
+        chain->count++;
+
+        /* evict the least recently used entry */
+        if (chain->count > DCACHE_MAX_CHAIN)
+        {
+            for (pp = &chain->head; (*pp)->next; pp = &(*pp)->next)
+                ;
+
+            (*pp)->next = evicted;
+            evicted = *pp;
+            *pp = NULL;
+            chain->count--;
+        }
+    }
+    myst_spin_unlock(&_lock);
+
+    _free_list(evicted);
+}
+
+void myst_dcache_invalidate(const void* fs, uint64_t parent, const char* name)
+{
+    const uint64_t hash = _hash(fs, parent, name);
+    chain_t* chain = _chain(hash);
+    dentry_t* p = NULL;
+    dentry_t** pp;
+
+    myst_spin_lock(&_lock);
+
+    if ((pp = _find(chain, fs, parent, hash, name)))
+    {
+        p = *pp;
+        *pp = p->next;
+        p->next = NULL;
+        chain->count--;
+    }
+
+    myst_spin_unlock(&_lock);
+
+    _free_list(p);
+}
+
+void myst_dcache_invalidate_fs(const void* fs)
+{
+    dentry_t* list = NULL;
+
+    myst_spin_lock(&_lock);
+
+    for (size_t i = 0; i < DCACHE_NCHAINS; i++)
+    {
+        chain_t* chain = &_chains[i];
+
+        for (dentry_t** pp = &chain->head; *pp;)
+        {
+            dentry_t* p = *pp;
+
+            if (p->fs == fs)
+            {
+                *pp = p->next;
+                p->next = list;
+                list = p;
+                chain->count--;
+            }
+            else
+            {
+                pp = &p->next;
+            }
+        }
+    }
+
+    myst_spin_unlock(&_lock);
+
+    _free_list(list);
+}
+
+void myst_dcache_flush(void)
+{
+    dentry_t* list = NULL;
+
+    myst_spin_lock(&_lock);
+
+    for (size_t i = 0; i < DCACHE_NCHAINS; i++)
+    {
+        chain_t* chain = &_chains[i];
+        dentry_t* p = chain->head;
+
+        /* splice the chain onto the list */
+        while (p)
+        {
+            dentry_t* next = p->next;
+            p->next = list;
+            list = p;
+            p = next;
+        }
+
+        chain->head = NULL;
+        chain->count = 0;
+    }
+
+    myst_spin_unlock(&_lock);
+
+    _free_list(list);
+}
@@ -17,6 +17,7 @@
 #include <myst/errno.h>
 #include <myst/exec.h>
 #include <myst/fdtable.h>
+#include <myst/fiber.h>
 #include <myst/file.h>
 #include <myst/fs.h>
 #include <myst/fsgs.h>
@@ -31,6 +32,7 @@
 #include <myst/mount.h>
 #include <myst/options.h>
 #include <myst/panic.h>
+#include <myst/poll.h>
 #include <myst/printf.h>
 #include <myst/process.h>
 #include <myst/procfs.h>
@@ -386,36 +388,6 @@ static const char* _getenv(const char** envp, const char* varname)
     return ret;
 }
 
-static int _create_mem_file(
-    const char* path,
-    const void* file_data,
-    size_t file_size,
-    uint32_t file_mode)
-{
-    int ret = 0;
-    int fd = -1;
-
-    if (!path || !file_data)
-        ERAISE(-EINVAL);
-
-    if ((fd = open(path, O_WRONLY | O_CREAT, file_mode)) < 0)
-    {
-        myst_panic("kernel: open(): %s\n", path);
-        ERAISE(-ENOENT);
-    }
-
-    ECHECK(myst_ramfs_set_buf(_fs, path, file_data, file_size));
-
-    ret = 0;
-
-done:
-
-    if (fd >= 0)
-        close(fd);
-
-    return ret;
-}
-
 static int _teardown_ramfs(void)
 {
     if ((*_fs->fs_release)(_fs) != 0)
@@ -788,10 +760,10 @@ int myst_enter_kernel(myst_kernel_args_t* args)
         ERAISE(-EINVAL);
     }
 
-    /* Unpack the CPIO from memory */
+    /* Load the CPIO from memory (its entries are created on first use) */
     if (fstype == MYST_FSTYPE_RAMFS &&
-        myst_cpio_mem_unpack(
-            args->rootfs_data, args->rootfs_size, "/", _create_mem_file) != 0)
+        myst_ramfs_load_cpio(
+            _fs, "/", args->rootfs_data, args->rootfs_size) != 0)
     {
         myst_eprintf("failed to unpack root file system\n");
         ERAISE(-EINVAL);
@@ -904,12 +876,16 @@ int myst_enter_kernel(myst_kernel_args_t* args)
         while (process->prev_process || process->next_process)
             myst_sleep_msec(10);
 
+        /* Stop the fiber carrier threads (if any) */
+        myst_fiber_shutdown();
+
         if (args->shell_mode)
             myst_start_shell("\nMystikos shell (exit)\n");
 
         /* release signal related heap memory */
         myst_signal_free(process);
         myst_signal_free_siginfos(thread);
+        myst_poll_free_buffers(thread);
 
         /* release the exec stack */
         if (process->exec_stack)
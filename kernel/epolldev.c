@@ -2,7 +2,9 @@
 // Licensed under the MIT License.
 
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,22 +17,119 @@
 #include <myst/epolldev.h>
 #include <myst/eraise.h>
 #include <myst/fdtable.h>
+#include <myst/fiber.h>
 #include <myst/id.h>
 #include <myst/list.h>
+#include <myst/mutex.h>
+#include <myst/poll.h>
+#include <myst/signal.h>
 #include <myst/spinlock.h>
 #include <myst/syscall.h>
 #include <myst/tcall.h>
+#include <myst/times.h>
 
 #define MAGIC 0xc436d7e6
 
-typedef struct epoll_entry epoll_entry_t;
+/* after this many waits satisfied by internal events alone, also poll the
+ * host (without blocking) so that host descriptors are not starved */
+#define HOST_CHECK_INTERVAL 16
+
+/*
+**==============================================================================
+**
+** epoll:
+**
+**     The interest list is kept in the kernel (indexed by fd). Objects with
+**     internal events (fd_get_events() >= 0) are tracked in the kernel: those
+**     with a wake queue (fd_get_wq()) are put on the ready list by a wake
+**     queue callback; those without one stay on the ready list and are
+**     re-checked by every wait. Only the objects with a target fd (host
+**     sockets, etc.) are added to the host epoll. So epoll_wait() makes no
+**     ocall when internal events are ready, and waits for internal events
+**     alone without the host epoll.
+**
+**     A host item whose object buffers input in the kernel (see
+**     fd_get_buffered_events()) is also registered with the object's wake
+**     queue, so that the buffered input is reported although the host no
+**     longer sees it. Events for the same item from both sources within a
+**     wait are merged into one.
+**
+**     Lock order: state->mutex, object locks, wake queue locks, state->lock.
+**     The mutex serializes epoll_ctl() and event harvesting (so items are
+**     not freed while being examined); wake queue callbacks only take
+**     state->lock, which protects the ready list and the waiters.
+**
+**     Like Linux, an item is implicitly removed once its fd is closed: an
+**     item whose fd no longer refers to the object (or to a duplicate that
+**     shares its state) is dropped when it is next examined.
+**
+**==============================================================================
+*/
+
+typedef struct epoll_state epoll_state_t;
+
+/* an entry of the interest list */
+typedef struct epitem
+{
+    myst_list_node_t base;     /* link in the ready list */
+    myst_poll_waiter_t waiter; /* registration with the object's wake queue */
+    epoll_state_t* state;
+    int fd;
+    myst_fdops_t* fdops;
+    void* object;
+    myst_poll_wq_t* wq;       /* the object's wake queue (null if none) */
+    struct epoll_event event; /* the requested events and the user data */
+    uint32_t last;            /* last events reported (edge, no wake queue) */
+    int tfd;                  /* target fd (if delegated to the host) */
+    uint64_t gen;             /* the harvest that reported buffered input */
+    int slot;                 /* the index of that event */
+    bool host;                /* delegated to the host epoll */
+    bool detached;            /* taken off the host epoll (one-shot fired) */
+    bool nested;              /* the object is another epoll instance */
+    bool ready;               /* on the ready list (or being harvested) */
+    bool woken;               /* notified while being harvested */
+    bool disabled;            /* an EPOLLONESHOT item that has fired */
+} epitem_t;
+
+/* a thread waiting for a wake queue callback */
+typedef struct epoll_waiter
+{
+    struct epoll_waiter* next;
+    myst_thread_t* thread;
+} epoll_waiter_t;
+
+/* the state shared by all file descriptors of this epoll instance */
+struct epoll_state
+{
+    _Atomic(size_t) nrefs;
+    myst_mutex_t mutex;
+    myst_spinlock_t lock;
+    myst_list_t rdlist;      /* ready list (under lock) */
+    epoll_waiter_t* waiters; /* (under lock) */
+    size_t nhostwaiters;     /* threads in the host poll (under lock) */
+    uint64_t seq;            /* incremented by callbacks (under lock) */
+    epitem_t** items;        /* interest list indexed by fd */
+    size_t capacity;
+    size_t nitems;
+    size_t nhost;     /* items delegated to the host */
+    size_t nbuffered; /* host items that also buffer input in the kernel */
+    size_t npolled;   /* internal items without a wake queue */
+    size_t nnested;   /* items that are epoll instances */
+    size_t nskipped;  /* waits that skipped the host */
+    uint64_t gen;     /* incremented by every harvest */
+    int epfd;         /* host epoll */
+    myst_poll_wq_t wq; /* wakes the epoll instances this one was added to */
+};
 
 struct myst_epoll
 {
     uint32_t magic; /* MAGIC */
-    int epfd;
+    epoll_state_t* state;
 };
 
+/* serializes the checks that keep epoll nesting one level deep */
+static myst_spinlock_t _nesting_lock = MYST_SPINLOCK_INITIALIZER;
+
 MYST_INLINE long _sys_epoll_create1(int flags)
 {
     long params[6] = {flags};
@@ -47,13 +146,26 @@ MYST_INLINE long _sys_epoll_ctl(
     return myst_tcall(SYS_epoll_ctl, params);
 }
 
-MYST_INLINE long _sys_epoll_wait(
+static long _sys_epoll_wait(
     int epfd,
     struct epoll_event* events,
     size_t maxevents,
     int timeout)
 {
     long params[6] = {epfd, (long)events, (long)maxevents, timeout};
+
+    /* park a fiber (rather than its carrier thread) until the host epoll
+     * instance is readable */
+    if (timeout != 0 && myst_fiber_self())
+    {
+        long ret;
+
+        if ((ret = myst_fiber_wait_host(epfd, POLLIN, timeout)) <= 0)
+            return ret;
+
+        params[3] = 0;
+    }
+
     return myst_tcall(SYS_epoll_wait, params);
 }
 
@@ -62,6 +174,496 @@ static bool _valid_epoll(const myst_epoll_t* epoll)
     return epoll && epoll->magic == MAGIC;
 }
 
+static myst_poll_wq_t* _get_wq(myst_fdops_t* fdops, void* object)
+{
+    if (!fdops->fd_get_wq)
+        return NULL;
+
+    return (*fdops->fd_get_wq)(fdops, object);
+}
+
+/* the events of an item on the ready list: internal events, or the input
+ * that a host item buffers in the kernel */
+static int _get_events(epitem_t* item)
+{
+    if (item->host)
+        return (*item->fdops->fd_get_buffered_events)(
+            item->fdops, item->object);
+
+    return (*item->fdops->fd_get_events)(item->fdops, item->object);
+}
+
+static epitem_t* _lookup(epoll_state_t* state, int fd)
+{
+    if ((size_t)fd >= state->capacity)
+        return NULL;
+
+    return state->items[fd];
+}
+
+/* grow the interest list to hold the given fd */
+static int _reserve(epoll_state_t* state, int fd)
+{
+    int ret = 0;
+    size_t capacity = state->capacity;
+    epitem_t** items;
+
+    if ((size_t)fd < capacity)
+        goto done;
+
+    if (capacity < 64)
+        capacity = 64;
+
+    while (capacity <= (size_t)fd)
+        capacity *= 2;
+
+    if (!(items = realloc(state->items, capacity * sizeof(epitem_t*))))
+        ERAISE(-ENOMEM);
+
+    memset(items + state->capacity,
+           0,
+           (capacity - state->capacity) * sizeof(epitem_t*));
+
+    state->items = items;
+    state->capacity = capacity;
+
+done:
+    return ret;
+}
+
+/* Check that the item's fd still refers to its object or to a duplicate of
+ * it (e.g., in a forked child); returns -EBADF if the fd was closed */
+static int _resolve(epitem_t* item)
+{
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    myst_fdtable_type_t type;
+    myst_fdops_t* fdops;
+    void* object;
+
+    if (!fdtable)
+        return -EBADF;
+
+    if (myst_fdtable_get_any(
+            fdtable, item->fd, &type, (void**)&fdops, &object) != 0)
+    {
+        return -EBADF;
+    }
+
+    if (object == item->object)
+        return 0;
+
+    if (fdops != item->fdops)
+        return -EBADF;
+
+    if (item->host)
+    {
+        if ((*fdops->fd_target_fd)(fdops, object) != item->tfd)
+            return -EBADF;
+    }
+    else if (_get_wq(fdops, object) != item->wq)
+    {
+        return -EBADF;
+    }
+
+    item->object = object;
+    return 0;
+}
+
+/* wake queue callback: the item's object may have become ready */
+static bool _callback(myst_poll_waiter_t* waiter)
+{
+    epitem_t* item = (epitem_t*)((char*)waiter - offsetof(epitem_t, waiter));
+    epoll_state_t* state = item->state;
+    bool interrupt;
+
+    myst_spin_lock(&state->lock);
+    {
+        state->seq++;
+
+        if (item->ready)
+        {
+            item->woken = true;
+        }
+        else
+        {
+            item->ready = true;
+            myst_list_append(&state->rdlist, &item->base);
+        }
+
+        /* wake the threads waiting for internal events (once) */
+        for (epoll_waiter_t* p = state->waiters; p; p = p->next)
+            myst_tcall_wake(p->thread->event);
+
+        state->waiters = NULL;
+
+        /* the threads waiting in the host poll are woken by the caller */
+        interrupt = state->nhostwaiters > 0;
+    }
+    myst_spin_unlock(&state->lock);
+
+    /* this instance may have become ready for the enclosing instances */
+    if (myst_poll_wq_notify(&state->wq))
+        interrupt = true;
+
+    return interrupt;
+}
+
+/* put the item on the ready list unless it is already there */
+static void _make_ready(epoll_state_t* state, epitem_t* item)
+{
+    myst_spin_lock(&state->lock);
+    {
+        if (!item->ready)
+        {
+            item->ready = true;
+            myst_list_append(&state->rdlist, &item->base);
+        }
+    }
+    myst_spin_unlock(&state->lock);
+}
+
+/* Remove the item from the interest list and free it (called with the mutex
+ * held). If on_rdlist is false, the caller already took it off the list. */
+static void _remove_item(epoll_state_t* state, epitem_t* item, bool on_rdlist)
+{
+    state->items[item->fd] = NULL;
+    state->nitems--;
+
+    /* after this, no callback refers to the item */
+    myst_poll_wq_remove(&item->waiter);
+
+    if (item->host)
+    {
+        /* the target may already be closed (which removed it) */
+        if (!item->detached)
+            _sys_epoll_ctl(state->epfd, EPOLL_CTL_DEL, item->tfd, NULL);
+
+        state->nhost--;
+
+        if (item->wq)
+            state->nbuffered--;
+    }
+    else
+    {
+        if (!item->wq)
+            state->npolled--;
+
+        if (item->nested)
+        {
+            myst_spin_lock(&_nesting_lock);
+            state->nnested--;
+            myst_spin_unlock(&_nesting_lock);
+        }
+    }
+
+    if (on_rdlist)
+    {
+        myst_spin_lock(&state->lock);
+
+        if (item->ready)
+            myst_list_remove(&state->rdlist, &item->base);
+
+        myst_spin_unlock(&state->lock);
+    }
+
+    free(item);
+}
+
+/* Gather up to maxevents internal events from the ready list (with the mutex
+ * held). Items that may still be ready are put back on the ready list. */
+static int _harvest(
+    epoll_state_t* state,
+    struct epoll_event* events,
+    int maxevents,
+    uint64_t* seq_out)
+{
+    int n = 0;
+    myst_list_t txlist;
+
+    myst_spin_lock(&state->lock);
+    {
+        txlist = state->rdlist;
+        memset(&state->rdlist, 0, sizeof(state->rdlist));
+
+        /* callbacks from now on are recorded in item->woken */
+        for (myst_list_node_t* p = txlist.head; p; p = p->next)
+            ((epitem_t*)p)->woken = false;
+
+        *seq_out = state->seq;
+    }
+    myst_spin_unlock(&state->lock);
+
+    /* identifies the buffered input reported by this harvest */
+    state->gen++;
+
+    while (txlist.head)
+    {
+        epitem_t* item = (epitem_t*)txlist.head;
+        bool keep = false;
+
+        myst_list_remove(&txlist, &item->base);
+
+        if (item->disabled)
+        {
+            /* a fired one-shot item: wait for EPOLL_CTL_MOD */
+        }
+        else if (_resolve(item) != 0)
+        {
+            _remove_item(state, item, false);
+            continue;
+        }
+        else if (n == maxevents)
+        {
+            keep = true;
+        }
+        else
+        {
+            const uint32_t mask = item->event.events | EPOLLERR | EPOLLHUP;
+            const bool edge = (item->event.events & EPOLLET);
+            int r = _get_events(item);
+            uint32_t revents = (r > 0) ? ((uint32_t)r & mask) : 0;
+
+            /* without a wake queue, an edge is a change of the events */
+            if (!item->wq && edge)
+            {
+                const uint32_t last = item->last;
+                item->last = revents;
+
+                if (revents == last)
+                    revents = 0;
+            }
+
+            if (revents)
+            {
+                /* merged with the host events by _translate() */
+                if (item->host)
+                {
+                    item->gen = state->gen;
+                    item->slot = n;
+                }
+
+                events[n].events = revents;
+                events[n].data = item->event.data;
+                n++;
+
+                if (item->event.events & EPOLLONESHOT)
+                {
+                    item->disabled = true;
+
+                    /* the host must not report the item either */
+                    if (item->host && !item->detached)
+                    {
+                        _sys_epoll_ctl(
+                            state->epfd, EPOLL_CTL_DEL, item->tfd, NULL);
+                        item->detached = true;
+                    }
+                }
+                else if (!edge)
+                {
+                    keep = true;
+                }
+            }
+
+            /* items without a wake queue are re-checked by every wait */
+            if (!item->wq && !item->disabled)
+                keep = true;
+        }
+
+        myst_spin_lock(&state->lock);
+        {
+            if (keep || (item->woken && !item->disabled))
+                myst_list_append(&state->rdlist, &item->base);
+            else
+                item->ready = false;
+        }
+        myst_spin_unlock(&state->lock);
+    }
+
+    return n;
+}
+
+/* Replace the fds in the nevents events from the host epoll (which follow
+ * the nprev events from _harvest()) with the user data of the items (with
+ * the mutex held); returns the number of events kept. */
+static int _translate(
+    epoll_state_t* state,
+    struct epoll_event* events,
+    int nprev,
+    int nevents)
+{
+    int n = 0;
+
+    for (int i = nprev; i < nprev + nevents; i++)
+    {
+        epitem_t* item = _lookup(state, (int)events[i].data.u64);
+
+        /* skip events for items removed while waiting */
+        if (!item || !item->host)
+            continue;
+
+        /* a one-shot item that fired on the host must not report its
+         * buffered input either */
+        if (item->wq && (item->event.events & EPOLLONESHOT))
+            item->disabled = true;
+
+        /* merge with the buffered input reported by this harvest */
+        if (item->wq && item->gen == state->gen && item->slot < nprev)
+        {
+            events[item->slot].events |= events[i].events;
+            continue;
+        }
+
+        events[nprev + n].events = events[i].events;
+        events[nprev + n].data = item->event.data;
+        n++;
+    }
+
+    return n;
+}
+
+static long _wait_host(
+    epoll_state_t* state,
+    struct epoll_event* events,
+    int nprev,
+    int maxevents,
+    int timeout)
+{
+    long ret = 0;
+    long n;
+
+    /* a signal interrupts the wait (the caller checks for signals) */
+    if ((n = _sys_epoll_wait(
+             state->epfd, events + nprev, maxevents - nprev, timeout)) ==
+        -EINTR)
+    {
+        goto done;
+    }
+
+    ECHECK(n);
+
+    if (n > 0)
+    {
+        myst_mutex_lock(&state->mutex);
+        ret = _translate(state, events, nprev, (int)n);
+        myst_mutex_unlock(&state->mutex);
+    }
+
+done:
+    return ret;
+}
+
+/* Wait until a callback, a signal, or the timeout (unless a callback was
+ * made since seq was obtained from _harvest()) */
+static void _wait_callback(epoll_state_t* state, uint64_t seq, int timeout)
+{
+    myst_thread_t* self = myst_thread_self();
+    epoll_waiter_t waiter = {.next = NULL, .thread = self};
+    bool sleep;
+
+    myst_spin_lock(&state->lock);
+    {
+        if ((sleep = (state->seq == seq)))
+        {
+            waiter.next = state->waiters;
+            state->waiters = &waiter;
+        }
+    }
+    myst_spin_unlock(&state->lock);
+
+    if (!sleep)
+        return;
+
+    self->signal.waiting_on_event = true;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (!myst_signal_has_active_signals(self))
+    {
+        struct timespec ts;
+
+        if (timeout > 0)
+        {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000L;
+        }
+
+        myst_tcall_wait(self->event, (timeout > 0) ? &ts : NULL);
+    }
+
+    self->signal.waiting_on_event = false;
+
+    /* the callback removes the waiters that it wakes */
+    myst_spin_lock(&state->lock);
+    {
+        for (epoll_waiter_t** p = &state->waiters; *p; p = &(*p)->next)
+        {
+            if (*p == &waiter)
+            {
+                *p = waiter.next;
+                break;
+            }
+        }
+    }
+    myst_spin_unlock(&state->lock);
+}
+
+static void _free_state(epoll_state_t* state)
+{
+    for (size_t fd = 0; fd < state->capacity; fd++)
+    {
+        epitem_t* item = state->items[fd];
+
+        /* closing the host epoll below removes the host items */
+        if (item)
+        {
+            myst_poll_wq_remove(&item->waiter);
+            free(item);
+        }
+    }
+
+    myst_poll_wq_release(&state->wq);
+    myst_tcall_close(state->epfd);
+    free(state->items);
+    myst_mutex_destroy(&state->mutex);
+    memset(state, 0, sizeof(epoll_state_t));
+    free(state);
+}
+
+/* whether there are any ready internal events (without consuming them) */
+static bool _peek(epoll_state_t* state)
+{
+    bool ret = false;
+    myst_list_node_t* p;
+
+    myst_mutex_lock(&state->mutex);
+
+    /* items leave the ready list only with the mutex held */
+    myst_spin_lock(&state->lock);
+    p = state->rdlist.head;
+    myst_spin_unlock(&state->lock);
+
+    while (p && !ret)
+    {
+        epitem_t* item = (epitem_t*)p;
+
+        if (!item->disabled && _resolve(item) == 0)
+        {
+            const uint32_t mask = item->event.events | EPOLLERR | EPOLLHUP;
+            int r = _get_events(item);
+
+            if (r > 0 && ((uint32_t)r & mask))
+                ret = true;
+        }
+
+        myst_spin_lock(&state->lock);
+        p = p->next;
+        myst_spin_unlock(&state->lock);
+    }
+
+    myst_mutex_unlock(&state->mutex);
+
+    return ret;
+}
+
 static int _ed_epoll_create1(
     myst_epolldev_t* epolldev,
     int flags,
@@ -69,6 +671,7 @@ static int _ed_epoll_create1(
 {
     int ret = 0;
     myst_epoll_t* epoll = NULL;
+    epoll_state_t* state = NULL;
     int epfd;
 
     if (epoll_out)
@@ -82,24 +685,193 @@ static int _ed_epoll_create1(
         if (!(epoll = calloc(1, sizeof(myst_epoll_t))))
             ERAISE(-ENOMEM);
 
+        if (!(state = calloc(1, sizeof(epoll_state_t))))
+            ERAISE(-ENOMEM);
+
         epoll->magic = MAGIC;
     }
 
-    /* delegate the operation */
+    /* the host epoll for the host descriptors */
     ECHECK(epfd = _sys_epoll_create1(flags));
-    epoll->epfd = epfd;
+
+    myst_mutex_init(&state->mutex);
+    state->nrefs = 1;
+    state->epfd = epfd;
+    epoll->state = state;
+    state = NULL;
 
     *epoll_out = epoll;
     epoll = NULL;
 
 done:
 
+    if (state)
+        free(state);
+
     if (epoll)
         free(epoll);
 
     return ret;
 }
 
+/* Enforce a nesting depth of one (so that wake queue callbacks never recurse
+ * more than once and loops are impossible); called with _nesting_lock */
+static int _check_nesting(epoll_state_t* state, epoll_state_t* nested)
+{
+    if (nested == state)
+        return -EINVAL;
+
+    /* the nested instance contains instances or this one is nested */
+    if (nested->nnested || state->wq.head)
+        return -ELOOP;
+
+    return 0;
+}
+
+static int _add(
+    epoll_state_t* state,
+    int fd,
+    myst_fdtable_type_t type,
+    myst_fdops_t* fdops,
+    void* object,
+    const struct epoll_event* event)
+{
+    int ret = 0;
+    epitem_t* item = NULL;
+    int tfd = -1;
+    bool internal = false;
+
+    if (type == MYST_FDTABLE_TYPE_FILE)
+        ERAISE(-EPERM);
+
+    /* check before peeking into the nested instance (which could otherwise
+     * try to take this instance's mutex); checked again when registering */
+    if (type == MYST_FDTABLE_TYPE_EPOLL)
+    {
+        myst_spin_lock(&_nesting_lock);
+        ret = _check_nesting(state, ((myst_epoll_t*)object)->state);
+        myst_spin_unlock(&_nesting_lock);
+        ECHECK(ret);
+    }
+
+    /* internal events or host events */
+    if ((*fdops->fd_get_events)(fdops, object) >= 0)
+        internal = true;
+    else if ((tfd = (*fdops->fd_target_fd)(fdops, object)) < 0)
+        ERAISE(-EPERM);
+
+    ECHECK(_reserve(state, fd));
+
+    if (!(item = calloc(1, sizeof(epitem_t))))
+        ERAISE(-ENOMEM);
+
+    item->state = state;
+    item->fd = fd;
+    item->fdops = fdops;
+    item->object = object;
+    item->event = *event;
+    item->tfd = tfd;
+
+    if (internal)
+    {
+        item->wq = _get_wq(fdops, object);
+
+        if (type == MYST_FDTABLE_TYPE_EPOLL)
+        {
+            epoll_state_t* nested = ((myst_epoll_t*)object)->state;
+
+            myst_spin_lock(&_nesting_lock);
+
+            if ((ret = _check_nesting(state, nested)) == 0)
+            {
+                myst_poll_wq_add(item->wq, &item->waiter, _callback);
+                state->nnested++;
+                item->nested = true;
+            }
+
+            myst_spin_unlock(&_nesting_lock);
+            ECHECK(ret);
+        }
+        else if (item->wq)
+        {
+            myst_poll_wq_add(item->wq, &item->waiter, _callback);
+        }
+        else
+        {
+            state->npolled++;
+        }
+
+        /* check the initial state in the next wait */
+        _make_ready(state, item);
+    }
+    else
+    {
+        struct epoll_event ev = {.events = event->events};
+        ev.data.u64 = (uint64_t)fd;
+
+        ECHECK(_sys_epoll_ctl(state->epfd, EPOLL_CTL_ADD, tfd, &ev));
+        item->host = true;
+        state->nhost++;
+
+        /* input buffered in the kernel is published by the wake queue */
+        if (fdops->fd_get_buffered_events &&
+            (*fdops->fd_get_buffered_events)(fdops, object) >= 0 &&
+            (item->wq = _get_wq(fdops, object)))
+        {
+            myst_poll_wq_add(item->wq, &item->waiter, _callback);
+            state->nbuffered++;
+            _make_ready(state, item);
+        }
+    }
+
+    state->items[fd] = item;
+    state->nitems++;
+    item = NULL;
+
+done:
+
+    if (item)
+        free(item);
+
+    return ret;
+}
+
+static int _modify(
+    epoll_state_t* state,
+    epitem_t* item,
+    const struct epoll_event* event)
+{
+    int ret = 0;
+
+    if (item->host)
+    {
+        struct epoll_event ev = {.events = event->events};
+        const int op = item->detached ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        ev.data.u64 = (uint64_t)item->fd;
+
+        ECHECK(_sys_epoll_ctl(state->epfd, op, item->tfd, &ev));
+        item->event = *event;
+        item->detached = false;
+        item->disabled = false;
+
+        /* report the buffered input in the next wait */
+        if (item->wq)
+            _make_ready(state, item);
+    }
+    else
+    {
+        item->event = *event;
+        item->last = 0;
+        item->disabled = false;
+
+        /* report the current state in the next wait (like Linux) */
+        _make_ready(state, item);
+    }
+
+done:
+    return ret;
+}
+
 static int _ed_epoll_ctl(
     myst_epolldev_t* epolldev,
     myst_epoll_t* epoll,
@@ -107,37 +879,81 @@ static int _ed_epoll_ctl(
     int fd,
     struct epoll_event* event)
 {
-    ssize_t ret = 0;
-    int target_fd;
+    int ret = 0;
+    epoll_state_t* state;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    myst_fdtable_type_t type;
+    myst_fdops_t* fdops;
+    void* object;
+    epitem_t* item;
+    bool locked = false;
 
-    if (!epolldev || !_valid_epoll(epoll) || !event)
+    if (!epolldev || !_valid_epoll(epoll))
         ERAISE(-EBADF);
 
     if (!myst_valid_fd(fd))
         ERAISE(-EBADF);
 
-    /* get the target file descriptor for this file descriptor */
+    if (op != EPOLL_CTL_DEL && !event)
+        ERAISE(-EFAULT);
+
+    ECHECK(myst_fdtable_get_any(
+        fdtable, fd, &type, (void**)&fdops, (void**)&object));
+
+    if (object == epoll || (type == MYST_FDTABLE_TYPE_EPOLL &&
+                            ((myst_epoll_t*)object)->state == epoll->state))
+    {
+        ERAISE(-EINVAL);
+    }
+
+    state = epoll->state;
+    myst_mutex_lock(&state->mutex);
+    locked = true;
+
+    /* drop the item if its fd was closed (and maybe reused) */
+    if ((item = _lookup(state, fd)) && _resolve(item) != 0)
     {
-        myst_fdtable_t* fdtable = myst_fdtable_current();
-        myst_fdtable_type_t type;
-        myst_fdops_t* fdops;
-        void* object;
+        _remove_item(state, item, true);
+        item = NULL;
+    }
 
-        ECHECK(myst_fdtable_get_any(
-            fdtable, fd, &type, (void**)&fdops, (void**)&object));
+    switch (op)
+    {
+        case EPOLL_CTL_ADD:
+        {
+            if (item)
+                ERAISE(-EEXIST);
+
+            ECHECK(_add(state, fd, type, fdops, object, event));
+            break;
+        }
+        case EPOLL_CTL_MOD:
+        {
+            if (!item)
+                ERAISE(-ENOENT);
 
-        if (type == MYST_FDTABLE_TYPE_FILE)
-            ERAISE(-EPERM);
+            ECHECK(_modify(state, item, event));
+            break;
+        }
+        case EPOLL_CTL_DEL:
+        {
+            if (!item)
+                ERAISE(-ENOENT);
 
-        if ((target_fd = (*fdops->fd_target_fd)(fdops, object)) < 0)
+            _remove_item(state, item, true);
+            break;
+        }
+        default:
+        {
             ERAISE(-EINVAL);
+        }
     }
 
-    /* delegate the request to the target */
-    ECHECK(_sys_epoll_ctl(epoll->epfd, op, target_fd, event));
-
 done:
 
+    if (locked)
+        myst_mutex_unlock(&state->mutex);
+
     return ret;
 }
 
@@ -149,13 +965,135 @@ static int _ed_epoll_wait(
     int timeout) /* milliseconds */
 {
     int ret = 0;
-    int n;
+    epoll_state_t* state;
+    const int original_timeout = timeout;
+    struct timespec start;
+    struct timespec end;
+    long lapsed;
 
-    if (!epolldev || !_valid_epoll(epoll) || !events || maxevents < 0)
+    if (!epolldev || !_valid_epoll(epoll) || !events || maxevents <= 0)
         ERAISE(-EINVAL);
 
-    ECHECK(n = _sys_epoll_wait(epoll->epfd, events, maxevents, timeout));
-    ret = n;
+    state = epoll->state;
+    myst_syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (1)
+    {
+        const uint64_t seq = myst_poll_seq();
+        uint64_t state_seq;
+        size_t nhost;
+        size_t ninternal;
+        size_t npolled;
+        long n;
+
+        myst_mutex_lock(&state->mutex);
+        {
+            n = _harvest(state, events, maxevents, &state_seq);
+            nhost = state->nhost;
+            ninternal = state->nitems - state->nhost + state->nbuffered;
+            npolled = state->npolled;
+        }
+        myst_mutex_unlock(&state->mutex);
+
+        if (n > 0)
+        {
+            /* satisfied without an ocall (but see HOST_CHECK_INTERVAL) */
+            if (nhost && n < maxevents &&
+                __atomic_add_fetch(&state->nskipped, 1, __ATOMIC_RELAXED) >=
+                    HOST_CHECK_INTERVAL)
+            {
+                long r;
+
+                state->nskipped = 0;
+                ECHECK(r = _wait_host(state, events, n, maxevents, 0));
+                n += r;
+            }
+
+            ret = n;
+            goto done;
+        }
+
+        if (nhost == 0 && npolled == 0)
+        {
+            /* only objects with wake queues: wait for their callbacks */
+            if (timeout != 0)
+                _wait_callback(state, state_seq, timeout);
+        }
+        else if (ninternal == 0 || timeout == 0)
+        {
+            /* only host descriptors (or no wait): a single host call */
+            ECHECK(n = _wait_host(state, events, 0, maxevents, timeout));
+        }
+        else
+        {
+            /* host and internal objects: a callback (or, for the internal
+             * objects without a wake queue, the poll wait queue) interrupts
+             * the host poll when an internal object changes */
+            struct pollfd fds = {.fd = state->epfd, .events = POLLIN};
+            bool sleep;
+            long r;
+
+            myst_spin_lock(&state->lock);
+            {
+                if ((sleep = (state->seq == state_seq)))
+                    state->nhostwaiters++;
+            }
+            myst_spin_unlock(&state->lock);
+
+            if (!sleep)
+                continue;
+
+            if (npolled && !myst_poll_wait_begin(seq))
+            {
+                r = 0;
+            }
+            else
+            {
+                if (nhost)
+                    r = myst_tcall_poll(&fds, 1, timeout);
+                else
+                    r = myst_tcall_poll(NULL, 0, timeout);
+
+                if (npolled)
+                    myst_poll_wait_end(seq);
+            }
+
+            myst_spin_lock(&state->lock);
+            state->nhostwaiters--;
+            myst_spin_unlock(&state->lock);
+
+            if (r > 0)
+                ECHECK(n = _wait_host(state, events, 0, maxevents, 0));
+        }
+
+        if (n > 0)
+        {
+            ret = n;
+            goto done;
+        }
+
+        if (myst_signal_has_active_signals(myst_thread_self()))
+            ERAISE(-EINTR);
+
+        if (original_timeout == 0)
+            break;
+
+        /* keep waiting for the rest of the timeout */
+        if (original_timeout > 0)
+        {
+            myst_syscall_clock_gettime(CLOCK_MONOTONIC, &end);
+            lapsed = myst_lapsed_nsecs(&start, &end) / 1000000;
+
+            if (original_timeout - lapsed <= 0)
+                break;
+
+            timeout = original_timeout - lapsed;
+        }
+        else
+        {
+            timeout = original_timeout;
+        }
+    }
 
 done:
 
@@ -254,7 +1192,7 @@ static int _ed_fstat(
     if (!epolldev || !_valid_epoll(epoll) || !statbuf)
         ERAISE(-EINVAL);
 
-    ECHECK(myst_tcall_fstat(epoll->epfd, statbuf));
+    ECHECK(myst_tcall_fstat(epoll->state->epfd, statbuf));
 
 done:
     return ret;
@@ -272,7 +1210,7 @@ static int _ed_fcntl(
     if (!epolldev || !_valid_epoll(epoll))
         ERAISE(-EINVAL);
 
-    ECHECK((r = myst_tcall_fcntl(epoll->epfd, cmd, arg)));
+    ECHECK((r = myst_tcall_fcntl(epoll->state->epfd, cmd, arg)));
     ret = r;
 
 done:
@@ -317,10 +1255,9 @@ static int _ed_dup(
     if (!(new_epoll = calloc(1, sizeof(myst_epoll_t))))
         ERAISE(-ENOMEM);
 
+    /* duplicates share the interest list (like Linux) */
     *new_epoll = *epoll;
-
-    /* perform syscall */
-    ECHECK(new_epoll->epfd = myst_tcall_dup(epoll->epfd));
+    new_epoll->state->nrefs++;
 
     *epoll_out = new_epoll;
     new_epoll = NULL;
@@ -340,7 +1277,9 @@ static int _ed_close(myst_epolldev_t* epolldev, myst_epoll_t* epoll)
     if (!epolldev || !_valid_epoll(epoll))
         ERAISE(-EBADF);
 
-    ECHECK(myst_tcall_close(epoll->epfd));
+    if (--epoll->state->nrefs == 0)
+        _free_state(epoll->state);
+
     memset(epoll, 0, sizeof(myst_epoll_t));
     free(epoll);
 
@@ -356,7 +1295,11 @@ static int _ed_target_fd(myst_epolldev_t* epolldev, myst_epoll_t* epoll)
     if (!epolldev || !_valid_epoll(epoll))
         ERAISE(-EINVAL);
 
-    ret = -ENOTSUP;
+    /* an instance with host descriptors is polled through the host */
+    if (epoll->state->nhost)
+        ret = epoll->state->epfd;
+    else
+        ret = -ENOTSUP;
 
 done:
     return ret;
@@ -369,12 +1312,25 @@ static int _ed_get_events(myst_epolldev_t* epolldev, myst_epoll_t* epoll)
     if (!epolldev || !_valid_epoll(epoll))
         ERAISE(-EINVAL);
 
-    ret = -ENOTSUP;
+    if (epoll->state->nhost)
+        ret = -ENOTSUP;
+    else
+        ret = _peek(epoll->state) ? POLLIN : 0;
 
 done:
     return ret;
 }
 
+static myst_poll_wq_t* _ed_get_wq(
+    myst_epolldev_t* epolldev,
+    myst_epoll_t* epoll)
+{
+    if (!epolldev || !_valid_epoll(epoll))
+        return NULL;
+
+    return &epoll->state->wq;
+}
+
 extern myst_epolldev_t* myst_epolldev_get(void)
 {
     // clang-format-off
@@ -391,6 +1347,7 @@ extern myst_epolldev_t* myst_epolldev_get(void)
             .fd_close = (void*)_ed_close,
             .fd_target_fd = (void*)_ed_target_fd,
             .fd_get_events = (void*)_ed_get_events,
+            .fd_get_wq = (void*)_ed_get_wq,
         },
         .ed_epoll_create1 = _ed_epoll_create1,
         .ed_epoll_ctl = _ed_epoll_ctl,
@@ -1,31 +1,114 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 
+#include <myst/cond.h>
 #include <myst/eraise.h>
 #include <myst/eventfddev.h>
+#include <myst/mutex.h>
+#include <myst/poll.h>
+#include <myst/signal.h>
 #include <myst/syscall.h>
 
 #define MAGIC 0x9906acdc
 
-//#define USE_ASYNC_TCALL
+/* the largest value the counter may hold */
+#define MAX_COUNTER (UINT64_MAX - 1)
+
+/*
+**==============================================================================
+**
+** The eventfd counter is kept within the kernel (there is no host eventfd).
+**
+** Reads and writes update the counter with compare-and-swap, so the common
+** case (the counter can be updated without blocking) takes no lock and makes
+** no host call. A reader that finds the counter zero, or a writer that would
+** overflow it, waits on the condition variable after incrementing nwaiters;
+** the other side takes the lock to wake it only if nwaiters is non-zero.
+** Every update also wakes the wake queue, so poll(), select(), and epoll()
+** observe the readiness computed by _eventfd_get_events().
+**
+**==============================================================================
+*/
+
+/* this structure is shared by duplicates of the eventfd */
+typedef struct state
+{
+    _Atomic(size_t) nrefs;
+    uint64_t counter;
+    bool semaphore;   /* EFD_SEMAPHORE */
+    int status_flags; /* O_NONBLOCK */
+    myst_mutex_t lock;
+    myst_cond_t cond;
+    size_t nwaiters;
+    myst_poll_wq_t wq;
+} state_t;
 
 struct myst_eventfd
 {
     uint32_t magic;
-    int fd;
+    int fd_flags; /* FD_CLOEXEC */
+    state_t* state;
 };
 
-MYST_INLINE long _sys_eventfd2(unsigned int initval, int flags)
+MYST_INLINE bool _valid_eventfd(const myst_eventfd_t* eventfd)
 {
-    long params[6] = {(long)initval, (long)flags};
-    return myst_tcall(SYS_eventfd2, params);
+    return eventfd && eventfd->magic == MAGIC;
 }
 
-MYST_INLINE bool _valid_eventfd(const myst_eventfd_t* eventfd)
+MYST_INLINE uint64_t _counter(const state_t* state)
 {
-    return eventfd && eventfd->magic == MAGIC;
+    return __atomic_load_n(&state->counter, __ATOMIC_ACQUIRE);
+}
+
+MYST_INLINE bool _update(state_t* state, uint64_t old, uint64_t new)
+{
+    return __atomic_compare_exchange_n(
+        &state->counter,
+        &old,
+        new,
+        false,
+        __ATOMIC_ACQ_REL,
+        __ATOMIC_ACQUIRE);
+}
+
+/* wake the blocked readers/writers and the pollers after an update */
+static void _notify(state_t* state)
+{
+    /* order the counter update before loading nwaiters (pairs with the
+     * increment in _wait()) */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&state->nwaiters, __ATOMIC_RELAXED))
+    {
+        myst_mutex_lock(&state->lock);
+        myst_cond_broadcast(&state->cond, SIZE_MAX);
+        myst_mutex_unlock(&state->lock);
+    }
+
+    myst_poll_wq_wake(&state->wq);
+}
+
+/* block until a read (value == 0) or a write of value may succeed */
+static void _wait(state_t* state, uint64_t value)
+{
+    myst_mutex_lock(&state->lock);
+    __atomic_add_fetch(&state->nwaiters, 1, __ATOMIC_SEQ_CST);
+
+    const uint64_t counter = _counter(state);
+    const bool ready = value ? (MAX_COUNTER - counter >= value) : counter;
+
+    if (!ready)
+        myst_cond_wait(&state->cond, &state->lock);
+
+    __atomic_sub_fetch(&state->nwaiters, 1, __ATOMIC_SEQ_CST);
+    myst_mutex_unlock(&state->lock);
 }
 
 static int _eventfd_eventfd(
@@ -36,26 +119,45 @@ static int _eventfd_eventfd(
 {
     int ret = 0;
     myst_eventfd_t* eventfd = NULL;
+    state_t* state = NULL;
 
     if (!eventfddev || !eventfd_out)
         ERAISE(-EINVAL);
 
-    /* Allocate the read eventfd struct. */
+    if (flags & ~(EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE))
+        ERAISE(-EINVAL);
+
+    /* Allocate the shared state */
+    {
+        if (!(state = calloc(1, sizeof(state_t))))
+            ERAISE(-ENOMEM);
+
+        state->nrefs = 1;
+        state->counter = initval;
+        state->semaphore = (flags & EFD_SEMAPHORE);
+        state->status_flags = (flags & EFD_NONBLOCK) ? O_NONBLOCK : 0;
+        ECHECK(myst_cond_init(&state->cond));
+    }
+
+    /* Allocate the eventfd struct. */
     {
         if (!(eventfd = calloc(1, sizeof(myst_eventfd_t))))
             ERAISE(-ENOMEM);
 
         eventfd->magic = MAGIC;
+        eventfd->fd_flags = (flags & EFD_CLOEXEC) ? FD_CLOEXEC : 0;
+        eventfd->state = state;
+        state = NULL;
     }
 
-    /* Create the eventfd file descriptor */
-    ECHECK(eventfd->fd = _sys_eventfd2(initval, flags));
-
     *eventfd_out = eventfd;
     eventfd = NULL;
 
 done:
 
+    if (state)
+        free(state);
+
     if (eventfd)
         free(eventfd);
 
@@ -69,6 +171,7 @@ static ssize_t _eventfd_read(
     size_t count)
 {
     ssize_t ret = 0;
+    state_t* state;
 
     if (!eventfddev || !_valid_eventfd(eventfd))
         ERAISE(-EBADF);
@@ -76,10 +179,34 @@ static ssize_t _eventfd_read(
     if (!buf || count < sizeof(uint64_t))
         ERAISE(-EINVAL);
 
-    ssize_t nread;
-    ECHECK(nread = myst_tcall_read(eventfd->fd, buf, count));
+    state = eventfd->state;
 
-    ret = nread;
+    for (;;)
+    {
+        const uint64_t counter = _counter(state);
+
+        if (counter)
+        {
+            /* a semaphore is decremented by one; otherwise reset to zero */
+            const uint64_t value = state->semaphore ? 1 : counter;
+
+            if (!_update(state, counter, counter - value))
+                continue;
+
+            memcpy(buf, &value, sizeof(value));
+            _notify(state);
+            ret = sizeof(uint64_t);
+            break;
+        }
+
+        if (state->status_flags & O_NONBLOCK)
+            ERAISE(-EAGAIN);
+
+        if (myst_signal_has_active_signals(myst_thread_self()))
+            ERAISE(-EINTR);
+
+        _wait(state, 0);
+    }
 
 done:
     return ret;
@@ -92,6 +219,8 @@ static ssize_t _eventfd_write(
     size_t count)
 {
     ssize_t ret = 0;
+    state_t* state;
+    uint64_t value;
 
     if (!eventfddev || !_valid_eventfd(eventfd))
         ERAISE(-EBADF);
@@ -99,10 +228,36 @@ static ssize_t _eventfd_write(
     if (!buf || count < sizeof(uint64_t))
         ERAISE(-EINVAL);
 
-    ssize_t nwritten;
-    ECHECK(nwritten = myst_tcall_write(eventfd->fd, buf, count));
+    memcpy(&value, buf, sizeof(value));
 
-    ret = nwritten;
+    if (value == UINT64_MAX)
+        ERAISE(-EINVAL);
+
+    state = eventfd->state;
+
+    for (;;)
+    {
+        const uint64_t counter = _counter(state);
+
+        /* block if the addition would exceed the maximum */
+        if (MAX_COUNTER - counter >= value)
+        {
+            if (!_update(state, counter, counter + value))
+                continue;
+
+            _notify(state);
+            ret = sizeof(uint64_t);
+            break;
+        }
+
+        if (state->status_flags & O_NONBLOCK)
+            ERAISE(-EAGAIN);
+
+        if (myst_signal_has_active_signals(myst_thread_self()))
+            ERAISE(-EINTR);
+
+        _wait(state, value);
+    }
 
 done:
     return ret;
@@ -156,7 +311,10 @@ static int _eventfd_fstat(
     if (!eventfddev || !_valid_eventfd(eventfd) || !statbuf)
         ERAISE(-EINVAL);
 
-    ECHECK(myst_tcall_fstat(eventfd->fd, statbuf));
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_mode = S_IRUSR | S_IWUSR;
+    statbuf->st_nlink = 1;
+    statbuf->st_blksize = 4096;
 
 done:
     return ret;
@@ -169,13 +327,27 @@ static int _eventfd_fcntl(
     long arg)
 {
     int ret = 0;
-    long r;
 
     if (!eventfddev || !_valid_eventfd(eventfd))
         ERAISE(-EINVAL);
 
-    ECHECK((r = myst_tcall_fcntl(eventfd->fd, cmd, arg)));
-    ret = r;
+    switch (cmd)
+    {
+        case F_GETFD:
+            ret = eventfd->fd_flags;
+            break;
+        case F_SETFD:
+            eventfd->fd_flags = (int)(arg & FD_CLOEXEC);
+            break;
+        case F_GETFL:
+            ret = O_RDWR | eventfd->state->status_flags;
+            break;
+        case F_SETFL:
+            eventfd->state->status_flags = (int)(arg & O_NONBLOCK);
+            break;
+        default:
+            ERAISE(-EINVAL);
+    }
 
 done:
 
@@ -222,8 +394,10 @@ static int _eventfd_dup(
     if (!(new_eventfd = calloc(1, sizeof(myst_eventfd_t))))
         ERAISE(-ENOMEM);
 
-    ECHECK(new_eventfd->fd = myst_tcall_dup(eventfd->fd));
+    /* the duplicate shares the counter but not the FD_CLOEXEC flag */
     new_eventfd->magic = MAGIC;
+    new_eventfd->state = eventfd->state;
+    new_eventfd->state->nrefs++;
 
     *eventfd_out = new_eventfd;
     new_eventfd = NULL;
@@ -236,16 +410,41 @@ done:
     return ret;
 }
 
+static int _eventfd_interrupt(
+    myst_eventfddev_t* eventfddev,
+    myst_eventfd_t* eventfd)
+{
+    int ret = 0;
+
+    if (!eventfddev || !_valid_eventfd(eventfd))
+        ERAISE(-EBADF);
+
+    /* wake any threads blocked on read or write (the caller holds a
+     * spinlock, so do not take the eventfd lock) */
+    myst_cond_broadcast(&eventfd->state->cond, SIZE_MAX);
+
+done:
+    return ret;
+}
+
 static int _eventfd_close(
     myst_eventfddev_t* eventfddev,
     myst_eventfd_t* eventfd)
 {
     int ret = 0;
+    state_t* state;
 
     if (!eventfddev || !_valid_eventfd(eventfd))
         ERAISE(-EBADF);
 
-    ECHECK(myst_tcall_close(eventfd->fd));
+    state = eventfd->state;
+
+    if (--state->nrefs == 0)
+    {
+        myst_poll_wq_release(&state->wq);
+        myst_cond_destroy(&state->cond);
+        free(state);
+    }
 
     memset(eventfd, 0, sizeof(myst_eventfd_t));
     free(eventfd);
@@ -263,7 +462,8 @@ static int _eventfd_target_fd(
     if (!eventfddev || !_valid_eventfd(eventfd))
         ERAISE(-EINVAL);
 
-    ret = eventfd->fd;
+    /* there is no host descriptor (see _eventfd_get_events()) */
+    ret = -ENOTSUP;
 
 done:
     return ret;
@@ -274,16 +474,33 @@ static int _eventfd_get_events(
     myst_eventfd_t* eventfd)
 {
     int ret = 0;
+    uint64_t counter;
 
     if (!eventfddev || !_valid_eventfd(eventfd))
         ERAISE(-EINVAL);
 
-    ret = -ENOTSUP;
+    counter = _counter(eventfd->state);
+
+    if (counter > 0)
+        ret |= POLLIN;
+
+    if (counter < MAX_COUNTER)
+        ret |= POLLOUT;
 
 done:
     return ret;
 }
 
+static myst_poll_wq_t* _eventfd_get_wq(
+    myst_eventfddev_t* eventfddev,
+    myst_eventfd_t* eventfd)
+{
+    if (!eventfddev || !_valid_eventfd(eventfd))
+        return NULL;
+
+    return &eventfd->state->wq;
+}
+
 extern myst_eventfddev_t* myst_eventfddev_get(void)
 {
     // clang-format off
@@ -299,8 +516,10 @@ extern myst_eventfddev_t* myst_eventfddev_get(void)
             .fd_ioctl = (void*)_eventfd_ioctl,
             .fd_dup = (void*)_eventfd_dup,
             .fd_close = (void*)_eventfd_close,
+            .fd_interrupt = (void*)_eventfd_interrupt,
             .fd_target_fd = (void*)_eventfd_target_fd,
             .fd_get_events = (void*)_eventfd_get_events,
+            .fd_get_wq = (void*)_eventfd_get_wq,
         },
         .eventfd = _eventfd_eventfd,
         .read = _eventfd_read,
@@ -314,6 +533,7 @@ extern myst_eventfddev_t* myst_eventfddev_get(void)
         .close = _eventfd_close,
         .target_fd = _eventfd_target_fd,
         .get_events = _eventfd_get_events,
+        .get_wq = _eventfd_get_wq,
     };
     // clang-format on
 
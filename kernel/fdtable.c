@@ -20,6 +20,442 @@
 #include <myst/thread.h>
 #include <myst/ttydev.h>
 
+/*
+**==============================================================================
+**
+** Entry bitmaps:
+**
+**     Entries live in chunks of MYST_FDTABLE_CHUNK_SIZE that are allocated on
+**     demand, so the table grows up to MYST_FDTABLE_MAX_SIZE descriptors. Each
+**     chunk has one bit per entry (used) and the table has one bit per chunk
+**     (full and nonempty). The lowest free descriptor is found by locating the
+**     first chunk that is not full and then the first free entry within it.
+**     Iteration visits only the used entries of nonempty chunks.
+**
+**     Chunks are kept until the table is freed, even when they become empty,
+**     so lookups may find an entry without holding the table lock. Writers
+**     (holding the lock) bump the entry's seq to an odd value while they
+**     update it; readers retry until they observe the same even seq before
+**     and after reading the fields.
+**
+**==============================================================================
+*/
+
+/*
+**==============================================================================
+**
+** Copy-on-write sharing:
+**
+**     myst_fdtable_clone() (used by vfork) does not duplicate every object,
+**     which costs a host dup() for sockets, pipes and eventfds, only to have
+**     most of them closed by exec (FD_CLOEXEC). Instead, the clone copies the
+**     entries and marks them borrowed: the objects still belong to the parent.
+**
+**     Objects are not reference counted, so the child may use a borrowed
+**     object at any time without holding the table lock. The caller asks to
+**     borrow only when nothing else runs in the parent process until the
+**     child execs or exits (the parent is single-threaded and suspended), and
+**     a table lends to at most one child at a time; otherwise the clone
+**     duplicates every object as before.
+**
+**     A borrowed object is duplicated only when it must be:
+**
+**         - when the child execs and the descriptor survives FD_CLOEXEC
+**         - when the child changes per-descriptor state (myst_fdtable_unshare)
+**         - when the parent is about to close or replace any of its entries,
+**           or execs (then all its children stop borrowing first)
+**
+**     When the parent exits meanwhile (it was killed), the child takes over
+**     the borrowed objects instead, so none is closed under the child.
+**     Closing a borrowed descriptor in the child only clears the entry.
+**
+**     _cow_lock protects the cow_parent and cow_children links (which are
+**     also changed with the parent's table lock held). It is always acquired
+**     before any table lock.
+**
+**==============================================================================
+*/
+
+static myst_spinlock_t _cow_lock = MYST_SPINLOCK_INITIALIZER;
+
+#define CHUNK_SIZE MYST_FDTABLE_CHUNK_SIZE
+#define NUM_CHUNKS MYST_FDTABLE_NUM_CHUNKS
+
+MYST_INLINE bool _test_bit(const uint64_t* words, size_t index)
+{
+    return (words[index / 64] & (1UL << (index % 64))) ? true : false;
+}
+
+MYST_INLINE void _set_bit(uint64_t* words, size_t index)
+{
+    words[index / 64] |= (1UL << (index % 64));
+}
+
+MYST_INLINE void _clear_bit(uint64_t* words, size_t index)
+{
+    words[index / 64] &= ~(1UL << (index % 64));
+}
+
+/* find the first bit equal to value at or after start (or nbits if none) */
+static size_t _find_bit(
+    const uint64_t* words,
+    size_t nbits,
+    size_t start,
+    bool value)
+{
+    for (size_t i = start / 64; i < nbits / 64; i++)
+    {
+        uint64_t bits = value ? words[i] : ~words[i];
+
+        if (i == start / 64)
+            bits &= ~0UL << (start % 64);
+
+        if (bits)
+            return i * 64 + (size_t)__builtin_ctzl(bits);
+    }
+
+    return nbits;
+}
+
+/* get the entry for fd or null if its chunk has not been allocated */
+static myst_fdtable_entry_t* _get_entry(const myst_fdtable_t* fdtable, int fd)
+{
+    myst_fdtable_chunk_t* const* slot = &fdtable->chunks[fd / CHUNK_SIZE];
+    myst_fdtable_chunk_t* chunk = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    return chunk ? &chunk->entries[fd % CHUNK_SIZE] : NULL;
+}
+
+/* return true if the object of fd belongs to the parent's table */
+static bool _is_borrowed(const myst_fdtable_t* fdtable, int fd)
+{
+    myst_fdtable_chunk_t* chunk = fdtable->chunks[fd / CHUNK_SIZE];
+    return chunk && _test_bit(chunk->borrowed, fd % CHUNK_SIZE);
+}
+
+/* allocate the chunk that holds fd (if not already allocated) */
+static int _alloc_chunk(myst_fdtable_t* fdtable, int fd)
+{
+    const size_t c = fd / CHUNK_SIZE;
+    myst_fdtable_chunk_t* chunk;
+
+    if (!fdtable->chunks[c])
+    {
+        if (!(chunk = calloc(1, sizeof(myst_fdtable_chunk_t))))
+            return -ENOMEM;
+
+        /* publish the zero-filled chunk to lock-free readers */
+        __atomic_store_n(&fdtable->chunks[c], chunk, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+/* update an entry (under the table lock) so that readers never see a mix of
+ * old and new fields */
+static void _write_entry(
+    myst_fdtable_entry_t* entry,
+    myst_fdtable_type_t type,
+    void* device,
+    void* object)
+{
+    uint32_t seq = entry->seq;
+
+    __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&entry->type, type, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->device, device, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->object, object, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* read an entry without the table lock */
+static void _read_entry(
+    const myst_fdtable_entry_t* entry,
+    myst_fdtable_type_t* type,
+    void** device,
+    void** object)
+{
+    for (;;)
+    {
+        uint32_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+
+        if (seq & 1)
+        {
+            __builtin_ia32_pause();
+            continue;
+        }
+
+        *type = __atomic_load_n(&entry->type, __ATOMIC_RELAXED);
+        *device = __atomic_load_n(&entry->device, __ATOMIC_RELAXED);
+        *object = __atomic_load_n(&entry->object, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq)
+            return;
+    }
+}
+
+/* fill in the free entry for fd (its chunk must be allocated) */
+static void _install(
+    myst_fdtable_t* fdtable,
+    int fd,
+    myst_fdtable_type_t type,
+    void* device,
+    void* object)
+{
+    const size_t c = fd / CHUNK_SIZE;
+    const size_t i = fd % CHUNK_SIZE;
+    myst_fdtable_chunk_t* chunk = fdtable->chunks[c];
+
+    _write_entry(&chunk->entries[i], type, device, object);
+
+    _set_bit(chunk->used, i);
+    _set_bit(fdtable->nonempty, c);
+
+    if (++chunk->count == CHUNK_SIZE)
+        _set_bit(fdtable->full, c);
+
+    fdtable->count++;
+}
+
+/* clear the entry for fd (if in use); returns true if it was borrowed */
+static bool _clear(myst_fdtable_t* fdtable, int fd)
+{
+    const size_t c = fd / CHUNK_SIZE;
+    const size_t i = fd % CHUNK_SIZE;
+    myst_fdtable_chunk_t* chunk = fdtable->chunks[c];
+    bool borrowed;
+
+    if (!chunk || !_test_bit(chunk->used, i))
+        return false;
+
+    if ((borrowed = _test_bit(chunk->borrowed, i)))
+    {
+        _clear_bit(chunk->borrowed, i);
+        fdtable->nborrowed--;
+    }
+
+    _write_entry(&chunk->entries[i], MYST_FDTABLE_TYPE_NONE, NULL, NULL);
+    _clear_bit(chunk->used, i);
+    _clear_bit(fdtable->full, c);
+
+    if (--chunk->count == 0)
+        _clear_bit(fdtable->nonempty, c);
+
+    fdtable->count--;
+
+    return borrowed;
+}
+
+/* clear the entry for fd and close its object (unless borrowed) */
+static void _close_entry(myst_fdtable_t* fdtable, int fd)
+{
+    myst_fdtable_entry_t* entry = _get_entry(fdtable, fd);
+    myst_fdtable_type_t type = entry->type;
+    myst_fdops_t* fdops = entry->device;
+    void* object = entry->object;
+
+    if (!_clear(fdtable, fd))
+        (*fdops->fd_close)(fdops, object);
+
+    if (type == MYST_FDTABLE_TYPE_FILE)
+        myst_remove_fd_link(fd);
+}
+
+/* find the lowest free descriptor at or after start (or -EMFILE) */
+static int _find_free(const myst_fdtable_t* fdtable, size_t start)
+{
+    size_t c = start / CHUNK_SIZE;
+
+    while ((c = _find_bit(fdtable->full, NUM_CHUNKS, c, false)) < NUM_CHUNKS)
+    {
+        const myst_fdtable_chunk_t* chunk = fdtable->chunks[c];
+        size_t first = (c == start / CHUNK_SIZE) ? start % CHUNK_SIZE : 0;
+        size_t i = first;
+        size_t fd;
+
+        /* an unallocated chunk is entirely free */
+        if (chunk)
+            i = _find_bit(chunk->used, CHUNK_SIZE, first, false);
+
+        if (i == CHUNK_SIZE)
+        {
+            c++;
+            continue;
+        }
+
+        if ((fd = c * CHUNK_SIZE + i) >= fdtable->limit)
+            break;
+
+        return (int)fd;
+    }
+
+    return -EMFILE;
+}
+
+/* find the lowest used descriptor at or after start (or -1) */
+static int _next_used(const myst_fdtable_t* fdtable, size_t start)
+{
+    size_t c = start / CHUNK_SIZE;
+
+    while ((c = _find_bit(fdtable->nonempty, NUM_CHUNKS, c, true)) < NUM_CHUNKS)
+    {
+        const myst_fdtable_chunk_t* chunk = fdtable->chunks[c];
+        size_t first = (c == start / CHUNK_SIZE) ? start % CHUNK_SIZE : 0;
+        size_t i = _find_bit(chunk->used, CHUNK_SIZE, first, true);
+
+        if (i < CHUNK_SIZE)
+            return (int)(c * CHUNK_SIZE + i);
+
+        c++;
+    }
+
+    return -1;
+}
+
+/* iterate over the descriptors in use */
+#define FOREACH_FD(FDTABLE, FD)                    \
+    for (int FD = _next_used(FDTABLE, 0); FD >= 0; \
+         FD = _next_used(FDTABLE, FD + 1))
+
+static void _free_chunks(myst_fdtable_t* fdtable)
+{
+    for (size_t c = 0; c < NUM_CHUNKS; c++)
+    {
+        if (fdtable->chunks[c])
+        {
+            free(fdtable->chunks[c]);
+            fdtable->chunks[c] = NULL;
+        }
+    }
+}
+
+/* replace the borrowed object of fd with a duplicate owned by this table */
+static int _own_entry(myst_fdtable_t* fdtable, int fd)
+{
+    myst_fdtable_chunk_t* chunk = fdtable->chunks[fd / CHUNK_SIZE];
+    const size_t i = fd % CHUNK_SIZE;
+    myst_fdtable_entry_t* entry;
+    myst_fdops_t* fdops;
+    void* object;
+    int r;
+
+    if (!_is_borrowed(fdtable, fd))
+        return 0;
+
+    entry = &chunk->entries[i];
+    fdops = entry->device;
+
+    if ((r = (*fdops->fd_dup)(fdops, entry->object, &object)) != 0)
+    {
+        /* drop the descriptor rather than keep sharing the parent's object */
+        _clear(fdtable, fd);
+        return r;
+    }
+
+    _write_entry(entry, entry->type, entry->device, object);
+    _clear_bit(chunk->borrowed, i);
+    fdtable->nborrowed--;
+
+    return 0;
+}
+
+/* detach fdtable from the table it borrowed from (caller holds _cow_lock) */
+static void _unlink(myst_fdtable_t* fdtable)
+{
+    myst_fdtable_t* parent = fdtable->cow_parent;
+
+    if (!parent)
+        return;
+
+    myst_spin_lock(&parent->lock);
+    {
+        if (fdtable->cow_prev)
+            fdtable->cow_prev->cow_next = fdtable->cow_next;
+        else
+            parent->cow_children = fdtable->cow_next;
+
+        if (fdtable->cow_next)
+            fdtable->cow_next->cow_prev = fdtable->cow_prev;
+    }
+    myst_spin_unlock(&parent->lock);
+
+    fdtable->cow_parent = NULL;
+    fdtable->cow_prev = NULL;
+    fdtable->cow_next = NULL;
+}
+
+/* let every table that borrows from fdtable own its objects (caller holds
+ * _cow_lock but not the table locks) */
+static void _unshare_children(myst_fdtable_t* fdtable)
+{
+    myst_fdtable_t* child;
+
+    while ((child = fdtable->cow_children))
+    {
+        myst_spin_lock(&child->lock);
+        {
+            /* on failure, _own_entry() drops the descriptor from the child */
+            FOREACH_FD(child, i)
+                _own_entry(child, i);
+        }
+        myst_spin_unlock(&child->lock);
+
+        _unlink(child);
+    }
+}
+
+/* let the tables that borrow from fdtable own the borrowed objects without
+ * duplicating them, and drop them from fdtable (which is being freed); the
+ * caller holds _cow_lock */
+static void _hand_over_children(myst_fdtable_t* fdtable)
+{
+    myst_fdtable_t* child;
+
+    while ((child = fdtable->cow_children))
+    {
+        myst_spin_lock(&child->lock);
+        myst_spin_lock(&fdtable->lock);
+        {
+            FOREACH_FD(child, i)
+            {
+                myst_fdtable_chunk_t* chunk = child->chunks[i / CHUNK_SIZE];
+
+                if (!_is_borrowed(child, i))
+                    continue;
+
+                /* the borrowed entry refers to the object of the same
+                 * descriptor of fdtable (changes unshare children first) */
+                _clear_bit(chunk->borrowed, i % CHUNK_SIZE);
+                child->nborrowed--;
+                _clear(fdtable, i);
+            }
+        }
+        myst_spin_unlock(&fdtable->lock);
+        myst_spin_unlock(&child->lock);
+
+        _unlink(child);
+    }
+}
+
+/* lock fdtable to close or replace its entries (no table borrows from it
+ * while the lock is held) */
+static void _lock_for_update(myst_fdtable_t* fdtable)
+{
+    myst_spin_lock(&fdtable->lock);
+
+    if (fdtable->cow_children)
+    {
+        myst_spin_unlock(&fdtable->lock);
+        myst_spin_lock(&_cow_lock);
+        _unshare_children(fdtable);
+
+        /* children are only added with _cow_lock held */
+        myst_spin_lock(&fdtable->lock);
+        myst_spin_unlock(&_cow_lock);
+    }
+}
+
 int myst_fdtable_create(myst_fdtable_t** fdtable_out)
 {
     int ret = 0;
@@ -35,6 +471,8 @@ int myst_fdtable_create(myst_fdtable_t** fdtable_out)
     if (!(fdtable = calloc(1, sizeof(myst_fdtable_t))))
         ERAISE(-ENOMEM);
 
+    fdtable->limit = MYST_FDTABLE_SIZE;
+
     *fdtable_out = fdtable;
     fdtable = NULL;
 
@@ -46,10 +484,51 @@ done:
     return ret;
 }
 
-int myst_fdtable_clone(myst_fdtable_t* fdtable, myst_fdtable_t** fdtable_out)
+/* give the clone its own duplicate of every object */
+static int _clone_objects(myst_fdtable_t* fdtable, myst_fdtable_t* new_fdtable)
+{
+    int ret = 0;
+
+    myst_spin_lock(&fdtable->lock);
+    {
+        new_fdtable->limit = fdtable->limit;
+
+        FOREACH_FD(fdtable, i)
+        {
+            const myst_fdtable_entry_t* entry = _get_entry(fdtable, i);
+            myst_fdops_t* fdops = entry->device;
+            void* object;
+            int r;
+
+            if ((r = _alloc_chunk(new_fdtable, i)) != 0)
+            {
+                myst_spin_unlock(&fdtable->lock);
+                ERAISE(r);
+            }
+
+            if ((r = (*fdops->fd_dup)(fdops, entry->object, &object)) != 0)
+            {
+                myst_spin_unlock(&fdtable->lock);
+                ERAISE(r);
+            }
+
+            _install(new_fdtable, i, entry->type, entry->device, object);
+        }
+    }
+    myst_spin_unlock(&fdtable->lock);
+
+done:
+    return ret;
+}
+
+int myst_fdtable_clone(
+    myst_fdtable_t* fdtable,
+    bool borrow,
+    myst_fdtable_t** fdtable_out)
 {
     int ret = 0;
     myst_fdtable_t* new_fdtable = NULL;
+    bool locked = false;
 
     if (fdtable_out)
         *fdtable_out = NULL;
@@ -61,40 +540,93 @@ int myst_fdtable_clone(myst_fdtable_t* fdtable, myst_fdtable_t** fdtable_out)
     if (!(new_fdtable = calloc(1, sizeof(myst_fdtable_t))))
         ERAISE(-ENOMEM);
 
+    myst_spin_lock(&_cow_lock);
+    locked = true;
+
+    /* lend to at most one child (see _hand_over_children()) */
+    if (!borrow || fdtable->cow_children)
+    {
+        myst_spin_unlock(&_cow_lock);
+        locked = false;
+
+        if ((ret = _clone_objects(fdtable, new_fdtable)) != 0)
+        {
+            /* close the descriptors that were duplicated before the failure */
+            myst_fdtable_free(new_fdtable);
+            new_fdtable = NULL;
+            ERAISE(ret);
+        }
+
+        *fdtable_out = new_fdtable;
+        new_fdtable = NULL;
+        goto done;
+    }
+
+    /* a table that still borrows must own its objects before lending them */
+    if (fdtable->cow_parent)
+    {
+        myst_spin_lock(&fdtable->lock);
+        {
+            FOREACH_FD(fdtable, i)
+                _own_entry(fdtable, i);
+        }
+        myst_spin_unlock(&fdtable->lock);
+
+        _unlink(fdtable);
+    }
+
     myst_spin_lock(&fdtable->lock);
     {
-        for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
+        new_fdtable->limit = fdtable->limit;
+
+        /* copy the entries without duplicating their objects */
+        FOREACH_FD(fdtable, i)
         {
-            const myst_fdtable_entry_t* entry = &fdtable->entries[i];
+            const myst_fdtable_entry_t* entry = _get_entry(fdtable, i);
+            myst_fdtable_chunk_t* chunk;
+            int r;
 
-            if (entry->type != MYST_FDTABLE_TYPE_NONE)
+            if ((r = _alloc_chunk(new_fdtable, i)) != 0)
             {
-                myst_fdtable_entry_t* new_entry = &new_fdtable->entries[i];
-                myst_fdops_t* fdops = entry->device;
-                void* object;
-                long r;
-
-                if ((r = (*fdops->fd_dup)(fdops, entry->object, &object)) != 0)
-                {
-                    myst_spin_unlock(&fdtable->lock);
-                    ERAISE(r);
-                }
-
-                new_entry->type = entry->type;
-                new_entry->device = entry->device;
-                new_entry->object = object;
+                myst_spin_unlock(&fdtable->lock);
+                ERAISE(r);
             }
+
+            _install(new_fdtable, i, entry->type, entry->device, entry->object);
+
+            chunk = new_fdtable->chunks[i / CHUNK_SIZE];
+            _set_bit(chunk->borrowed, i % CHUNK_SIZE);
+            new_fdtable->nborrowed++;
         }
+
+        /* add the new table to the borrowers of this table */
+        new_fdtable->cow_parent = fdtable;
+        new_fdtable->cow_next = fdtable->cow_children;
+
+        if (fdtable->cow_children)
+            fdtable->cow_children->cow_prev = new_fdtable;
+
+        fdtable->cow_children = new_fdtable;
     }
     myst_spin_unlock(&fdtable->lock);
 
+    myst_spin_unlock(&_cow_lock);
+    locked = false;
+
     *fdtable_out = new_fdtable;
     new_fdtable = NULL;
 
 done:
 
+    if (locked)
+        myst_spin_unlock(&_cow_lock);
+
+    /* the entries copied before the failure are borrowed (not closed) */
     if (new_fdtable)
+    {
+        _free_chunks(new_fdtable);
         free(new_fdtable);
+    }
 
     return ret;
 }
@@ -102,45 +634,48 @@ done:
 int myst_fdtable_cloexec(myst_fdtable_t* fdtable)
 {
     int ret = 0;
+    bool locked = false;
 
     if (!fdtable)
         ERAISE(-EINVAL);
 
+    myst_spin_lock(&_cow_lock);
+    locked = true;
+
+    /* tables borrowing from this one must not see the descriptors close */
+    _unshare_children(fdtable);
+
     myst_spin_lock(&fdtable->lock);
     {
         /* close any file descriptors with FD_CLOEXEC flag */
-        for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
+        FOREACH_FD(fdtable, i)
         {
-            myst_fdtable_entry_t* entry = &fdtable->entries[i];
+            myst_fdtable_entry_t* entry = _get_entry(fdtable, i);
+            myst_fdops_t* fdops = entry->device;
+            int r = (*fdops->fd_fcntl)(fdops, entry->object, F_GETFD, 0);
 
-            if (entry->type != MYST_FDTABLE_TYPE_NONE)
+            if (r < 0)
             {
-                myst_fdops_t* fdops = entry->device;
-                int r = (*fdops->fd_fcntl)(fdops, entry->object, F_GETFD, 0);
-
-                if (r < 0)
-                {
-                    myst_spin_unlock(&fdtable->lock);
-                    ERAISE(r);
-                }
-
-                if ((r & FD_CLOEXEC))
-                {
-                    (*fdops->fd_close)(fdops, entry->object);
-
-                    if (entry->type == MYST_FDTABLE_TYPE_FILE)
-                    {
-                        myst_remove_fd_link(i);
-                    }
-
-                    memset(entry, 0, sizeof(myst_fdtable_entry_t));
-                }
+                myst_spin_unlock(&fdtable->lock);
+                ERAISE(r);
             }
+
+            /* only the borrowed descriptors that survive are duplicated */
+            if ((r & FD_CLOEXEC))
+                _close_entry(fdtable, i);
+            else
+                _own_entry(fdtable, i);
         }
     }
     myst_spin_unlock(&fdtable->lock);
 
+    _unlink(fdtable);
+
 done:
+
+    if (locked)
+        myst_spin_unlock(&_cow_lock);
+
     return ret;
 }
 
@@ -151,26 +686,33 @@ int myst_fdtable_free(myst_fdtable_t* fdtable)
     if (!fdtable)
         ERAISE(-EINVAL);
 
-    /* Close all objects */
-    for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
+    /* stop lending and borrowing objects */
+    if (fdtable->cow_children || fdtable->cow_parent)
     {
-        myst_fdtable_entry_t* entry = &fdtable->entries[i];
+        myst_spin_lock(&_cow_lock);
+        _hand_over_children(fdtable);
 
-        if (entry->type != MYST_FDTABLE_TYPE_NONE)
+        myst_spin_lock(&fdtable->lock);
         {
-            myst_fdops_t* fdops = entry->device;
-            (*fdops->fd_close)(fdops, entry->object);
-
-            if (entry->type == MYST_FDTABLE_TYPE_FILE)
+            /* the parent still owns the borrowed objects */
+            FOREACH_FD(fdtable, i)
             {
-                myst_remove_fd_link(i);
+                if (_is_borrowed(fdtable, i))
+                    _close_entry(fdtable, i);
             }
-
-            memset(entry, 0, sizeof(myst_fdtable_entry_t));
         }
+        myst_spin_unlock(&fdtable->lock);
+
+        _unlink(fdtable);
+        myst_spin_unlock(&_cow_lock);
     }
 
+    /* Close all objects */
+    FOREACH_FD(fdtable, i)
+        _close_entry(fdtable, i);
+
     /* Files are released by ramfs */
+    _free_chunks(fdtable);
     memset(fdtable, 0, sizeof(myst_fdtable_t));
     free(fdtable);
 
@@ -186,14 +728,21 @@ int myst_fdtable_interrupt(myst_fdtable_t* fdtable)
         ERAISE(-EINVAL);
 
     /* Close all objects */
-    for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
+    FOREACH_FD(fdtable, i)
     {
-        myst_fdtable_entry_t* entry = &fdtable->entries[i];
+        myst_fdtable_entry_t* entry = _get_entry(fdtable, i);
 
-        if (entry->type == MYST_FDTABLE_TYPE_PIPE)
+        if (entry->type == MYST_FDTABLE_TYPE_PIPE ||
+            entry->type == MYST_FDTABLE_TYPE_EVENTFD ||
+            entry->type == MYST_FDTABLE_TYPE_TIMERFD ||
+            entry->type == MYST_FDTABLE_TYPE_SIGNALFD ||
+            entry->type == MYST_FDTABLE_TYPE_SOCK)
         {
             myst_fdops_t* fdops = entry->device;
-            (*fdops->fd_interrupt)(fdops, entry->object);
+
+            /* only the in-kernel sockets implement fd_interrupt */
+            if (fdops->fd_interrupt)
+                (*fdops->fd_interrupt)(fdops, entry->object);
         }
     }
 
@@ -208,34 +757,26 @@ int myst_fdtable_assign(
     void* object)
 {
     int ret = 0;
+    bool locked = false;
+    int fd;
 
     if (!fdtable || !object)
         ERAISE(-EINVAL);
 
     myst_spin_lock(&fdtable->lock);
-    {
-        /* Use the first available entry */
-        for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
-        {
-            myst_fdtable_entry_t* entry = &fdtable->entries[i];
-
-            if (entry->type == MYST_FDTABLE_TYPE_NONE)
-            {
-                entry->type = type;
-                entry->device = device;
-                entry->object = object;
-                ret = i;
-                myst_spin_unlock(&fdtable->lock);
-                goto done;
-            }
-        }
-    }
-    myst_spin_unlock(&fdtable->lock);
+    locked = true;
 
-    ERAISE(-EMFILE);
+    /* Use the first available entry */
+    ECHECK(fd = _find_free(fdtable, 0));
+    ECHECK(_alloc_chunk(fdtable, fd));
+    _install(fdtable, fd, type, device, object);
+    ret = fd;
 
 done:
 
+    if (locked)
+        myst_spin_unlock(&fdtable->lock);
+
     return ret;
 }
 
@@ -308,19 +849,21 @@ int myst_fdtable_dup(
         }
     }
 
-    myst_spin_lock(&fdtable->lock);
+    _lock_for_update(fdtable);
     locked = true;
 
     {
-        myst_fdtable_entry_t* old = &fdtable->entries[oldfd];
-        myst_fdtable_entry_t* new = NULL;
-        myst_fdops_t* old_fdops = old->device;
+        myst_fdtable_entry_t* old = _get_entry(fdtable, oldfd);
+        myst_fdtable_entry_t* new;
+        myst_fdops_t* old_fdops;
         void* newobj;
         int r;
 
-        if (old->type == MYST_FDTABLE_TYPE_NONE)
+        if (!old || old->type == MYST_FDTABLE_TYPE_NONE)
             ERAISE(-ENOENT);
 
+        old_fdops = old->device;
+
         if (newfd == oldfd) /* dup2() */
         {
             /* sucessful no-op case */
@@ -330,38 +873,23 @@ int myst_fdtable_dup(
 
         if (use_next_available_fd)
         {
-            /* find the first free file descriptor */
-            for (size_t i = start_fd; i < MYST_COUNTOF(fdtable->entries); i++)
-            {
-                myst_fdtable_entry_t* p = &fdtable->entries[i];
-
-                if (p->type == MYST_FDTABLE_TYPE_NONE)
-                {
-                    new = p;
-                    newfd = i;
-                    break;
-                }
-            }
+            if (start_fd >= fdtable->limit)
+                ERAISE(-EINVAL);
 
-            if (!new)
-                ERAISE(-EMFILE);
+            /* find the first free file descriptor */
+            ECHECK(newfd = _find_free(fdtable, start_fd));
         }
-        else
+        else if ((size_t)newfd >= fdtable->limit)
         {
-            new = &fdtable->entries[newfd];
+            ERAISE(-EBADF);
+        }
 
-            /* if new entry is not empty, close the descriptor */
-            if (new->type != MYST_FDTABLE_TYPE_NONE)
-            {
-                myst_fdops_t* new_fdops = new->device;
-                (new_fdops->fd_close)(new->device, new->object);
+        ECHECK(_alloc_chunk(fdtable, newfd));
+        new = _get_entry(fdtable, newfd);
 
-                if (new->type == MYST_FDTABLE_TYPE_FILE)
-                {
-                    myst_remove_fd_link(newfd);
-                }
-            }
-        }
+        /* if new entry is not empty, close the descriptor */
+        if (new->type != MYST_FDTABLE_TYPE_NONE)
+            _close_entry(fdtable, newfd);
 
         /* dup the old object */
         if ((r = (old_fdops->fd_dup)(old->device, old->object, &newobj)) != 0)
@@ -370,9 +898,7 @@ int myst_fdtable_dup(
         if (set_cloexec && flags == O_CLOEXEC)
             (*old_fdops->fd_fcntl)(old_fdops, newobj, F_SETFD, FD_CLOEXEC);
 
-        new->type = old->type;
-        new->device = old->device;
-        new->object = newobj;
+        _install(fdtable, newfd, old->type, old->device, newobj);
 
         ret = newfd;
     }
@@ -392,11 +918,29 @@ int myst_fdtable_remove(myst_fdtable_t* fdtable, int fd)
     if (!fdtable)
         ERAISE(-EINVAL);
 
-    if (fd < 0 || fd >= MYST_FDTABLE_SIZE)
+    if (!myst_valid_fd(fd))
         ERAISE(-EINVAL);
 
-    myst_spin_lock(&fdtable->lock);
-    memset(&fdtable->entries[fd], 0, sizeof(myst_fdtable_entry_t));
+    _lock_for_update(fdtable);
+    ret = _clear(fdtable, fd) ? 1 : 0;
+    myst_spin_unlock(&fdtable->lock);
+
+done:
+    return ret;
+}
+
+int myst_fdtable_unshare(myst_fdtable_t* fdtable, int fd)
+{
+    int ret = 0;
+
+    if (!fdtable)
+        ERAISE(-EINVAL);
+
+    if (!myst_valid_fd(fd))
+        ERAISE(-EBADF);
+
+    _lock_for_update(fdtable);
+    ret = _own_entry(fdtable, fd);
     myst_spin_unlock(&fdtable->lock);
 
 done:
@@ -411,30 +955,30 @@ int myst_fdtable_get(
     void** object)
 {
     int ret = 0;
+    const myst_fdtable_entry_t* entry;
+    myst_fdtable_type_t entry_type;
+    void* entry_device;
+    void* entry_object;
 
     if (!fdtable || !device || !object)
         ERAISE(-EINVAL);
 
-    if (!(fd >= 0 && fd < MYST_FDTABLE_SIZE))
+    if (!myst_valid_fd(fd))
         ERAISE(-EBADF);
 
     if (type == MYST_FDTABLE_TYPE_NONE)
         ERAISE(-EINVAL);
 
-    myst_spin_lock(&fdtable->lock);
-    {
-        myst_fdtable_entry_t* entry = &fdtable->entries[fd];
+    if (!(entry = _get_entry(fdtable, fd)))
+        ERAISE(-EBADF);
 
-        if (entry->type != type || !(entry->object && entry->device))
-        {
-            myst_spin_unlock(&fdtable->lock);
-            ERAISE(-EBADF);
-        }
+    _read_entry(entry, &entry_type, &entry_device, &entry_object);
 
-        *device = entry->device;
-        *object = entry->object;
-    }
-    myst_spin_unlock(&fdtable->lock);
+    if (entry_type != type || !(entry_object && entry_device))
+        ERAISE(-EBADF);
+
+    *device = entry_device;
+    *object = entry_object;
 
 done:
 
@@ -449,6 +993,10 @@ int myst_fdtable_get_any(
     void** object)
 {
     int ret = 0;
+    const myst_fdtable_entry_t* entry;
+    myst_fdtable_type_t entry_type;
+    void* entry_device;
+    void* entry_object;
 
     if (type)
         *type = MYST_FDTABLE_TYPE_NONE;
@@ -456,24 +1004,20 @@ int myst_fdtable_get_any(
     if (!fdtable || !type || !device || !object)
         ERAISE(-EINVAL);
 
-    if (!(fd >= 0 && fd < MYST_FDTABLE_SIZE))
+    if (!myst_valid_fd(fd))
         ERAISE(-EBADF);
 
-    myst_spin_lock(&fdtable->lock);
-    {
-        myst_fdtable_entry_t* entry = &fdtable->entries[fd];
+    if (!(entry = _get_entry(fdtable, fd)))
+        ERAISE(-EBADF);
 
-        if (entry->type == MYST_FDTABLE_TYPE_NONE)
-        {
-            myst_spin_unlock(&fdtable->lock);
-            ERAISE(-EBADF);
-        }
+    _read_entry(entry, &entry_type, &entry_device, &entry_object);
 
-        *type = entry->type;
-        *device = entry->device;
-        *object = entry->object;
-    }
-    myst_spin_unlock(&fdtable->lock);
+    if (entry_type == MYST_FDTABLE_TYPE_NONE)
+        ERAISE(-EBADF);
+
+    *type = entry_type;
+    *device = entry_device;
+    *object = entry_object;
 
 done:
 
@@ -505,6 +1049,10 @@ static const char* _type_name(myst_fdtable_type_t type)
             return "inotify";
         case MYST_FDTABLE_TYPE_EVENTFD:
             return "eventfd";
+        case MYST_FDTABLE_TYPE_TIMERFD:
+            return "timerfd";
+        case MYST_FDTABLE_TYPE_SIGNALFD:
+            return "signalfd";
         case MYST_FDTABLE_TYPE_NONE:
             return "none";
     }
@@ -528,37 +1076,32 @@ int myst_fdtable_list(const myst_fdtable_t* fdtable)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
-    for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
+    FOREACH_FD(fdtable, i)
     {
-        const myst_fdtable_entry_t* entry = &fdtable->entries[i];
-
-        if (entry->type != MYST_FDTABLE_TYPE_NONE)
-        {
-            pid_t pid = myst_getpid();
-            ssize_t m;
+        const myst_fdtable_entry_t* entry = _get_entry(fdtable, i);
+        pid_t pid = myst_getpid();
+        ssize_t m;
 
-            printf("%d: %s", i, _type_name(entry->type));
+        printf("%d: %s", i, _type_name(entry->type));
 
-            if (entry->type == MYST_FDTABLE_TYPE_FILE)
+        if (entry->type == MYST_FDTABLE_TYPE_FILE)
+        {
+            const size_t n = sizeof(locals->linkpath);
+            if (snprintf(locals->linkpath, n, "/proc/%d/fd/%d", pid, i) >=
+                (int)n)
             {
-                const size_t n = sizeof(locals->linkpath);
-                if (snprintf(locals->linkpath, n, "/proc/%d/fd/%d", pid, i) >=
-                    (int)n)
-                {
-                    ERAISE(-ENAMETOOLONG);
-                }
-
-                if ((m = myst_syscall_readlink(
-                         locals->linkpath, locals->buf, sizeof(locals->buf))) <
-                    0)
-                {
-                    ERAISE(-ENAMETOOLONG);
-                }
-                printf(" (%s)", locals->buf);
+                ERAISE(-ENAMETOOLONG);
             }
 
-            printf("\n");
+            if ((m = myst_syscall_readlink(
+                     locals->linkpath, locals->buf, sizeof(locals->buf))) < 0)
+            {
+                ERAISE(-ENAMETOOLONG);
+            }
+            printf(" (%s)", locals->buf);
         }
+
+        printf("\n");
     }
 
     printf("\n");
@@ -583,9 +1126,9 @@ long myst_fdtable_sync(myst_fdtable_t* fdtable)
     locked = true;
 
     {
-        for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
+        FOREACH_FD(fdtable, i)
         {
-            const myst_fdtable_entry_t* entry = &fdtable->entries[i];
+            const myst_fdtable_entry_t* entry = _get_entry(fdtable, i);
 
             if (entry->type == MYST_FDTABLE_TYPE_FILE)
             {
@@ -607,24 +1150,32 @@ done:
 ssize_t myst_fdtable_count(const myst_fdtable_t* fdtable)
 {
     ssize_t ret = 0;
-    ssize_t count = 0;
 
     if (!fdtable)
         ERAISE(-EINVAL);
 
     myst_spin_lock(&((myst_fdtable_t*)fdtable)->lock);
     {
-        for (int i = 0; i < MYST_FDTABLE_SIZE; i++)
-        {
-            const myst_fdtable_entry_t* entry = &fdtable->entries[i];
-
-            if (entry->type == MYST_FDTABLE_TYPE_NONE)
-                count++;
-        }
+        if (fdtable->count < fdtable->limit)
+            ret = (ssize_t)(fdtable->limit - fdtable->count);
     }
     myst_spin_unlock(&((myst_fdtable_t*)fdtable)->lock);
 
-    ret = count;
+done:
+    return ret;
+}
+
+int myst_fdtable_set_limit(myst_fdtable_t* fdtable, size_t limit)
+{
+    int ret = 0;
+
+    if (!fdtable || limit > MYST_FDTABLE_MAX_SIZE)
+        ERAISE(-EINVAL);
+
+    /* descriptors above a lowered limit stay open (as on Linux) */
+    myst_spin_lock(&fdtable->lock);
+    fdtable->limit = limit;
+    myst_spin_unlock(&fdtable->lock);
 
 done:
     return ret;
@@ -0,0 +1,1212 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <syscall.h>
+
+#include <myst/assume.h>
+#include <myst/eraise.h>
+#include <myst/fiber.h>
+#include <myst/fsgs.h>
+#include <myst/kernel.h>
+#include <myst/lfence.h>
+#include <myst/panic.h>
+#include <myst/printf.h>
+#include <myst/setjmp.h>
+#include <myst/signal.h>
+#include <myst/spinlock.h>
+#include <myst/syscall.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
+#include <myst/time.h>
+#include <myst/times.h>
+
+/* the stack a fiber starts on (the thread then moves to its entry stack) */
+#define FIBER_STACK_SIZE (16 * 1024)
+
+/* the stack the carrier threads run the scheduler on */
+#define CARRIER_STACK_SIZE (64 * 1024)
+
+/* the initial capacity of the host poll set of a carrier */
+#define MIN_POLL_CAPACITY 16
+
+/* how long shutdown waits for parked fibers to exit (and how often it wakes
+ * them) before abandoning their carriers */
+#define SHUTDOWN_TIMEOUT_MSEC 5000
+#define SHUTDOWN_WAKE_MSEC 100
+
+typedef enum fiber_state
+{
+    FIBER_READY,    /* on the run queue */
+    FIBER_RUNNING,  /* current fiber of its carrier */
+    FIBER_WAITING,  /* parked in myst_fiber_wait() */
+    FIBER_SLEEPING, /* parked in myst_fiber_sleep() */
+    FIBER_EXITED,   /* the thread has exited */
+} fiber_state_t;
+
+typedef enum carrier_state
+{
+    CARRIER_STOPPED,
+    CARRIER_STARTING, /* waiting for the target to call back */
+    CARRIER_RUNNING,
+} carrier_state_t;
+
+typedef struct carrier carrier_t;
+
+struct myst_fiber
+{
+    /* link for the run queue or the timer list */
+    myst_fiber_t* next;
+    myst_fiber_t* prev;
+
+    /* link for the list of all fibers of the carrier */
+    myst_fiber_t* all_next;
+    myst_fiber_t* all_prev;
+
+    /* link for the list of fibers parked on host fds */
+    myst_fiber_t* poll_next;
+    myst_fiber_t* poll_prev;
+
+    carrier_t* carrier;
+    myst_thread_t* thread;
+    fiber_state_t state;
+    bool started;
+
+    /* event counter with the same semantics as the host thread event */
+    int value;
+
+    /* absolute CLOCK_MONOTONIC deadline in nanoseconds while on a timer */
+    long deadline;
+    bool timer;
+    bool timed_out;
+
+    /* the host fds while parked in myst_fiber_poll() */
+    struct pollfd* fds;
+    nfds_t nfds;
+    bool polling;     /* on the poller list of the carrier */
+    bool wakeable;    /* interrupted by myst_fiber_poll_wake() */
+    bool interrupted; /* set by myst_fiber_poll_wake() until a poll sees it */
+
+    /* context saved when switching to the scheduler */
+    myst_jmp_buf_t jmpbuf;
+    uint64_t tsd;
+    void* fsbase;
+
+    void* stack;
+};
+
+struct carrier
+{
+    myst_spinlock_t lock;
+    carrier_state_t state;
+
+    /* the host thread event, thread id, and thread descriptor */
+    uint64_t event;
+    pid_t target_tid;
+    void* fsbase;
+
+    /* the scheduler context */
+    myst_jmp_buf_t jmpbuf;
+    myst_fiber_t* current;
+
+    /* fibers ready to run (FIFO) */
+    myst_fiber_t* head;
+    myst_fiber_t* tail;
+
+    /* parked fibers with deadlines (ordered by deadline) */
+    myst_fiber_t* timers;
+
+    /* every live fiber of this carrier */
+    myst_fiber_t* fibers;
+
+    /* fibers parked on host fds and the number of fds they wait on */
+    myst_fiber_t* pollers;
+    size_t num_poll_fds;
+
+    /* the host poll set (only used by the carrier thread) */
+    struct pollfd* poll_fds;
+    myst_fiber_t** poll_owners;
+    size_t poll_capacity;
+
+    /* host eventfd that interrupts the host poll of the idle carrier */
+    int wakefd;
+
+    size_t num_fibers;
+    bool idle;
+    bool polling; /* idle in a host poll (rather than on the event) */
+    bool stopping;
+};
+
+typedef enum carrier_wake
+{
+    WAKE_NONE,
+    WAKE_EVENT, /* signal the host thread event */
+    WAKE_POLL,  /* interrupt the host poll */
+} carrier_wake_t;
+
+static carrier_t _carriers[MYST_MAX_FIBER_CARRIERS];
+static myst_spinlock_t _carriers_lock = MYST_SPINLOCK_INITIALIZER;
+static _Atomic(size_t) _next_carrier;
+static _Atomic(size_t) _num_fibers;
+
+/*
+**==============================================================================
+**
+** local helpers:
+**
+**==============================================================================
+*/
+
+static size_t _num_carriers(void)
+{
+    const size_t max_threads = __myst_kernel_args.max_threads;
+    size_t n = __myst_kernel_args.fiber_carriers;
+
+    if (n > MYST_MAX_FIBER_CARRIERS)
+        n = MYST_MAX_FIBER_CARRIERS;
+
+    /* the main thread always needs a host thread */
+    if (n && n >= max_threads)
+        n = max_threads - 1;
+
+    return n;
+}
+
+/* the number of host threads after which new threads become fibers */
+static size_t _threshold(void)
+{
+    const size_t limit = __myst_kernel_args.max_threads - _num_carriers();
+    const size_t n = __myst_kernel_args.fiber_threshold;
+
+    return (n && n < limit) ? n : limit;
+}
+
+static size_t _max_fibers(void)
+{
+    const size_t n = __myst_kernel_args.max_fibers;
+    return (n && n < MYST_MAX_FIBERS) ? n : MYST_MAX_FIBERS;
+}
+
+static long _now(void)
+{
+    struct timespec ts;
+
+    if (myst_syscall_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        myst_panic("clock_gettime() failed");
+
+    return timespec_to_nanos(&ts);
+}
+
+MYST_INLINE myst_fiber_t* _event_to_fiber(uint64_t event)
+{
+    myst_fiber_t* fiber = (myst_fiber_t*)(event & ~(uint64_t)1);
+    myst_assume(fiber->carrier != NULL);
+    return fiber;
+}
+
+MYST_INLINE uint64_t _fiber_to_event(myst_fiber_t* fiber)
+{
+    return (uint64_t)fiber | 1;
+}
+
+/* the following operate on the carrier with its lock held */
+
+static void _make_ready(carrier_t* c, myst_fiber_t* fiber)
+{
+    fiber->state = FIBER_READY;
+    fiber->next = NULL;
+
+    if (c->tail)
+        c->tail->next = fiber;
+    else
+        c->head = fiber;
+
+    c->tail = fiber;
+}
+
+static myst_fiber_t* _dequeue(carrier_t* c)
+{
+    myst_fiber_t* fiber;
+
+    if ((fiber = c->head))
+    {
+        if (!(c->head = fiber->next))
+            c->tail = NULL;
+
+        fiber->next = NULL;
+    }
+
+    return fiber;
+}
+
+static void _add_timer(carrier_t* c, myst_fiber_t* fiber)
+{
+    myst_fiber_t* prev = NULL;
+    myst_fiber_t* p = c->timers;
+
+    while (p && p->deadline <= fiber->deadline)
+    {
+        prev = p;
+        p = p->next;
+    }
+
+    fiber->prev = prev;
+    fiber->next = p;
+
+    if (p)
+        p->prev = fiber;
+
+    if (prev)
+        prev->next = fiber;
+    else
+        c->timers = fiber;
+
+    fiber->timer = true;
+}
+
+static void _remove_timer(carrier_t* c, myst_fiber_t* fiber)
+{
+    if (!fiber->timer)
+        return;
+
+    if (fiber->prev)
+        fiber->prev->next = fiber->next;
+    else
+        c->timers = fiber->next;
+
+    if (fiber->next)
+        fiber->next->prev = fiber->prev;
+
+    fiber->next = NULL;
+    fiber->prev = NULL;
+    fiber->timer = false;
+}
+
+static void _expire_timers(carrier_t* c)
+{
+    myst_fiber_t* fiber;
+    long now;
+
+    if (!c->timers)
+        return;
+
+    now = _now();
+
+    while ((fiber = c->timers) && fiber->deadline <= now)
+    {
+        _remove_timer(c, fiber);
+        fiber->timed_out = true;
+        _make_ready(c, fiber);
+    }
+}
+
+static void _add_fiber(carrier_t* c, myst_fiber_t* fiber)
+{
+    fiber->all_prev = NULL;
+    fiber->all_next = c->fibers;
+
+    if (c->fibers)
+        c->fibers->all_prev = fiber;
+
+    c->fibers = fiber;
+    c->num_fibers++;
+}
+
+static void _remove_fiber(carrier_t* c, myst_fiber_t* fiber)
+{
+    if (fiber->all_prev)
+        fiber->all_prev->all_next = fiber->all_next;
+    else
+        c->fibers = fiber->all_next;
+
+    if (fiber->all_next)
+        fiber->all_next->all_prev = fiber->all_prev;
+
+    c->num_fibers--;
+}
+
+static void _add_poller(carrier_t* c, myst_fiber_t* fiber)
+{
+    fiber->poll_prev = NULL;
+    fiber->poll_next = c->pollers;
+
+    if (c->pollers)
+        c->pollers->poll_prev = fiber;
+
+    c->pollers = fiber;
+    c->num_poll_fds += fiber->nfds;
+    fiber->polling = true;
+}
+
+static void _remove_poller(carrier_t* c, myst_fiber_t* fiber)
+{
+    if (!fiber->polling)
+        return;
+
+    if (fiber->poll_prev)
+        fiber->poll_prev->poll_next = fiber->poll_next;
+    else
+        c->pollers = fiber->poll_next;
+
+    if (fiber->poll_next)
+        fiber->poll_next->poll_prev = fiber->poll_prev;
+
+    fiber->poll_next = NULL;
+    fiber->poll_prev = NULL;
+    c->num_poll_fds -= fiber->nfds;
+    fiber->polling = false;
+}
+
+/* make a parked fiber ready as if its thread event were signaled; returns
+ * true if the fiber was parked */
+static bool _unpark(carrier_t* c, myst_fiber_t* fiber)
+{
+    if (fiber->state == FIBER_WAITING)
+    {
+        /* a spurious wake (the counter goes from -1 back to zero) */
+        fiber->value++;
+    }
+    else if (fiber->state != FIBER_SLEEPING)
+    {
+        return false;
+    }
+
+    _remove_timer(c, fiber);
+    _make_ready(c, fiber);
+    return true;
+}
+
+/* returns how the carrier must be woken up (after releasing the lock) */
+static carrier_wake_t _notify(carrier_t* c)
+{
+    if (c->idle)
+    {
+        c->idle = false;
+        return c->polling ? WAKE_POLL : WAKE_EVENT;
+    }
+
+    return WAKE_NONE;
+}
+
+static void _wake(carrier_t* c, carrier_wake_t wake)
+{
+    if (wake == WAKE_EVENT)
+    {
+        myst_tcall_wake(c->event);
+    }
+    else if (wake == WAKE_POLL)
+    {
+        const uint64_t one = 1;
+        long params[6] = {c->wakefd, (long)&one, sizeof(one)};
+
+        /* fails only if the counter is full (then the fd is readable) */
+        myst_tcall(SYS_write, params);
+    }
+}
+
+/* switch from the calling fiber to the scheduler of its carrier; the caller
+ * holds the carrier lock, which the scheduler releases */
+static void _switch(carrier_t* c, myst_fiber_t* fiber)
+{
+    myst_assume(myst_tcall_get_tsd(&fiber->tsd) == 0);
+    fiber->fsbase = myst_get_fsbase();
+
+    if (myst_setjmp(&fiber->jmpbuf) == 0)
+        myst_longjmp(&c->jmpbuf, 1);
+
+    /* resumed by the scheduler (without the carrier lock) */
+}
+
+/*
+**==============================================================================
+**
+** scheduler:
+**
+**==============================================================================
+*/
+
+/* grow the host poll set of the carrier to hold nfds more fds (only the
+ * carrier thread uses the set, so this runs without the carrier lock) */
+static long _reserve_poll_fds(carrier_t* c, nfds_t nfds)
+{
+    long ret = 0;
+    const size_t n = c->num_poll_fds + nfds + 1;
+    size_t capacity = c->poll_capacity;
+    struct pollfd* fds;
+    myst_fiber_t** owners;
+
+    if (n <= capacity)
+        goto done;
+
+    if (capacity < MIN_POLL_CAPACITY)
+        capacity = MIN_POLL_CAPACITY;
+
+    while (capacity < n)
+        capacity *= 2;
+
+    if (!(fds = realloc(c->poll_fds, capacity * sizeof(*fds))))
+        ERAISE(-ENOMEM);
+
+    c->poll_fds = fds;
+
+    if (!(owners = realloc(c->poll_owners, capacity * sizeof(*owners))))
+        ERAISE(-ENOMEM);
+
+    c->poll_owners = owners;
+    c->poll_capacity = capacity;
+
+done:
+    return ret;
+}
+
+/* block the idle carrier in one host poll over the fds of all its pollers
+ * and make ready the fibers whose fds became ready; the caller holds the
+ * carrier lock, which this function releases */
+static void _poll_idle(carrier_t* c, const struct timespec* timeout)
+{
+    struct pollfd* fds = c->poll_fds;
+    myst_fiber_t** owners = c->poll_owners;
+    size_t n = 0;
+    long msec = -1;
+    long r;
+
+    fds[n].fd = c->wakefd;
+    fds[n].events = POLLIN;
+    fds[n].revents = 0;
+    owners[n++] = NULL;
+
+    for (myst_fiber_t* p = c->pollers; p; p = p->poll_next)
+    {
+        for (nfds_t i = 0; i < p->nfds; i++)
+        {
+            fds[n].fd = p->fds[i].fd;
+            fds[n].events = p->fds[i].events;
+            fds[n].revents = 0;
+            owners[n++] = p;
+        }
+    }
+
+    if (timeout)
+        msec = (timespec_to_nanos(timeout) + 999999) / 1000000;
+
+    c->idle = true;
+    c->polling = true;
+    myst_spin_unlock(&c->lock);
+
+    /* myst_tcall_poll_wake() interrupts this poll too (returning -EINTR if
+     * nothing is ready), but pollers learn of it from myst_fiber_poll_wake()
+     * instead, so the scheduler just polls again */
+    {
+        long params[6] = {(long)fds, n, msec > INT_MAX ? INT_MAX : msec};
+        r = myst_tcall(SYS_poll, params);
+    }
+
+    if (r > 0 && (fds[0].revents & POLLIN))
+    {
+        uint64_t value;
+        long params[6] = {c->wakefd, (long)&value, sizeof(value)};
+        myst_tcall(SYS_read, params);
+    }
+
+    myst_spin_lock(&c->lock);
+    {
+        c->idle = false;
+        c->polling = false;
+
+        for (size_t i = 1; r > 0 && i < n; i++)
+        {
+            myst_fiber_t* p = owners[i];
+
+            /* the owners cannot exit while the carrier polls */
+            if (fds[i].revents && p->polling)
+            {
+                _remove_poller(c, p);
+                _unpark(c, p);
+            }
+        }
+    }
+    myst_spin_unlock(&c->lock);
+}
+
+static long _fiber_main(void* arg)
+{
+    myst_fiber_t* fiber = arg;
+    carrier_t* c = fiber->carrier;
+
+    /* run the thread to completion (this frees the thread) */
+    myst_run_fiber(fiber->thread, _fiber_to_event(fiber), c->target_tid);
+    fiber->thread = NULL;
+
+    myst_spin_lock(&c->lock);
+    fiber->state = FIBER_EXITED;
+    myst_longjmp(&c->jmpbuf, 1);
+
+    /* unreachable */
+    return 0;
+}
+
+static void _resume(myst_fiber_t* fiber)
+{
+    if (!fiber->started)
+    {
+        uint8_t* stack_end = (uint8_t*)fiber->stack + FIBER_STACK_SIZE;
+
+        fiber->started = true;
+        myst_call_on_stack(stack_end, _fiber_main, fiber);
+        myst_panic("unexpected return");
+    }
+
+    myst_assume(myst_tcall_set_tsd(fiber->tsd) == 0);
+    myst_set_fsbase(fiber->fsbase);
+    myst_longjmp(&fiber->jmpbuf, 1);
+}
+
+static long _schedule(void* arg)
+{
+    carrier_t* c = arg;
+
+    for (;;)
+    {
+        myst_fiber_t* fiber;
+
+        myst_spin_lock(&c->lock);
+        c->idle = false;
+
+        _expire_timers(c);
+
+        if (!(fiber = _dequeue(c)))
+        {
+            struct timespec ts;
+            const struct timespec* timeout = NULL;
+
+            if (c->stopping && c->num_fibers == 0)
+            {
+                myst_spin_unlock(&c->lock);
+                break;
+            }
+
+            /* sleep until woken or until the nearest deadline */
+            if (c->timers)
+            {
+                long nsec = c->timers->deadline - _now();
+                nanos_to_timespec(&ts, nsec > 0 ? nsec : 0);
+                timeout = &ts;
+            }
+
+            if (c->pollers)
+            {
+                _poll_idle(c, timeout);
+                continue;
+            }
+
+            c->idle = true;
+            myst_spin_unlock(&c->lock);
+
+            myst_tcall_wait(c->event, timeout);
+            continue;
+        }
+
+        c->current = fiber;
+        fiber->state = FIBER_RUNNING;
+        myst_spin_unlock(&c->lock);
+
+        if (myst_setjmp(&c->jmpbuf) == 0)
+            _resume(fiber);
+
+        /* ---------- the fiber switched back with the lock held ---------- */
+
+        myst_set_fsbase(c->fsbase);
+        myst_assume(myst_tcall_set_tsd(0) == 0);
+
+        fiber = c->current;
+        c->current = NULL;
+
+        if (fiber->state == FIBER_EXITED)
+        {
+            _remove_fiber(c, fiber);
+            myst_spin_unlock(&c->lock);
+
+            free(fiber->stack);
+            free(fiber);
+            _num_fibers--;
+            continue;
+        }
+
+        if (fiber->state == FIBER_READY)
+            _make_ready(c, fiber);
+        else if (fiber->deadline)
+            _add_timer(c, fiber);
+
+        myst_spin_unlock(&c->lock);
+    }
+
+    return 0;
+}
+
+static long _start_carrier(carrier_t* c, size_t index)
+{
+    long ret = 0;
+
+    myst_spin_lock(&_carriers_lock);
+    {
+        if (c->state == CARRIER_STOPPED)
+        {
+            const uint64_t cookie = MYST_FIBER_CARRIER_COOKIE | index;
+
+            c->state = CARRIER_STARTING;
+
+            if (myst_tcall_create_thread(cookie) != 0)
+            {
+                c->state = CARRIER_STOPPED;
+                ret = -EAGAIN;
+            }
+        }
+    }
+    myst_spin_unlock(&_carriers_lock);
+
+    return ret;
+}
+
+long myst_fiber_run_carrier(uint64_t cookie, uint64_t event, pid_t target_tid)
+{
+    long ret = 0;
+    const uint64_t index = cookie & ~MYST_FIBER_CARRIER_COOKIE;
+    carrier_t* c = NULL;
+    void* stack = NULL;
+
+    if (index >= MYST_MAX_FIBER_CARRIERS || !event)
+        ERAISE(-EINVAL);
+
+    myst_lfence();
+
+    myst_spin_lock(&_carriers_lock);
+    {
+        if (_carriers[index].state == CARRIER_STARTING)
+        {
+            c = &_carriers[index];
+            c->state = CARRIER_RUNNING;
+        }
+    }
+    myst_spin_unlock(&_carriers_lock);
+
+    if (!c)
+        ERAISE(-EINVAL);
+
+    c->event = event;
+    c->target_tid = target_tid;
+    c->fsbase = myst_get_fsbase();
+    c->wakefd = -1;
+
+    if (!(stack = malloc(CARRIER_STACK_SIZE)))
+        ERAISE(-ENOMEM);
+
+    {
+        long params[6] = {0, EFD_NONBLOCK | EFD_CLOEXEC};
+        ECHECK((c->wakefd = myst_tcall(SYS_eventfd2, params)));
+    }
+
+    ECHECK(myst_call_on_stack(
+        (uint8_t*)stack + CARRIER_STACK_SIZE, _schedule, c));
+
+done:
+
+    if (stack)
+        free(stack);
+
+    if (c)
+    {
+        if (c->wakefd >= 0)
+        {
+            long params[6] = {c->wakefd};
+            myst_tcall(SYS_close, params);
+            c->wakefd = -1;
+        }
+
+        free(c->poll_fds);
+        free(c->poll_owners);
+        c->poll_fds = NULL;
+        c->poll_owners = NULL;
+        c->poll_capacity = 0;
+
+        myst_spin_lock(&_carriers_lock);
+        c->state = CARRIER_STOPPED;
+        myst_spin_unlock(&_carriers_lock);
+    }
+
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** public interface:
+**
+**==============================================================================
+*/
+
+int myst_fiber_select(size_t num_threads)
+{
+    const size_t num_fibers = _num_fibers;
+    size_t host_threads;
+
+    if (_num_carriers() == 0)
+        return (num_threads == __myst_kernel_args.max_threads) ? -EAGAIN : 0;
+
+    /* exiting fibers may already be gone from num_threads */
+    host_threads = (num_threads > num_fibers) ? num_threads - num_fibers : 0;
+
+    if (host_threads < _threshold())
+        return 0;
+
+    if (num_fibers >= _max_fibers())
+        return -EAGAIN;
+
+    return 1;
+}
+
+long myst_fiber_create(myst_thread_t* thread)
+{
+    long ret = 0;
+    const size_t num_carriers = _num_carriers();
+    myst_fiber_t* fiber = NULL;
+    size_t index;
+    carrier_t* c;
+    carrier_wake_t wake;
+
+    if (!thread || num_carriers == 0)
+        ERAISE(-EINVAL);
+
+    if (!(fiber = calloc(1, sizeof(myst_fiber_t))))
+        ERAISE(-ENOMEM);
+
+    if (!(fiber->stack = malloc(FIBER_STACK_SIZE)))
+        ERAISE(-ENOMEM);
+
+    /* pin the fiber to a carrier (round robin) */
+    index = _next_carrier++ % num_carriers;
+    c = &_carriers[index];
+    fiber->carrier = c;
+    fiber->thread = thread;
+
+    ECHECK(_start_carrier(c, index));
+
+    _num_fibers++;
+
+    myst_spin_lock(&c->lock);
+    {
+        _add_fiber(c, fiber);
+        _make_ready(c, fiber);
+        wake = _notify(c);
+    }
+    myst_spin_unlock(&c->lock);
+
+    fiber = NULL;
+
+    _wake(c, wake);
+
+done:
+
+    if (fiber)
+    {
+        free(fiber->stack);
+        free(fiber);
+    }
+
+    return ret;
+}
+
+myst_fiber_t* myst_fiber_self(void)
+{
+    uint64_t value;
+    myst_thread_t* thread;
+
+    /* fast path: no fibers (or fibers are disabled) */
+    if (_num_fibers == 0)
+        return NULL;
+
+    if (myst_tcall_get_tsd(&value) != 0)
+        return NULL;
+
+    thread = (myst_thread_t*)value;
+
+    if (!myst_valid_thread(thread) || !myst_is_fiber_event(thread->event))
+        return NULL;
+
+    return _event_to_fiber(thread->event);
+}
+
+size_t myst_fiber_count(void)
+{
+    return _num_fibers;
+}
+
+long myst_fiber_wait(uint64_t event, const struct timespec* timeout)
+{
+    myst_fiber_t* fiber = _event_to_fiber(event);
+    carrier_t* c = fiber->carrier;
+
+    myst_spin_lock(&c->lock);
+    myst_assume(c->current == fiber);
+
+    /* block if the counter was zero (see target/shared/waitwake.c) */
+    if (fiber->value-- == 0)
+    {
+        fiber->state = FIBER_WAITING;
+        fiber->timed_out = false;
+        fiber->deadline = timeout ? _now() + timespec_to_nanos(timeout) : 0;
+        _switch(c, fiber);
+
+        if (fiber->timed_out)
+        {
+            /* if the counter is still negative one, then reset to zero */
+            myst_spin_lock(&c->lock);
+            if (fiber->value == -1)
+                fiber->value = 0;
+            myst_spin_unlock(&c->lock);
+            return -ETIMEDOUT;
+        }
+
+        return 0;
+    }
+
+    myst_spin_unlock(&c->lock);
+    return 0;
+}
+
+long myst_fiber_wake(uint64_t event)
+{
+    long ret = 0;
+    myst_fiber_t* fiber = _event_to_fiber(event);
+    carrier_t* c = fiber->carrier;
+    carrier_wake_t wake = WAKE_NONE;
+
+    myst_spin_lock(&c->lock);
+    {
+        if (fiber->value++ != 0 && fiber->state == FIBER_WAITING)
+        {
+            _remove_timer(c, fiber);
+            _make_ready(c, fiber);
+            wake = _notify(c);
+            ret = 1;
+        }
+        else if (fiber->state == FIBER_SLEEPING)
+        {
+            /* signal delivery wakes the thread event: let the sleeper check
+             * for signals (a host nanosleep would be interrupted too) */
+            _remove_timer(c, fiber);
+            _make_ready(c, fiber);
+            wake = _notify(c);
+        }
+    }
+    myst_spin_unlock(&c->lock);
+
+    _wake(c, wake);
+
+    return ret;
+}
+
+long myst_fiber_sleep(const struct timespec* req, struct timespec* rem)
+{
+    long ret = 0;
+    myst_fiber_t* fiber;
+    myst_thread_t* self;
+    carrier_t* c;
+    long deadline;
+    long remaining;
+    bool waiting;
+
+    if (!req || !is_timespec_valid(req))
+        return -EINVAL;
+
+    if (!(fiber = myst_fiber_self()))
+        return -ENOTSUP;
+
+    c = fiber->carrier;
+    self = fiber->thread;
+    deadline = _now() + timespec_to_nanos(req);
+
+    /* signal delivery wakes the thread event while this is set */
+    waiting = self->signal.waiting_on_event;
+    self->signal.waiting_on_event = true;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    while ((remaining = deadline - _now()) > 0)
+    {
+        if (myst_signal_has_active_signals(self))
+        {
+            ret = -EINTR;
+            break;
+        }
+
+        myst_spin_lock(&c->lock);
+
+        /* the kernel is shutting down (see myst_fiber_shutdown()) */
+        if (c->stopping)
+        {
+            myst_spin_unlock(&c->lock);
+            ret = -EINTR;
+            break;
+        }
+
+        fiber->state = FIBER_SLEEPING;
+        fiber->deadline = deadline;
+        _switch(c, fiber);
+    }
+
+    self->signal.waiting_on_event = waiting;
+
+    if (rem)
+    {
+        if (ret == -EINTR)
+            nanos_to_timespec(rem, remaining);
+        else
+            memset(rem, 0, sizeof(struct timespec));
+    }
+
+    return ret;
+}
+
+long myst_fiber_yield(void)
+{
+    myst_fiber_t* fiber;
+    carrier_t* c;
+
+    if (!(fiber = myst_fiber_self()))
+        return -ENOTSUP;
+
+    c = fiber->carrier;
+
+    myst_spin_lock(&c->lock);
+    fiber->state = FIBER_READY;
+    fiber->deadline = 0;
+    _switch(c, fiber);
+
+    return 0;
+}
+
+/* park the calling fiber on the host poll set of its carrier until one of
+ * the fds is ready, the timeout expires, or a signal arrives; a wakeable
+ * poll also returns -EINTR when interrupted by myst_fiber_poll_wake() */
+static long _poll(struct pollfd* fds, nfds_t nfds, int timeout, bool wakeable)
+{
+    long ret = 0;
+    myst_fiber_t* fiber;
+    myst_thread_t* self;
+    carrier_t* c;
+    long deadline = 0;
+    bool waiting;
+
+    if (!(fiber = myst_fiber_self()))
+        return -ENOTSUP;
+
+    c = fiber->carrier;
+    self = fiber->thread;
+
+    if (timeout > 0)
+        deadline = _now() + (long)timeout * 1000000L;
+
+    /* signal delivery wakes the thread event while this is set */
+    waiting = self->signal.waiting_on_event;
+    self->signal.waiting_on_event = true;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (;;)
+    {
+        long params[6] = {(long)fds, nfds, 0};
+
+        /* the carrier thread may consume a wake of the target poll (see
+         * myst_tcall_poll_wake()), but myst_fiber_poll_wake() reports it */
+        if ((ret = myst_tcall(SYS_poll, params)) == -EINTR)
+            ret = 0;
+
+        if (ret != 0 || timeout == 0)
+            break;
+
+        if (deadline && _now() >= deadline)
+            break;
+
+        if (myst_signal_has_active_signals(self))
+        {
+            ret = -EINTR;
+            break;
+        }
+
+        /* other fibers may have grown the set since the last iteration */
+        if ((ret = _reserve_poll_fds(c, nfds)) != 0)
+            break;
+
+        myst_spin_lock(&c->lock);
+
+        /* the kernel is shutting down (see myst_fiber_shutdown()) */
+        if (c->stopping)
+        {
+            myst_spin_unlock(&c->lock);
+            ret = -EINTR;
+            break;
+        }
+
+        /* like the target waker, a wake is not lost on a fiber that has
+         * yet to park (e.g., between myst_poll_wait_begin() and here) */
+        if (wakeable && fiber->interrupted)
+        {
+            myst_spin_unlock(&c->lock);
+            ret = -EINTR;
+            break;
+        }
+
+        fiber->fds = fds;
+        fiber->nfds = nfds;
+        fiber->wakeable = wakeable;
+        _add_poller(c, fiber);
+
+        fiber->state = FIBER_SLEEPING;
+        fiber->deadline = deadline;
+        _switch(c, fiber);
+
+        /* woken by readiness, a timeout, a signal, or an interruption */
+        myst_spin_lock(&c->lock);
+        _remove_poller(c, fiber);
+        myst_spin_unlock(&c->lock);
+    }
+
+    if (wakeable)
+    {
+        myst_spin_lock(&c->lock);
+        fiber->interrupted = false;
+        myst_spin_unlock(&c->lock);
+    }
+
+    self->signal.waiting_on_event = waiting;
+
+    return ret;
+}
+
+long myst_fiber_poll(struct pollfd* fds, nfds_t nfds, int timeout)
+{
+    return _poll(fds, nfds, timeout, true);
+}
+
+long myst_fiber_poll_wake(void)
+{
+    const size_t num_carriers = _num_carriers();
+
+    if (_num_fibers == 0)
+        return 0;
+
+    for (size_t i = 0; i < num_carriers; i++)
+    {
+        carrier_t* c = &_carriers[i];
+        carrier_wake_t wake = WAKE_NONE;
+
+        myst_spin_lock(&c->lock);
+        {
+            for (myst_fiber_t* p = c->fibers; p; p = p->all_next)
+            {
+                p->interrupted = true;
+
+                if (p->polling && p->wakeable)
+                {
+                    _remove_poller(c, p);
+
+                    if (_unpark(c, p) && wake == WAKE_NONE)
+                        wake = _notify(c);
+                }
+            }
+        }
+        myst_spin_unlock(&c->lock);
+
+        _wake(c, wake);
+    }
+
+    return 0;
+}
+
+long myst_fiber_wait_host(int tfd, short events, int timeout)
+{
+    struct pollfd fds = {.fd = tfd, .events = events};
+    return _poll(&fds, 1, timeout, false);
+}
+
+long myst_fiber_wait_fd(int tfd, short events)
+{
+    long ret = 0;
+    struct pollfd fds = {.fd = tfd, .events = events};
+    long params[6] = {(long)&fds, 1, 0};
+    long args[6] = {tfd, F_GETFL};
+    long flags;
+
+    if (!myst_fiber_self())
+        return 0;
+
+    if (myst_tcall(SYS_poll, params) > 0)
+        return 0;
+
+    /* the host operation will not block on a non-blocking fd */
+    ECHECK((flags = myst_tcall(SYS_fcntl, args)));
+
+    if (!(flags & O_NONBLOCK))
+        ECHECK(myst_fiber_wait_host(tfd, events, -1));
+
+done:
+    return ret;
+}
+
+/* ask the carriers to stop and wake their parked fibers */
+static void _stop_carriers(void)
+{
+    for (size_t i = 0; i < MYST_MAX_FIBER_CARRIERS; i++)
+    {
+        carrier_t* c = &_carriers[i];
+        carrier_wake_t wake = WAKE_NONE;
+
+        myst_spin_lock(&c->lock);
+        {
+            c->stopping = true;
+
+            /* sleepers return -EINTR and waiters see a spurious wake, so
+             * killed threads get to process their signals and exit */
+            for (myst_fiber_t* p = c->fibers; p; p = p->all_next)
+                _unpark(c, p);
+
+            wake = _notify(c);
+        }
+        myst_spin_unlock(&c->lock);
+
+        _wake(c, wake);
+    }
+}
+
+void myst_fiber_shutdown(void)
+{
+    size_t waited = 0;
+
+    _stop_carriers();
+
+    /* wait for the carriers to run their remaining fibers and exit */
+    for (size_t i = 0; i < MYST_MAX_FIBER_CARRIERS; i++)
+    {
+        while (_carriers[i].state != CARRIER_STOPPED)
+        {
+            if (waited >= SHUTDOWN_TIMEOUT_MSEC)
+            {
+                /* abandon the carriers of fibers that never exit */
+                myst_eprintf(
+                    "kernel: abandoning %zu fibers at shutdown\n",
+                    myst_fiber_count());
+                return;
+            }
+
+            myst_sleep_msec(10);
+            waited += 10;
+
+            /* a fiber may have parked again before its thread was killed */
+            if (waited % SHUTDOWN_WAKE_MSEC == 0)
+                _stop_carriers();
+        }
+    }
+}
@@ -10,7 +10,6 @@
 #include <myst/fssig.h>
 #include <myst/hex.h>
 #include <myst/kernel.h>
-#include <myst/lockfs.h>
 #include <myst/mount.h>
 #include <myst/printf.h>
 #include <myst/process.h>
@@ -75,7 +74,6 @@ int myst_load_fs(
     int ret = 0;
     myst_blkdev_t* blkdev = NULL;
     myst_fs_t* fs = NULL;
-    myst_fs_t* ext2fs = NULL;
     int r;
     struct locals
     {
@@ -180,11 +178,25 @@ int myst_load_fs(
         blkdev = tmp;
     }
 
-    /* wrap ext2fs inside a lockfs */
-    ECHECK(ext2_create(blkdev, &ext2fs, resolve_cb));
-    ECHECK(myst_lockfs_init(ext2fs, &fs));
-    ECHECK(ext2_set_wrapper_fs(ext2fs, fs));
-    ext2fs = NULL;
+    /* cache decrypted and verified blocks (written back on fsync and sync);
+     * the Ext2CacheKB setting sizes the cache */
+    {
+        size_t size = __myst_kernel_args.ext2_cache_size;
+        size_t max_blocks;
+        myst_blkdev_t* tmp;
+
+        if (size == 0)
+            size = EXT2_DEFAULT_CACHE_KB * 1024;
+
+        if ((max_blocks = size / MYST_BLKSIZE) == 0)
+            max_blocks = 1;
+
+        ECHECK(myst_cacheblkdev_open(blkdev, max_blocks, &tmp));
+        blkdev = tmp;
+    }
+
+    /* ext2fs does its own locking (see ext2/ext2.c) */
+    ECHECK(ext2_create(blkdev, &fs, resolve_cb));
 
     blkdev = NULL;
     *fs_out = fs;
@@ -201,9 +213,6 @@ done:
     if (fs)
         (fs->fs_release)(fs);
 
-    if (ext2fs)
-        (ext2fs->fs_release)(ext2fs);
-
     return ret;
 }
 #endif /* MYST_ENABLE_EXT2FS */
@@ -1,125 +1,345 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
-#include <assert.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdint.h>
-#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <myst/clock.h>
-#include <myst/cond.h>
 #include <myst/eraise.h>
 #include <myst/mutex.h>
 #include <myst/process.h>
+#include <myst/signal.h>
 #include <myst/syscall.h>
+#include <myst/thread.h>
 #include <myst/time.h>
+#include <myst/timer.h>
+#include <myst/times.h>
 #include <myst/timeval.h>
 
-/* ATTN: currently the itimer is only for the single process case */
-typedef struct itimer
+/*
+**==============================================================================
+**
+** Interval timers (setitimer) and POSIX timers (timer_create) are both kept
+** in the table below and driven by the kernel timer thread (see timer.c).
+** Each entry arms a myst_timer_t for its next expiration. Entries measured
+** in CPU time (ITIMER_VIRTUAL and ITIMER_PROF) arm the kernel timer for the
+** remaining CPU time (the earliest wall-clock time they can expire) and
+** re-arm themselves if the CPU clock has not yet reached the deadline.
+**
+**==============================================================================
+*/
+
+#define MAX_TIMERS 256
+
+/* the timer_create() id of the first POSIX timer */
+#define POSIX_TIMER_BASE 0
+
+/* the kernel's struct sigevent layout (libc's layout differs) */
+struct ksigevent
 {
-    myst_cond_t cond;
-    uint64_t real_interval; /* ITIMER_REAL interval */
-    uint64_t real_value;    /* ITIMER_REAL value */
-    myst_mutex_t mutex;
-    _Atomic(int) initialized;
-} itimer_t;
+    union sigval sigev_value;
+    int sigev_signo;
+    int sigev_notify;
+    int sigev_tid;
+};
 
-static itimer_t _it;
+typedef enum ktimer_kind
+{
+    KTIMER_NONE = 0,
+    KTIMER_ITIMER,
+    KTIMER_POSIX,
+} ktimer_kind_t;
 
-/* get time as microseconds since epoch: return 0 on failure */
-static uint64_t _get_current_time(void)
+typedef struct ktimer
 {
-    uint64_t ret;
-    struct timespec ts;
-    struct timeval tv;
+    myst_timer_t timer;
+    ktimer_kind_t kind;
 
-    if (myst_syscall_clock_gettime(CLOCK_REALTIME, &ts) != 0)
-        return 0;
+    /* the owning process (and thread for SIGEV_THREAD_ID) */
+    pid_t pid;
+    pid_t tid;
 
-    /* downgrade from nanosecond to microsecond granularity */
-    tv.tv_sec = ts.tv_sec;
-    tv.tv_usec = ts.tv_nsec / 1000;
+    /* ITIMER_REAL, ITIMER_VIRTUAL, or ITIMER_PROF (for KTIMER_ITIMER) */
+    int which;
 
-    /* convert timeval to uint64 */
-    if (myst_timeval_to_uint64(&tv, &ret) != 0)
-        return 0;
+    /* the clock and notification (for KTIMER_POSIX) */
+    clockid_t clockid;
+    int notify;
+    int signo;
+    union sigval value;
 
-    return ret;
+    /* the clock value at the next expiration (zero if disarmed) */
+    uint64_t expires;
+
+    /* the reload interval in nanoseconds (zero if one-shot) */
+    uint64_t interval;
+
+    /* number of missed expirations of the last notification */
+    int overrun;
+} ktimer_t;
+
+static ktimer_t _timers[MAX_TIMERS];
+static myst_mutex_t _lock;
+
+static bool _is_cpu_itimer(const ktimer_t* t)
+{
+    return t->kind == KTIMER_ITIMER && t->which != ITIMER_REAL;
+}
+
+/* get the current value of the clock that drives this timer */
+static uint64_t _clock_now(const ktimer_t* t)
+{
+    if (t->kind == KTIMER_ITIMER && t->which == ITIMER_VIRTUAL)
+        return (uint64_t)myst_times_user_time();
+
+    if (t->kind == KTIMER_ITIMER && t->which == ITIMER_PROF)
+        return (uint64_t)(myst_times_user_time() + myst_times_system_time());
+
+    return myst_timer_now();
 }
 
-static void _update_and_check_expiration(uint64_t start, uint64_t end)
+static myst_thread_t* _find_thread_in_process(myst_process_t* process, int tid)
 {
-    uint64_t elapsed = end - start;
+    myst_thread_t* thread = process->main_process_thread;
+    myst_thread_t* t;
 
-    /* update the timer */
-    if (elapsed < _it.real_value)
-        _it.real_value -= elapsed;
+    for (t = thread; t; t = t->group_next)
+    {
+        if (t->tid == tid)
+            return t;
+    }
+
+    for (t = thread->group_prev; t; t = t->group_prev)
+    {
+        if (t->tid == tid)
+            return t;
+    }
+
+    return NULL;
+}
+
+/* deliver the signal to the process (or one of its threads) */
+static void _deliver(pid_t pid, pid_t tid, siginfo_t* siginfo)
+{
+    myst_process_t* process;
+    myst_thread_t* target = NULL;
+
+    myst_spin_lock(&myst_process_list_lock);
+
+    if ((process = myst_find_process_from_pid(pid, false)))
+    {
+        target = process->main_process_thread;
+
+        if (tid)
+        {
+            myst_thread_t* thread;
+
+            myst_spin_lock(&process->thread_group_lock);
+            thread = _find_thread_in_process(process, tid);
+            myst_spin_unlock(&process->thread_group_lock);
+
+            if (thread)
+                target = thread;
+        }
+    }
+
+    if (target)
+        myst_signal_deliver(target, siginfo->si_signo, siginfo);
     else
-        _it.real_value = 0;
+        free(siginfo);
+
+    myst_spin_unlock(&myst_process_list_lock);
+}
 
-    /* if timer expired */
-    if (_it.real_value == 0)
+/* arm the kernel timer for the next expiration (called with _lock held) */
+static void _arm(ktimer_t* t)
+{
+    uint64_t now = _clock_now(t);
+    uint64_t deadline;
+
+    if (_is_cpu_itimer(t))
     {
-        myst_syscall_kill(myst_getpid(), SIGALRM);
-        _it.real_value = _it.real_interval;
+        /* the CPU clock cannot advance faster than the wall clock */
+        deadline = myst_timer_now() + (t->expires - now);
     }
+    else
+    {
+        deadline = t->expires;
+    }
+
+    myst_timer_arm(&t->timer, deadline);
 }
 
-long myst_syscall_run_itimer(void)
+/* the kernel timer callback (runs on the timer thread) */
+static void _expired(myst_timer_t* timer, void* arg)
 {
-    myst_mutex_lock(&_it.mutex);
+    ktimer_t* t = (ktimer_t*)arg;
+    siginfo_t* siginfo = NULL;
+    pid_t pid = 0;
+    pid_t tid = 0;
+
+    (void)timer;
+
+    myst_mutex_lock(&_lock);
     {
-        _it.initialized = 1;
+        uint64_t now;
 
-        for (;;)
+        /* ignore stale expirations of disarmed or deleted timers */
+        if (t->kind == KTIMER_NONE || t->expires == 0)
         {
-            struct timespec buf;
-            struct timespec* to;
+            myst_mutex_unlock(&_lock);
+            return;
+        }
 
-            /* if ITIMER_REAL is non-zero */
-            if (_it.real_value == 0)
-            {
-                to = NULL;
-            }
-            else
-            {
-                size_t PULSE = MICRO_IN_SECOND / 1000; /* one millisecond */
-                size_t min = PULSE;
+        now = _clock_now(t);
 
-                if (_it.real_value < min)
-                    min = _it.real_value;
+        if (now < t->expires)
+        {
+            /* fired early (CPU timers or a re-armed timer) */
+            _arm(t);
+            myst_mutex_unlock(&_lock);
+            return;
+        }
 
-                to = &buf;
-                to->tv_sec = min / 1000000;
-                to->tv_nsec = (min * 1000) % NANO_IN_SECOND;
-            }
+        t->overrun = 0;
 
-            uint64_t start = _get_current_time();
-            int r = myst_cond_timedwait(&_it.cond, &_it.mutex, to);
-            uint64_t end = _get_current_time();
+        if (t->interval)
+        {
+            uint64_t missed = (now - t->expires) / t->interval;
 
-            assert(start != 0);
-            assert(end != 0);
-            assert(end >= start);
+            t->overrun = (missed > INT_MAX) ? INT_MAX : (int)missed;
+            t->expires += (missed + 1) * t->interval;
+            _arm(t);
+        }
+        else
+        {
+            t->expires = 0;
+        }
 
-            /* if recieved a signal on condition */
-            if (r == 0)
+        if (t->kind == KTIMER_POSIX && t->notify == SIGEV_NONE)
+        {
+            myst_mutex_unlock(&_lock);
+            return;
+        }
+
+        if ((siginfo = calloc(1, sizeof(siginfo_t))))
+        {
+            if (t->kind == KTIMER_ITIMER)
             {
-                /* no-op */
+                static const int _signals[] = {SIGALRM, SIGVTALRM, SIGPROF};
+                siginfo->si_signo = _signals[t->which];
+                siginfo->si_code = SI_KERNEL;
             }
-            else if (r == -ETIMEDOUT)
+            else
             {
-                _update_and_check_expiration(start, end);
+                siginfo->si_signo = t->signo;
+                siginfo->si_code = SI_TIMER;
+                siginfo->si_value = t->value;
+                siginfo->si_timerid = (int)(t - _timers) + POSIX_TIMER_BASE;
+                siginfo->si_overrun = t->overrun;
             }
         }
+
+        pid = t->pid;
+        tid = t->tid;
+    }
+    myst_mutex_unlock(&_lock);
+
+    if (siginfo)
+        _deliver(pid, tid, siginfo);
+}
+
+/* find the itimer of the given process (called with _lock held) */
+static ktimer_t* _find_itimer(pid_t pid, int which, bool create)
+{
+    ktimer_t* free_slot = NULL;
+
+    for (size_t i = 0; i < MAX_TIMERS; i++)
+    {
+        ktimer_t* t = &_timers[i];
+
+        if (t->kind == KTIMER_ITIMER && t->pid == pid && t->which == which)
+            return t;
+
+        if (t->kind == KTIMER_NONE && !free_slot)
+            free_slot = t;
     }
-    myst_mutex_unlock(&_it.mutex);
 
+    if (!create || !free_slot)
+        return NULL;
+
+    memset(free_slot, 0, sizeof(ktimer_t));
+    myst_timer_init(&free_slot->timer, _expired, free_slot);
+    free_slot->kind = KTIMER_ITIMER;
+    free_slot->pid = pid;
+    free_slot->which = which;
+
+    return free_slot;
+}
+
+/* find the POSIX timer of the calling process (called with _lock held) */
+static ktimer_t* _find_posix_timer(int timerid)
+{
+    ktimer_t* t;
+
+    if (timerid < POSIX_TIMER_BASE || timerid >= POSIX_TIMER_BASE + MAX_TIMERS)
+        return NULL;
+
+    t = &_timers[timerid - POSIX_TIMER_BASE];
+
+    if (t->kind != KTIMER_POSIX || t->pid != myst_getpid())
+        return NULL;
+
+    return t;
+}
+
+/* get the time until the next expiration (called with _lock held) */
+static uint64_t _remaining(const ktimer_t* t)
+{
+    uint64_t now;
+
+    if (t->expires == 0)
+        return 0;
+
+    now = _clock_now(t);
+
+    /* report at least one nanosecond until the signal is sent */
+    return (t->expires > now) ? t->expires - now : 1;
+}
+
+static int _timeval_to_nanos(const struct timeval* tv, uint64_t* nanos)
+{
+    uint64_t usecs;
+
+    if (myst_timeval_to_uint64(tv, &usecs) != 0)
+        return -EINVAL;
+
+    *nanos = usecs * 1000;
     return 0;
 }
 
+static void _nanos_to_timeval(uint64_t nanos, struct timeval* tv)
+{
+    /* round up so that a running timer never reads as zero */
+    myst_uint64_to_timeval((nanos + 999) / 1000, tv);
+}
+
+/*
+**==============================================================================
+**
+** setitimer() and getitimer():
+**
+**==============================================================================
+*/
+
+long myst_syscall_run_itimer(void)
+{
+    return myst_run_timers();
+}
+
 long myst_syscall_setitimer(
     int which,
     const struct itimerval* new_value,
@@ -128,41 +348,47 @@ long myst_syscall_setitimer(
     long ret = 0;
     uint64_t interval;
     uint64_t value;
+    ktimer_t* t;
 
-    /* ATTN: only ITIMER_REAL is supported so far */
-    if (which != ITIMER_REAL || !new_value)
+    if (which < ITIMER_REAL || which > ITIMER_PROF || !new_value)
         ERAISE(-EINVAL);
 
-    /* convert new_value to uint64_t */
-    ECHECK(myst_timeval_to_uint64(&new_value->it_interval, &interval));
-    ECHECK(myst_timeval_to_uint64(&new_value->it_value, &value));
+    ECHECK(_timeval_to_nanos(&new_value->it_interval, &interval));
+    ECHECK(_timeval_to_nanos(&new_value->it_value, &value));
 
-    /* wait for itimer thread to obtain the mutex for the first time */
-    while (_it.initialized == 0)
+    myst_mutex_lock(&_lock);
     {
-        __asm__ __volatile__("pause" : : : "memory");
-    }
+        if (!(t = _find_itimer(myst_getpid(), which, value != 0)))
+        {
+            if (old_value)
+                memset(old_value, 0, sizeof(struct itimerval));
+
+            myst_mutex_unlock(&_lock);
+            goto done;
+        }
 
-    myst_mutex_lock(&_it.mutex);
-    {
         if (old_value)
         {
-            myst_uint64_to_timeval(_it.real_interval, &old_value->it_interval);
-            myst_uint64_to_timeval(_it.real_value, &old_value->it_value);
+            _nanos_to_timeval(t->interval, &old_value->it_interval);
+            _nanos_to_timeval(_remaining(t), &old_value->it_value);
         }
 
-        /* set the new value for the itimer */
-        _it.real_interval = interval;
-        _it.real_value = value;
+        t->interval = interval;
 
-        /* signal the itimer thread */
-        if (myst_cond_signal(&_it.cond) != 0)
+        if (value)
         {
-            myst_mutex_unlock(&_it.mutex);
-            ERAISE(-ENOSYS);
+            t->expires = _clock_now(t) + value;
+            _arm(t);
+        }
+        else
+        {
+            /* disarm and release the slot (callbacks ignore stale fires) */
+            myst_timer_disarm(&t->timer);
+            t->expires = 0;
+            t->kind = KTIMER_NONE;
         }
     }
-    myst_mutex_unlock(&_it.mutex);
+    myst_mutex_unlock(&_lock);
 
 done:
     return ret;
@@ -171,19 +397,266 @@ done:
 int myst_syscall_getitimer(int which, struct itimerval* curr_value)
 {
     int ret = 0;
+    ktimer_t* t;
 
     if (curr_value)
         memset(curr_value, 0, sizeof(struct itimerval));
 
-    /* ATTN: only ITIMER_REAL is supported so far */
-    if (which != ITIMER_REAL || !curr_value)
+    if (which < ITIMER_REAL || which > ITIMER_PROF || !curr_value)
+        ERAISE(-EINVAL);
+
+    myst_mutex_lock(&_lock);
+    {
+        if ((t = _find_itimer(myst_getpid(), which, false)))
+        {
+            _nanos_to_timeval(t->interval, &curr_value->it_interval);
+            _nanos_to_timeval(_remaining(t), &curr_value->it_value);
+        }
+    }
+    myst_mutex_unlock(&_lock);
+
+done:
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** timer_create() and friends:
+**
+**==============================================================================
+*/
+
+long myst_syscall_timer_create(
+    clockid_t clockid,
+    struct sigevent* sevp,
+    int* timerid)
+{
+    long ret = 0;
+    const struct ksigevent* sev = (const struct ksigevent*)sevp;
+    ktimer_t* t = NULL;
+    int notify = SIGEV_SIGNAL;
+    int signo = SIGALRM;
+    pid_t tid = 0;
+
+    if (!timerid)
         ERAISE(-EINVAL);
 
-    myst_mutex_lock(&_it.mutex);
-    myst_uint64_to_timeval(_it.real_value, &curr_value->it_value);
-    myst_uint64_to_timeval(_it.real_interval, &curr_value->it_interval);
-    myst_mutex_unlock(&_it.mutex);
+    switch (clockid)
+    {
+        case CLOCK_REALTIME:
+        case CLOCK_MONOTONIC:
+        case CLOCK_BOOTTIME:
+            break;
+        default:
+            ERAISE(-EINVAL);
+    }
+
+    if (sev)
+    {
+        notify = sev->sigev_notify;
+        signo = sev->sigev_signo;
+
+        switch (notify)
+        {
+            case SIGEV_NONE:
+                break;
+            case SIGEV_SIGNAL:
+            case SIGEV_THREAD_ID:
+            {
+                if (signo < 1 || signo > NSIG - 1)
+                    ERAISE(-EINVAL);
+
+                if (notify == SIGEV_THREAD_ID)
+                    tid = sev->sigev_tid;
+
+                break;
+            }
+            default:
+                /* SIGEV_THREAD is implemented by libc with SIGEV_THREAD_ID */
+                ERAISE(-EINVAL);
+        }
+    }
+
+    myst_mutex_lock(&_lock);
+    {
+        for (size_t i = 0; i < MAX_TIMERS; i++)
+        {
+            if (_timers[i].kind == KTIMER_NONE)
+            {
+                t = &_timers[i];
+                break;
+            }
+        }
+
+        if (!t)
+        {
+            myst_mutex_unlock(&_lock);
+            ERAISE(-EAGAIN);
+        }
+
+        memset(t, 0, sizeof(ktimer_t));
+        myst_timer_init(&t->timer, _expired, t);
+        t->kind = KTIMER_POSIX;
+        t->pid = myst_getpid();
+        t->tid = tid;
+        t->clockid = clockid;
+        t->notify = notify;
+        t->signo = signo;
+        *timerid = (int)(t - _timers) + POSIX_TIMER_BASE;
+
+        /* the default notification value is the timer id */
+        if (sev)
+            t->value = sev->sigev_value;
+        else
+            t->value.sival_int = *timerid;
+    }
+    myst_mutex_unlock(&_lock);
 
 done:
     return ret;
 }
+
+long myst_syscall_timer_settime(
+    int timerid,
+    int flags,
+    const struct itimerspec* new_value,
+    struct itimerspec* old_value)
+{
+    long ret = 0;
+    ktimer_t* t;
+    uint64_t interval;
+    uint64_t value;
+
+    if (!new_value || !is_timespec_valid(&new_value->it_value) ||
+        !is_timespec_valid(&new_value->it_interval))
+    {
+        ERAISE(-EINVAL);
+    }
+
+    interval = (uint64_t)timespec_to_nanos(&new_value->it_interval);
+    value = (uint64_t)timespec_to_nanos(&new_value->it_value);
+
+    myst_mutex_lock(&_lock);
+    {
+        if (!(t = _find_posix_timer(timerid)))
+        {
+            myst_mutex_unlock(&_lock);
+            ERAISE(-EINVAL);
+        }
+
+        if (old_value)
+        {
+            nanos_to_timespec(&old_value->it_interval, (long)t->interval);
+            nanos_to_timespec(&old_value->it_value, (long)_remaining(t));
+        }
+
+        t->interval = interval;
+        t->overrun = 0;
+
+        if (value == 0)
+        {
+            myst_timer_disarm(&t->timer);
+            t->expires = 0;
+        }
+        else
+        {
+            t->expires = myst_timer_deadline(
+                t->clockid, &new_value->it_value, flags & TIMER_ABSTIME);
+
+            _arm(t);
+        }
+    }
+    myst_mutex_unlock(&_lock);
+
+done:
+    return ret;
+}
+
+long myst_syscall_timer_gettime(int timerid, struct itimerspec* curr_value)
+{
+    long ret = 0;
+    ktimer_t* t;
+
+    if (!curr_value)
+        ERAISE(-EINVAL);
+
+    myst_mutex_lock(&_lock);
+    {
+        if (!(t = _find_posix_timer(timerid)))
+        {
+            myst_mutex_unlock(&_lock);
+            ERAISE(-EINVAL);
+        }
+
+        nanos_to_timespec(&curr_value->it_interval, (long)t->interval);
+        nanos_to_timespec(&curr_value->it_value, (long)_remaining(t));
+    }
+    myst_mutex_unlock(&_lock);
+
+done:
+    return ret;
+}
+
+long myst_syscall_timer_getoverrun(int timerid)
+{
+    long ret = 0;
+    ktimer_t* t;
+
+    myst_mutex_lock(&_lock);
+    {
+        if (!(t = _find_posix_timer(timerid)))
+        {
+            myst_mutex_unlock(&_lock);
+            ERAISE(-EINVAL);
+        }
+
+        ret = t->overrun;
+    }
+    myst_mutex_unlock(&_lock);
+
+done:
+    return ret;
+}
+
+long myst_syscall_timer_delete(int timerid)
+{
+    long ret = 0;
+    ktimer_t* t;
+
+    myst_mutex_lock(&_lock);
+    {
+        if (!(t = _find_posix_timer(timerid)))
+        {
+            myst_mutex_unlock(&_lock);
+            ERAISE(-EINVAL);
+        }
+
+        myst_timer_disarm(&t->timer);
+        t->expires = 0;
+        t->kind = KTIMER_NONE;
+    }
+    myst_mutex_unlock(&_lock);
+
+done:
+    return ret;
+}
+
+void myst_release_process_timers(pid_t pid)
+{
+    myst_mutex_lock(&_lock);
+    {
+        for (size_t i = 0; i < MAX_TIMERS; i++)
+        {
+            ktimer_t* t = &_timers[i];
+
+            if (t->kind != KTIMER_NONE && t->pid == pid)
+            {
+                myst_timer_disarm(&t->timer);
+                t->expires = 0;
+                t->kind = KTIMER_NONE;
+            }
+        }
+    }
+    myst_mutex_unlock(&_lock);
+}
@@ -47,9 +47,9 @@ int myst_limit_set_default(struct rlimit rlimits[])
     rlimits[RLIMIT_NPROC].rlim_cur = __myst_kernel_args.max_threads;
     rlimits[RLIMIT_NPROC].rlim_max = __myst_kernel_args.max_threads;
 
-    // RLIMIT_NOFILE
+    // RLIMIT_NOFILE (the fdtable grows up to the soft limit)
     rlimits[RLIMIT_NOFILE].rlim_cur = MYST_FDTABLE_SIZE;
-    rlimits[RLIMIT_NOFILE].rlim_max = MYST_FDTABLE_SIZE;
+    rlimits[RLIMIT_NOFILE].rlim_max = MYST_FDTABLE_MAX_SIZE;
 
     // RLIMIT_MEMLOCK (unsupported)
     rlimits[RLIMIT_MEMLOCK].rlim_cur = 0;
@@ -140,6 +140,9 @@ done:
 int myst_limit_set_rlimit(pid_t pid, int resource, struct rlimit* rlim)
 {
     int ret = 0;
+    myst_process_t* process;
+    bool locked = false;
+
     if (!rlim)
         ERAISE(-EFAULT);
 
@@ -154,6 +157,34 @@ int myst_limit_set_rlimit(pid_t pid, int resource, struct rlimit* rlim)
     // and tests/glibc (RLIMIT_STACK)
     if (resource != RLIMIT_NOFILE && resource != RLIMIT_STACK)
         ERAISE(-EINVAL);
+
+    if (resource == RLIMIT_NOFILE)
+    {
+        if (rlim->rlim_cur > rlim->rlim_max)
+            ERAISE(-EINVAL);
+
+        if (rlim->rlim_max > MYST_FDTABLE_MAX_SIZE)
+            ERAISE(-EPERM);
+
+        myst_spin_lock(&myst_process_list_lock);
+        locked = true;
+
+        if (pid == 0)
+            process = myst_thread_self()->process;
+        else if (!(process = myst_find_process_from_pid(pid, false)))
+            ERAISE(-ESRCH);
+
+        if (process->fdtable)
+            ECHECK(myst_fdtable_set_limit(process->fdtable, rlim->rlim_cur));
+
+        process->rlimits[resource].rlim_cur = rlim->rlim_cur;
+        process->rlimits[resource].rlim_max = rlim->rlim_max;
+    }
+
 done:
+
+    if (locked)
+        myst_spin_unlock(&myst_process_list_lock);
+
     return ret;
 }
@@ -26,6 +26,7 @@
 #include <myst/procfs.h>
 #include <myst/refstr.h>
 #include <myst/round.h>
+#include <myst/spinlock.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
 #include <myst/trace.h>
@@ -687,6 +688,8 @@ int myst_get_free_ram(size_t* size)
     return myst_mman_free_size(&_mman, size);
 }
 
+static void _stack_cache_forget_process(pid_t pid);
+
 /* release mappings owned by the given process */
 int myst_release_process_mappings(pid_t pid)
 {
@@ -699,6 +702,9 @@ int myst_release_process_mappings(pid_t pid)
     if (pid <= 0)
         ERAISE(-EINVAL);
 
+    /* threads of this process will never be joined */
+    _stack_cache_forget_process(pid);
+
     {
         uint8_t* addr = (uint8_t*)_mman.map;
         size_t length = ((uint8_t*)_mman.end) - addr;
@@ -1220,3 +1226,240 @@ void myst_mman_unlock(void)
 {
     myst_rspin_unlock(&_mman.lock);
 }
+
+/*
+**==============================================================================
+**
+** thread stack cache:
+**
+**     The C runtime maps a region for every new thread (guard page, stack,
+**     and TLS) and releases it when the thread exits, either with
+**     SYS_myst_unmap_on_exit (detached threads) or with munmap() from the
+**     joining thread. When the ThreadStackCacheSize setting is non-zero,
+**     these regions stay mapped and are handed back to the next anonymous
+**     mmap() of the same size, so thread churn neither takes the VAD gap
+**     search nor fragments the VAD list.
+**
+**==============================================================================
+*/
+
+#define MAX_STACK_CACHE_SIZE 256
+
+typedef struct stack_cache_entry
+{
+    void* addr;
+    size_t length;
+} stack_cache_entry_t;
+
+/* C-runtime thread descriptors of exited threads that are not yet joined */
+typedef struct stack_cache_expected
+{
+    const void* td;
+    pid_t pid;
+} stack_cache_expected_t;
+
+static stack_cache_entry_t _stack_cache[MAX_STACK_CACHE_SIZE];
+static size_t _stack_cache_count;
+static stack_cache_expected_t _stack_cache_expected[MAX_STACK_CACHE_SIZE];
+static size_t _stack_cache_expected_count;
+static myst_spinlock_t _stack_cache_lock = MYST_SPINLOCK_INITIALIZER;
+static myst_once_t _stack_cache_atexit_once;
+
+static size_t _stack_cache_capacity(void)
+{
+    const size_t n = __myst_kernel_args.thread_stack_cache_size;
+    return (n < MAX_STACK_CACHE_SIZE) ? n : MAX_STACK_CACHE_SIZE;
+}
+
+static void _free_stack_cache(void* arg)
+{
+    (void)arg;
+
+    myst_spin_lock(&_stack_cache_lock);
+    {
+        while (_stack_cache_count)
+        {
+            stack_cache_entry_t* p = &_stack_cache[--_stack_cache_count];
+            myst_munmap(p->addr, p->length);
+        }
+
+        _stack_cache_expected_count = 0;
+    }
+    myst_spin_unlock(&_stack_cache_lock);
+}
+
+static void _stack_cache_atexit(void)
+{
+    myst_atexit(_free_stack_cache, NULL);
+}
+
+int myst_stack_cache_put(void* addr, size_t length)
+{
+    int ret = 0;
+    bool cached = false;
+    fdlist_t* head = NULL;
+
+    /* not an error: the caller unmaps the region instead */
+    if (_stack_cache_capacity() == 0)
+        return -ENOSYS;
+
+    if (!addr || ((uint64_t)addr % PAGE_SIZE) || !length)
+        ERAISE(-EINVAL);
+
+    ECHECK(myst_round_up(length, PAGE_SIZE, &length));
+    ECHECK(_get_page_index(addr, length));
+
+    /* the region is no longer owned by any process */
+    ECHECK(_remove_file_mappings(addr, length, &head));
+    _close_file_handles(head);
+    ECHECK(myst_mman_pids_set(addr, length, 0));
+
+    myst_once(&_stack_cache_atexit_once, _stack_cache_atexit);
+
+    myst_spin_lock(&_stack_cache_lock);
+    {
+        if (_stack_cache_count < _stack_cache_capacity())
+        {
+            _stack_cache[_stack_cache_count].addr = addr;
+            _stack_cache[_stack_cache_count].length = length;
+            _stack_cache_count++;
+            cached = true;
+        }
+    }
+    myst_spin_unlock(&_stack_cache_lock);
+
+    if (!cached)
+        ret = -ENOSPC;
+
+done:
+    return ret;
+}
+
+long myst_stack_cache_mmap(void* addr, size_t length, int prot, int flags)
+{
+    stack_cache_entry_t entry = {NULL, 0};
+    const int mask = MYST_MAP_PRIVATE | MYST_MAP_ANONYMOUS | MYST_MAP_FIXED;
+
+    /* only satisfy private anonymous mappings at any address */
+    if (addr || (flags & mask) != (MYST_MAP_PRIVATE | MYST_MAP_ANONYMOUS))
+        return 0;
+
+    if (!length || (prot & (~MYST_PROT_MMAP_MASK)))
+        return 0;
+
+    if (myst_round_up(length, PAGE_SIZE, &length) != 0)
+        return 0;
+
+    myst_spin_lock(&_stack_cache_lock);
+    {
+        /* prefer the most recently released region */
+        for (size_t i = _stack_cache_count; i > 0; i--)
+        {
+            if (_stack_cache[i - 1].length == length)
+            {
+                entry = _stack_cache[i - 1];
+                _stack_cache[i - 1] = _stack_cache[--_stack_cache_count];
+                break;
+            }
+        }
+    }
+    myst_spin_unlock(&_stack_cache_lock);
+
+    if (!entry.addr)
+        return 0;
+
+    /* zero-fill, then restore the requested protection (including any
+     * PROT_NONE guard page, which the C runtime splits off afterwards) */
+    if (myst_mprotect(entry.addr, length, PROT_READ | PROT_WRITE) != 0)
+        goto failed;
+
+    memset(entry.addr, 0, length);
+
+    if (prot != (PROT_READ | PROT_WRITE) &&
+        myst_mprotect(entry.addr, length, prot) != 0)
+    {
+        goto failed;
+    }
+
+    return (long)entry.addr;
+
+failed:
+    myst_munmap(entry.addr, length);
+    return 0;
+}
+
+void myst_stack_cache_expect(pid_t pid, const void* td)
+{
+    if (_stack_cache_capacity() == 0 || !td)
+        return;
+
+    myst_spin_lock(&_stack_cache_lock);
+    {
+        /* if full, forget the oldest thread that was never joined */
+        if (_stack_cache_expected_count == MAX_STACK_CACHE_SIZE)
+        {
+            memmove(
+                &_stack_cache_expected[0],
+                &_stack_cache_expected[1],
+                (MAX_STACK_CACHE_SIZE - 1) * sizeof(stack_cache_expected_t));
+            _stack_cache_expected_count--;
+        }
+
+        _stack_cache_expected[_stack_cache_expected_count].td = td;
+        _stack_cache_expected[_stack_cache_expected_count].pid = pid;
+        _stack_cache_expected_count++;
+    }
+    myst_spin_unlock(&_stack_cache_lock);
+}
+
+int myst_stack_cache_munmap(void* addr, size_t length)
+{
+    bool found = false;
+    const uint8_t* start = addr;
+    const uint8_t* end = start + length;
+
+    if (_stack_cache_capacity() == 0)
+        return -ENOSYS;
+
+    myst_spin_lock(&_stack_cache_lock);
+    {
+        for (size_t i = 0; i < _stack_cache_expected_count; i++)
+        {
+            const uint8_t* td = _stack_cache_expected[i].td;
+
+            if (td >= start && td < end)
+            {
+                _stack_cache_expected[i] =
+                    _stack_cache_expected[--_stack_cache_expected_count];
+                found = true;
+                break;
+            }
+        }
+    }
+    myst_spin_unlock(&_stack_cache_lock);
+
+    if (!found)
+        return -ENOENT;
+
+    return myst_stack_cache_put(addr, length);
+}
+
+static void _stack_cache_forget_process(pid_t pid)
+{
+    myst_spin_lock(&_stack_cache_lock);
+    {
+        for (size_t i = 0; i < _stack_cache_expected_count;)
+        {
+            if (_stack_cache_expected[i].pid == pid)
+            {
+                _stack_cache_expected[i] =
+                    _stack_cache_expected[--_stack_cache_expected_count];
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+    myst_spin_unlock(&_stack_cache_lock);
+}
@@ -7,6 +7,7 @@
 #include <myst/atexit.h>
 #include <myst/blkdev.h>
 #include <myst/cpio.h>
+#include <myst/dcache.h>
 #include <myst/eraise.h>
 #include <myst/ext2.h>
 #include <myst/file.h>
@@ -15,6 +16,7 @@
 #include <myst/hostfs.h>
 #include <myst/kernel.h>
 #include <myst/mount.h>
+#include <myst/mutex.h>
 #include <myst/paths.h>
 #include <myst/printf.h>
 #include <myst/pubkey.h>
@@ -44,8 +46,200 @@ static mount_table_entry_t _mount_table[MOUNT_TABLE_SIZE];
 static size_t _mount_table_size = 0;
 static myst_spinlock_t _lock = MYST_SPINLOCK_INITIALIZER;
 
+/* held while file systems are released or synced, so that myst_mount_sync()
+ * can sync without holding _lock (which path resolution needs) */
+static myst_mutex_t _release_mutex;
+
 static bool _installed_free_mount_table = false;
 
+/*
+**==============================================================================
+**
+** mount resolution cache:
+**
+**     Caches the mount resolution of directories (the directory part of
+**     resolved paths). A path resolves like its directory unless a mount
+**     point is a direct child of that directory, which is recorded in the
+**     entry. The cache is direct-mapped, guarded by _lock and cleared by
+**     every change of the mount table.
+**
+**==============================================================================
+*/
+
+#define MOUNT_CACHE_SIZE 64
+#define MOUNT_CACHE_DIR_MAX 256
+
+typedef struct mount_cache_entry
+{
+    size_t dirlen; /* zero for an unused entry */
+    char dir[MOUNT_CACHE_DIR_MAX];
+    myst_fs_t* fs;
+    size_t skip;        /* the length of the mount path (0 for root) */
+    bool child_mounts;  /* a mount point is a direct child of dir */
+} mount_cache_entry_t;
+
+static mount_cache_entry_t _mount_cache[MOUNT_CACHE_SIZE];
+
+/* called with _lock held whenever the mount table changes */
+static void _mount_cache_clear(void)
+{
+    for (size_t i = 0; i < MOUNT_CACHE_SIZE; i++)
+        _mount_cache[i].dirlen = 0;
+}
+
+static size_t _mount_cache_slot(const char* dir, size_t dirlen)
+{
+    /* FNV-1a */
+    uint64_t h = 14695981039346656037UL;
+
+    for (size_t i = 0; i < dirlen; i++)
+    {
+        h ^= (uint8_t)dir[i];
+        h *= 1099511628211UL;
+    }
+
+    return h % MOUNT_CACHE_SIZE;
+}
+
+/* the length of the directory part of a resolved path (1 for "/x") */
+static size_t _dirlen(const char* path, size_t len)
+{
+    while (len > 1 && path[len - 1] != '/')
+        len--;
+
+    return len > 1 ? len - 1 : 1;
+}
+
+/* whether an absolute path is already in the form myst_realpath() produces:
+ * no empty, "." or ".." elements and no trailing slash */
+static bool _is_resolved(const char* path)
+{
+    const char* p = path;
+
+    if (*p != '/')
+        return false;
+
+    if (p[1] == '\0')
+        return true;
+
+    while (*p)
+    {
+        /* p points to a slash that starts an element */
+        const char* elem = ++p;
+
+        while (*p && *p != '/')
+            p++;
+
+        switch (p - elem)
+        {
+            case 0:
+                return false;
+            case 1:
+                if (elem[0] == '.')
+                    return false;
+                break;
+            case 2:
+                if (elem[0] == '.' && elem[1] == '.')
+                    return false;
+                break;
+        }
+    }
+
+    return true;
+}
+
+/* find the longest mount path that contains the given path (of length len);
+ * also tells whether a mount point is a direct child of it */
+static void _mount_table_find(
+    const char* path,
+    size_t len,
+    myst_fs_t** fs_out,
+    size_t* skip_out,
+    bool* child_mounts_out)
+{
+    size_t match_len = 0;
+    bool child_mounts = false;
+
+    *fs_out = NULL;
+    *skip_out = 0;
+
+    for (size_t i = 0; i < _mount_table_size; i++)
+    {
+        const char* mpath = _mount_table[i].path;
+        size_t mlen = strlen(mpath);
+
+        if (mpath[0] == '/' && mpath[1] == '\0')
+        {
+            if (mlen > match_len)
+            {
+                match_len = mlen;
+                *fs_out = _mount_table[i].fs;
+                *skip_out = 0;
+            }
+
+            continue;
+        }
+
+        if (mlen <= len && strncmp(mpath, path, mlen) == 0 &&
+            (mlen == len || path[mlen] == '/'))
+        {
+            if (mlen > match_len)
+            {
+                match_len = mlen;
+                *fs_out = _mount_table[i].fs;
+                *skip_out = mlen;
+            }
+        }
+        else if (
+            _dirlen(mpath, mlen) == len && strncmp(mpath, path, len) == 0)
+        {
+            child_mounts = true;
+        }
+    }
+
+    if (child_mounts_out)
+        *child_mounts_out = child_mounts;
+}
+
+/* resolve a resolved path through the cache (called with _lock held) */
+static void _mount_cache_find(
+    const char* path,
+    myst_fs_t** fs_out,
+    size_t* skip_out)
+{
+    size_t len = strlen(path);
+    size_t dirlen;
+    mount_cache_entry_t* entry;
+
+    dirlen = _dirlen(path, len);
+
+    if (len == 1 || dirlen >= MOUNT_CACHE_DIR_MAX)
+    {
+        _mount_table_find(path, len, fs_out, skip_out, NULL);
+        return;
+    }
+
+    entry = &_mount_cache[_mount_cache_slot(path, dirlen)];
+
+    if (entry->dirlen != dirlen || memcmp(entry->dir, path, dirlen) != 0)
+    {
+        memcpy(entry->dir, path, dirlen);
+        entry->dirlen = dirlen;
+        _mount_table_find(
+            path, dirlen, &entry->fs, &entry->skip, &entry->child_mounts);
+    }
+
+    if (entry->child_mounts)
+    {
+        /* the path itself may be a mount point */
+        _mount_table_find(path, len, fs_out, skip_out, NULL);
+        return;
+    }
+
+    *fs_out = entry->fs;
+    *skip_out = entry->skip;
+}
+
 static void _free_mount_table(void* arg)
 {
     (void)arg;
@@ -63,9 +257,8 @@ int myst_mount_resolve(
     myst_fs_t** fs_out)
 {
     int ret = 0;
-    size_t match_len = 0;
-    bool locked = false;
     myst_fs_t* fs = NULL;
+    size_t skip;
     struct locals
     {
         myst_path_t realpath;
@@ -78,57 +271,33 @@ int myst_mount_resolve(
     if (!path || !suffix)
         ERAISE(-EINVAL);
 
-    if (!(locals = malloc(sizeof(struct locals))))
-        ERAISE(-ENOMEM);
-
     /* Find the real path (the absolute non-relative path). */
-    ECHECK(myst_realpath(path, &locals->realpath));
-
-    myst_spin_lock(&_lock);
-    locked = true;
-
-    /* Find the longest binding point that contains this path. */
-    for (size_t i = 0; i < _mount_table_size; i++)
+    if (!_is_resolved(path))
     {
-        size_t len = strlen(_mount_table[i].path);
-        const char* mpath = _mount_table[i].path;
-
-        if (mpath[0] == '/' && mpath[1] == '\0')
-        {
-            if (len > match_len)
-            {
-                myst_strlcpy(suffix, locals->realpath.buf, PATH_MAX);
-                match_len = len;
-                fs = _mount_table[i].fs;
-            }
-        }
-        else if (
-            strncmp(mpath, locals->realpath.buf, len) == 0 &&
-            (locals->realpath.buf[len] == '/' ||
-             locals->realpath.buf[len] == '\0'))
-        {
-            if (len > match_len)
-            {
-                myst_strlcpy(suffix, locals->realpath.buf + len, PATH_MAX);
-
-                if (*suffix == '\0')
-                    myst_strlcpy(suffix, "/", PATH_MAX);
+        if (!(locals = malloc(sizeof(struct locals))))
+            ERAISE(-ENOMEM);
 
-                match_len = len;
-                fs = _mount_table[i].fs;
-            }
-        }
+        ECHECK(myst_realpath(path, &locals->realpath));
+        path = locals->realpath.buf;
     }
-
-    if (locked)
+    else if (strlen(path) >= PATH_MAX)
     {
-        myst_spin_unlock(&_lock);
-        locked = false;
+        ERAISE(-ENAMETOOLONG);
     }
 
+    /* Find the longest binding point that contains this path. */
+    myst_spin_lock(&_lock);
+    _mount_cache_find(path, &fs, &skip);
+    myst_spin_unlock(&_lock);
+
     if (!fs)
         ERAISE(-ENOENT);
 
+    if (path[skip] == '\0')
+        myst_strlcpy(suffix, "/", PATH_MAX);
+    else
+        myst_strlcpy(suffix, path + skip, PATH_MAX);
+
     *fs_out = fs;
 
 done:
@@ -136,9 +305,6 @@ done:
     if (locals)
         free(locals);
 
-    if (locked)
-        myst_spin_unlock(&_lock);
-
     return ret;
 }
 
@@ -227,6 +393,10 @@ int myst_mount(
     _mount_table[_mount_table_size++] = mount_table_entry;
     mount_table_entry.path = NULL;
 
+    /* the new mount hides the names beneath the target */
+    myst_dcache_flush();
+    _mount_cache_clear();
+
     ret = 0;
 
 done:
@@ -253,6 +423,8 @@ int myst_umount(const char* target)
     };
     struct locals* locals = NULL;
 
+    myst_mutex_lock(&_release_mutex);
+
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
@@ -281,6 +453,10 @@ int myst_umount(const char* target)
             _mount_table[i] = _mount_table[_mount_table_size - 1];
             _mount_table_size--;
 
+            /* uncover the names beneath the target */
+            myst_dcache_flush();
+            _mount_cache_clear();
+
             found = true;
             break;
         }
@@ -295,6 +471,43 @@ done:
         free(locals);
 
     myst_spin_unlock(&_lock);
+    myst_mutex_unlock(&_release_mutex);
+
+    return ret;
+}
+
+int myst_mount_sync(void)
+{
+    int ret = 0;
+#ifdef MYST_ENABLE_EXT2FS
+    myst_fs_t* fs[MOUNT_TABLE_SIZE];
+    size_t n = 0;
+
+    /* the mutex keeps the file systems from being released meanwhile */
+    myst_mutex_lock(&_release_mutex);
+
+    /* ext2 caches inodes, allocation metadata and blocks */
+    myst_spin_lock(&_lock);
+    {
+        for (size_t i = 0; i < _mount_table_size; i++)
+        {
+            if (myst_is_ext2fs(_mount_table[i].fs))
+                fs[n++] = _mount_table[i].fs;
+        }
+    }
+    myst_spin_unlock(&_lock);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        int r = ext2_sync(fs[i]);
+
+        /* sync the others even if one fails */
+        if (r != 0 && ret == 0)
+            ret = r;
+    }
+
+    myst_mutex_unlock(&_release_mutex);
+#endif /* MYST_ENABLE_EXT2FS */
 
     return ret;
 }
@@ -303,6 +516,7 @@ int myst_teardown_auto_mounts()
 {
     int ret = 0;
 
+    myst_mutex_lock(&_release_mutex);
     myst_spin_lock(&_lock);
 
     for (size_t i = 0; i < _mount_table_size; i++)
@@ -323,12 +537,16 @@ int myst_teardown_auto_mounts()
             /* remove this entry from the mount table */
             _mount_table[i--] = _mount_table[_mount_table_size - 1];
             _mount_table_size--;
+
+            myst_dcache_flush();
+            _mount_cache_clear();
         }
     }
 
 done:
 
     myst_spin_unlock(&_lock);
+    myst_mutex_unlock(&_release_mutex);
 
     return ret;
 }
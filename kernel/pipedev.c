@@ -1,17 +1,21 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 
-#include <myst/buf.h>
 #include <myst/cond.h>
 #include <myst/eraise.h>
 #include <myst/mutex.h>
 #include <myst/pipedev.h>
+#include <myst/poll.h>
 #include <myst/printf.h>
 #include <myst/process.h>
 #include <myst/signal.h>
-#include <myst/spinlock.h>
 #include <myst/syscall.h>
 
 //#define ENABLE_TRACE
@@ -25,65 +29,67 @@
 
 #define DEFAULT_PIPE_SIZE (64 * 1024)
 
-#define BLOCK_SIZE PIPE_BUF
+/* same as the default /proc/sys/fs/pipe-max-size on Linux */
+#define MAX_PIPE_SIZE (1024 * 1024)
 
 /*
 **==============================================================================
 **
-** The host-side pipes are used only for synchronization with poll() and
-** epoll(). The data is exchanged within the kernel and is not visible from
-** the host. The host-side pipes are used to manage read and write enablement
-** states by setting the pipe size to two blocks and filling zero, one, or two
-** blocks with zeros, where:
+** Pipes are implemented entirely within the kernel (no host descriptors).
 **
-**     - zero filled blocks indicates write-enablement (empty pipe)
-**     - one filled block indicates read-write-enablement (half-full pipe)
-**     - two filled blocks indicates read-enablement (full pipe)
+** The data is kept in a ring buffer whose capacity is a power of two (set by
+** fcntl(F_SETPIPE_SZ)). The head and tail are free-running byte counters, so
+** (tail - head) is the number of bytes in the pipe and (index & (capacity-1))
+** is the position of a byte within the ring.
 **
-** These states and the corresponding blocks are depicted in the diagram below,
-** where the block size is BLOCK_SIZE.
+** The readers own the head and the writers own the tail. Readers serialize on
+** rdlock and writers on wrlock, so a single reader and a single writer never
+** contend for a lock: the writer publishes bytes by storing the tail and the
+** reader releases space by storing the head.
 **
-**                              Read-Enabled   Write-Enabled    Macro
-**     +--------+--------+      -----------------------------------------
-**     |        |        |      No              Yes             WR_ENABLED
-**     +--------+--------+
-**
-**     +--------+--------+
-**     |XXXXXXXX|        |      Yes             Yes             RDWR_ENABLED
-**     +--------+--------+
-**
-**     +--------+--------+
-**     |XXXXXXXX|XXXXXXXX|      Yes             No              RD_ENABLED
-**     +--------+--------+
+** A reader or writer that must block waits on the condition variable (under
+** lock) after incrementing nwaiters. The other side checks nwaiters after
+** each transfer and takes the lock only if someone is waiting. Each transfer
+** and close also wakes the wake queue of the pipe, so poll(), select(), and
+** epoll() observe the readiness computed by _pd_get_events().
 **
 **==============================================================================
 */
 
-typedef enum state
-{
-    STATE_WR_ENABLED = 'E',   /* empty */
-    STATE_RDWR_ENABLED = 'H', /* half-full (or half-empty) */
-    STATE_RD_ENABLED = 'F',   /* full */
-} state_t;
+/* indices of shared_t.status_flags[] */
+#define RDEND 0
+#define WREND 1
 
-/* this structure is shared by the pipe */
+/* this structure is shared by both ends of the pipe */
 typedef struct shared
 {
+    /* the ring buffer (allocated by the first write) */
+    uint8_t* data;
+    size_t capacity; /* F_SETPIPE_SZ/F_GETPIPE_SZ */
+    size_t head;     /* number of bytes ever read */
+    size_t tail;     /* number of bytes ever written */
+
+    /* serializes the readers and the writers respectively */
+    myst_mutex_t rdlock;
+    myst_mutex_t wrlock;
+
+    /* blocked readers and writers wait on cond */
     myst_mutex_t lock;
     myst_cond_t cond;
-    int flags; /* O_NONBLOCK */
+    size_t nwaiters;
+
     size_t nreaders;
     size_t nwriters;
-    size_t pipesz; /* capacity of pipe (F_SETPIPE_SZ/F_GETPIPE_SZ) */
-    state_t state; /* read-write enablement state */
-    myst_buf_t buf;
+    int status_flags[2]; /* O_NONBLOCK (per end) */
+    ino_t ino;
+    myst_poll_wq_t wq;
 } shared_t;
 
 struct myst_pipe
 {
     uint32_t magic; /* MAGIC */
-    int fd;         /* host file descriptor */
     int mode;       /* O_RDONLY or O_WRONLY */
+    int fd_flags;   /* FD_CLOEXEC */
     shared_t* shared;
 };
 
@@ -97,14 +103,39 @@ MYST_INLINE bool _valid_pipe(const myst_pipe_t* pipe)
     return pipe && pipe->magic == MAGIC;
 }
 
+MYST_INLINE int* _status_flags(myst_pipe_t* pipe)
+{
+    return &pipe->shared->status_flags[pipe->mode == O_RDONLY ? RDEND : WREND];
+}
+
+MYST_INLINE size_t _capacity(const shared_t* shared)
+{
+    return __atomic_load_n(&shared->capacity, __ATOMIC_RELAXED);
+}
+
+/* exact for the readers and the writers; a snapshot for everyone else */
 MYST_INLINE size_t _nbytes(const shared_t* shared)
 {
-    return shared->buf.size;
+    /* load the head first so that it cannot pass the tail */
+    const size_t head = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+    const size_t tail = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+
+    return _min(tail - head, _capacity(shared));
 }
 
 MYST_INLINE size_t _space(const shared_t* shared)
 {
-    return shared->pipesz - shared->buf.size;
+    return _capacity(shared) - _nbytes(shared);
+}
+
+MYST_INLINE size_t _nreaders(const shared_t* shared)
+{
+    return __atomic_load_n(&shared->nreaders, __ATOMIC_SEQ_CST);
+}
+
+MYST_INLINE size_t _nwriters(const shared_t* shared)
+{
+    return __atomic_load_n(&shared->nwriters, __ATOMIC_SEQ_CST);
 }
 
 MYST_INLINE void _lock(myst_mutex_t* lock, bool* locked)
@@ -122,23 +153,83 @@ MYST_INLINE void _unlock(myst_mutex_t* lock, bool* locked)
     }
 }
 
+/* copy n bytes out of the ring starting at index pos */
+static void _ring_get(const shared_t* shared, size_t pos, void* buf, size_t n)
+{
+    const size_t off = pos & (shared->capacity - 1);
+    const size_t n1 = _min(n, shared->capacity - off);
+
+    memcpy(buf, shared->data + off, n1);
+    memcpy((uint8_t*)buf + n1, shared->data, n - n1);
+}
+
+/* copy n bytes into the ring starting at index pos */
+static void _ring_put(shared_t* shared, size_t pos, const void* buf, size_t n)
+{
+    const size_t off = pos & (shared->capacity - 1);
+    const size_t n1 = _min(n, shared->capacity - off);
+
+    memcpy(shared->data + off, buf, n1);
+    memcpy(shared->data, (const uint8_t*)buf + n1, n - n1);
+}
+
+/* wake the blocked readers/writers and the pollers after a transition */
+static void _notify(shared_t* shared)
+{
+    /* order the preceding head/tail/count update before loading nwaiters
+     * (pairs with the increment in _wait()) */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&shared->nwaiters, __ATOMIC_RELAXED))
+    {
+        myst_mutex_lock(&shared->lock);
+        myst_cond_broadcast(&shared->cond, SIZE_MAX);
+        myst_mutex_unlock(&shared->lock);
+    }
+
+    myst_poll_wq_wake(&shared->wq);
+}
+
+static bool _ready(const shared_t* shared, int mode, size_t need)
+{
+    if (mode == O_RDONLY)
+        return _nbytes(shared) > 0 || _nwriters(shared) == 0;
+    else
+        return _space(shared) >= need || _nreaders(shared) == 0;
+}
+
+/* block until the pipe may be ready for mode (the caller re-checks) */
+static void _wait(shared_t* shared, int mode, size_t need)
+{
+    myst_mutex_lock(&shared->lock);
+    __atomic_add_fetch(&shared->nwaiters, 1, __ATOMIC_SEQ_CST);
+
+    if (!_ready(shared, mode, need))
+        myst_cond_wait(&shared->cond, &shared->lock);
+
+    __atomic_sub_fetch(&shared->nwaiters, 1, __ATOMIC_SEQ_CST);
+    myst_mutex_unlock(&shared->lock);
+}
+
+static void _free_shared(shared_t* shared)
+{
+    myst_poll_wq_release(&shared->wq);
+    myst_cond_destroy(&shared->cond);
+    free(shared->data);
+    free(shared);
+}
+
 static int _pd_pipe2(myst_pipedev_t* pipedev, myst_pipe_t* pipe[2], int flags)
 {
     int ret = 0;
     myst_pipe_t* rdpipe = NULL;
     myst_pipe_t* wrpipe = NULL;
     shared_t* shared = NULL;
-    int fds[2] = {-1, -1};
+    static ino_t _ino;
 
     if (!pipedev || !pipe || (flags & ~(O_CLOEXEC | O_DIRECT | O_NONBLOCK)))
         ERAISE(-EINVAL);
 
-    /* Create the pipe descriptors on the host */
-    ECHECK(myst_tcall_pipe2(fds, flags));
-
-    /* Set the pipe buffer size to hold two blocks */
-    ECHECK(myst_tcall_fcntl(fds[0], F_SETPIPE_SZ, 2 * BLOCK_SIZE));
-
     /* Create the shared structure */
     {
         if (!(shared = calloc(1, sizeof(shared_t))))
@@ -149,13 +240,13 @@ static int _pd_pipe2(myst_pipedev_t* pipedev, myst_pipe_t* pipe[2], int flags)
         shared->nwriters = 1;
 
         /* Set initial pipe capacity; may be updated by fcntl(F_SETPIPE_SZ) */
-        shared->pipesz = DEFAULT_PIPE_SIZE;
+        shared->capacity = DEFAULT_PIPE_SIZE;
 
-        /* Set the state */
-        shared->state = STATE_WR_ENABLED;
+        /* Set the non-blocking flag of both ends */
+        shared->status_flags[RDEND] = flags & O_NONBLOCK;
+        shared->status_flags[WREND] = flags & O_NONBLOCK;
 
-        /* Set the non-blocking flag */
-        shared->flags = flags;
+        shared->ino = __atomic_add_fetch(&_ino, 1, __ATOMIC_RELAXED);
 
         ECHECK(myst_cond_init(&shared->cond));
     }
@@ -166,8 +257,8 @@ static int _pd_pipe2(myst_pipedev_t* pipedev, myst_pipe_t* pipe[2], int flags)
             ERAISE(-ENOMEM);
 
         rdpipe->magic = MAGIC;
-        rdpipe->fd = fds[0];
         rdpipe->mode = O_RDONLY;
+        rdpipe->fd_flags = (flags & O_CLOEXEC) ? FD_CLOEXEC : 0;
         rdpipe->shared = shared;
     }
 
@@ -177,20 +268,18 @@ static int _pd_pipe2(myst_pipedev_t* pipedev, myst_pipe_t* pipe[2], int flags)
             ERAISE(-ENOMEM);
 
         wrpipe->magic = MAGIC;
-        wrpipe->fd = fds[1];
         wrpipe->mode = O_WRONLY;
+        wrpipe->fd_flags = (flags & O_CLOEXEC) ? FD_CLOEXEC : 0;
         wrpipe->shared = shared;
     }
 
-    T(printf(
-          "_pd_pipe2(): fds[%d:%d] pid=%d\n", fds[0], fds[1], myst_getpid());)
+    T(printf("_pd_pipe2(): ino=%lu pid=%d\n", shared->ino, myst_getpid());)
 
     pipe[0] = rdpipe;
     pipe[1] = wrpipe;
     rdpipe = NULL;
     wrpipe = NULL;
-    fds[0] = -1;
-    fds[1] = -1;
+    shared = NULL;
 
 done:
 
@@ -200,11 +289,8 @@ done:
     if (wrpipe)
         free(wrpipe);
 
-    if (fds[0] >= 0)
-        myst_tcall_close(fds[0]);
-
-    if (fds[1] >= 0)
-        myst_tcall_close(fds[1]);
+    if (shared)
+        free(shared);
 
     return ret;
 }
@@ -216,13 +302,7 @@ static ssize_t _pd_read(
     size_t count)
 {
     ssize_t ret = 0;
-    ssize_t nread = 0;
-    shared_t* shared;
-    struct locals
-    {
-        uint8_t zeros[2 * BLOCK_SIZE];
-    };
-    struct locals* locals = NULL;
+    shared_t* shared = NULL;
     bool locked = false;
 
     T(printf("=== _pd_read(): count=%zu\n", count));
@@ -239,102 +319,47 @@ static ssize_t _pd_read(
     if (pipe->mode == O_WRONLY)
         ERAISE(-EBADF);
 
-    if (!(locals = calloc(1, sizeof(struct locals))))
-        ERAISE(-ENOMEM);
-
     shared = pipe->shared;
-    _lock(&shared->lock, &locked);
+    _lock(&shared->rdlock, &locked);
 
-    /* perform the read operation */
+    for (;;)
     {
-        uint8_t* ptr = buf;
-        size_t rem = count;
+        /* load nwriters before the tail: if there are no writers, then all
+         * the bytes they wrote are visible below */
+        const size_t nwriters = _nwriters(shared);
+        const size_t n = _min(count, _nbytes(shared));
 
-        while (rem > 0)
+        if (n) /* there is data in the pipe */
         {
-            size_t min = _min(rem, _nbytes(shared));
-
-            if (min) /* there is data in the buffer */
-            {
-                memcpy(ptr, shared->buf.data, min);
-                ECHECK(myst_buf_remove(&shared->buf, 0, min));
-                rem -= min;
-                ptr += min;
-                nread += min;
-
-                switch (shared->state)
-                {
-                    case STATE_RD_ENABLED:
-                    {
-                        if (shared->buf.size == 0)
-                        {
-                            const size_t n = 2 * BLOCK_SIZE;
-                            ECHECK(myst_tcall_read(pipe->fd, locals->zeros, n));
-                            shared->state = STATE_WR_ENABLED;
-                        }
-                        else
-                        {
-                            const size_t n = BLOCK_SIZE;
-                            ECHECK(myst_tcall_read(pipe->fd, locals->zeros, n));
-                            shared->state = STATE_RDWR_ENABLED;
-                        }
-                        break;
-                    }
-                    case STATE_RDWR_ENABLED:
-                    {
-                        if (shared->buf.size == 0)
-                        {
-                            const size_t n = BLOCK_SIZE;
-                            ECHECK(myst_tcall_read(pipe->fd, locals->zeros, n));
-                            shared->state = STATE_WR_ENABLED;
-                        }
-                        break;
-                    }
-                    case STATE_WR_ENABLED:
-                    {
-                        break;
-                    }
-                }
-
-                /* signal that pipe is now write enabled */
-                myst_cond_signal(&shared->cond);
-            }
-            else /* the buffer is empty */
-            {
-                if (shared->flags == O_NONBLOCK)
-                {
-                    if (nread == 0)
-                        ERAISE(-EAGAIN);
-
-                    break;
-                }
-                else
-                {
-                    /* break out if there are no writters */
-                    if (shared->nwriters == 0)
-                        break;
-
-                    /* block here until pipe becomes read enabled */
-                    myst_cond_wait(&shared->cond, &shared->lock);
-                }
-            }
-
-            if (nread > 0)
-                break;
+            const size_t head = shared->head;
 
-            if (myst_signal_has_active_signals(myst_thread_self()))
-                ERAISE(-EINTR);
+            _ring_get(shared, head, buf, n);
+            __atomic_store_n(&shared->head, head + n, __ATOMIC_RELEASE);
+            _notify(shared);
+            ret = n;
+            break;
         }
-    }
 
-    ret = nread;
+        /* end of file if there are no writers */
+        if (nwriters == 0)
+            break;
 
-done:
+        if (*_status_flags(pipe) & O_NONBLOCK)
+            ERAISE(-EAGAIN);
 
-    if (locals)
-        free(locals);
+        if (myst_signal_has_active_signals(myst_thread_self()))
+            ERAISE(-EINTR);
 
-    _unlock(&shared->lock, &locked);
+        /* do not hold rdlock while blocked (see _set_capacity()) */
+        _unlock(&shared->rdlock, &locked);
+        _wait(shared, O_RDONLY, 1);
+        _lock(&shared->rdlock, &locked);
+    }
+
+done:
+
+    if (shared)
+        _unlock(&shared->rdlock, &locked);
 
     T(printf("_pd_read(): ret=%zd\n", ret));
 
@@ -349,12 +374,8 @@ static ssize_t _pd_write(
 {
     ssize_t ret = 0;
     bool locked = false;
-    shared_t* shared;
-    struct locals
-    {
-        uint8_t zeros[2 * BLOCK_SIZE];
-    };
-    struct locals* locals = NULL;
+    shared_t* shared = NULL;
+    const uint8_t* ptr = buf;
     size_t nwritten = 0;
 
     T(printf("=== _pd_write(): count=%zu\n", count));
@@ -371,114 +392,68 @@ static ssize_t _pd_write(
     if (count == 0)
         goto done;
 
-    if (!(locals = calloc(1, sizeof(struct locals))))
-        ERAISE(-ENOMEM);
-
     shared = pipe->shared;
-    _lock(&shared->lock, &locked);
+    _lock(&shared->wrlock, &locked);
 
-    /* if there are no readers, then raise EPIPE */
-    if (shared->nreaders == 0)
+    while (nwritten < count)
     {
-        myst_syscall_kill(myst_getpid(), SIGPIPE);
-        ERAISE(-EPIPE);
-    }
+        /* writes of up to PIPE_BUF bytes are atomic (never split) */
+        const size_t need = (count <= PIPE_BUF) ? count : 1;
+        size_t space;
 
-    /* perform the write operation */
-    {
-        const uint8_t* ptr = buf;
-        size_t rem = count;
+        /* if there are no readers, then raise EPIPE */
+        if (_nreaders(shared) == 0)
+        {
+            if (nwritten)
+                break;
 
-        while (rem > 0)
+            myst_syscall_kill(myst_getpid(), SIGPIPE);
+            ERAISE(-EPIPE);
+        }
+
+        if ((space = _space(shared)) >= need) /* there is space in the pipe */
         {
-            size_t space = shared->pipesz - _nbytes(shared);
-            size_t min = _min(rem, space);
-
-            if (min) /* there is space in the buffer */
-            {
-                ECHECK(myst_buf_append(&shared->buf, ptr, min));
-                rem -= min;
-                ptr += min;
-                nwritten += min;
-
-                switch (shared->state)
-                {
-                    case STATE_WR_ENABLED:
-                    {
-                        if (_space(shared))
-                        {
-                            const size_t n = BLOCK_SIZE;
-                            ECHECK(
-                                myst_tcall_write(pipe->fd, locals->zeros, n));
-                            shared->state = STATE_RDWR_ENABLED;
-                        }
-                        else
-                        {
-                            const size_t n = 2 * BLOCK_SIZE;
-                            ECHECK(
-                                myst_tcall_write(pipe->fd, locals->zeros, n));
-                            shared->state = STATE_RD_ENABLED;
-                        }
-                        break;
-                    }
-                    case STATE_RDWR_ENABLED:
-                    {
-                        if (_space(shared) == 0)
-                        {
-                            const size_t n = BLOCK_SIZE;
-                            ECHECK(
-                                myst_tcall_write(pipe->fd, locals->zeros, n));
-                            shared->state = STATE_RD_ENABLED;
-                        }
-                        break;
-                    }
-                    case STATE_RD_ENABLED:
-                    {
-                        break;
-                    }
-                }
-
-                /* signal that pipe is now read enabled */
-                myst_cond_signal(&shared->cond);
-            }
-            else /* the buffer is full */
-            {
-                if (shared->flags == O_NONBLOCK)
-                {
-                    if (nwritten == 0)
-                        ERAISE(-EAGAIN);
-
-                    break;
-                }
-                else
-                {
-                    /* break out if there are no readers */
-                    if (shared->nreaders == 0)
-                        break;
-
-                    /* wait for pipe to become write enabled or closed */
-                    myst_cond_wait(&shared->cond, &shared->lock);
-                }
-            }
-
-            if (myst_signal_has_active_signals(myst_thread_self()))
-            {
-                if (nwritten == 0)
-                    ERAISE(-EINTR);
+            const size_t n = _min(count - nwritten, space);
+            const size_t tail = shared->tail;
 
-                break;
-            }
+            if (!shared->data && !(shared->data = malloc(shared->capacity)))
+                ERAISE(-ENOMEM);
+
+            _ring_put(shared, tail, ptr + nwritten, n);
+            __atomic_store_n(&shared->tail, tail + n, __ATOMIC_RELEASE);
+            _notify(shared);
+            nwritten += n;
+            continue;
+        }
+
+        if (*_status_flags(pipe) & O_NONBLOCK)
+        {
+            if (nwritten == 0)
+                ERAISE(-EAGAIN);
+
+            break;
         }
+
+        if (myst_signal_has_active_signals(myst_thread_self()))
+        {
+            if (nwritten == 0)
+                ERAISE(-EINTR);
+
+            break;
+        }
+
+        /* do not hold wrlock while blocked (see _set_capacity()) */
+        _unlock(&shared->wrlock, &locked);
+        _wait(shared, O_WRONLY, need);
+        _lock(&shared->wrlock, &locked);
     }
 
     ret = nwritten;
 
 done:
 
-    _unlock(&shared->lock, &locked);
-
-    if (locals)
-        free(locals);
+    if (shared)
+        _unlock(&shared->wrlock, &locked);
 
     T(printf("_pd_write(): ret=%ld\n", ret));
 
@@ -533,9 +508,89 @@ static int _pd_fstat(
     if (!pipedev || !_valid_pipe(pipe) || !statbuf)
         ERAISE(-EINVAL);
 
-    ECHECK(myst_tcall_fstat(pipe->fd, statbuf));
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_ino = pipe->shared->ino;
+    statbuf->st_mode = S_IFIFO | S_IRUSR | S_IWUSR;
+    statbuf->st_nlink = 1;
+    statbuf->st_uid = myst_syscall_geteuid();
+    statbuf->st_gid = myst_syscall_getegid();
+    statbuf->st_blksize = PIPE_BUF;
+
+done:
+    return ret;
+}
+
+/* resize the ring buffer (relocating any bytes in the pipe) */
+static int _set_capacity(shared_t* shared, long arg)
+{
+    int ret = 0;
+    size_t capacity = PIPE_BUF;
+    uint8_t* data = NULL;
+    bool locked = false;
+
+    if (arg < 0)
+        ERAISE(-EINVAL);
+
+    if (arg > MAX_PIPE_SIZE)
+        ERAISE(-EPERM);
+
+    /* round up to a power of two */
+    while (capacity < (size_t)arg)
+        capacity <<= 1;
+
+    /* exclude the readers and the writers (neither blocks holding these) */
+    myst_mutex_lock(&shared->wrlock);
+    myst_mutex_lock(&shared->rdlock);
+    locked = true;
+
+    if (capacity == shared->capacity)
+        goto done;
+
+    if (shared->tail - shared->head > capacity)
+        ERAISE(-EBUSY);
+
+    if (shared->data)
+    {
+        const size_t old_capacity = shared->capacity;
+
+        if (!(data = malloc(capacity)))
+            ERAISE(-ENOMEM);
+
+        /* the indices do not change, only the positions they map to */
+        for (size_t pos = shared->head; pos != shared->tail;)
+        {
+            const size_t i = pos & (old_capacity - 1);
+            const size_t j = pos & (capacity - 1);
+            size_t n = shared->tail - pos;
+
+            n = _min(n, old_capacity - i);
+            n = _min(n, capacity - j);
+            memcpy(data + j, shared->data + i, n);
+            pos += n;
+        }
+
+        free(shared->data);
+        shared->data = data;
+        data = NULL;
+    }
+
+    __atomic_store_n(&shared->capacity, capacity, __ATOMIC_RELAXED);
 
 done:
+
+    if (locked)
+    {
+        myst_mutex_unlock(&shared->rdlock);
+        myst_mutex_unlock(&shared->wrlock);
+
+        /* the space available to the writers may have changed */
+        if (ret == 0)
+            _notify(shared);
+    }
+
+    if (data)
+        free(data);
+
     return ret;
 }
 
@@ -546,43 +601,48 @@ static int _pd_fcntl(
     long arg)
 {
     int ret = 0;
-    long r;
 
     if (!pipedev || !_valid_pipe(pipe))
-        ERAISE(-EINVAL);
+        ERAISE(-EBADF);
 
     switch (cmd)
     {
         case F_SETPIPE_SZ:
         {
-            if (arg < PIPE_BUF)
-                arg = PIPE_BUF;
-
-            arg = (arg + (PIPE_BUF - 1)) / PIPE_BUF * PIPE_BUF;
-
-            pipe->shared->pipesz = arg;
-            goto done;
+            ECHECK(_set_capacity(pipe->shared, arg));
+            break;
         }
         case F_GETPIPE_SZ:
         {
-            ret = pipe->shared->pipesz;
-            goto done;
+            ret = (int)_capacity(pipe->shared);
+            break;
+        }
+        case F_GETFD:
+        {
+            ret = pipe->fd_flags;
+            break;
+        }
+        case F_SETFD:
+        {
+            pipe->fd_flags = (int)(arg & FD_CLOEXEC);
+            break;
+        }
+        case F_GETFL:
+        {
+            ret = pipe->mode | *_status_flags(pipe);
+            break;
         }
-    }
-
-    ECHECK((r = myst_tcall_fcntl(pipe->fd, cmd, arg)));
-
-    switch (cmd)
-    {
         case F_SETFL:
         {
-            pipe->shared->flags |= arg;
+            *_status_flags(pipe) = (int)(arg & O_NONBLOCK);
             break;
         }
+        default:
+        {
+            ERAISE(-EINVAL);
+        }
     }
 
-    ret = r;
-
 done:
 
     return ret;
@@ -618,6 +678,7 @@ static int _pd_dup(
 {
     int ret = 0;
     myst_pipe_t* new_pipe = NULL;
+    shared_t* shared;
 
     if (pipe_out)
         *pipe_out = NULL;
@@ -630,19 +691,20 @@ static int _pd_dup(
 
     *new_pipe = *pipe;
 
-    /* perform syscall */
-    ECHECK(new_pipe->fd = myst_tcall_dup(pipe->fd));
+    /* the duplicate shares the pipe but not the FD_CLOEXEC flag */
+    new_pipe->fd_flags = 0;
+    shared = new_pipe->shared;
 
-    if (new_pipe->mode == O_RDONLY)
-        new_pipe->shared->nreaders++;
-    else
-        new_pipe->shared->nwriters++;
+    myst_mutex_lock(&shared->lock);
+    {
+        if (new_pipe->mode == O_RDONLY)
+            __atomic_add_fetch(&shared->nreaders, 1, __ATOMIC_SEQ_CST);
+        else
+            __atomic_add_fetch(&shared->nwriters, 1, __ATOMIC_SEQ_CST);
+    }
+    myst_mutex_unlock(&shared->lock);
 
-    T(printf(
-          "_pd_dup(): oldfd=%d newfd=%d pid=%d\n",
-          pipe->fd,
-          new_pipe->fd,
-          myst_getpid());)
+    T(printf("_pd_dup(): ino=%lu pid=%d\n", shared->ino, myst_getpid());)
 
     *pipe_out = new_pipe;
     new_pipe = NULL;
@@ -663,10 +725,11 @@ static int _pd_interrupt(myst_pipedev_t* pipedev, myst_pipe_t* pipe)
     if (!pipedev || !_valid_pipe(pipe))
         ERAISE(-EBADF);
 
-    T(printf("_pd_interrupt(): fd=%d pid=%d\n", pipe->fd, myst_getpid());)
+    T(printf("_pd_interrupt(): pid=%d\n", myst_getpid());)
 
-    /* signal any threads blocked on read or write */
-    myst_cond_signal(&pipe->shared->cond);
+    /* wake any threads blocked on read or write (the caller holds a
+     * spinlock, so do not take the pipe lock) */
+    myst_cond_broadcast(&pipe->shared->cond, SIZE_MAX);
 
 done:
     T(printf("_pd_interrupt(): done\n");)
@@ -676,38 +739,42 @@ done:
 static int _pd_close(myst_pipedev_t* pipedev, myst_pipe_t* pipe)
 {
     int ret = 0;
-    bool locked = false;
+    shared_t* shared;
+    size_t nrefs;
 
     if (!pipedev || !_valid_pipe(pipe))
         ERAISE(-EBADF);
 
-    if (!pipe->shared->nreaders && !pipe->shared->nwriters)
+    shared = pipe->shared;
+
+    if (!_nreaders(shared) && !_nwriters(shared))
         ERAISE(-EBADF);
 
-    T(printf("_pd_close(): fd=%d pid=%d\n", pipe->fd, myst_getpid());)
-    ECHECK(myst_tcall_close(pipe->fd));
+    T(printf("_pd_close(): ino=%lu pid=%d\n", shared->ino, myst_getpid());)
 
-    _lock(&pipe->shared->lock, &locked);
+    myst_mutex_lock(&shared->lock);
+    {
+        if (pipe->mode == O_RDONLY)
+            __atomic_sub_fetch(&shared->nreaders, 1, __ATOMIC_SEQ_CST);
+        else
+            __atomic_sub_fetch(&shared->nwriters, 1, __ATOMIC_SEQ_CST);
 
-    if (pipe->mode == O_RDONLY)
-        pipe->shared->nreaders--;
-    else if (pipe->mode == O_WRONLY)
-        pipe->shared->nwriters--;
+        nrefs = shared->nreaders + shared->nwriters;
 
-    if (pipe->shared->nreaders == 0 && pipe->shared->nwriters == 0)
-    {
-        /* this is the last reference to the shared pipe structure */
-        _unlock(&pipe->shared->lock, &locked);
-        ECHECK(myst_cond_destroy(&pipe->shared->cond));
-        myst_buf_release(&pipe->shared->buf);
-        free(pipe->shared);
-    }
-    else
-    {
-        /* signal that this end of the pipe has been closed */
-        myst_cond_signal(&pipe->shared->cond);
-        _unlock(&pipe->shared->lock, &locked);
+        /* Wake the other end (end-of-file, EPIPE, POLLHUP, or POLLERR). This
+         * must be done before unlocking: the last closer may free the shared
+         * structure as soon as it acquires the lock after this. */
+        if (nrefs)
+        {
+            myst_cond_broadcast(&shared->cond, SIZE_MAX);
+            myst_poll_wq_wake(&shared->wq);
+        }
     }
+    myst_mutex_unlock(&shared->lock);
+
+    /* this is the last reference to the shared pipe structure */
+    if (nrefs == 0)
+        _free_shared(shared);
 
     memset(pipe, 0, sizeof(myst_pipe_t));
     free(pipe);
@@ -723,31 +790,55 @@ static int _pd_target_fd(myst_pipedev_t* pipedev, myst_pipe_t* pipe)
 {
     int ret = 0;
 
-    T(printf("_pd_target_fd()\n"));
-
     if (!pipedev || !_valid_pipe(pipe))
         ERAISE(-EINVAL);
 
-    ret = pipe->fd;
+    /* there is no host descriptor (see _pd_get_events()) */
+    ret = -ENOTSUP;
 
 done:
-    T(printf("_pd_target_fd(): ret=%d\n", ret));
     return ret;
 }
 
 static int _pd_get_events(myst_pipedev_t* pipedev, myst_pipe_t* pipe)
 {
     int ret = 0;
+    const shared_t* shared;
 
     if (!pipedev || !_valid_pipe(pipe))
         ERAISE(-EINVAL);
 
-    ret = -ENOTSUP;
+    shared = pipe->shared;
+
+    if (pipe->mode == O_RDONLY)
+    {
+        if (_nbytes(shared))
+            ret |= POLLIN | POLLRDNORM;
+
+        if (_nwriters(shared) == 0)
+            ret |= POLLHUP;
+    }
+    else
+    {
+        if (_space(shared) >= PIPE_BUF)
+            ret |= POLLOUT | POLLWRNORM;
+
+        if (_nreaders(shared) == 0)
+            ret |= POLLERR;
+    }
 
 done:
     return ret;
 }
 
+static myst_poll_wq_t* _pd_get_wq(myst_pipedev_t* pipedev, myst_pipe_t* pipe)
+{
+    if (!pipedev || !_valid_pipe(pipe))
+        return NULL;
+
+    return &pipe->shared->wq;
+}
+
 extern myst_pipedev_t* myst_pipedev_get(void)
 {
     // clang-format-off
@@ -765,6 +856,7 @@ extern myst_pipedev_t* myst_pipedev_get(void)
             .fd_interrupt = (void*)_pd_interrupt,
             .fd_target_fd = (void*)_pd_target_fd,
             .fd_get_events = (void*)_pd_get_events,
+            .fd_get_wq = (void*)_pd_get_wq,
         },
         .pd_pipe2 = _pd_pipe2,
         .pd_read = _pd_read,
@@ -778,6 +870,7 @@ extern myst_pipedev_t* myst_pipedev_get(void)
         .pd_close = _pd_close,
         .pd_target_fd = _pd_target_fd,
         .pd_get_events = _pd_get_events,
+        .pd_get_wq = _pd_get_wq,
     };
     // clang-format-on
 
@@ -4,7 +4,9 @@
 #include <assert.h>
 #include <errno.h>
 #include <poll.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -12,56 +14,314 @@
 #include <myst/eraise.h>
 #include <myst/fdops.h>
 #include <myst/fdtable.h>
+#include <myst/fiber.h>
+#include <myst/poll.h>
 #include <myst/signal.h>
 #include <myst/sockdev.h>
 #include <myst/syscall.h>
 #include <myst/tcall.h>
 #include <myst/thread.h>
 #include <myst/time.h>
+#include <myst/times.h>
+
+/*
+**==============================================================================
+**
+** poll wait queue (see include/myst/poll.h):
+**
+**     A wake increments seq before checking for waiters; a waiter registers
+**     before re-checking seq. So either the waker sees the waiter (and
+**     interrupts its host poll) or the waiter sees the new seq (and re-scans
+**     instead of sleeping). A wake that arrives before the waiter enters the
+**     host poll is not lost: the host waker stays readable until consumed.
+**
+**==============================================================================
+*/
+
+static struct
+{
+    volatile uint64_t seq; /* incremented by every wake */
+    volatile long waiters; /* threads sleeping in the host poll */
+} _wq;
 
-static long _syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
+void myst_poll_wake(void)
 {
-    long ret = 0;
-    myst_fdtable_t* fdtable;
-    struct pollfd* tfds = NULL; /* target file descriptors */
-    nfds_t tnfds = 0;           /* number of target file descriptors */
-    size_t* tindices = NULL;    /* target indices */
-    long tevents = 0;           /* the number of target events */
-    long ievents = 0;           /* internal events */
-    static myst_spinlock_t _lock;
-    bool locked = false;
-    long has_signals = 0;
-    int original_timeout = timeout;
-    struct timespec start;
-    struct timespec end;
-    long lapsed = 0;
+    __atomic_add_fetch(&_wq.seq, 1, __ATOMIC_SEQ_CST);
 
-    /* special case: if nfds is zero */
-    if (nfds == 0)
+    if (__atomic_load_n(&_wq.waiters, __ATOMIC_SEQ_CST) > 0)
+        myst_tcall_poll_wake();
+}
+
+uint64_t myst_poll_seq(void)
+{
+    return __atomic_load_n(&_wq.seq, __ATOMIC_SEQ_CST);
+}
+
+bool myst_poll_wait_begin(uint64_t seq)
+{
+    __atomic_add_fetch(&_wq.waiters, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&_wq.seq, __ATOMIC_SEQ_CST) != seq)
     {
-        long r;
-        long params[6] = {(long)NULL, nfds, timeout};
-        ECHECK((r = myst_tcall(SYS_poll, params)));
-        ret = r;
-        goto done;
+        __atomic_sub_fetch(&_wq.waiters, 1, __ATOMIC_SEQ_CST);
+        return false;
     }
 
-    if (!fds && nfds)
-        ERAISE(-EFAULT);
+    return true;
+}
 
-    if (!(fdtable = myst_fdtable_current()))
-        ERAISE(-ENOSYS);
+bool myst_poll_wait_end(uint64_t seq)
+{
+    __atomic_sub_fetch(&_wq.waiters, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&_wq.seq, __ATOMIC_SEQ_CST) != seq;
+}
+
+/*
+**==============================================================================
+**
+** object wake queues:
+**
+**     Registration changes take _wq_lock as well as the queue lock, so that
+**     myst_poll_wq_remove() never touches a queue that was released (and
+**     possibly freed) concurrently. Notification takes only the queue lock.
+**
+**==============================================================================
+*/
+
+static myst_spinlock_t _wq_lock = MYST_SPINLOCK_INITIALIZER;
+
+void myst_poll_wq_add(
+    myst_poll_wq_t* wq,
+    myst_poll_waiter_t* waiter,
+    myst_poll_callback_t callback)
+{
+    myst_spin_lock(&_wq_lock);
+    myst_spin_lock(&wq->lock);
+    {
+        waiter->callback = callback;
+        waiter->wq = wq;
+        waiter->prev = NULL;
+        waiter->next = wq->head;
 
-    if (!(tfds = calloc(nfds, sizeof(struct pollfd))))
+        if (wq->head)
+            wq->head->prev = waiter;
+
+        wq->head = waiter;
+    }
+    myst_spin_unlock(&wq->lock);
+    myst_spin_unlock(&_wq_lock);
+}
+
+static void _unlink_waiter(myst_poll_wq_t* wq, myst_poll_waiter_t* waiter)
+{
+    if (waiter->prev)
+        waiter->prev->next = waiter->next;
+    else
+        wq->head = waiter->next;
+
+    if (waiter->next)
+        waiter->next->prev = waiter->prev;
+
+    waiter->prev = NULL;
+    waiter->next = NULL;
+    waiter->wq = NULL;
+}
+
+void myst_poll_wq_remove(myst_poll_waiter_t* waiter)
+{
+    myst_spin_lock(&_wq_lock);
+    {
+        myst_poll_wq_t* wq = waiter->wq;
+
+        if (wq)
+        {
+            myst_spin_lock(&wq->lock);
+            _unlink_waiter(wq, waiter);
+            myst_spin_unlock(&wq->lock);
+        }
+    }
+    myst_spin_unlock(&_wq_lock);
+}
+
+bool myst_poll_wq_notify(myst_poll_wq_t* wq)
+{
+    bool interrupt = false;
+
+    /* a waiter that registers after this either sees the new seq or is seen
+     * below (pairs with the fence in _register_waiters()) */
+    __atomic_add_fetch(&_wq.seq, 1, __ATOMIC_SEQ_CST);
+
+    /* skip the lock when nobody is registered */
+    if (!__atomic_load_n(&wq->head, __ATOMIC_SEQ_CST))
+        return false;
+
+    myst_spin_lock(&wq->lock);
+    {
+        for (myst_poll_waiter_t* p = wq->head; p; p = p->next)
+        {
+            if ((*p->callback)(p))
+                interrupt = true;
+        }
+    }
+    myst_spin_unlock(&wq->lock);
+
+    return interrupt;
+}
+
+void myst_poll_wq_wake(myst_poll_wq_t* wq)
+{
+    if (myst_poll_wq_notify(wq))
+        myst_tcall_poll_wake();
+}
+
+void myst_poll_wq_release(myst_poll_wq_t* wq)
+{
+    myst_spin_lock(&_wq_lock);
+    myst_spin_lock(&wq->lock);
+    {
+        while (wq->head)
+            _unlink_waiter(wq, wq->head);
+    }
+    myst_spin_unlock(&wq->lock);
+    myst_spin_unlock(&_wq_lock);
+}
+
+/*
+**==============================================================================
+**
+** poll():
+**
+**==============================================================================
+*/
+
+#define MIN_BUFFER_CAPACITY 16
+
+void myst_poll_free_buffers(myst_thread_t* thread)
+{
+    free(thread->poll.tfds);
+    free(thread->poll.tindices);
+    free(thread->poll.wqs);
+    free(thread->poll.waiters);
+    thread->poll.tfds = NULL;
+    thread->poll.tindices = NULL;
+    thread->poll.wqs = NULL;
+    thread->poll.waiters = NULL;
+    thread->poll.capacity = 0;
+}
+
+/* grow the thread's reusable buffers to hold at least nfds entries */
+static int _reserve_buffers(myst_thread_t* thread, nfds_t nfds)
+{
+    int ret = 0;
+    size_t capacity = thread->poll.capacity;
+    struct pollfd* tfds;
+    size_t* tindices;
+    myst_poll_wq_t** wqs;
+    myst_poll_waiter_t* waiters;
+
+    if (nfds <= capacity)
+        goto done;
+
+    if (capacity < MIN_BUFFER_CAPACITY)
+        capacity = MIN_BUFFER_CAPACITY;
+
+    while (capacity < nfds)
+        capacity *= 2;
+
+    if (!(tfds = realloc(thread->poll.tfds, capacity * sizeof(*tfds))))
+        ERAISE(-ENOMEM);
+
+    thread->poll.tfds = tfds;
+
+    if (!(tindices = realloc(thread->poll.tindices, capacity * sizeof(size_t))))
         ERAISE(-ENOMEM);
 
-    if (!(tindices = calloc(nfds, sizeof(size_t))))
+    thread->poll.tindices = tindices;
+
+    if (!(wqs = realloc(thread->poll.wqs, capacity * sizeof(*wqs))))
         ERAISE(-ENOMEM);
 
-    myst_spin_lock(&_lock);
-    locked = true;
+    thread->poll.wqs = wqs;
+
+    if (!(waiters = realloc(thread->poll.waiters, capacity * sizeof(*waiters))))
+        ERAISE(-ENOMEM);
+
+    thread->poll.waiters = waiters;
+    thread->poll.capacity = capacity;
+
+done:
+    return ret;
+}
+
+/* the poller sleeps in the host poll while registered (see _wait_begin()) */
+static bool _poll_callback(myst_poll_waiter_t* waiter)
+{
+    (void)waiter;
+    return true;
+}
+
+/* register the waiters on the wake queues gathered by _scan(): returns false
+ * (and registers none) if an object may have changed since seq */
+static bool _register_waiters(myst_thread_t* thread, size_t nwq, uint64_t seq)
+{
+    for (size_t i = 0; i < nwq; i++)
+    {
+        myst_poll_wq_add(
+            thread->poll.wqs[i], &thread->poll.waiters[i], _poll_callback);
+    }
+
+    /* order the registrations before loading seq (see myst_poll_wq_notify) */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (myst_poll_seq() == seq)
+        return true;
+
+    for (size_t i = 0; i < nwq; i++)
+        myst_poll_wq_remove(&thread->poll.waiters[i]);
+
+    return false;
+}
+
+/* watch the internal object (wq is its wake queue or null) */
+MYST_INLINE void _watch(
+    myst_thread_t* thread,
+    myst_poll_wq_t* wq,
+    size_t* nwatch,
+    size_t* nwq)
+{
+    if (wq)
+        thread->poll.wqs[(*nwq)++] = wq;
+    else
+        (*nwatch)++;
+}
+
+MYST_INLINE myst_poll_wq_t* _get_wq(myst_fdops_t* fdops, void* object)
+{
+    return fdops->fd_get_wq ? (*fdops->fd_get_wq)(fdops, object) : NULL;
+}
+
+/* Set revents for the invalid fds and for the objects with internal events
+ * and gather the rest into the target buffers. Returns the number of ready
+ * fds; *tnfds_out is the number of target fds, *nwatch_out the number of
+ * objects whose readiness is published through the poll wait queue, and
+ * *nwq_out the number of wake queues gathered into thread->poll.wqs. */
+static long _scan(
+    myst_fdtable_t* fdtable,
+    struct pollfd* fds,
+    nfds_t nfds,
+    myst_thread_t* thread,
+    nfds_t* tnfds_out,
+    size_t* nwatch_out,
+    size_t* nwq_out)
+{
+    long ret = 0;
+    struct pollfd* tfds = thread->poll.tfds;
+    size_t* tindices = thread->poll.tindices;
+    nfds_t tnfds = 0;
+    size_t nwatch = 0;
+    size_t nwq = 0;
+    long ievents = 0;
 
-    /* copy fds[] into arrays tfds[] array */
     for (nfds_t i = 0; i < nfds; i++)
     {
         int tfd;
@@ -69,6 +329,12 @@ static long _syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
         myst_fdops_t* fdops;
         void* object;
 
+        fds[i].revents = 0;
+
+        /* negative fds are ignored */
+        if (fds[i].fd < 0)
+            continue;
+
         /* get the device for this file descriptor */
         int res = (myst_fdtable_get_any(
             fdtable, fds[i].fd, &type, (void**)&fdops, (void**)&object));
@@ -92,8 +358,14 @@ static long _syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
 
             if (events >= 0)
             {
-                fds[i].revents = (fds[i].events & events);
-                ievents++;
+                /* errors and hangups are reported even if not requested */
+                const short mask = fds[i].events | POLLERR | POLLHUP;
+
+                if ((fds[i].revents = (events & mask)))
+                    ievents++;
+                else
+                    _watch(thread, _get_wq(fdops, object), &nwatch, &nwq);
+
                 continue;
             }
         }
@@ -102,44 +374,130 @@ static long _syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
         if ((tfd = (*fdops->fd_target_fd)(fdops, object)) >= 0)
         {
             tfds[tnfds].events = fds[i].events;
+            tfds[tnfds].revents = 0;
             tfds[tnfds].fd = tfd;
             tindices[tnfds] = i;
             tnfds++;
+
+            /* input buffered in the kernel adds to the host events */
+            if (fdops->fd_get_buffered_events)
+            {
+                const int events =
+                    (*fdops->fd_get_buffered_events)(fdops, object);
+
+                if (events >= 0)
+                {
+                    if ((fds[i].revents = (events & fds[i].events)))
+                        ievents++;
+                    else
+                        _watch(thread, _get_wq(fdops, object), &nwatch, &nwq);
+                }
+            }
         }
     }
 
-    myst_syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+    *tnfds_out = tnfds;
+    *nwatch_out = nwatch;
+    *nwq_out = nwq;
+    ret = ievents;
 
-    if ((original_timeout > 500) || (original_timeout < 0))
-        timeout = 500;
-    else
-        timeout = original_timeout;
+done:
+    return ret;
+}
+
+static long _syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
+{
+    long ret = 0;
+    myst_fdtable_t* fdtable;
+    myst_thread_t* thread = myst_thread_self();
+    nfds_t tnfds = 0;  /* number of target file descriptors */
+    size_t nwatch = 0; /* objects that wake us through the wait queue */
+    size_t nwq = 0;    /* wake queues of the other watched objects */
+    long tevents = 0;  /* the number of target events */
+    long ievents = 0;  /* internal events */
+    int original_timeout = timeout;
+    struct timespec start;
+    struct timespec end;
+    long lapsed = 0;
+
+    /* special case: if nfds is zero */
+    if (nfds == 0)
+    {
+        long r;
+        ECHECK((r = myst_tcall_poll(NULL, nfds, timeout)));
+        ret = r;
+        goto done;
+    }
 
+    if (!fds && nfds)
+        ERAISE(-EFAULT);
+
+    if (nfds > MYST_FDTABLE_MAX_SIZE)
+        ERAISE(-EINVAL);
+
+    if (!(fdtable = myst_fdtable_current()))
+        ERAISE(-ENOSYS);
+
+    ECHECK(_reserve_buffers(thread, nfds));
+
+    myst_syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* Wait for the whole timeout in one host poll. Signal delivery, thread
+     * termination and readiness changes of internal objects (through their
+     * wake queues or the poll wait queue) interrupt the host poll with
+     * myst_tcall_poll_wake(). */
     while (1)
     {
-        myst_spin_unlock(&_lock);
-        locked = false;
+        const uint64_t seq = myst_poll_seq();
+        struct pollfd* tfds = thread->poll.tfds;
+        bool waiting = false;
+        bool registered = false;
+
+        ECHECK(
+            ievents =
+                _scan(fdtable, fds, nfds, thread, &tnfds, &nwatch, &nwq));
 
         /* If any internal events, do not sleep waiting for external events */
         if (ievents)
             timeout = 0;
 
-        /* poll for target events */
-        if (tnfds && tfds)
+        if (timeout != 0 && (nwatch || nwq))
         {
-            tevents = myst_tcall_poll(tfds, tnfds, timeout);
+            /* an internal object may have changed during the scan */
+            if (nwq && !(registered = _register_waiters(thread, nwq, seq)))
+                continue;
+
+            if (nwatch && !(waiting = myst_poll_wait_begin(seq)))
+            {
+                for (size_t i = 0; i < nwq; i++)
+                    myst_poll_wq_remove(&thread->poll.waiters[i]);
+
+                continue;
+            }
         }
-        else
+
+        /* poll for target events */
+        tevents = myst_tcall_poll(tnfds ? tfds : NULL, tnfds, timeout);
+
+        if (waiting)
+            myst_poll_wait_end(seq);
+
+        if (registered)
         {
-            tevents = myst_tcall_poll(NULL, tnfds, timeout);
+            for (size_t i = 0; i < nwq; i++)
+                myst_poll_wq_remove(&thread->poll.waiters[i]);
         }
 
+        /* woken by myst_tcall_poll_wake(): check signals and re-scan */
+        if (tevents == -EINTR)
+            tevents = 0;
+
         ECHECK(tevents);
-        if (tevents > 0)
+
+        if (tevents > 0 || ievents)
             break;
 
-        has_signals = myst_signal_has_active_signals(myst_thread_self());
-        if (has_signals)
+        if (myst_signal_has_active_signals(thread))
         {
             ret = -EINTR;
             goto done;
@@ -148,43 +506,44 @@ static long _syscall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
         if (original_timeout == 0)
             break;
 
-        // work out if we have timed out yet
-        myst_syscall_clock_gettime(CLOCK_MONOTONIC, &end);
-
-        lapsed += ((end.tv_sec - start.tv_sec) * 1000000000 +
-                   (end.tv_nsec - start.tv_nsec)) /
-                  1000000;
+        /* keep waiting for the rest of the timeout */
+        if (original_timeout > 0)
+        {
+            myst_syscall_clock_gettime(CLOCK_MONOTONIC, &end);
+            lapsed = myst_lapsed_nsecs(&start, &end) / 1000000;
 
-        if ((original_timeout > 0) && ((original_timeout - lapsed) <= 0))
-            break;
+            if (original_timeout - lapsed <= 0)
+                break;
 
-        if (original_timeout > 0)
             timeout = original_timeout - lapsed;
+        }
         else
-            timeout = 500;
-
-        myst_spin_lock(&_lock);
-        locked = true;
+        {
+            timeout = original_timeout;
+        }
     }
 
-    /* add target events and internal events */
-    ret = tevents + ievents;
-
     /* update fds[] with the target events */
     for (nfds_t i = 0; i < tnfds; i++)
-        fds[tindices[i]].revents = tfds[i].revents;
+        fds[thread->poll.tindices[i]].revents |= thread->poll.tfds[i].revents;
 
-done:
-
-    if (locked)
-        myst_spin_unlock(&_lock);
-
-    if (tfds)
-        free(tfds);
+    /* count the ready fds (a target fd may also have buffered events) */
+    if (ievents && tevents)
+    {
+        ret = 0;
 
-    if (tindices)
-        free(tindices);
+        for (nfds_t i = 0; i < nfds; i++)
+        {
+            if (fds[i].revents)
+                ret++;
+        }
+    }
+    else
+    {
+        ret = tevents + ievents;
+    }
 
+done:
     return ret;
 }
 
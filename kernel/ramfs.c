@@ -14,6 +14,7 @@
 #include <myst/buf.h>
 #include <myst/bufu64.h>
 #include <myst/clock.h>
+#include <myst/cpio.h>
 #include <myst/eraise.h>
 #include <myst/fs.h>
 #include <myst/id.h>
@@ -24,6 +25,8 @@
 #include <myst/ramfs.h>
 #include <myst/realpath.h>
 #include <myst/round.h>
+#include <myst/rwlock.h>
+#include <myst/spinlock.h>
 #include <myst/strings.h>
 #include <myst/syscall.h>
 #include <myst/thread.h>
@@ -33,7 +36,23 @@
 #define BLKSIZE 512
 
 /* ATTN: check access for all read operations */
-/* ATTN: add whole-file-system locking */
+
+/*
+** Locking:
+**
+** The directory tree (the directory entries and the inode metadata reached
+** through paths) is guarded by ramfs->lock. Path lookups take it shared and
+** operations that change the tree (creating, linking, unlinking, renaming,
+** truncating, changing ownership or mode) take it exclusive. The lock is
+** released before delegating an operation to another file system.
+**
+** The data of each inode is guarded by its own inode->lock, which readers
+** take shared and writers take exclusive. Operations on open files take only
+** the inode lock, since an open file keeps its inode alive (see nopens). The
+** file offset is guarded by file->mutex.
+**
+** The lock order is: ramfs->lock, file->mutex, inode->lock.
+*/
 
 /*
 **==============================================================================
@@ -47,6 +66,8 @@
 
 typedef struct inode inode_t;
 
+typedef struct cpioindex cpioindex_t;
+
 typedef struct ramfs
 {
     myst_fs_t base;
@@ -55,8 +76,9 @@ typedef struct ramfs
     char source[PATH_MAX]; /* source argument to myst_mount() */
     char target[PATH_MAX]; /* target argument to myst_mount() */
     myst_mount_resolve_callback_t resolve;
-    size_t ninodes;
-    myst_fs_t* lockfs;
+    _Atomic(size_t) ninodes;
+    myst_rwlock_t lock; /* the directory-tree lock */
+    cpioindex_t* cpio;  /* set by myst_ramfs_load_cpio() */
 } ramfs_t;
 
 static bool _ramfs_valid(const ramfs_t* ramfs)
@@ -64,6 +86,731 @@ static bool _ramfs_valid(const ramfs_t* ramfs)
     return ramfs && ramfs->magic == RAMFS_MAGIC;
 }
 
+/*
+**==============================================================================
+**
+** dirindex_t: a hash index from the names of directory entries to inodes
+**
+** The entries themselves stay in the directory buffer (in creation order),
+** which getdents64() iterates by offset. The index only speeds up lookups.
+**
+**==============================================================================
+*/
+
+#define DIRINDEX_MIN_CHAINS 16
+
+typedef struct dirindex_entry dirindex_entry_t;
+
+struct dirindex_entry
+{
+    dirindex_entry_t* next;
+    inode_t* inode;
+    uint64_t hash;
+    char name[];
+};
+
+typedef struct dirindex
+{
+    dirindex_entry_t** chains;
+    size_t nchains; /* zero or a power of two */
+    size_t count;
+} dirindex_t;
+
+/* FNV-1a */
+static uint64_t _dirindex_hash(const char* name)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (const uint8_t* p = (const uint8_t*)name; *p; p++)
+    {
+        hash ^= *p;
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+static int _dirindex_rehash(dirindex_t* index, size_t nchains)
+{
+    int ret = 0;
+    dirindex_entry_t** chains;
+
+    if (!(chains = calloc(nchains, sizeof(dirindex_entry_t*))))
+        ERAISE(-ENOMEM);
+
+    for (size_t i = 0; i < index->nchains; i++)
+    {
+        dirindex_entry_t* p = index->chains[i];
+
+        while (p)
+        {
+            dirindex_entry_t* next = p->next;
+            const size_t j = p->hash & (nchains - 1);
+
+            p->next = chains[j];
+            chains[j] = p;
+            p = next;
+        }
+    }
+
+    free(index->chains);
+    index->chains = chains;
+    index->nchains = nchains;
+
+done:
+    return ret;
+}
+
+static int _dirindex_insert(
+    dirindex_t* index,
+    const char* name,
+    inode_t* inode)
+{
+    int ret = 0;
+    const size_t len = strlen(name);
+    dirindex_entry_t* entry;
+    size_t i;
+
+    /* keep the load factor at or below one */
+    if (index->count == index->nchains)
+    {
+        size_t nchains = index->nchains * 2;
+
+        if (nchains < DIRINDEX_MIN_CHAINS)
+            nchains = DIRINDEX_MIN_CHAINS;
+
+        ECHECK(_dirindex_rehash(index, nchains));
+    }
+
+    if (!(entry = malloc(sizeof(dirindex_entry_t) + len + 1)))
+        ERAISE(-ENOMEM);
+
+    entry->inode = inode;
+    entry->hash = _dirindex_hash(name);
+    memcpy(entry->name, name, len + 1);
+
+    i = entry->hash & (index->nchains - 1);
+    entry->next = index->chains[i];
+    index->chains[i] = entry;
+    index->count++;
+
+done:
+    return ret;
+}
+
+static inode_t* _dirindex_find(const dirindex_t* index, const char* name)
+{
+    uint64_t hash;
+
+    if (index->count == 0)
+        return NULL;
+
+    hash = _dirindex_hash(name);
+
+    for (dirindex_entry_t* p = index->chains[hash & (index->nchains - 1)]; p;
+         p = p->next)
+    {
+        if (p->hash == hash && strcmp(p->name, name) == 0)
+            return p->inode;
+    }
+
+    return NULL;
+}
+
+static void _dirindex_remove(dirindex_t* index, const char* name)
+{
+    uint64_t hash;
+    dirindex_entry_t** pp;
+
+    if (index->count == 0)
+        return;
+
+    hash = _dirindex_hash(name);
+
+    for (pp = &index->chains[hash & (index->nchains - 1)]; *pp;
+         pp = &(*pp)->next)
+    {
+        dirindex_entry_t* p = *pp;
+
+        if (p->hash == hash && strcmp(p->name, name) == 0)
+        {
+            *pp = p->next;
+            free(p);
+            index->count--;
+            return;
+        }
+    }
+}
+
+static void _dirindex_release(dirindex_t* index)
+{
+    for (size_t i = 0; i < index->nchains; i++)
+    {
+        for (dirindex_entry_t* p = index->chains[i]; p;)
+        {
+            dirindex_entry_t* next = p->next;
+            free(p);
+            p = next;
+        }
+    }
+
+    free(index->chains);
+    memset(index, 0, sizeof(dirindex_t));
+}
+
+/*
+**==============================================================================
+**
+** pages_t: the data of a regular file as a table of page-sized chunks
+**
+** Growing a file only allocates the pages that are written, so files never
+** need to be moved to a larger buffer and the pages of a hole (that was
+** never written) are not allocated at all. Pages that are not allocated read
+** as zeros, or from the base buffer set by myst_ramfs_set_buf(), which is
+** copied page by page as it is written.
+**
+** The bytes beyond the file size are always zero.
+**
+**==============================================================================
+*/
+
+#define RAMFS_PAGE_SIZE 4096
+#define PAGES_MIN_TABLE 16
+
+typedef struct pages
+{
+    uint8_t** table;     /* null entries are holes */
+    size_t ntable;       /* the number of table entries */
+    size_t size;         /* the file size */
+    const uint8_t* base; /* set by myst_ramfs_set_buf() (not owned) */
+    size_t base_size;    /* the number of bytes of base still in use */
+} pages_t;
+
+static void _pages_release(pages_t* pages)
+{
+    for (size_t i = 0; i < pages->ntable; i++)
+        free(pages->table[i]);
+
+    free(pages->table);
+    memset(pages, 0, sizeof(pages_t));
+}
+
+static void _pages_read(
+    const pages_t* pages,
+    size_t offset,
+    void* buf,
+    size_t count)
+{
+    uint8_t* p = buf;
+
+    while (count)
+    {
+        const size_t index = offset / RAMFS_PAGE_SIZE;
+        const size_t off = offset % RAMFS_PAGE_SIZE;
+        size_t n = RAMFS_PAGE_SIZE - off;
+
+        if (n > count)
+            n = count;
+
+        if (index < pages->ntable && pages->table[index])
+        {
+            memcpy(p, pages->table[index] + off, n);
+        }
+        else
+        {
+            size_t m = 0;
+
+            if (offset < pages->base_size)
+            {
+                m = pages->base_size - offset;
+
+                if (m > n)
+                    m = n;
+
+                memcpy(p, pages->base + offset, m);
+            }
+
+            memset(p + m, 0, n - m);
+        }
+
+        p += n;
+        offset += n;
+        count -= n;
+    }
+}
+
+/* get the given page, allocating it (and the table entry) if necessary */
+static uint8_t* _pages_materialize(pages_t* pages, size_t index)
+{
+    uint8_t* page;
+
+    if (index >= pages->ntable)
+    {
+        size_t ntable = pages->ntable * 2;
+        uint8_t** table;
+
+        if (ntable < PAGES_MIN_TABLE)
+            ntable = PAGES_MIN_TABLE;
+
+        if (ntable <= index)
+            ntable = index + 1;
+
+        if (!(table = realloc(pages->table, ntable * sizeof(uint8_t*))))
+            return NULL;
+
+        memset(
+            table + pages->ntable,
+            0,
+            (ntable - pages->ntable) * sizeof(uint8_t*));
+        pages->table = table;
+        pages->ntable = ntable;
+    }
+
+    if (!(page = pages->table[index]))
+    {
+        const size_t offset = index * RAMFS_PAGE_SIZE;
+        size_t n = 0;
+
+        if (!(page = malloc(RAMFS_PAGE_SIZE)))
+            return NULL;
+
+        /* copy this page of the base buffer on the first write */
+        if (offset < pages->base_size)
+        {
+            n = pages->base_size - offset;
+
+            if (n > RAMFS_PAGE_SIZE)
+                n = RAMFS_PAGE_SIZE;
+
+            memcpy(page, pages->base + offset, n);
+        }
+
+        memset(page + n, 0, RAMFS_PAGE_SIZE - n);
+        pages->table[index] = page;
+    }
+
+    return page;
+}
+
+static int _pages_write(
+    pages_t* pages,
+    size_t offset,
+    const void* buf,
+    size_t count)
+{
+    const uint8_t* p = buf;
+
+    while (count)
+    {
+        const size_t off = offset % RAMFS_PAGE_SIZE;
+        size_t n = RAMFS_PAGE_SIZE - off;
+        uint8_t* page;
+
+        if (n > count)
+            n = count;
+
+        if (!(page = _pages_materialize(pages, offset / RAMFS_PAGE_SIZE)))
+            return -ENOMEM;
+
+        memcpy(page + off, p, n);
+
+        p += n;
+        offset += n;
+        count -= n;
+
+        if (offset > pages->size)
+            pages->size = offset;
+    }
+
+    return 0;
+}
+
+static void _pages_resize(pages_t* pages, size_t size)
+{
+    const size_t npages = (size + RAMFS_PAGE_SIZE - 1) / RAMFS_PAGE_SIZE;
+
+    if (size < pages->size)
+    {
+        const size_t off = size % RAMFS_PAGE_SIZE;
+
+        /* release the pages beyond the new end of the file */
+        for (size_t i = npages; i < pages->ntable; i++)
+        {
+            free(pages->table[i]);
+            pages->table[i] = NULL;
+        }
+
+        /* keep the bytes beyond the end of the file zero */
+        if (off && npages <= pages->ntable && pages->table[npages - 1])
+            memset(pages->table[npages - 1] + off, 0, RAMFS_PAGE_SIZE - off);
+
+        if (size < pages->base_size)
+            pages->base_size = size;
+
+        if (pages->base_size == 0)
+            pages->base = NULL;
+
+        if (npages == 0)
+        {
+            free(pages->table);
+            pages->table = NULL;
+            pages->ntable = 0;
+        }
+        else if (pages->ntable > npages)
+        {
+            pages->ntable = npages;
+        }
+    }
+
+    /* growing leaves a hole */
+    pages->size = size;
+}
+
+/* replace the data with the given buffer (which the caller keeps alive) */
+static void _pages_set_base(pages_t* pages, const void* base, size_t size)
+{
+    _pages_release(pages);
+    pages->base = base;
+    pages->base_size = size;
+    pages->size = size;
+}
+
+/*
+**==============================================================================
+**
+** cpioindex_t: an index of a CPIO archive whose entries are created lazily
+**
+** Loading a large archive used to create an inode for every entry at boot.
+** Instead, myst_ramfs_load_cpio() lists the entries of each directory of the
+** archive and marks the target directory as lazy. The entries of a lazy
+** directory are created (see _inode_populate()) the first time its children
+** are needed, and the child directories become lazy in turn. Regular files
+** are backed by the archive data (until written) as with myst_ramfs_set_buf().
+**
+**==============================================================================
+*/
+
+/* the position of entries that are implied by the paths of other entries */
+#define CPIO_IMPLIED SIZE_MAX
+
+typedef struct cpio_entry
+{
+    size_t pos;    /* position of the CPIO header (or CPIO_IMPLIED) */
+    uint32_t next; /* the next entry of the directory (index + 1) */
+    uint32_t dir;  /* the directory of this entry (index + 1) if any */
+} cpio_entry_t;
+
+typedef struct cpio_dir
+{
+    char* name;     /* the path within the archive ("" for the root) */
+    uint64_t hash;  /* the hash of the name */
+    uint32_t chain; /* the next directory in the hash chain (index + 1) */
+    uint32_t entry; /* the entry of this directory (index + 1) */
+    uint32_t first; /* the first entry of this directory (index + 1) */
+    uint32_t last;  /* the last entry of this directory (index + 1) */
+} cpio_dir_t;
+
+struct cpioindex
+{
+    const uint8_t* data;
+    size_t size;
+    cpio_entry_t* entries;
+    size_t nentries;
+    size_t entries_capacity;
+    cpio_dir_t* dirs;
+    size_t ndirs;
+    size_t dirs_capacity;
+    uint32_t* chains; /* heads of the directory hash chains (index + 1) */
+    size_t nchains;   /* zero or a power of two */
+    myst_mutex_t lock; /* serializes _inode_populate() */
+};
+
+/* FNV-1a */
+static uint64_t _cpioindex_hash(const char* name, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+static void _cpioindex_free(cpioindex_t* index)
+{
+    if (index)
+    {
+        for (size_t i = 0; i < index->ndirs; i++)
+            free(index->dirs[i].name);
+
+        free(index->entries);
+        free(index->dirs);
+        free(index->chains);
+        free(index);
+    }
+}
+
+static int _cpioindex_rehash(cpioindex_t* index)
+{
+    const size_t nchains = index->nchains ? index->nchains * 2 : 1024;
+    uint32_t* chains;
+
+    if (!(chains = calloc(nchains, sizeof(uint32_t))))
+        return -ENOMEM;
+
+    for (size_t i = 0; i < index->ndirs; i++)
+    {
+        cpio_dir_t* dir = &index->dirs[i];
+        uint32_t* head = &chains[dir->hash & (nchains - 1)];
+
+        dir->chain = *head;
+        *head = (uint32_t)(i + 1);
+    }
+
+    free(index->chains);
+    index->chains = chains;
+    index->nchains = nchains;
+
+    return 0;
+}
+
+/* append an entry to the given directory and return its index + 1 */
+static int _cpioindex_add_entry(
+    cpioindex_t* index,
+    uint32_t dir,
+    size_t pos,
+    uint32_t* entry_out)
+{
+    cpio_entry_t* entry;
+    cpio_dir_t* parent = &index->dirs[dir - 1];
+
+    if (index->nentries == UINT32_MAX - 1)
+        return -EFBIG;
+
+    if (index->nentries == index->entries_capacity)
+    {
+        size_t capacity = index->entries_capacity * 2;
+        cpio_entry_t* entries;
+
+        if (capacity == 0)
+            capacity = 4096;
+
+        if (!(entries =
+                  realloc(index->entries, capacity * sizeof(cpio_entry_t))))
+            return -ENOMEM;
+
+        index->entries = entries;
+        index->entries_capacity = capacity;
+    }
+
+    entry = &index->entries[index->nentries++];
+    entry->pos = pos;
+    entry->next = 0;
+    entry->dir = 0;
+
+    if (parent->last)
+        index->entries[parent->last - 1].next = (uint32_t)index->nentries;
+    else
+        parent->first = (uint32_t)index->nentries;
+
+    parent->last = (uint32_t)index->nentries;
+    *entry_out = (uint32_t)index->nentries;
+
+    return 0;
+}
+
+/* find the directory with the given name, adding it (and its parents) to
+ * the index as implied directories if needed, and return its index + 1 */
+static int _cpioindex_dir(
+    cpioindex_t* index,
+    const char* name,
+    size_t len,
+    uint32_t* dir_out)
+{
+    int ret = 0;
+    const uint64_t hash = _cpioindex_hash(name, len);
+    uint32_t parent;
+    uint32_t entry;
+    size_t parent_len = len;
+    cpio_dir_t* dir;
+
+    for (uint32_t i = index->chains[hash & (index->nchains - 1)]; i;
+         i = index->dirs[i - 1].chain)
+    {
+        dir = &index->dirs[i - 1];
+
+        if (dir->hash == hash && strncmp(dir->name, name, len) == 0 &&
+            dir->name[len] == '\0')
+        {
+            *dir_out = i;
+            goto done;
+        }
+    }
+
+    /* the root is always present, so this is a sub-directory */
+    while (parent_len > 0 && name[parent_len - 1] != '/')
+        parent_len--;
+
+    if (parent_len > 0)
+        parent_len--;
+
+    ECHECK(_cpioindex_dir(index, name, parent_len, &parent));
+    ECHECK(_cpioindex_add_entry(index, parent, CPIO_IMPLIED, &entry));
+
+    if (index->ndirs == index->dirs_capacity)
+    {
+        size_t capacity = index->dirs_capacity * 2;
+        cpio_dir_t* dirs;
+
+        if (capacity == 0)
+            capacity = 256;
+
+        if (!(dirs = realloc(index->dirs, capacity * sizeof(cpio_dir_t))))
+            ERAISE(-ENOMEM);
+
+        index->dirs = dirs;
+        index->dirs_capacity = capacity;
+    }
+
+    dir = &index->dirs[index->ndirs];
+    memset(dir, 0, sizeof(cpio_dir_t));
+
+    if (!(dir->name = malloc(len + 1)))
+        ERAISE(-ENOMEM);
+
+    memcpy(dir->name, name, len);
+    dir->name[len] = '\0';
+
+    dir->hash = hash;
+    dir->entry = entry;
+    index->entries[entry - 1].dir = (uint32_t)++index->ndirs;
+
+    if (index->ndirs > index->nchains)
+    {
+        ECHECK(_cpioindex_rehash(index));
+    }
+    else
+    {
+        uint32_t* head = &index->chains[hash & (index->nchains - 1)];
+        dir->chain = *head;
+        *head = (uint32_t)index->ndirs;
+    }
+
+    *dir_out = (uint32_t)index->ndirs;
+
+done:
+    return ret;
+}
+
+/* strip the leading "./" and "/" sequences from the name of an entry */
+static const char* _cpio_name(const char* name)
+{
+    for (;;)
+    {
+        if (name[0] == '/')
+            name++;
+        else if (name[0] == '.' && name[1] == '/')
+            name += 2;
+        else
+            return name;
+    }
+}
+
+static int _cpioindex_new(
+    const void* data,
+    size_t size,
+    cpioindex_t** index_out)
+{
+    int ret = 0;
+    cpioindex_t* index = NULL;
+    size_t pos = 0;
+    struct locals
+    {
+        myst_cpio_entry_t ent;
+    };
+    struct locals* locals = NULL;
+
+    if (!(locals = malloc(sizeof(struct locals))))
+        ERAISE(-ENOMEM);
+
+    if (!(index = calloc(1, sizeof(cpioindex_t))))
+        ERAISE(-ENOMEM);
+
+    index->data = data;
+    index->size = size;
+    myst_mutex_init(&index->lock);
+
+    /* add the root directory */
+    {
+        if (!(index->dirs = calloc(1, sizeof(cpio_dir_t))))
+            ERAISE(-ENOMEM);
+
+        index->dirs_capacity = 1;
+
+        if (!(index->dirs[0].name = strdup("")))
+            ERAISE(-ENOMEM);
+
+        index->dirs[0].hash = _cpioindex_hash("", 0);
+        index->ndirs = 1;
+        ECHECK(_cpioindex_rehash(index));
+    }
+
+    for (;;)
+    {
+        const size_t start = pos;
+        const void* file_data;
+        const char* name;
+        const char* slash;
+        uint32_t dir;
+        uint32_t entry;
+        int r;
+
+        if ((r = myst_cpio_next_entry(
+                 data, size, &pos, &locals->ent, &file_data)) == 0)
+            break;
+
+        if (r < 0)
+            ERAISE(-EINVAL);
+
+        name = _cpio_name(locals->ent.name);
+
+        if (*name == '\0' || strcmp(name, ".") == 0)
+            continue;
+
+        if (S_ISDIR(locals->ent.mode))
+        {
+            /* the directory may have been implied by an earlier entry */
+            ECHECK(_cpioindex_dir(index, name, strlen(name), &dir));
+            index->entries[index->dirs[dir - 1].entry - 1].pos = start;
+            continue;
+        }
+
+        slash = strrchr(name, '/');
+        ECHECK(_cpioindex_dir(index, name, slash ? slash - name : 0, &dir));
+        ECHECK(_cpioindex_add_entry(index, dir, start, &entry));
+    }
+
+    /* the names are still needed for the implied directories */
+    free(index->chains);
+    index->chains = NULL;
+    index->nchains = 0;
+
+    *index_out = index;
+    index = NULL;
+
+done:
+
+    if (locals)
+        free(locals);
+
+    _cpioindex_free(index);
+
+    return ret;
+}
+
 /*
 **==============================================================================
 **
@@ -77,17 +824,21 @@ static bool _ramfs_valid(const ramfs_t* ramfs)
 struct inode
 {
     uint64_t magic;
-    uint32_t mode;         /* Type and mode */
-    struct timespec atime; /* time of last access */
-    struct timespec ctime; /* time of last metadata change */
-    struct timespec mtime; /* time of last modification */
-    size_t nlink;          /* number of hard links to this inode */
-    size_t nopens;         /* number of times file is currently opened */
-    myst_buf_t buf;        /* file or directory data */
-    const void* data;      /* set by myst_ramfs_set_buf() */
-    uid_t uid;             /* user ID who created */
-    gid_t gid;             /* group ID who created */
-    myst_vcallback_t v_cb; /* callback(s) for virtual files */
+    uint32_t mode;          /* Type and mode */
+    struct timespec atime;  /* time of last access (see atime_lock) */
+    struct timespec ctime;  /* time of last metadata change */
+    struct timespec mtime;  /* time of last modification */
+    size_t nlink;           /* number of hard links to this inode */
+    _Atomic(size_t) nopens; /* number of times file is currently opened */
+    myst_rwlock_t lock;     /* guards the file data */
+    myst_spinlock_t atime_lock; /* guards atime, which readers also set */
+    myst_buf_t buf;         /* directory or symbolic link data */
+    pages_t pages;          /* regular file data */
+    dirindex_t index;       /* directory entries by name */
+    _Atomic(uint32_t) lazy; /* entries yet to be loaded (see cpioindex_t) */
+    uid_t uid;              /* user ID who created */
+    gid_t gid;              /* group ID who created */
+    myst_vcallback_t v_cb;  /* callback(s) for virtual files */
     myst_virtual_file_type_t v_type; /* virtual file type */
 };
 
@@ -109,8 +860,13 @@ static void _update_timestamps(inode_t* inode, int flags)
     if (myst_syscall_clock_gettime(CLOCK_REALTIME, &ts) != 0)
         myst_panic("clock_gettime() failed");
 
+    /* accesses update atime under the shared inode (or tree) lock */
     if (flags & ACCESS)
+    {
+        myst_spin_lock(&inode->atime_lock);
         inode->atime = ts;
+        myst_spin_unlock(&inode->atime_lock);
+    }
 
     if (flags & CHANGE)
         inode->ctime = ts;
@@ -119,12 +875,38 @@ static void _update_timestamps(inode_t* inode, int flags)
         inode->mtime = ts;
 }
 
+/* whether the data of this inode is kept in pages (see pages_t) */
+static bool _inode_paged(const inode_t* inode)
+{
+    return S_ISREG(inode->mode) && inode->v_type == NONE;
+}
+
+static size_t _inode_size(const inode_t* inode)
+{
+    return _inode_paged(inode) ? inode->pages.size : inode->buf.size;
+}
+
+static int _inode_resize(inode_t* inode, size_t size)
+{
+    if (_inode_paged(inode))
+    {
+        _pages_resize(&inode->pages, size);
+        return 0;
+    }
+
+    if (myst_buf_resize(&inode->buf, size) != 0)
+        return -ENOMEM;
+
+    return 0;
+}
+
 static void _inode_free(ramfs_t* ramfs, inode_t* inode)
 {
     if (inode)
     {
-        if (inode->buf.data != inode->data)
-            myst_buf_release(&inode->buf);
+        myst_buf_release(&inode->buf);
+        _pages_release(&inode->pages);
+        _dirindex_release(&inode->index);
         memset(inode, 0xdd, sizeof(inode_t));
         free(inode);
 
@@ -175,8 +957,18 @@ static int _inode_add_dirent(
             sizeof(locals->ent.d_name))
             ERAISE(-ENAMETOOLONG);
 
-        if (myst_buf_append(&dir->buf, &locals->ent, sizeof(locals->ent)) != 0)
+        ECHECK(_dirindex_insert(&dir->index, name, inode));
+
+        /* lookups hold the tree lock but read() takes only this one */
+        myst_rwlock_wrlock(&dir->lock);
+        ret = myst_buf_append(&dir->buf, &locals->ent, sizeof(locals->ent));
+        myst_rwlock_unlock(&dir->lock);
+
+        if (ret != 0)
+        {
+            _dirindex_remove(&dir->index, name);
             ERAISE(-ENOMEM);
+        }
     }
 
     _update_timestamps(dir, CHANGE | MODIFY);
@@ -193,7 +985,8 @@ static bool _inode_is_empty_dir(const inode_t* inode)
 {
     /* empty directories have two entries: "." and ".." */
     const size_t empty_size = (2 * sizeof(struct dirent));
-    return inode && S_ISDIR(inode->mode) && inode->buf.size == empty_size;
+    return inode && S_ISDIR(inode->mode) && inode->buf.size == empty_size &&
+           !inode->lazy;
 }
 
 #if 0
@@ -243,6 +1036,7 @@ static int _inode_new(
     inode->magic = INODE_MAGIC;
     inode->mode = mode;
     inode->nlink = 1;
+    myst_rwlock_init(&inode->lock);
 
     inode->gid = myst_syscall_getegid();
     inode->uid = myst_syscall_geteuid();
@@ -278,44 +1072,178 @@ static int _inode_new(
             ERAISE(-EINVAL);
         }
 
-        /* add new inode to parent directory */
-        {
-            ECHECK(_inode_add_dirent(parent, inode, type, name));
+        /* add new inode to parent directory */
+        {
+            ECHECK(_inode_add_dirent(parent, inode, type, name));
+
+            if (S_ISDIR(inode->mode))
+                parent->nlink++;
+        }
+    }
+
+    _update_timestamps(inode, ACCESS | CHANGE | MODIFY);
+
+    if (inode_out)
+        *inode_out = inode;
+
+    ramfs->ninodes++;
+    inode = NULL;
+
+done:
+
+    if (inode)
+        _inode_free(ramfs, inode);
+
+    return ret;
+}
+
+/* create the inode for an entry of a lazy directory (see cpioindex_t) */
+static int _inode_load_entry(
+    ramfs_t* ramfs,
+    inode_t* dir,
+    const cpio_entry_t* entry,
+    myst_cpio_entry_t* ent)
+{
+    int ret = 0;
+    const cpioindex_t* index = ramfs->cpio;
+    const void* file_data = NULL;
+    const char* name;
+    const char* slash;
+    uint32_t mode;
+    inode_t* inode;
+
+    if (entry->pos == CPIO_IMPLIED)
+    {
+        name = index->dirs[entry->dir - 1].name;
+        mode = S_IFDIR | 0755;
+    }
+    else
+    {
+        size_t pos = entry->pos;
+
+        if (myst_cpio_next_entry(
+                index->data, index->size, &pos, ent, &file_data) != 1)
+            ERAISE(-EINVAL);
+
+        name = _cpio_name(ent->name);
+        mode = ent->mode;
+    }
+
+    /* the name within the directory */
+    if ((slash = strrchr(name, '/')))
+        name = slash + 1;
+
+    /* entries may replace (or merge with) ones created before the load */
+    inode = _dirindex_find(&dir->index, name);
+
+    if (S_ISDIR(mode))
+    {
+        if (!inode)
+        {
+            mode = S_IFDIR | (mode & 07777);
+            ECHECK(_inode_new(ramfs, dir, name, mode, &inode));
+        }
+
+        if (S_ISDIR(inode->mode) && index->dirs[entry->dir - 1].first)
+            inode->lazy = entry->dir;
+    }
+    else if (S_ISREG(mode))
+    {
+        if (!inode)
+        {
+            mode = S_IFREG | (mode & 07777);
+            ECHECK(_inode_new(ramfs, dir, name, mode, &inode));
+        }
+
+        if (_inode_paged(inode))
+        {
+            myst_rwlock_wrlock(&inode->lock);
+            _pages_set_base(&inode->pages, file_data, ent->size);
+            myst_rwlock_unlock(&inode->lock);
+        }
+    }
+    else if (S_ISLNK(mode) && !inode)
+    {
+        /* skip a malformed link rather than failing the whole directory */
+        if (ent->size == 0 || ent->size >= PATH_MAX)
+            goto done;
+
+        ECHECK(_inode_new(ramfs, dir, name, S_IFLNK | 0777, &inode));
+
+        if (myst_buf_append(&inode->buf, file_data, ent->size) != 0 ||
+            myst_buf_append(&inode->buf, "", 1) != 0)
+            ERAISE(-ENOMEM);
+    }
+
+    /* other types of entries are not supported (and are ignored) */
+
+done:
+    return ret;
+}
+
+/* create the entries of a lazy directory (the caller holds the tree lock
+ * shared or exclusive, and other lookups of this directory wait here) */
+static int _inode_populate(ramfs_t* ramfs, inode_t* dir)
+{
+    int ret = 0;
+    cpioindex_t* index = ramfs->cpio;
+    struct locals
+    {
+        myst_cpio_entry_t ent;
+    };
+    struct locals* locals = NULL;
+
+    myst_mutex_lock(&index->lock);
 
-            if (S_ISDIR(inode->mode))
-                parent->nlink++;
-        }
-    }
+    if (!dir->lazy)
+        goto done;
 
-    _update_timestamps(inode, ACCESS | CHANGE | MODIFY);
+    if (!(locals = malloc(sizeof(struct locals))))
+        ERAISE(-ENOMEM);
 
-    if (inode_out)
-        *inode_out = inode;
+    for (uint32_t i = index->dirs[dir->lazy - 1].first; i;
+         i = index->entries[i - 1].next)
+    {
+        ECHECK(_inode_load_entry(
+            ramfs, dir, &index->entries[i - 1], &locals->ent));
+    }
 
-    ramfs->ninodes++;
-    inode = NULL;
+    /* a failed load is retried (the loaded entries are merged) */
+    dir->lazy = 0;
 
 done:
 
-    if (inode)
-        _inode_free(ramfs, inode);
+    myst_mutex_unlock(&index->lock);
+
+    if (locals)
+        free(locals);
 
     return ret;
 }
 
-static inode_t* _inode_find_child(const inode_t* inode, const char* name)
+/* find the named entry of a directory: fails with -ENOENT if there is none,
+ * or with the error of loading the entries of a lazy directory */
+static int _inode_find_child(
+    ramfs_t* ramfs,
+    inode_t* inode,
+    const char* name,
+    inode_t** child_out)
 {
-    struct dirent* ents = (struct dirent*)inode->buf.data;
-    size_t nents = inode->buf.size / sizeof(struct dirent);
+    int ret = 0;
+    inode_t* child;
 
-    for (size_t i = 0; i < nents; i++)
-    {
-        if (strcmp(ents[i].d_name, name) == 0)
-            return (inode_t*)ents[i].d_ino;
-    }
+    *child_out = NULL;
 
-    /* Not found */
-    return NULL;
+    if (inode->lazy)
+        ECHECK(_inode_populate(ramfs, inode));
+
+    if (!(child = _dirindex_find(&inode->index, name)))
+        ERAISE_QUIET(-ENOENT);
+
+    *child_out = child;
+
+done:
+    return ret;
 }
 
 /* Perform a depth-first release of all inodes */
@@ -374,10 +1302,14 @@ static int _inode_remove_dirent(inode_t* inode, const char* name)
     struct dirent* ents = (struct dirent*)inode->buf.data;
     size_t nents = inode->buf.size / sizeof(struct dirent);
     size_t index = (size_t)-1;
+    bool locked = false;
 
     if (!S_ISDIR(inode->mode))
         ERAISE(-ENOTDIR);
 
+    myst_rwlock_wrlock(&inode->lock);
+    locked = true;
+
     for (size_t i = 0; i < nents; i++)
     {
         if (strcmp(ents[i].d_name, name) == 0)
@@ -399,6 +1331,8 @@ static int _inode_remove_dirent(inode_t* inode, const char* name)
     if (index == (size_t)-1)
         ERAISE(-ENOENT);
 
+    _dirindex_remove(&inode->index, name);
+
     /* Adjust d_off for entries following the deleted entry */
     for (size_t i = index + 1; i < nents - 1; i++)
     {
@@ -409,14 +1343,37 @@ static int _inode_remove_dirent(inode_t* inode, const char* name)
     _update_timestamps(inode, CHANGE | MODIFY);
 
 done:
+
+    if (locked)
+        myst_rwlock_unlock(&inode->lock);
+
     return ret;
 }
 
-static const char* _inode_target(inode_t* inode)
+/* copy the target of a symbolic link (virtual links are regenerated, which
+ * requires the inode lock since lookups only hold the tree lock shared) */
+static int _inode_target(inode_t* inode, char target[PATH_MAX])
 {
-    if (inode->v_type == OPEN)
+    int ret = 0;
+    const bool regenerate = (inode->v_type == OPEN);
+
+    if (regenerate)
+        myst_rwlock_wrlock(&inode->lock);
+    else
+        myst_rwlock_rdlock(&inode->lock);
+
+    if (regenerate)
         inode->v_cb.open_cb(&inode->buf, NULL);
-    return (const char*)inode->buf.data;
+
+    if (!inode->buf.data)
+        *target = '\0';
+    else if (
+        myst_strlcpy(target, (char*)inode->buf.data, PATH_MAX) >= PATH_MAX)
+        ret = -ENAMETOOLONG;
+
+    myst_rwlock_unlock(&inode->lock);
+
+    return ret;
 }
 
 /*
@@ -438,7 +1395,8 @@ struct myst_file
     uint32_t operating; /* (O_APPEND | O_DIRECT | O_NOATIME) */
     int fdflags;        /* file descriptor flags: FD_CLOEXEC */
     char realpath[PATH_MAX];
-    myst_buf_t vbuf; /* virtual file buffer */
+    myst_buf_t vbuf;    /* virtual file buffer */
+    myst_mutex_t mutex; /* guards the offset */
     _Atomic(size_t) use_count;
 };
 
@@ -447,26 +1405,53 @@ static bool _file_valid(const myst_file_t* file)
     return file && file->magic == FILE_MAGIC;
 }
 
-static void* _file_data(const myst_file_t* file)
+/* the buffer that holds the data when the file is not paged */
+static myst_buf_t* _file_buf(myst_file_t* file)
 {
-    return (file->inode->v_type == OPEN) ? file->vbuf.data
-                                         : file->inode->buf.data;
+    return (file->inode->v_type == OPEN) ? &file->vbuf : &file->inode->buf;
 }
 
 static size_t _file_size(const myst_file_t* file)
 {
     return (file->inode->v_type == OPEN) ? file->vbuf.size
-                                         : file->inode->buf.size;
+                                         : _inode_size(file->inode);
 }
 
-static void* _file_current(myst_file_t* file)
+/* the caller checks that the range is within the file */
+static void _file_read_at(
+    myst_file_t* file,
+    size_t offset,
+    void* buf,
+    size_t count)
 {
-    return (uint8_t*)_file_data(file) + file->offset;
+    if (_inode_paged(file->inode))
+        _pages_read(&file->inode->pages, offset, buf, count);
+    else
+        memcpy(buf, _file_buf(file)->data + offset, count);
 }
 
-static void* _file_at(myst_file_t* file, size_t offset)
+/* write to the file, extending it as needed */
+static int _file_write_at(
+    myst_file_t* file,
+    size_t offset,
+    const void* buf,
+    size_t count)
 {
-    return (uint8_t*)_file_data(file) + offset;
+    myst_buf_t* fbuf;
+
+    if (_inode_paged(file->inode))
+        return _pages_write(&file->inode->pages, offset, buf, count);
+
+    fbuf = _file_buf(file);
+
+    if (offset + count > fbuf->size)
+    {
+        if (myst_buf_resize(fbuf, offset + count) != 0)
+            return -ENOMEM;
+    }
+
+    memcpy(fbuf->data + offset, buf, count);
+    return 0;
 }
 
 /*
@@ -502,6 +1487,7 @@ static int _path_to_inode_recursive(
     char** toks = NULL;
     size_t ntoks = 0;
     inode_t* inode = NULL;
+    char* target = NULL;
 
     if (inode_out)
         *inode_out = NULL;
@@ -540,8 +1526,7 @@ static int _path_to_inode_recursive(
                 ERAISE_QUIET(-ENOTDIR);
 
             inode_t* p;
-            if (!(p = _inode_find_child(parent, toks[i])))
-                ERAISE_QUIET(-ENOENT);
+            ECHECK_QUIET(_inode_find_child(ramfs, parent, toks[i], &p));
 
             if (!S_ISLNK(p->mode))
             {
@@ -557,7 +1542,10 @@ static int _path_to_inode_recursive(
 
             if (S_ISLNK(p->mode) && (follow || i + 1 != ntoks))
             {
-                const char* target = _inode_target(p);
+                if (!target && !(target = malloc(PATH_MAX)))
+                    ERAISE(-ENOMEM);
+
+                ECHECK(_inode_target(p, target));
 
                 if (*target == '/')
                 {
@@ -604,8 +1592,6 @@ static int _path_to_inode_recursive(
                         realpath,
                         target_out));
                 }
-
-                assert(target != NULL);
             }
 
             /* If final token */
@@ -632,6 +1618,9 @@ done:
     if (toks)
         free(toks);
 
+    if (target)
+        free(target);
+
     return ret;
 }
 
@@ -742,6 +1731,8 @@ static int _fs_release(myst_fs_t* fs)
 
     assert(ramfs->ninodes == 0);
 
+    _cpioindex_free(ramfs->cpio);
+
     free(ramfs);
 
 done:
@@ -752,10 +1743,14 @@ static int _fs_mount(myst_fs_t* fs, const char* source, const char* target)
 {
     int ret = 0;
     ramfs_t* ramfs = (ramfs_t*)fs;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !target)
         ERAISE(-EINVAL);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     if (myst_strlcpy(ramfs->target, target, PATH_MAX) >= PATH_MAX)
         ERAISE(-ENAMETOOLONG);
 
@@ -763,6 +1758,10 @@ static int _fs_mount(myst_fs_t* fs, const char* source, const char* target)
         ERAISE(-ENAMETOOLONG);
 
 done:
+
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -800,6 +1799,7 @@ static int _fs_open(
     int errnum;
     bool is_i_new = false;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
     struct locals
     {
         char suffix[PATH_MAX];
@@ -827,11 +1827,22 @@ static int _fs_open(
     if (!(file = calloc(1, sizeof(myst_file_t))))
         ERAISE(-ENOMEM);
 
+    /* creating or truncating changes the tree */
+    if ((flags & (O_CREAT | O_TRUNC)))
+        myst_rwlock_wrlock(&ramfs->lock);
+    else
+        myst_rwlock_rdlock(&ramfs->lock);
+
+    locked = true;
+
     errnum = _path_to_inode(
         ramfs, pathname, true, NULL, &inode, locals->suffix, &tfs);
 
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         /* delegate open operation to target filesystem */
         ECHECK(
             (ret = tfs->fs_open(
@@ -842,10 +1853,7 @@ static int _fs_open(
     {
         /* i.e, path resolving has terminated,
         file resides in the current fs. */
-        if (ramfs->lockfs)
-            *fs_out = ramfs->lockfs;
-        else
-            *fs_out = (myst_fs_t*)ramfs;
+        *fs_out = (myst_fs_t*)ramfs;
     }
 
     /* If the file already exists */
@@ -881,11 +1889,20 @@ static int _fs_open(
         if ((flags & O_DIRECTORY) && !S_ISDIR(inode->mode))
             ERAISE(-ENOTDIR);
 
-        if ((flags & O_TRUNC))
-            myst_buf_clear(&inode->buf);
+        if ((flags & (O_TRUNC | O_APPEND)))
+        {
+            myst_rwlock_wrlock(&inode->lock);
+
+            /* directory buffers hold entries (see _inode_add_dirent()) */
+            if ((flags & O_TRUNC) && !S_ISDIR(inode->mode))
+                ret = _inode_resize(inode, 0);
 
-        if ((flags & O_APPEND))
-            file->offset = inode->buf.size;
+            if ((flags & O_APPEND))
+                file->offset = _inode_size(inode);
+
+            myst_rwlock_unlock(&inode->lock);
+            ECHECK(ret);
+        }
 
         /* Get the realpath of this file */
         ECHECK(_path_to_inode_realpath(
@@ -929,6 +1946,7 @@ static int _fs_open(
     file->access = (flags & (O_RDONLY | O_RDWR | O_WRONLY));
     file->operating = (flags & O_APPEND);
     file->use_count = 1;
+    myst_mutex_init(&file->mutex);
     inode->nopens++;
 
     assert(_file_valid(file));
@@ -945,6 +1963,9 @@ done:
     if (inode && is_i_new)
         _inode_free(ramfs, inode);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     if (file)
         free(file);
 
@@ -960,6 +1981,7 @@ static off_t _fs_lseek(
     ramfs_t* ramfs = (ramfs_t*)fs;
     off_t ret = 0;
     off_t new_offset;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !_file_valid(file))
         ERAISE(-EINVAL);
@@ -968,6 +1990,10 @@ static off_t _fs_lseek(
     if (file->inode->v_type == RW)
         goto done;
 
+    myst_mutex_lock(&file->mutex);
+    myst_rwlock_rdlock(&file->inode->lock);
+    locked = true;
+
     switch (whence)
     {
         case SEEK_SET:
@@ -1004,6 +2030,13 @@ static off_t _fs_lseek(
     ret = new_offset;
 
 done:
+
+    if (locked)
+    {
+        myst_rwlock_unlock(&file->inode->lock);
+        myst_mutex_unlock(&file->mutex);
+    }
+
     return ret;
 }
 
@@ -1016,6 +2049,7 @@ static ssize_t _fs_read(
     ramfs_t* ramfs = (ramfs_t*)fs;
     ssize_t ret = 0;
     size_t n;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -1041,6 +2075,10 @@ static ssize_t _fs_read(
         goto done;
     }
 
+    myst_mutex_lock(&file->mutex);
+    myst_rwlock_rdlock(&file->inode->lock);
+    locked = true;
+
     /* Verify that the offset is in bounds */
     if (file->offset > _file_size(file))
         ERAISE(-EINVAL);
@@ -1056,7 +2094,7 @@ static ssize_t _fs_read(
         }
 
         n = (count < remaining) ? count : remaining;
-        memcpy(buf, _file_current(file), n);
+        _file_read_at(file, file->offset, buf, n);
         file->offset += n;
     }
 
@@ -1065,6 +2103,13 @@ static ssize_t _fs_read(
     ret = (ssize_t)n;
 
 done:
+
+    if (locked)
+    {
+        myst_rwlock_unlock(&file->inode->lock);
+        myst_mutex_unlock(&file->mutex);
+    }
+
     return ret;
 }
 
@@ -1076,6 +2121,7 @@ static ssize_t _fs_write(
 {
     ramfs_t* ramfs = (ramfs_t*)fs;
     ssize_t ret = 0;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -1101,22 +2147,18 @@ static ssize_t _fs_write(
         goto done;
     }
 
+    myst_mutex_lock(&file->mutex);
+    myst_rwlock_wrlock(&file->inode->lock);
+    locked = true;
+
     /* Verify that the offset is in bounds */
     if (file->offset > _file_size(file))
         ERAISE(-EINVAL);
 
     /* Write count bytes to the file or directory */
     {
-        size_t new_offset = file->offset + count;
-
-        if (new_offset > _file_size(file))
-        {
-            if (myst_buf_resize(&file->inode->buf, new_offset) != 0)
-                ERAISE(-ENOMEM);
-        }
-
-        memcpy(_file_current(file), buf, count);
-        file->offset = new_offset;
+        ECHECK(_file_write_at(file, file->offset, buf, count));
+        file->offset += count;
     }
 
     _update_timestamps(file->inode, MODIFY | CHANGE);
@@ -1124,6 +2166,13 @@ static ssize_t _fs_write(
     ret = (ssize_t)count;
 
 done:
+
+    if (locked)
+    {
+        myst_rwlock_unlock(&file->inode->lock);
+        myst_mutex_unlock(&file->mutex);
+    }
+
     return ret;
 }
 
@@ -1137,6 +2186,7 @@ static ssize_t _fs_pread(
     ramfs_t* ramfs = (ramfs_t*)fs;
     ssize_t ret = 0;
     size_t n;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -1161,6 +2211,10 @@ static ssize_t _fs_pread(
         goto done;
     }
 
+    /* the file offset is not used */
+    myst_rwlock_rdlock(&file->inode->lock);
+    locked = true;
+
     /* Verify that the offset is in bounds */
     if ((size_t)offset > _file_size(file))
         ERAISE(-EINVAL);
@@ -1176,7 +2230,7 @@ static ssize_t _fs_pread(
         }
 
         n = (count < remaining) ? count : remaining;
-        memcpy(buf, _file_at(file, (size_t)offset), n);
+        _file_read_at(file, (size_t)offset, buf, n);
     }
 
     _update_timestamps(file->inode, ACCESS);
@@ -1184,6 +2238,10 @@ static ssize_t _fs_pread(
     ret = (ssize_t)n;
 
 done:
+
+    if (locked)
+        myst_rwlock_unlock(&file->inode->lock);
+
     return ret;
 }
 
@@ -1196,6 +2254,7 @@ static ssize_t _fs_pwrite(
 {
     ramfs_t* ramfs = (ramfs_t*)fs;
     ssize_t ret = 0;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -1220,6 +2279,9 @@ static ssize_t _fs_pwrite(
         goto done;
     }
 
+    myst_rwlock_wrlock(&file->inode->lock);
+    locked = true;
+
     /* Write count bytes to the file or directory */
     {
         // When opened for append, Linux pwrite() appends data to the end of
@@ -1227,15 +2289,7 @@ static ssize_t _fs_pwrite(
         if ((file->operating & O_APPEND))
             offset = _file_size(file);
 
-        size_t new_offset = (size_t)offset + count;
-
-        if (new_offset > _file_size(file))
-        {
-            if (myst_buf_resize(&file->inode->buf, new_offset) != 0)
-                ERAISE(-ENOMEM);
-        }
-
-        memcpy(_file_at(file, (size_t)offset), buf, count);
+        ECHECK(_file_write_at(file, (size_t)offset, buf, count));
     }
 
     _update_timestamps(file->inode, CHANGE | MODIFY);
@@ -1243,6 +2297,10 @@ static ssize_t _fs_pwrite(
     ret = (ssize_t)count;
 
 done:
+
+    if (locked)
+        myst_rwlock_unlock(&file->inode->lock);
+
     return ret;
 }
 
@@ -1255,10 +2313,16 @@ static ssize_t _fs_readv(
     ssize_t ret = 0;
     ramfs_t* ramfs = (ramfs_t*)fs;
     ssize_t total = 0;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    /* hold the locks across the vector (the nested calls lock recursively) */
+    myst_mutex_lock(&file->mutex);
+    myst_rwlock_rdlock(&file->inode->lock);
+    locked = true;
+
     for (int i = 0; i < iovcnt; i++)
     {
         ssize_t n;
@@ -1276,6 +2340,13 @@ static ssize_t _fs_readv(
     ret = total;
 
 done:
+
+    if (locked)
+    {
+        myst_rwlock_unlock(&file->inode->lock);
+        myst_mutex_unlock(&file->mutex);
+    }
+
     return ret;
 }
 
@@ -1288,10 +2359,16 @@ static ssize_t _fs_writev(
     ssize_t ret = 0;
     ramfs_t* ramfs = (ramfs_t*)fs;
     ssize_t total = 0;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    /* hold the locks across the vector (the nested calls lock recursively) */
+    myst_mutex_lock(&file->mutex);
+    myst_rwlock_wrlock(&file->inode->lock);
+    locked = true;
+
     for (int i = 0; i < iovcnt; i++)
     {
         ssize_t n;
@@ -1309,6 +2386,13 @@ static ssize_t _fs_writev(
     ret = total;
 
 done:
+
+    if (locked)
+    {
+        myst_rwlock_unlock(&file->inode->lock);
+        myst_mutex_unlock(&file->mutex);
+    }
+
     return ret;
 }
 
@@ -1331,10 +2415,11 @@ static int _fs_close(myst_fs_t* fs, myst_file_t* file)
         if (file->inode->v_type == OPEN)
             myst_buf_release(&file->vbuf);
 
-        file->inode->nopens--;
+        /* the tree lock keeps nlink stable (see _fs_unlink()) */
+        myst_rwlock_rdlock(&ramfs->lock);
 
         /* handle case where file was deleted while open */
-        if (file->inode->nopens == 0 && file->inode->nlink == 0)
+        if (--file->inode->nopens == 0 && file->inode->nlink == 0)
         {
             _inode_free(ramfs, file->inode);
         }
@@ -1343,6 +2428,8 @@ static int _fs_close(myst_fs_t* fs, myst_file_t* file)
             _update_timestamps(file->inode, ACCESS);
         }
 
+        myst_rwlock_unlock(&ramfs->lock);
+
         memset(file, 0xdd, sizeof(myst_file_t));
         free(file);
     }
@@ -1361,6 +2448,7 @@ static int _fs_access(myst_fs_t* fs, const char* pathname, int mode)
     };
     struct locals* locals = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
@@ -1368,6 +2456,9 @@ static int _fs_access(myst_fs_t* fs, const char* pathname, int mode)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_rdlock(&ramfs->lock);
+    locked = true;
+
     if (mode != F_OK && !(mode & (R_OK | W_OK | X_OK)))
         ERAISE(-EINVAL);
 
@@ -1377,6 +2468,9 @@ static int _fs_access(myst_fs_t* fs, const char* pathname, int mode)
 
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_access(tfs, locals->suffix, mode)));
         goto done;
@@ -1401,6 +2495,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -1421,7 +2518,7 @@ static int _stat(inode_t* inode, struct stat* statbuf)
     }
     else
     {
-        size = inode->buf.size;
+        size = _inode_size(inode);
         ECHECK(myst_round_up_signed(size, BLKSIZE, &rounded));
     }
 
@@ -1438,7 +2535,9 @@ static int _stat(inode_t* inode, struct stat* statbuf)
     buf.st_blocks = rounded / BLKSIZE;
     buf.st_ctim = inode->ctime;
     buf.st_mtim = inode->mtime;
+    myst_spin_lock(&inode->atime_lock);
     buf.st_atim = inode->atime;
+    myst_spin_unlock(&inode->atime_lock);
 
     *statbuf = buf;
 
@@ -1457,6 +2556,7 @@ static int _fs_stat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     };
     struct locals* locals = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname || !statbuf)
         ERAISE(-EINVAL);
@@ -1464,10 +2564,16 @@ static int _fs_stat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_rdlock(&ramfs->lock);
+    locked = true;
+
     ECHECK(_path_to_inode(
         ramfs, pathname, true, NULL, &inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_stat(tfs, locals->suffix, statbuf)));
         goto done;
@@ -1479,6 +2585,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -1493,6 +2602,7 @@ static int _fs_lstat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     };
     struct locals* locals = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname || !statbuf)
         ERAISE(-EINVAL);
@@ -1500,10 +2610,16 @@ static int _fs_lstat(myst_fs_t* fs, const char* pathname, struct stat* statbuf)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_rdlock(&ramfs->lock);
+    locked = true;
+
     ECHECK(_path_to_inode(
         ramfs, pathname, false, NULL, &inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_lstat(tfs, locals->suffix, statbuf));
         goto done;
@@ -1515,6 +2631,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -1527,7 +2646,10 @@ static int _fs_fstat(myst_fs_t* fs, myst_file_t* file, struct stat* statbuf)
         ERAISE(-EINVAL);
 
     assert(_inode_valid(file->inode));
-    ERAISE(_stat(file->inode, statbuf));
+    myst_rwlock_rdlock(&file->inode->lock);
+    ret = _stat(file->inode, statbuf);
+    myst_rwlock_unlock(&file->inode->lock);
+    ERAISE(ret);
 
 done:
     return ret;
@@ -1547,6 +2669,7 @@ static int _fs_link(myst_fs_t* fs, const char* oldpath, const char* newpath)
     };
     struct locals* locals = NULL;
     myst_fs_t* tfs;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !oldpath || !newpath)
         ERAISE(-EINVAL);
@@ -1554,11 +2677,17 @@ static int _fs_link(myst_fs_t* fs, const char* oldpath, const char* newpath)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     /* Find the inode for oldpath */
     ECHECK(_path_to_inode(
         ramfs, oldpath, true, NULL, &old_inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK((ret = tfs->fs_link(tfs, locals->suffix, newpath)));
         goto done;
@@ -1574,8 +2703,17 @@ static int _fs_link(myst_fs_t* fs, const char* oldpath, const char* newpath)
         ramfs, locals->new_dirname, true, NULL, &new_parent, NULL, NULL));
 
     /* Fail if newpath already exists */
-    if (_inode_find_child(new_parent, locals->new_basename) != NULL)
-        ERAISE(-EEXIST);
+    {
+        inode_t* inode;
+        int r = _inode_find_child(
+            ramfs, new_parent, locals->new_basename, &inode);
+
+        if (r == 0)
+            ERAISE(-EEXIST);
+
+        if (r != -ENOENT)
+            ERAISE(r);
+    }
 
     /* Add the directory entry for the newpath */
     _inode_add_dirent(new_parent, old_inode, DT_REG, locals->new_basename);
@@ -1590,6 +2728,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -1607,6 +2748,7 @@ static int _fs_unlink(myst_fs_t* fs, const char* pathname)
     inode_t* parent;
     inode_t* inode;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
@@ -1614,11 +2756,17 @@ static int _fs_unlink(myst_fs_t* fs, const char* pathname)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     /* Get the inode for pathname */
     ECHECK(_path_to_inode(
         ramfs, pathname, false, NULL, &inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK((*tfs->fs_unlink)(tfs, locals->suffix));
         goto done;
@@ -1664,6 +2812,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -1685,6 +2836,7 @@ static int _fs_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
     inode_t* new_parent = NULL;
     inode_t* new_inode = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     /* ATTN: check attempt to make subdirectory a directory of itself */
     /* ATTN: check where newpath contains a prefix of oldpath */
@@ -1695,6 +2847,9 @@ static int _fs_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     /* Split oldpath */
     ECHECK(_split_path(oldpath, locals->old_dirname, locals->old_basename));
 
@@ -1703,6 +2858,9 @@ static int _fs_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
         ramfs, oldpath, true, &old_parent, &old_inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         /* append old_basename and delegate operation to target filesystem */
         if (myst_strlcat(locals->suffix, "/", PATH_MAX) >= PATH_MAX)
             ERAISE_QUIET(-ENAMETOOLONG);
@@ -1722,7 +2880,13 @@ static int _fs_rename(myst_fs_t* fs, const char* oldpath, const char* newpath)
         ramfs, locals->new_dirname, true, NULL, &new_parent, NULL, NULL));
 
     /* Get the newpath inode (if any) */
-    new_inode = _inode_find_child(new_parent, locals->new_basename);
+    {
+        int r = _inode_find_child(
+            ramfs, new_parent, locals->new_basename, &new_inode);
+
+        if (r != 0 && r != -ENOENT)
+            ERAISE(r);
+    }
 
     /* Succeed if oldpath and newpath refer to the same inode */
     if (new_inode == old_inode)
@@ -1775,6 +2939,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -1789,6 +2956,7 @@ static int _fs_truncate(myst_fs_t* fs, const char* pathname, off_t length)
     };
     struct locals* locals = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname || length < 0)
         ERAISE(-EINVAL);
@@ -1796,10 +2964,16 @@ static int _fs_truncate(myst_fs_t* fs, const char* pathname, off_t length)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     ECHECK(_path_to_inode(
         ramfs, pathname, true, NULL, &inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_truncate(tfs, locals->suffix, length)));
         goto done;
@@ -1812,8 +2986,10 @@ static int _fs_truncate(myst_fs_t* fs, const char* pathname, off_t length)
     if (inode->v_type != NONE)
         ERAISE(-EINVAL);
 
-    if (myst_buf_resize(&inode->buf, (size_t)length) != 0)
-        ERAISE(-ENOMEM);
+    myst_rwlock_wrlock(&inode->lock);
+    ret = _inode_resize(inode, (size_t)length);
+    myst_rwlock_unlock(&inode->lock);
+    ECHECK(ret);
 
     _update_timestamps(inode, CHANGE | MODIFY);
 
@@ -1822,6 +2998,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -1829,6 +3008,7 @@ static int _fs_ftruncate(myst_fs_t* fs, myst_file_t* file, off_t length)
 {
     int ret = 0;
     ramfs_t* ramfs = (ramfs_t*)fs;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !_file_valid(file) || length < 0)
         ERAISE(-EINVAL);
@@ -1840,12 +3020,18 @@ static int _fs_ftruncate(myst_fs_t* fs, myst_file_t* file, off_t length)
     if (file->inode->v_type != NONE)
         ERAISE(-EINVAL);
 
-    if (myst_buf_resize(&file->inode->buf, (size_t)length) != 0)
-        ERAISE(-ENOMEM);
+    myst_rwlock_wrlock(&file->inode->lock);
+    locked = true;
+
+    ECHECK(_inode_resize(file->inode, (size_t)length));
 
     _update_timestamps(file->inode, CHANGE | MODIFY);
 
 done:
+
+    if (locked)
+        myst_rwlock_unlock(&file->inode->lock);
+
     return ret;
 }
 
@@ -1862,6 +3048,7 @@ static int _fs_mkdir(myst_fs_t* fs, const char* pathname, mode_t mode)
     struct locals* locals = NULL;
     inode_t* parent;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
@@ -1869,11 +3056,17 @@ static int _fs_mkdir(myst_fs_t* fs, const char* pathname, mode_t mode)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     ECHECK(_split_path(pathname, locals->dirname, locals->basename));
     ECHECK(_path_to_inode(
         ramfs, locals->dirname, true, NULL, &parent, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         /* append basename and delegate operation to target filesystem */
         if (myst_strlcat(locals->suffix, "/", PATH_MAX) >= PATH_MAX)
             ERAISE_QUIET(-ENAMETOOLONG);
@@ -1891,8 +3084,16 @@ static int _fs_mkdir(myst_fs_t* fs, const char* pathname, mode_t mode)
         ERAISE(-ENOTDIR);
 
     /* Check whether the pathname already exists */
-    if (_inode_find_child(parent, locals->basename) != NULL)
-        ERAISE(-EEXIST);
+    {
+        inode_t* inode;
+        int r = _inode_find_child(ramfs, parent, locals->basename, &inode);
+
+        if (r == 0)
+            ERAISE(-EEXIST);
+
+        if (r != -ENOENT)
+            ERAISE(r);
+    }
 
     /* create the directory */
     ERAISE(_inode_new(ramfs, parent, locals->basename, (S_IFDIR | mode), NULL));
@@ -1902,6 +3103,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -1919,6 +3123,7 @@ static int _fs_rmdir(myst_fs_t* fs, const char* pathname)
     inode_t* parent;
     inode_t* child;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
@@ -1926,11 +3131,17 @@ static int _fs_rmdir(myst_fs_t* fs, const char* pathname)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     /* Get the child inode */
     ECHECK(_path_to_inode(
         ramfs, pathname, true, NULL, &child, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK(tfs->fs_rmdir(tfs, locals->suffix));
         goto done;
@@ -1941,7 +3152,7 @@ static int _fs_rmdir(myst_fs_t* fs, const char* pathname)
         ERAISE(-ENOTDIR);
 
     /* Make sure the directory has no children */
-    if (child->buf.size > (2 * sizeof(struct dirent)))
+    if (child->buf.size > (2 * sizeof(struct dirent)) || child->lazy)
         ERAISE(-ENOTEMPTY);
 
     /* Get the parent inode */
@@ -1970,6 +3181,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -1988,6 +3202,7 @@ static int _fs_getdents64(
         struct dirent ent;
     };
     struct locals* locals = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !_file_valid(file) || !dirp)
         ERAISE(-EINVAL);
@@ -1998,6 +3213,14 @@ static int _fs_getdents64(
     if (count == 0)
         goto done;
 
+    /* keep the directory entries stable across the reads below */
+    myst_rwlock_rdlock(&ramfs->lock);
+    myst_mutex_lock(&file->mutex);
+    locked = true;
+
+    if (file->inode->lazy)
+        ECHECK(_inode_populate(ramfs, file->inode));
+
     /* in case an entry was deleted (by unlink) during this iteration */
     if (file->offset >= file->inode->buf.size)
         file->offset = file->inode->buf.size;
@@ -2026,6 +3249,12 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+    {
+        myst_mutex_unlock(&file->mutex);
+        myst_rwlock_unlock(&ramfs->lock);
+    }
+
     return ret;
 }
 
@@ -2044,6 +3273,7 @@ static ssize_t _fs_readlink(
     };
     struct locals* locals = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname || !buf || !bufsiz)
         ERAISE(-EINVAL);
@@ -2051,11 +3281,17 @@ static ssize_t _fs_readlink(
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_rdlock(&ramfs->lock);
+    locked = true;
+
     /* Get the inode for pathname */
     ECHECK(_path_to_inode(
         ramfs, pathname, false, NULL, &inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         /* delegate operation to target filesystem */
         ECHECK((ret = tfs->fs_readlink(tfs, locals->suffix, buf, bufsiz)));
         goto done;
@@ -2064,6 +3300,12 @@ static ssize_t _fs_readlink(
     if (!S_ISLNK(inode->mode))
         ERAISE(-EINVAL);
 
+    /* regenerating a virtual link changes its data */
+    if (inode->v_type == OPEN)
+        myst_rwlock_wrlock(&inode->lock);
+    else
+        myst_rwlock_rdlock(&inode->lock);
+
     if (inode->v_type == OPEN)
     {
         inode->v_cb.open_cb(&inode->buf, NULL);
@@ -2075,17 +3317,23 @@ static ssize_t _fs_readlink(
     }
 
     if (!inode->buf.data || !inode->buf.size)
-        ERAISE(-EINVAL);
+        ret = -EINVAL;
+    else
+        ret = (ssize_t)myst_strlcpy(buf, (char*)inode->buf.data, bufsiz);
 
-    _update_timestamps(inode, ACCESS);
+    myst_rwlock_unlock(&inode->lock);
+    ECHECK(ret);
 
-    ret = (ssize_t)myst_strlcpy(buf, (char*)inode->buf.data, bufsiz);
+    _update_timestamps(inode, ACCESS);
 
 done:
 
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -2103,6 +3351,7 @@ static int _fs_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
     };
     struct locals* locals = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -2113,6 +3362,9 @@ static int _fs_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     /* Split linkpath into directory and filename */
     ECHECK(_split_path(linkpath, locals->dirname, locals->basename));
 
@@ -2121,6 +3373,9 @@ static int _fs_symlink(myst_fs_t* fs, const char* target, const char* linkpath)
         ramfs, locals->dirname, true, NULL, &parent, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         /* append basename and delegate operation to target filesystem */
         if (myst_strlcat(locals->suffix, "/", PATH_MAX) >= PATH_MAX)
             ERAISE_QUIET(-ENAMETOOLONG);
@@ -2145,6 +3400,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -2358,6 +3616,7 @@ static int _fs_statfs(myst_fs_t* fs, const char* pathname, struct statfs* buf)
     };
     struct locals* locals = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname || !buf)
         ERAISE(-EINVAL);
@@ -2365,11 +3624,17 @@ static int _fs_statfs(myst_fs_t* fs, const char* pathname, struct statfs* buf)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_rdlock(&ramfs->lock);
+    locked = true;
+
     /* Check if path exists */
     ECHECK(_path_to_inode(
         ramfs, pathname, true, NULL, &inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_statfs(tfs, locals->suffix, buf)));
         goto done;
@@ -2381,6 +3646,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -2405,10 +3673,14 @@ static int _fs_futimens(
 {
     int ret = 0;
     ramfs_t* ramfs = (ramfs_t*)fs;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !_file_valid(file))
         ERAISE(-EINVAL);
 
+    myst_rwlock_wrlock(&file->inode->lock);
+    locked = true;
+
     if (times)
     {
         switch (times[0].tv_nsec)
@@ -2442,6 +3714,10 @@ static int _fs_futimens(
     }
 
 done:
+
+    if (locked)
+        myst_rwlock_unlock(&file->inode->lock);
+
     return ret;
 }
 
@@ -2490,6 +3766,7 @@ static int _fs_chown(
         char suffix[PATH_MAX];
     }* locals = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
@@ -2497,11 +3774,17 @@ static int _fs_chown(
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     /* Check if path exists */
     ECHECK(_path_to_inode(
         ramfs, pathname, true, NULL, &locals->inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_chown(tfs, locals->suffix, owner, group)));
         goto done;
@@ -2514,6 +3797,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -2526,7 +3812,12 @@ int _fs_fchown(myst_fs_t* fs, myst_file_t* file, uid_t owner, gid_t group)
         ERAISE(-EINVAL);
 
     assert(_inode_valid(file->inode));
-    ECHECK(_chown(file->inode, owner, group));
+
+    /* the owner and mode are checked by path lookups */
+    myst_rwlock_wrlock(&ramfs->lock);
+    ret = _chown(file->inode, owner, group);
+    myst_rwlock_unlock(&ramfs->lock);
+    ECHECK(ret);
 
 done:
     return ret;
@@ -2546,6 +3837,7 @@ static int _fs_lchown(
         char suffix[PATH_MAX];
     }* locals = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
@@ -2553,11 +3845,17 @@ static int _fs_lchown(
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     /* Check if path exists */
     ECHECK(_path_to_inode(
         ramfs, pathname, false, NULL, &locals->inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_lchown(tfs, locals->suffix, owner, group)));
         goto done;
@@ -2573,6 +3871,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -2613,6 +3914,7 @@ static int _fs_chmod(myst_fs_t* fs, const char* pathname, mode_t mode)
         char suffix[PATH_MAX];
     }* locals = NULL;
     myst_fs_t* tfs = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs) || !pathname)
         ERAISE(-EINVAL);
@@ -2620,11 +3922,17 @@ static int _fs_chmod(myst_fs_t* fs, const char* pathname, mode_t mode)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     /* Check if path exists */
     ECHECK(_path_to_inode(
         ramfs, pathname, true, NULL, &locals->inode, locals->suffix, &tfs));
     if (tfs)
     {
+        myst_rwlock_unlock(&ramfs->lock);
+        locked = false;
+
         // delegate operation to target filesystem.
         ECHECK((ret = tfs->fs_chmod(tfs, locals->suffix, mode)));
         goto done;
@@ -2637,6 +3945,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -2649,7 +3960,12 @@ static int _fs_fchmod(myst_fs_t* fs, myst_file_t* file, mode_t mode)
         ERAISE(-EINVAL);
 
     assert(_inode_valid(file->inode));
-    ECHECK(_chmod(file->inode, mode));
+
+    /* the owner and mode are checked by path lookups */
+    myst_rwlock_wrlock(&ramfs->lock);
+    ret = _chmod(file->inode, mode);
+    myst_rwlock_unlock(&ramfs->lock);
+    ECHECK(ret);
 
 done:
     return ret;
@@ -2680,6 +3996,7 @@ static int _fs_release_tree(myst_fs_t* fs, const char* pathname)
         char basename[PATH_MAX];
     };
     struct locals* locals = NULL;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -2690,6 +4007,9 @@ static int _fs_release_tree(myst_fs_t* fs, const char* pathname)
     if (!(locals = malloc(sizeof(struct locals))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
     ECHECK(_path_to_inode(ramfs, pathname, true, &parent, &self, NULL, NULL));
 
     if (!_inode_valid(parent) || !_inode_valid(self))
@@ -2728,6 +4048,9 @@ done:
     if (locals)
         free(locals);
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -2809,6 +4132,8 @@ static int _init_ramfs(
     if (!(ramfs = calloc(1, sizeof(ramfs_t))))
         ERAISE(-ENOMEM);
 
+    myst_rwlock_init(&ramfs->lock);
+
     ECHECK(_inode_new(ramfs, NULL, "/", (S_IFDIR | MODE_RWX), &root_inode));
 
     ramfs->magic = RAMFS_MAGIC;
@@ -2836,25 +4161,16 @@ int myst_init_ramfs(
     myst_mount_resolve_callback_t resolve_cb,
     myst_fs_t** fs_out)
 {
-    int ret = 0;
-    myst_fs_t* ramfs = NULL;
-    myst_fs_t* lockfs;
-
-    /* always wrap ramfs inside lockfs */
-    ECHECK(_init_ramfs(resolve_cb, &ramfs));
-    ECHECK(myst_lockfs_init(ramfs, &lockfs));
-    ((ramfs_t*)ramfs)->lockfs = lockfs;
-    ramfs = NULL;
-    *fs_out = lockfs;
-
-done:
-
-    if (ramfs)
-        (*ramfs->fs_release)(ramfs);
+    /* ramfs does its own locking (see above) */
+    return _init_ramfs(resolve_cb, fs_out);
+}
 
-    return ret;
+bool myst_is_ramfs(const myst_fs_t* fs)
+{
+    return _ramfs_valid((const ramfs_t*)fs);
 }
 
+/* also accept a ramfs that was wrapped in a lockfs */
 static ramfs_t* _ramfs(myst_fs_t* fs)
 {
     myst_fs_t* target = myst_lockfs_target(fs);
@@ -2870,6 +4186,7 @@ int myst_ramfs_set_buf(
     ramfs_t* ramfs = _ramfs(fs);
     inode_t* inode = NULL;
     int ret = 0;
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -2880,17 +4197,72 @@ int myst_ramfs_set_buf(
     if (!buf && buf_size)
         ERAISE(-EINVAL);
 
+    myst_rwlock_rdlock(&ramfs->lock);
+    locked = true;
+
+    ECHECK(_path_to_inode(ramfs, pathname, true, NULL, &inode, NULL, NULL));
+
+    if (!_inode_paged(inode))
+        ERAISE(-EINVAL);
+
+    myst_rwlock_wrlock(&inode->lock);
+    _pages_set_base(&inode->pages, buf, buf_size);
+    myst_rwlock_unlock(&inode->lock);
+
+done:
+
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
+    return ret;
+}
+
+int myst_ramfs_load_cpio(
+    myst_fs_t* fs,
+    const char* pathname,
+    const void* data,
+    size_t size)
+{
+    ramfs_t* ramfs = _ramfs(fs);
+    inode_t* inode = NULL;
+    cpioindex_t* index = NULL;
+    int ret = 0;
+    bool locked = false;
+
+    if (!_ramfs_valid(ramfs))
+        ERAISE(-EINVAL);
+
+    if (!pathname || !data || !size)
+        ERAISE(-EINVAL);
+
+    ECHECK(_cpioindex_new(data, size, &index));
+
+    myst_rwlock_wrlock(&ramfs->lock);
+    locked = true;
+
+    /* one archive per file system */
+    if (ramfs->cpio)
+        ERAISE(-EBUSY);
+
     ECHECK(_path_to_inode(ramfs, pathname, true, NULL, &inode, NULL, NULL));
 
-    if (inode->buf.data != inode->data)
-        myst_buf_clear(&inode->buf);
+    if (!S_ISDIR(inode->mode))
+        ERAISE(-ENOTDIR);
 
-    inode->data = buf;
-    inode->buf.data = (void*)buf;
-    inode->buf.size = buf_size;
+    ramfs->cpio = index;
+    index = NULL;
+
+    /* the root of the archive */
+    if (ramfs->cpio->dirs[0].first)
+        inode->lazy = 1;
 
 done:
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
+    _cpioindex_free(index);
+
     return ret;
 }
 
@@ -2903,6 +4275,7 @@ int myst_create_virtual_file(
 {
     int ret = 0;
     ramfs_t* ramfs = _ramfs(fs);
+    bool locked = false;
 
     if (!_ramfs_valid(ramfs))
         ERAISE(-EINVAL);
@@ -2942,6 +4315,10 @@ int myst_create_virtual_file(
     /* inject vcallback into the inode */
     {
         inode_t* inode = NULL;
+
+        myst_rwlock_wrlock(&ramfs->lock);
+        locked = true;
+
         ECHECK(
             _path_to_inode(ramfs, pathname, false, NULL, &inode, NULL, NULL));
 
@@ -2959,6 +4336,9 @@ int myst_create_virtual_file(
 
 done:
 
+    if (locked)
+        myst_rwlock_unlock(&ramfs->lock);
+
     return ret;
 }
 
@@ -0,0 +1,224 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <myst/rwlock.h>
+
+int myst_rwlock_init(myst_rwlock_t* rw)
+{
+    if (!rw)
+        return -EINVAL;
+
+    memset(rw, 0, sizeof(myst_rwlock_t));
+    myst_mutex_init(&rw->mutex);
+    myst_cond_init(&rw->cond);
+
+    return 0;
+}
+
+/* take a shared acquisition unless a writer holds the lock (or waits for it
+ * and the caller holds no other shared acquisition) */
+static bool _rdlock_try(myst_rwlock_t* rw, bool nested)
+{
+    uint64_t state = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        if (state & MYST_RWLOCK_WRITER)
+            return false;
+
+        if ((state & MYST_RWLOCK_WAITING) && !nested)
+            return false;
+
+        if (__atomic_compare_exchange_n(
+                &rw->state,
+                &state,
+                state + MYST_RWLOCK_READER,
+                true,
+                __ATOMIC_SEQ_CST,
+                __ATOMIC_RELAXED))
+        {
+            return true;
+        }
+    }
+}
+
+/* take the exclusive acquisition unless the lock is held */
+static bool _wrlock_try(myst_rwlock_t* rw)
+{
+    uint64_t state = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        if ((state & MYST_RWLOCK_WRITER) || state >= MYST_RWLOCK_READER)
+            return false;
+
+        if (__atomic_compare_exchange_n(
+                &rw->state,
+                &state,
+                state | MYST_RWLOCK_WRITER,
+                true,
+                __ATOMIC_SEQ_CST,
+                __ATOMIC_RELAXED))
+        {
+            return true;
+        }
+    }
+}
+
+/* wake the waiting threads (if any) after a release: a waiter increments
+ * nwaiters before it checks the state, and the caller checks nwaiters after
+ * it changed the state, so one of them sees the other */
+static void _wake(myst_rwlock_t* rw)
+{
+    if (__atomic_load_n(&rw->nwaiters, __ATOMIC_SEQ_CST) == 0)
+        return;
+
+    myst_mutex_lock(&rw->mutex);
+    myst_cond_broadcast(&rw->cond, SIZE_MAX);
+    myst_mutex_unlock(&rw->mutex);
+}
+
+int myst_rwlock_rdlock(myst_rwlock_t* rw)
+{
+    myst_thread_t* self = myst_thread_self();
+    bool nested;
+
+    if (!rw)
+        return -EINVAL;
+
+    if (self && __atomic_load_n(&rw->writer, __ATOMIC_RELAXED) == self)
+    {
+        /* nested within an exclusive acquisition */
+        rw->depth++;
+        return 0;
+    }
+
+    /* waiting for writers would deadlock if this thread already holds this
+     * lock shared (and may if it holds another one) */
+    nested = self && self->rwlock_nshared;
+
+    if (!_rdlock_try(rw, nested))
+    {
+        myst_mutex_lock(&rw->mutex);
+        __atomic_add_fetch(&rw->nwaiters, 1, __ATOMIC_SEQ_CST);
+
+        while (!_rdlock_try(rw, nested))
+            myst_cond_wait(&rw->cond, &rw->mutex);
+
+        __atomic_sub_fetch(&rw->nwaiters, 1, __ATOMIC_SEQ_CST);
+        myst_mutex_unlock(&rw->mutex);
+    }
+
+    if (self)
+        self->rwlock_nshared++;
+
+    return 0;
+}
+
+int myst_rwlock_wrlock(myst_rwlock_t* rw)
+{
+    myst_thread_t* self = myst_thread_self();
+
+    if (!rw)
+        return -EINVAL;
+
+    if (self && __atomic_load_n(&rw->writer, __ATOMIC_RELAXED) == self)
+    {
+        rw->depth++;
+        return 0;
+    }
+
+    if (!_wrlock_try(rw))
+    {
+        myst_mutex_lock(&rw->mutex);
+        __atomic_add_fetch(&rw->nwaiters, 1, __ATOMIC_SEQ_CST);
+
+        /* hold off new readers until the waiting writers are done */
+        if (rw->nwriters++ == 0)
+        {
+            __atomic_or_fetch(
+                &rw->state, MYST_RWLOCK_WAITING, __ATOMIC_SEQ_CST);
+        }
+
+        while (!_wrlock_try(rw))
+            myst_cond_wait(&rw->cond, &rw->mutex);
+
+        if (--rw->nwriters == 0)
+        {
+            __atomic_and_fetch(
+                &rw->state, ~MYST_RWLOCK_WAITING, __ATOMIC_SEQ_CST);
+        }
+
+        __atomic_sub_fetch(&rw->nwaiters, 1, __ATOMIC_SEQ_CST);
+        myst_mutex_unlock(&rw->mutex);
+    }
+
+    __atomic_store_n(&rw->writer, self, __ATOMIC_RELAXED);
+    rw->depth = 1;
+
+    return 0;
+}
+
+int myst_rwlock_unlock(myst_rwlock_t* rw)
+{
+    myst_thread_t* self = myst_thread_self();
+    uint64_t state;
+
+    if (!rw)
+        return -EINVAL;
+
+    if (self && __atomic_load_n(&rw->writer, __ATOMIC_RELAXED) == self)
+    {
+        if (--rw->depth == 0)
+        {
+            __atomic_store_n(&rw->writer, NULL, __ATOMIC_RELAXED);
+            __atomic_and_fetch(
+                &rw->state, ~MYST_RWLOCK_WRITER, __ATOMIC_SEQ_CST);
+            _wake(rw);
+        }
+
+        return 0;
+    }
+
+    state = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+
+    do
+    {
+        if (state < MYST_RWLOCK_READER)
+            return -EPERM;
+    } while (!__atomic_compare_exchange_n(
+        &rw->state,
+        &state,
+        state - MYST_RWLOCK_READER,
+        true,
+        __ATOMIC_SEQ_CST,
+        __ATOMIC_RELAXED));
+
+    if (self)
+        self->rwlock_nshared--;
+
+    /* the last reader lets a waiting writer in */
+    if (state - MYST_RWLOCK_READER < MYST_RWLOCK_READER)
+        _wake(rw);
+
+    return 0;
+}
+
+int myst_rwlock_destroy(myst_rwlock_t* rw)
+{
+    if (!rw)
+        return -EINVAL;
+
+    if (rw->writer || rw->state >= MYST_RWLOCK_READER)
+        return -EBUSY;
+
+    myst_cond_destroy(&rw->cond);
+    myst_mutex_destroy(&rw->mutex);
+
+    return 0;
+}
@@ -9,6 +9,7 @@
 #include <myst/fsgs.h>
 #include <myst/printf.h>
 #include <myst/signal.h>
+#include <myst/signalfddev.h>
 
 //#define TRACE
 
@@ -557,6 +558,9 @@ long myst_signal_deliver(
 
         myst_spin_unlock(&thread->signal.lock);
 
+        // Make any signalfd that accepts this signal readable
+        myst_signalfd_notify(thread, signum);
+
         // Wake up target if necessary
         if (thread->signal.waiting_on_event)
         {
@@ -585,6 +589,50 @@ done:
     return ret;
 }
 
+long myst_signal_dequeue(
+    myst_thread_t* thread,
+    uint64_t mask,
+    siginfo_t* siginfo)
+{
+    long ret = -EAGAIN;
+
+    myst_spin_lock(&thread->signal.lock);
+    {
+        uint64_t pending = thread->signal.pending & mask;
+
+        if (pending)
+        {
+            unsigned bitnum = __builtin_ctzl(pending);
+            struct siginfo_list_item* item = thread->signal.siginfos[bitnum];
+
+            memset(siginfo, 0, sizeof(siginfo_t));
+
+            if (item)
+            {
+                if (item->siginfo)
+                {
+                    *siginfo = *item->siginfo;
+                    free(item->siginfo);
+                }
+
+                thread->signal.siginfos[bitnum] = item->next;
+                free(item);
+            }
+
+            // Signals without siginfo only carry the signal number
+            siginfo->si_signo = bitnum + 1;
+
+            if (!thread->signal.siginfos[bitnum])
+                thread->signal.pending &= ~((uint64_t)1 << bitnum);
+
+            ret = bitnum + 1;
+        }
+    }
+    myst_spin_unlock(&thread->signal.lock);
+
+    return ret;
+}
+
 long myst_signal_sigpending(sigset_t* set, unsigned size)
 {
     if (size > sizeof(sigset_t) || !set)
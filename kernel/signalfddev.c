@@ -0,0 +1,623 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+
+#include <myst/eraise.h>
+#include <myst/poll.h>
+#include <myst/signal.h>
+#include <myst/signalfddev.h>
+#include <myst/spinlock.h>
+#include <myst/syscall.h>
+#include <myst/tcall.h>
+#include <myst/thread.h>
+
+#define MAGIC 0x51f3d0a7
+
+#define UNMASKABLE \
+    (((uint64_t)1 << (SIGKILL - 1)) | ((uint64_t)1 << (SIGSTOP - 1)))
+
+/* a thread blocked in read() */
+typedef struct signalfd_waiter
+{
+    struct signalfd_waiter* next;
+    myst_thread_t* thread;
+} signalfd_waiter_t;
+
+/* The state shared by all file descriptors that refer to the same signalfd
+ * (see dup). Reads take signals directly from the queues of the reading
+ * thread and its process (there is no host descriptor). Signal delivery runs
+ * with spinlocks held, so it only wakes the blocked readers through their
+ * thread events and the pollers through the wake queue. */
+typedef struct signalfd_state
+{
+    struct signalfd_state* next;
+    _Atomic(size_t) nrefs;
+    _Atomic(uint64_t) mask;
+    int status_flags;           /* O_NONBLOCK */
+    signalfd_waiter_t* waiters; /* (under _states_lock) */
+    myst_poll_wq_t wq;
+} signalfd_state_t;
+
+struct myst_signalfd
+{
+    uint32_t magic;
+    int fd_flags; /* FD_CLOEXEC */
+    signalfd_state_t* state;
+};
+
+/* all signalfd states (so that signal delivery can find them) */
+static signalfd_state_t* _states;
+static myst_spinlock_t _states_lock = MYST_SPINLOCK_INITIALIZER;
+
+MYST_INLINE bool _valid_signalfd(const myst_signalfd_t* signalfd)
+{
+    return signalfd && signalfd->magic == MAGIC;
+}
+
+static uint64_t _sigset_to_mask(const sigset_t* set)
+{
+    uint64_t mask;
+    memcpy(&mask, set, sizeof(mask));
+    return mask & ~UNMASKABLE;
+}
+
+/* wake the blocked readers (called with _states_lock held) */
+static void _wake_waiters(signalfd_state_t* state)
+{
+    for (signalfd_waiter_t* p = state->waiters; p; p = p->next)
+        myst_tcall_wake(p->thread->event);
+
+    /* the woken readers re-register if they wait again */
+    state->waiters = NULL;
+}
+
+/* whether a signal in the mask is pending for the thread or its process */
+static bool _have_pending(myst_thread_t* thread, uint64_t mask)
+{
+    myst_thread_t* process_thread = thread->process->main_process_thread;
+
+    if (thread->signal.pending & mask)
+        return true;
+
+    return process_thread && (process_thread->signal.pending & mask);
+}
+
+void myst_signalfd_notify(myst_thread_t* thread, unsigned signum)
+{
+    const uint64_t bit = (uint64_t)1 << (signum - 1);
+    bool interrupt = false;
+
+    (void)thread;
+
+    /* avoid taking the lock when there are no signalfds at all (the masks
+     * never contain SIGKILL or SIGSTOP) */
+    if (!_states || (bit & UNMASKABLE))
+        return;
+
+    /* The reader may belong to any process that shares the signalfd (after
+     * fork), so wake every signalfd that accepts the signal; reads only
+     * consume signals queued for the reader. The caller may hold spinlocks,
+     * so this makes no blocking host calls. */
+    myst_spin_lock(&_states_lock);
+    {
+        for (signalfd_state_t* p = _states; p; p = p->next)
+        {
+            if (p->mask & bit)
+            {
+                _wake_waiters(p);
+
+                if (myst_poll_wq_notify(&p->wq))
+                    interrupt = true;
+            }
+        }
+    }
+    myst_spin_unlock(&_states_lock);
+
+    if (interrupt)
+        myst_tcall_poll_wake();
+}
+
+/* wait until a matching signal is delivered (or any unblocked signal) */
+static void _wait(signalfd_state_t* state, myst_thread_t* self)
+{
+    signalfd_waiter_t waiter = {.next = NULL, .thread = self};
+
+    myst_spin_lock(&_states_lock);
+    waiter.next = state->waiters;
+    state->waiters = &waiter;
+    myst_spin_unlock(&_states_lock);
+
+    /* a delivery after the check below finds the waiter and wakes the thread
+     * event (which is not lost if it precedes the wait) */
+    self->signal.waiting_on_event = true;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (!_have_pending(self, state->mask) &&
+        !myst_signal_has_active_signals(self))
+    {
+        myst_tcall_wait(self->event, NULL);
+    }
+
+    self->signal.waiting_on_event = false;
+
+    /* _wake_waiters() removes the waiters that it wakes */
+    myst_spin_lock(&_states_lock);
+    {
+        for (signalfd_waiter_t** p = &state->waiters; *p; p = &(*p)->next)
+        {
+            if (*p == &waiter)
+            {
+                *p = waiter.next;
+                break;
+            }
+        }
+    }
+    myst_spin_unlock(&_states_lock);
+}
+
+static void _fill_siginfo(struct signalfd_siginfo* ssi, const siginfo_t* si)
+{
+    memset(ssi, 0, sizeof(struct signalfd_siginfo));
+    ssi->ssi_signo = (uint32_t)si->si_signo;
+    ssi->ssi_errno = si->si_errno;
+    ssi->ssi_code = si->si_code;
+
+    switch (si->si_code)
+    {
+        case SI_TIMER:
+            ssi->ssi_tid = (uint32_t)si->si_timerid;
+            ssi->ssi_overrun = (uint32_t)si->si_overrun;
+            ssi->ssi_int = si->si_value.sival_int;
+            ssi->ssi_ptr = (uint64_t)si->si_value.sival_ptr;
+            break;
+        case SI_QUEUE:
+        case SI_MESGQ:
+            ssi->ssi_pid = (uint32_t)si->si_pid;
+            ssi->ssi_uid = (uint32_t)si->si_uid;
+            ssi->ssi_int = si->si_value.sival_int;
+            ssi->ssi_ptr = (uint64_t)si->si_value.sival_ptr;
+            break;
+        default:
+        {
+            ssi->ssi_pid = (uint32_t)si->si_pid;
+            ssi->ssi_uid = (uint32_t)si->si_uid;
+
+            if (si->si_signo == SIGCHLD)
+            {
+                ssi->ssi_status = si->si_status;
+                ssi->ssi_utime = (uint64_t)si->si_utime;
+                ssi->ssi_stime = (uint64_t)si->si_stime;
+            }
+            break;
+        }
+    }
+}
+
+static int _sd_signalfd(
+    myst_signalfddev_t* dev,
+    const sigset_t* mask,
+    int flags,
+    myst_signalfd_t** obj_out)
+{
+    int ret = 0;
+    myst_signalfd_t* signalfd = NULL;
+    signalfd_state_t* state = NULL;
+
+    if (obj_out)
+        *obj_out = NULL;
+
+    if (!dev || !mask || !obj_out)
+        ERAISE(-EINVAL);
+
+    if (flags & ~(SFD_NONBLOCK | SFD_CLOEXEC))
+        ERAISE(-EINVAL);
+
+    if (!(signalfd = calloc(1, sizeof(myst_signalfd_t))))
+        ERAISE(-ENOMEM);
+
+    if (!(state = calloc(1, sizeof(signalfd_state_t))))
+        ERAISE(-ENOMEM);
+
+    state->nrefs = 1;
+    state->mask = _sigset_to_mask(mask);
+    state->status_flags = (flags & SFD_NONBLOCK) ? O_NONBLOCK : 0;
+
+    myst_spin_lock(&_states_lock);
+    state->next = _states;
+    _states = state;
+    myst_spin_unlock(&_states_lock);
+
+    signalfd->magic = MAGIC;
+    signalfd->fd_flags = (flags & SFD_CLOEXEC) ? FD_CLOEXEC : 0;
+    signalfd->state = state;
+    state = NULL;
+
+    *obj_out = signalfd;
+    signalfd = NULL;
+
+done:
+
+    if (state)
+        free(state);
+
+    if (signalfd)
+        free(signalfd);
+
+    return ret;
+}
+
+static int _sd_set_mask(
+    myst_signalfddev_t* dev,
+    myst_signalfd_t* signalfd,
+    const sigset_t* mask)
+{
+    int ret = 0;
+    signalfd_state_t* state;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EINVAL);
+
+    if (!mask)
+        ERAISE(-EINVAL);
+
+    state = signalfd->state;
+    state->mask = _sigset_to_mask(mask);
+
+    /* the readiness depends on the mask (see _sd_get_events()) */
+    myst_poll_wq_wake(&state->wq);
+
+done:
+    return ret;
+}
+
+static ssize_t _sd_read(
+    myst_signalfddev_t* dev,
+    myst_signalfd_t* signalfd,
+    void* buf,
+    size_t count)
+{
+    ssize_t ret = 0;
+    const size_t size = sizeof(struct signalfd_siginfo);
+    struct signalfd_siginfo* ssi = buf;
+    myst_thread_t* self = myst_thread_self();
+    myst_thread_t* process_thread = self->process->main_process_thread;
+    signalfd_state_t* state;
+    siginfo_t siginfo;
+    size_t n = 0;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EBADF);
+
+    if (!buf || count < size)
+        ERAISE(-EINVAL);
+
+    state = signalfd->state;
+
+    for (;;)
+    {
+        /* take thread-directed signals first, then process-directed ones */
+        while (n < count / size)
+        {
+            long signum = myst_signal_dequeue(self, state->mask, &siginfo);
+
+            if (signum < 0 && process_thread && process_thread != self)
+                signum = myst_signal_dequeue(
+                    process_thread, state->mask, &siginfo);
+
+            if (signum < 0)
+                break;
+
+            _fill_siginfo(&ssi[n++], &siginfo);
+        }
+
+        if (n)
+        {
+            ret = (ssize_t)(n * size);
+            goto done;
+        }
+
+        if (state->status_flags & O_NONBLOCK)
+            ERAISE(-EAGAIN);
+
+        if (myst_signal_has_active_signals(self))
+            ERAISE(-EINTR);
+
+        _wait(state, self);
+    }
+
+done:
+    return ret;
+}
+
+static ssize_t _sd_write(
+    myst_signalfddev_t* dev,
+    myst_signalfd_t* signalfd,
+    const void* buf,
+    size_t count)
+{
+    ssize_t ret = 0;
+
+    (void)buf;
+    (void)count;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EBADF);
+
+    ERAISE(-EINVAL);
+
+done:
+    return ret;
+}
+
+static ssize_t _sd_readv(
+    myst_signalfddev_t* dev,
+    myst_signalfd_t* signalfd,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    ssize_t ret = 0;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EBADF);
+
+    ret = myst_fdops_readv(&dev->fdops, signalfd, iov, iovcnt);
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static ssize_t _sd_writev(
+    myst_signalfddev_t* dev,
+    myst_signalfd_t* signalfd,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    ssize_t ret = 0;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EBADF);
+
+    ret = myst_fdops_writev(&dev->fdops, signalfd, iov, iovcnt);
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static int _sd_fstat(
+    myst_signalfddev_t* dev,
+    myst_signalfd_t* signalfd,
+    struct stat* statbuf)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_signalfd(signalfd) || !statbuf)
+        ERAISE(-EINVAL);
+
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_mode = S_IRUSR | S_IWUSR;
+    statbuf->st_nlink = 1;
+    statbuf->st_blksize = 4096;
+
+done:
+    return ret;
+}
+
+static int _sd_fcntl(
+    myst_signalfddev_t* dev,
+    myst_signalfd_t* signalfd,
+    int cmd,
+    long arg)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EBADF);
+
+    switch (cmd)
+    {
+        case F_GETFD:
+            ret = signalfd->fd_flags;
+            break;
+        case F_SETFD:
+            signalfd->fd_flags = (int)(arg & FD_CLOEXEC);
+            break;
+        case F_GETFL:
+            ret = O_RDWR | signalfd->state->status_flags;
+            break;
+        case F_SETFL:
+            signalfd->state->status_flags = (int)(arg & O_NONBLOCK);
+            break;
+        default:
+            ERAISE(-EINVAL);
+    }
+
+done:
+    return ret;
+}
+
+static int _sd_ioctl(
+    myst_signalfddev_t* dev,
+    myst_signalfd_t* signalfd,
+    unsigned long request,
+    long arg)
+{
+    int ret = 0;
+
+    (void)arg;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EBADF);
+
+    if (request == TIOCGWINSZ)
+        ERAISE(-EINVAL);
+
+    ERAISE(-ENOTSUP);
+
+done:
+    return ret;
+}
+
+static int _sd_dup(
+    myst_signalfddev_t* dev,
+    const myst_signalfd_t* signalfd,
+    myst_signalfd_t** signalfd_out)
+{
+    int ret = 0;
+    myst_signalfd_t* new_signalfd = NULL;
+
+    if (signalfd_out)
+        *signalfd_out = NULL;
+
+    if (!dev || !_valid_signalfd(signalfd) || !signalfd_out)
+        ERAISE(-EINVAL);
+
+    if (!(new_signalfd = calloc(1, sizeof(myst_signalfd_t))))
+        ERAISE(-ENOMEM);
+
+    new_signalfd->magic = MAGIC;
+    new_signalfd->state = signalfd->state;
+    new_signalfd->state->nrefs++;
+
+    *signalfd_out = new_signalfd;
+
+done:
+    return ret;
+}
+
+static int _sd_close(myst_signalfddev_t* dev, myst_signalfd_t* signalfd)
+{
+    int ret = 0;
+    signalfd_state_t* state;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EBADF);
+
+    state = signalfd->state;
+
+    if (--state->nrefs == 0)
+    {
+        myst_spin_lock(&_states_lock);
+        {
+            for (signalfd_state_t** p = &_states; *p; p = &(*p)->next)
+            {
+                if (*p == state)
+                {
+                    *p = state->next;
+                    break;
+                }
+            }
+        }
+        myst_spin_unlock(&_states_lock);
+
+        myst_poll_wq_release(&state->wq);
+        memset(state, 0, sizeof(signalfd_state_t));
+        free(state);
+    }
+
+    memset(signalfd, 0, sizeof(myst_signalfd_t));
+    free(signalfd);
+
+done:
+    return ret;
+}
+
+static int _sd_interrupt(myst_signalfddev_t* dev, myst_signalfd_t* signalfd)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EBADF);
+
+    myst_spin_lock(&_states_lock);
+    _wake_waiters(signalfd->state);
+    myst_spin_unlock(&_states_lock);
+
+done:
+    return ret;
+}
+
+static int _sd_target_fd(myst_signalfddev_t* dev, myst_signalfd_t* signalfd)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EINVAL);
+
+    /* there is no host descriptor (see _sd_get_events()) */
+    ret = -ENOTSUP;
+
+done:
+    return ret;
+}
+
+static int _sd_get_events(myst_signalfddev_t* dev, myst_signalfd_t* signalfd)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_signalfd(signalfd))
+        ERAISE(-EINVAL);
+
+    /* like Linux, readiness is that of the polling thread */
+    if (_have_pending(myst_thread_self(), signalfd->state->mask))
+        ret = POLLIN;
+
+done:
+    return ret;
+}
+
+static myst_poll_wq_t* _sd_get_wq(
+    myst_signalfddev_t* dev,
+    myst_signalfd_t* signalfd)
+{
+    if (!dev || !_valid_signalfd(signalfd))
+        return NULL;
+
+    return &signalfd->state->wq;
+}
+
+extern myst_signalfddev_t* myst_signalfddev_get(void)
+{
+    // clang-format off
+    static myst_signalfddev_t _dev =
+    {
+        {
+            .fd_read = (void*)_sd_read,
+            .fd_write = (void*)_sd_write,
+            .fd_readv = (void*)_sd_readv,
+            .fd_writev = (void*)_sd_writev,
+            .fd_fstat = (void*)_sd_fstat,
+            .fd_fcntl = (void*)_sd_fcntl,
+            .fd_ioctl = (void*)_sd_ioctl,
+            .fd_dup = (void*)_sd_dup,
+            .fd_close = (void*)_sd_close,
+            .fd_interrupt = (void*)_sd_interrupt,
+            .fd_target_fd = (void*)_sd_target_fd,
+            .fd_get_events = (void*)_sd_get_events,
+            .fd_get_wq = (void*)_sd_get_wq,
+        },
+        .sd_signalfd = _sd_signalfd,
+        .sd_set_mask = _sd_set_mask,
+        .sd_read = _sd_read,
+        .sd_write = _sd_write,
+        .sd_readv = _sd_readv,
+        .sd_writev = _sd_writev,
+        .sd_fstat = _sd_fstat,
+        .sd_fcntl = _sd_fcntl,
+        .sd_ioctl = _sd_ioctl,
+        .sd_dup = _sd_dup,
+        .sd_close = _sd_close,
+        .sd_target_fd = _sd_target_fd,
+        .sd_get_events = _sd_get_events,
+        .sd_get_wq = _sd_get_wq,
+    };
+    // clang-format on
+
+    return &_dev;
+}
@@ -2,24 +2,51 @@
 // Licensed under the MIT License.
 
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <netinet/in.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 
+#include <myst/cond.h>
 #include <myst/eraise.h>
+#include <myst/fiber.h>
 #include <myst/iov.h>
+#include <myst/kernel.h>
+#include <myst/mutex.h>
 #include <myst/panic.h>
+#include <myst/poll.h>
 #include <myst/sockdev.h>
 #include <myst/spinlock.h>
 #include <myst/syscall.h>
 #include <myst/tcall.h>
+#include <myst/timer.h>
+#include <myst/times.h>
 
 #define MAGIC 0xc436d7e6
 
+/* how long accept() waits for an in-kernel client to finish connect() */
+#define LO_CONNECT_TIMEOUT_MSEC 1000
+
+typedef struct lo_listener lo_listener_t;
+
+typedef struct rbuf rbuf_t;
+
 struct myst_sock
 {
     uint32_t magic; /* MAGIC */
     int fd;         /* the target-relative file descriptor */
+    int domain;     /* AF_INET, AF_INET6, ... */
+    int type;       /* SOCK_STREAM, SOCK_DGRAM, ... */
+    bool nonblock;  /* O_NONBLOCK */
+    bool observed;  /* readiness was taken from the host (_sd_get_events) */
+    struct timeval rcvtimeo;
+    struct timeval sndtimeo;
+    myst_sock_t* lo;         /* the in-kernel data channel (loopback) */
+    lo_listener_t* listener; /* registration of a listening socket */
+    rbuf_t* rbuf;            /* the read-ahead buffer (if enabled) */
 };
 
 MYST_INLINE bool _valid_sock(const myst_sock_t* sock)
@@ -27,6 +54,16 @@ MYST_INLINE bool _valid_sock(const myst_sock_t* sock)
     return sock && sock->magic == MAGIC;
 }
 
+/* park a calling fiber (rather than its carrier thread) until the socket is
+ * ready for an operation that would otherwise block on the host */
+static int _wait_ready(myst_sock_t* sock, short events, int flags)
+{
+    if (flags & MSG_DONTWAIT)
+        return 0;
+
+    return (int)myst_fiber_wait_fd(sock->fd, events);
+}
+
 static void _free_sock(myst_sock_t* sock)
 {
     if (sock)
@@ -60,6 +97,819 @@ done:
     return ret;
 }
 
+/*
+**==============================================================================
+**
+** loopback:
+**
+**     A TCP connection to a loopback address whose listener lives in this
+**     kernel is still established on the host (so the listener's accept()
+**     and readiness, getsockname(), getpeername(), and the socket options
+**     are unchanged), but its data bypasses the host. connect() creates a
+**     pair of in-kernel stream sockets (see udsdev.c), keeps one end as its
+**     data channel, and parks the other end on a pending list under the
+**     client's address. accept() takes the end parked under the address of
+**     the accepted peer as the data channel of the new socket.
+**
+**     connect() binds an unbound socket to an ephemeral loopback port (so its
+**     address is known in advance), adds its pending entry before the host
+**     connect() and completes it afterwards. accept() waits (unless the
+**     listener is non-blocking) while an incomplete entry could belong to
+**     the accepted peer, rather than mistaking an in-kernel client for a host
+**     one. An entry that accept() gives up on is rejected: its client then
+**     keeps the host data path, like the peer. A socket whose readiness was
+**     already taken from the host (by poll or epoll) keeps the host data
+**     path, since epoll would go on watching the host descriptor.
+**
+**==============================================================================
+*/
+
+typedef struct lo_addr
+{
+    uint16_t port;
+    uint8_t addr[16]; /* IPv4 addresses are IPv4-mapped */
+} lo_addr_t;
+
+struct lo_listener
+{
+    lo_listener_t* next;
+    size_t nrefs; /* descriptors of the listening socket */
+    lo_addr_t addr;
+};
+
+typedef struct lo_pending
+{
+    struct lo_pending* next;
+    lo_listener_t* listener; /* null once the listener is closed (or the
+                                entry was rejected by accept) */
+    bool complete;           /* the host connect() has returned */
+    lo_addr_t client;        /* the address of the client */
+    myst_sock_t* end;        /* the server end of the data channel */
+} lo_pending_t;
+
+static struct
+{
+    myst_mutex_t lock;
+    myst_cond_t cond;
+    lo_listener_t* listeners;
+    lo_pending_t* pending;
+} _lo;
+
+static const uint8_t _v4mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+MYST_INLINE bool _lo_eligible(const myst_sock_t* sock)
+{
+    return (sock->domain == AF_INET || sock->domain == AF_INET6) &&
+           sock->type == SOCK_STREAM;
+}
+
+MYST_INLINE bool _lo_is_v4(const lo_addr_t* addr)
+{
+    return memcmp(addr->addr, _v4mapped, sizeof(_v4mapped)) == 0;
+}
+
+static bool _lo_get_addr(
+    const struct sockaddr* sa,
+    socklen_t len,
+    lo_addr_t* addr)
+{
+    memset(addr, 0, sizeof(lo_addr_t));
+
+    if (sa->sa_family == AF_INET && len >= sizeof(struct sockaddr_in))
+    {
+        const struct sockaddr_in* sin = (const struct sockaddr_in*)sa;
+
+        addr->port = sin->sin_port;
+        memcpy(addr->addr, _v4mapped, sizeof(_v4mapped));
+        memcpy(addr->addr + sizeof(_v4mapped), &sin->sin_addr, 4);
+        return true;
+    }
+
+    if (sa->sa_family == AF_INET6 && len >= sizeof(struct sockaddr_in6))
+    {
+        const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*)sa;
+
+        addr->port = sin6->sin6_port;
+        memcpy(addr->addr, &sin6->sin6_addr, sizeof(addr->addr));
+        return true;
+    }
+
+    return false;
+}
+
+static bool _lo_is_loopback(const lo_addr_t* addr)
+{
+    static const uint8_t v6[16] = {[15] = 1};
+
+    if (_lo_is_v4(addr))
+        return addr->addr[sizeof(_v4mapped)] == 127;
+
+    return memcmp(addr->addr, v6, sizeof(v6)) == 0;
+}
+
+/* whether a listener bound to addr accepts connections to dest */
+static bool _lo_match(const lo_addr_t* addr, const lo_addr_t* dest)
+{
+    static const uint8_t any[16];
+
+    if (addr->port != dest->port)
+        return false;
+
+    /* the IPv6 wildcard also accepts IPv4 (assuming a dual-stack host) */
+    if (memcmp(addr->addr, any, sizeof(any)) == 0)
+        return true;
+
+    /* the IPv4 wildcard accepts IPv4 only */
+    if (_lo_is_v4(addr) && _lo_is_v4(dest))
+    {
+        if (memcmp(addr->addr + sizeof(_v4mapped), any, 4) == 0)
+            return true;
+    }
+
+    return memcmp(addr->addr, dest->addr, sizeof(addr->addr)) == 0;
+}
+
+/* whether the client address (obtained before the host connect) may be the
+ * address of the accepted peer */
+static bool _lo_client_match(const lo_addr_t* client, const lo_addr_t* peer)
+{
+    static const uint8_t any[16];
+
+    if (client->port != peer->port)
+        return false;
+
+    if (memcmp(client->addr, peer->addr, sizeof(peer->addr)) == 0)
+        return true;
+
+    /* a socket bound to a wildcard address before connect() */
+    if (memcmp(client->addr, any, sizeof(any)) == 0)
+        return true;
+
+    return _lo_is_v4(client) &&
+           memcmp(client->addr + sizeof(_v4mapped), any, 4) == 0;
+}
+
+static int _host_getsockname(int fd, lo_addr_t* addr)
+{
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    long params[6] = {fd, (long)&ss, (long)&len};
+    int ret = 0;
+
+    ECHECK(myst_tcall(SYS_getsockname, params));
+
+    if (!_lo_get_addr((struct sockaddr*)&ss, len, addr))
+        ERAISE(-EAFNOSUPPORT);
+
+done:
+    return ret;
+}
+
+/* bind an unbound socket to an ephemeral port of the loopback address (so
+ * that its address is known before the host connect to dest) */
+static int _lo_bind(myst_sock_t* sock, const lo_addr_t* dest, lo_addr_t* client)
+{
+    int ret = 0;
+    struct sockaddr_storage ss;
+    socklen_t len;
+
+    ECHECK(_host_getsockname(sock->fd, client));
+
+    if (client->port)
+        goto done;
+
+    memset(&ss, 0, sizeof(ss));
+
+    if (sock->domain == AF_INET)
+    {
+        struct sockaddr_in* sin = (struct sockaddr_in*)&ss;
+
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        len = sizeof(struct sockaddr_in);
+    }
+    else
+    {
+        struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&ss;
+
+        sin6->sin6_family = AF_INET6;
+
+        if (_lo_is_v4(dest))
+        {
+            memcpy(&sin6->sin6_addr, _v4mapped, sizeof(_v4mapped));
+            sin6->sin6_addr.s6_addr[12] = 127;
+            sin6->sin6_addr.s6_addr[15] = 1;
+        }
+        else
+        {
+            sin6->sin6_addr = in6addr_loopback;
+        }
+
+        len = sizeof(struct sockaddr_in6);
+    }
+
+    {
+        long params[6] = {sock->fd, (long)&ss, len};
+        ECHECK(myst_tcall(SYS_bind, params));
+    }
+
+    ECHECK(_host_getsockname(sock->fd, client));
+
+done:
+    return ret;
+}
+
+/* make end the data channel of sock (with the flags and options of sock) */
+static void _lo_attach(myst_sock_t* sock, myst_sock_t* end)
+{
+    myst_sockdev_t* ud = myst_udsdev_get();
+    const socklen_t len = sizeof(struct timeval);
+
+    if (sock->nonblock)
+        (*ud->sd_fcntl)(ud, end, F_SETFL, O_NONBLOCK);
+
+    (*ud->sd_setsockopt)(
+        ud, end, SOL_SOCKET, SO_RCVTIMEO, &sock->rcvtimeo, len);
+    (*ud->sd_setsockopt)(
+        ud, end, SOL_SOCKET, SO_SNDTIMEO, &sock->sndtimeo, len);
+
+    sock->lo = end;
+}
+
+/* register a listening socket (best effort) */
+static void _lo_listen(myst_sock_t* sock)
+{
+    lo_listener_t* listener;
+
+    if (!(listener = calloc(1, sizeof(lo_listener_t))))
+        return;
+
+    if (_host_getsockname(sock->fd, &listener->addr) != 0)
+    {
+        free(listener);
+        return;
+    }
+
+    listener->nrefs = 1;
+
+    myst_mutex_lock(&_lo.lock);
+    listener->next = _lo.listeners;
+    _lo.listeners = listener;
+    myst_mutex_unlock(&_lo.lock);
+
+    sock->listener = listener;
+}
+
+/* release a descriptor of a listening socket */
+static void _lo_unlisten(lo_listener_t* listener)
+{
+    myst_sockdev_t* ud = myst_udsdev_get();
+    lo_pending_t* orphans = NULL;
+
+    myst_mutex_lock(&_lo.lock);
+
+    if (--listener->nrefs == 0)
+    {
+        for (lo_listener_t** p = &_lo.listeners; *p; p = &(*p)->next)
+        {
+            if (*p == listener)
+            {
+                *p = listener->next;
+                break;
+            }
+        }
+
+        /* drop the connections that were never accepted */
+        for (lo_pending_t** p = &_lo.pending; *p;)
+        {
+            lo_pending_t* pending = *p;
+
+            if (pending->listener != listener)
+            {
+                p = &pending->next;
+            }
+            else if (!pending->complete)
+            {
+                /* completed (and freed) by _lo_connect_end() */
+                pending->listener = NULL;
+                p = &pending->next;
+            }
+            else
+            {
+                *p = pending->next;
+                pending->next = orphans;
+                orphans = pending;
+            }
+        }
+    }
+    else
+    {
+        listener = NULL;
+    }
+
+    myst_mutex_unlock(&_lo.lock);
+
+    /* the clients see end-of-file */
+    while (orphans)
+    {
+        lo_pending_t* next = orphans->next;
+        (*ud->sd_close)(ud, orphans->end);
+        free(orphans);
+        orphans = next;
+    }
+
+    free(listener);
+}
+
+/* start an in-kernel connection if dest has a listener in this kernel */
+static lo_pending_t* _lo_connect_begin(
+    myst_sock_t* sock,
+    const struct sockaddr* addr,
+    socklen_t addrlen,
+    myst_sock_t* pair[2])
+{
+    myst_sockdev_t* ud = myst_udsdev_get();
+    lo_pending_t* pending = NULL;
+    lo_listener_t* listener;
+    lo_addr_t dest;
+    lo_addr_t client;
+
+    if (!_lo_eligible(sock) || sock->observed || sock->lo || !addr)
+        return NULL;
+
+    if (!_lo_get_addr(addr, addrlen, &dest) || !_lo_is_loopback(&dest))
+        return NULL;
+
+    myst_mutex_lock(&_lo.lock);
+
+    for (listener = _lo.listeners; listener; listener = listener->next)
+    {
+        if (_lo_match(&listener->addr, &dest))
+            break;
+    }
+
+    myst_mutex_unlock(&_lo.lock);
+
+    /* bind only for a listener in this kernel (without holding the lock) */
+    if (!listener || _lo_bind(sock, &dest, &client) != 0)
+        return NULL;
+
+    myst_mutex_lock(&_lo.lock);
+
+    /* the listener may have been closed meanwhile */
+    for (listener = _lo.listeners; listener; listener = listener->next)
+    {
+        if (_lo_match(&listener->addr, &dest))
+            break;
+    }
+
+    if (listener && (pending = calloc(1, sizeof(lo_pending_t))))
+    {
+        if ((*ud->sd_socketpair)(ud, AF_UNIX, SOCK_STREAM, 0, pair) == 0)
+        {
+            pending->listener = listener;
+            pending->client = client;
+            pending->next = _lo.pending;
+            _lo.pending = pending;
+        }
+        else
+        {
+            free(pending);
+            pending = NULL;
+        }
+    }
+
+    myst_mutex_unlock(&_lo.lock);
+
+    return pending;
+}
+
+/* complete the pending entry (or withdraw it if the host connect failed) */
+static void _lo_connect_end(
+    myst_sock_t* sock,
+    lo_pending_t* pending,
+    myst_sock_t* pair[2],
+    long result)
+{
+    myst_sockdev_t* ud = myst_udsdev_get();
+    lo_addr_t client;
+    bool ok = false;
+
+    if (result == 0 || result == -EINPROGRESS)
+        ok = (_host_getsockname(sock->fd, &client) == 0);
+
+    myst_mutex_lock(&_lo.lock);
+    {
+        if (ok && pending->listener)
+        {
+            pending->client = client;
+            pending->end = pair[1];
+            pending->complete = true;
+        }
+        else
+        {
+            for (lo_pending_t** p = &_lo.pending; *p; p = &(*p)->next)
+            {
+                if (*p == pending)
+                {
+                    *p = pending->next;
+                    break;
+                }
+            }
+
+            ok = false;
+        }
+
+        /* wake accept() calls waiting for this entry */
+        myst_cond_broadcast(&_lo.cond, SIZE_MAX);
+    }
+    myst_mutex_unlock(&_lo.lock);
+
+    if (ok)
+    {
+        _lo_attach(sock, pair[0]);
+    }
+    else
+    {
+        (*ud->sd_close)(ud, pair[0]);
+        (*ud->sd_close)(ud, pair[1]);
+        free(pending);
+    }
+}
+
+/* take the data channel parked for the accepted peer (if any); nonblock is
+ * true if the listener is non-blocking */
+static myst_sock_t* _lo_accept(
+    lo_listener_t* listener,
+    const struct sockaddr* addr,
+    socklen_t addrlen,
+    bool nonblock)
+{
+    myst_sock_t* end = NULL;
+    lo_addr_t peer;
+    uint64_t deadline;
+
+    if (!_lo_get_addr(addr, addrlen, &peer) || !_lo_is_loopback(&peer))
+        return NULL;
+
+    deadline = myst_timer_now() + LO_CONNECT_TIMEOUT_MSEC * 1000000UL;
+
+    myst_mutex_lock(&_lo.lock);
+
+    for (;;)
+    {
+        lo_pending_t* incomplete = NULL;
+        struct timespec timeout;
+        uint64_t now;
+
+        for (lo_pending_t** p = &_lo.pending; *p; p = &(*p)->next)
+        {
+            lo_pending_t* pending = *p;
+
+            if (pending->listener != listener ||
+                !_lo_client_match(&pending->client, &peer))
+            {
+                continue;
+            }
+
+            if (!pending->complete)
+            {
+                incomplete = pending;
+                continue;
+            }
+
+            /* completed entries have the address after the host connect */
+            if (memcmp(&pending->client, &peer, sizeof(peer)) == 0)
+            {
+                *p = pending->next;
+                end = pending->end;
+                free(pending);
+                break;
+            }
+        }
+
+        /* a connection from the host */
+        if (end || !incomplete)
+            break;
+
+        /* the client is still in connect(): unless waiting is allowed, its
+         * connection keeps the host data path (see _lo_connect_end()) */
+        if (nonblock || (now = myst_timer_now()) >= deadline)
+        {
+            incomplete->listener = NULL;
+            break;
+        }
+
+        nanos_to_timespec(&timeout, (long)(deadline - now));
+        myst_cond_timedwait(&_lo.cond, &_lo.lock, &timeout);
+    }
+
+    myst_mutex_unlock(&_lo.lock);
+
+    return end;
+}
+
+/*
+**==============================================================================
+**
+** read-ahead:
+**
+**     With the SocketReadAheadKB setting, a receive on a TCP socket that
+**     asks for less than that reads as much as that from the host into a
+**     buffer of the socket, and later receives are served from the buffer.
+**     So protocols that receive in small pieces (request parsers, etc.)
+**     make fewer ocalls. Larger receives go straight to the host once the
+**     buffer is empty. The buffer is shared by the duplicates of a socket.
+**
+**     The host no longer sees the buffered input, so the socket reports it
+**     through fd_get_buffered_events() (which poll and epoll add to the
+**     host events) and wakes its wake queue when input is buffered.
+**     MSG_PEEK is served from the buffer, MSG_WAITALL receives the rest from
+**     the host, and receives with other flags (MSG_OOB, MSG_ERRQUEUE, ...)
+**     or with control data bypass the buffer.
+**
+**==============================================================================
+*/
+
+struct rbuf
+{
+    _Atomic(size_t) nrefs; /* the sockets that share the buffer */
+    myst_mutex_t mutex;    /* serializes the receives */
+    myst_poll_wq_t wq;     /* woken when input is buffered */
+    uint8_t* data;         /* allocated by the first small receive */
+    size_t size;
+    size_t off; /* the offset of the buffered input */
+    size_t len; /* the length of the buffered input (atomic) */
+};
+
+/* the receive flags that the buffer handles */
+#define RBUF_FLAGS (MSG_PEEK | MSG_DONTWAIT | MSG_WAITALL | MSG_CMSG_CLOEXEC)
+
+MYST_INLINE size_t _rb_len(const rbuf_t* rb)
+{
+    return __atomic_load_n(&rb->len, __ATOMIC_ACQUIRE);
+}
+
+MYST_INLINE void _rb_set_len(rbuf_t* rb, size_t len)
+{
+    __atomic_store_n(&rb->len, len, __ATOMIC_RELEASE);
+}
+
+/* create a buffer for a TCP socket (if the setting is enabled) */
+static void _rb_attach(myst_sock_t* sock)
+{
+    const size_t size = __myst_kernel_args.socket_read_ahead_size;
+    rbuf_t* rb;
+
+    if (size == 0 || sock->rbuf)
+        return;
+
+    if ((sock->domain != AF_INET && sock->domain != AF_INET6) ||
+        sock->type != SOCK_STREAM)
+    {
+        return;
+    }
+
+    /* best effort: the socket just receives from the host without one */
+    if (!(rb = calloc(1, sizeof(rbuf_t))))
+        return;
+
+    rb->nrefs = 1;
+    rb->size = size;
+    myst_mutex_init(&rb->mutex);
+    sock->rbuf = rb;
+}
+
+static void _rb_release(rbuf_t* rb)
+{
+    if (rb && --rb->nrefs == 0)
+    {
+        myst_poll_wq_release(&rb->wq);
+        myst_mutex_destroy(&rb->mutex);
+        free(rb->data);
+        free(rb);
+    }
+}
+
+static ssize_t _host_recv(myst_sock_t* sock, void* buf, size_t len, int flags)
+{
+    ssize_t ret = 0;
+
+    ECHECK(_wait_ready(sock, POLLIN, flags));
+
+    /* perform syscall */
+    {
+        long params[6] = {sock->fd, (long)buf, len, flags};
+        ECHECK((ret = myst_tcall(SYS_recvfrom, params)));
+    }
+
+done:
+    return ret;
+}
+
+/* receive into the iov from the host, skipping its first skip bytes */
+static ssize_t _host_recv_iov(
+    myst_sock_t* sock,
+    const struct iovec* iov,
+    int iovcnt,
+    size_t skip,
+    int flags)
+{
+    ssize_t ret = 0;
+
+    /* a single call unless the rest of a MSG_WAITALL receive is needed */
+    if (skip == 0 && iovcnt > 1)
+    {
+        struct msghdr msg = {.msg_iov = (struct iovec*)iov};
+        long params[6] = {sock->fd, (long)&msg, flags};
+
+        msg.msg_iovlen = iovcnt;
+        ECHECK(_wait_ready(sock, POLLIN, flags));
+        ECHECK((ret = myst_tcall(SYS_recvmsg, params)));
+        goto done;
+    }
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        uint8_t* base = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        ssize_t r;
+
+        if (skip >= len)
+        {
+            skip -= len;
+            continue;
+        }
+
+        base += skip;
+        len -= skip;
+        skip = 0;
+
+        if ((r = _host_recv(sock, base, len, flags)) < 0)
+        {
+            /* return what was received so far */
+            if (ret == 0)
+                ret = r;
+
+            break;
+        }
+
+        ret += r;
+
+        if ((size_t)r < len)
+            break;
+    }
+
+done:
+    return ret;
+}
+
+/* Make sure there is buffered input (at least want bytes if the buffer can
+ * hold them and MSG_PEEK|MSG_WAITALL is given); with rb->mutex held.
+ * Returns the length of the buffered input, zero at end-of-file. */
+static ssize_t _rb_fill(myst_sock_t* sock, size_t want, int flags)
+{
+    ssize_t ret = 0;
+    rbuf_t* rb = sock->rbuf;
+    size_t len = rb->len;
+    const bool peekall = (flags & (MSG_PEEK | MSG_WAITALL)) ==
+                         (MSG_PEEK | MSG_WAITALL);
+
+    if (want > rb->size)
+        want = rb->size;
+
+    if (len && !(peekall && len < want))
+    {
+        ret = len;
+        goto done;
+    }
+
+    if (!rb->data && !(rb->data = malloc(rb->size)))
+        ERAISE(-ENOMEM);
+
+    /* move the buffered input to the front to make room */
+    if (rb->off)
+    {
+        memmove(rb->data, rb->data + rb->off, len);
+        rb->off = 0;
+    }
+
+    do
+    {
+        ssize_t r = _host_recv(
+            sock, rb->data + len, rb->size - len, flags & MSG_DONTWAIT);
+
+        if (r <= 0)
+        {
+            /* report the error (or end-of-file) if nothing is buffered */
+            if (len == 0)
+            {
+                ret = r;
+                goto done;
+            }
+
+            break;
+        }
+
+        len += r;
+    } while (peekall && len < want);
+
+    _rb_set_len(rb, len);
+    ret = len;
+
+done:
+    return ret;
+}
+
+/* a receive from a socket with a read-ahead buffer */
+static ssize_t _rb_recv(
+    myst_sock_t* sock,
+    const struct iovec* iov,
+    int iovcnt,
+    int flags)
+{
+    ssize_t ret = 0;
+    rbuf_t* rb = sock->rbuf;
+    bool locked = false;
+    bool empty;
+    ssize_t len;
+    ssize_t n;
+
+    ECHECK(len = myst_iov_len(iov, iovcnt));
+
+    /* a receive on a non-blocking socket must not wait for another one
+     * that is blocked on the host */
+    if (sock->nonblock || (flags & MSG_DONTWAIT))
+    {
+        if (myst_mutex_trylock(&rb->mutex) != 0)
+            ERAISE(-EAGAIN);
+    }
+    else
+    {
+        myst_mutex_lock(&rb->mutex);
+    }
+
+    locked = true;
+    empty = (rb->len == 0);
+
+    if (len == 0)
+        goto done;
+
+    /* large receives go straight to the host */
+    if (empty && (size_t)len >= rb->size)
+    {
+        ret = _host_recv_iov(sock, iov, iovcnt, 0, flags);
+        goto done;
+    }
+
+    if ((n = _rb_fill(sock, len, flags)) <= 0)
+    {
+        ret = n;
+        goto done;
+    }
+
+    if (n > len)
+        n = len;
+
+    myst_iov_scatter(iov, iovcnt, rb->data + rb->off, n);
+    ret = n;
+
+    if (!(flags & MSG_PEEK))
+    {
+        rb->off += n;
+        _rb_set_len(rb, rb->len - n);
+
+        if (rb->len == 0)
+            rb->off = 0;
+
+        /* receive the rest of a MSG_WAITALL receive from the host */
+        if ((flags & MSG_WAITALL) && n < len)
+        {
+            ssize_t r = _host_recv_iov(sock, iov, iovcnt, n, flags);
+
+            if (r > 0)
+                ret += r;
+        }
+    }
+
+    /* the input that is left over is now invisible to the host poll */
+    if (empty && rb->len)
+        myst_poll_wq_wake(&rb->wq);
+
+done:
+
+    if (locked)
+        myst_mutex_unlock(&rb->mutex);
+
+    return ret;
+}
+
+/* whether a receive with these flags is served through the buffer */
+MYST_INLINE bool _rb_use(const myst_sock_t* sock, int flags)
+{
+    return sock->rbuf && !(flags & ~RBUF_FLAGS);
+}
+
 /* ATTN: remove this! */
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 
@@ -89,6 +939,10 @@ static int _sd_socket(
     }
 
     sock->fd = (int)fd;
+    sock->domain = domain;
+    sock->type = type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+    sock->nonblock = (type & SOCK_NONBLOCK);
+    _rb_attach(sock);
     *sock_out = sock;
     sock = NULL;
 
@@ -155,16 +1009,27 @@ static int _sd_connect(
     socklen_t addrlen)
 {
     int ret = 0;
+    lo_pending_t* pending;
+    myst_sock_t* pair[2];
+    long r;
 
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    /* connections to a listener in this kernel bypass the host for data */
+    pending = _lo_connect_begin(sock, addr, addrlen, pair);
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, (long)addr, addrlen};
-        ECHECK(myst_tcall(SYS_connect, params));
+        r = myst_tcall(SYS_connect, params);
     }
 
+    if (pending)
+        _lo_connect_end(sock, pending, pair, r);
+
+    ECHECK(r);
+
 done:
     return ret;
 }
@@ -180,19 +1045,53 @@ static int _sd_accept4(
     int ret = 0;
     myst_sock_t* new_sock = NULL;
     int fd;
+    struct sockaddr_storage ss;
+    socklen_t sslen = sizeof(ss);
 
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
     ECHECK(_new_sock(&new_sock));
 
-    /* perform syscall */
+    ECHECK(_wait_ready(sock, POLLIN, 0));
+
+    /* the address of the peer identifies in-kernel clients */
+    if (sock->listener)
+    {
+        long params[6] = {sock->fd, (long)&ss, (long)&sslen, flags};
+        ECHECK((fd = myst_tcall(SYS_accept4, params)));
+
+        if (addr && addrlen)
+        {
+            memcpy(addr, &ss, (*addrlen < sslen) ? *addrlen : sslen);
+            *addrlen = sslen;
+        }
+    }
+    else
     {
         long params[6] = {sock->fd, (long)addr, (long)addrlen, flags};
         ECHECK((fd = myst_tcall(SYS_accept4, params)));
     }
 
     new_sock->fd = fd;
+    new_sock->domain = sock->domain;
+    new_sock->type = sock->type;
+    new_sock->nonblock = (flags & SOCK_NONBLOCK);
+    new_sock->rcvtimeo = sock->rcvtimeo;
+    new_sock->sndtimeo = sock->sndtimeo;
+
+    if (sock->listener)
+    {
+        myst_sock_t* end;
+
+        if ((end = _lo_accept(
+                 sock->listener, (struct sockaddr*)&ss, sslen, sock->nonblock)))
+            _lo_attach(new_sock, end);
+    }
+
+    if (!new_sock->lo)
+        _rb_attach(new_sock);
+
     *new_sock_out = new_sock;
     new_sock = NULL;
 
@@ -239,6 +1138,13 @@ static int _sd_listen(myst_sockdev_t* sd, myst_sock_t* sock, int backlog)
         ECHECK(myst_tcall(SYS_listen, params));
     }
 
+    if (_lo_eligible(sock) && !sock->listener)
+        _lo_listen(sock);
+
+    /* a listening socket receives no data */
+    _rb_release(sock->rbuf);
+    sock->rbuf = NULL;
+
 done:
 
     return ret;
@@ -258,6 +1164,16 @@ static ssize_t _sd_sendto(
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    /* the destination of a connected stream socket is ignored */
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ret = (*ud->sd_sendto)(ud, sock->lo, buf, len, flags, NULL, 0);
+        goto done;
+    }
+
+    ECHECK(_wait_ready(sock, POLLOUT, flags));
+
     /* perform syscall */
     {
         long params[6] = {
@@ -284,6 +1200,29 @@ static ssize_t _sd_recvfrom(
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ret = (*ud->sd_recvfrom)(
+            ud, sock->lo, buf, len, flags, src_addr, addrlen);
+        goto done;
+    }
+
+    /* the source address of a connected stream socket is not reported */
+    if (_rb_use(sock, flags))
+    {
+        struct iovec iov = {.iov_base = buf, .iov_len = len};
+
+        ECHECK((ret = _rb_recv(sock, &iov, 1, flags)));
+
+        if (src_addr && addrlen)
+            *addrlen = 0;
+
+        goto done;
+    }
+
+    ECHECK(_wait_ready(sock, POLLIN, flags));
+
     /* perform syscall */
     {
         long params[6] = {
@@ -315,6 +1254,20 @@ static int _sd_sendmsg(
     if (!msg)
         ERAISE(-EFAULT);
 
+    /* the name and the control data are ignored (as for TCP) */
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        struct msghdr m = *msg;
+
+        m.msg_name = NULL;
+        m.msg_namelen = 0;
+        m.msg_control = NULL;
+        m.msg_controllen = 0;
+        ret = (*ud->sd_sendmsg)(ud, sock->lo, &m, flags);
+        goto done;
+    }
+
     if (msg->msg_iovlen < 0 || msg->msg_iovlen > IOV_MAX)
         ERAISE(-EINVAL);
 
@@ -343,6 +1296,8 @@ static int _sd_sendmsg(
         msg_ptr = msg;
     }
 
+    ECHECK(_wait_ready(sock, POLLOUT, flags));
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, (long)msg_ptr, flags};
@@ -368,6 +1323,26 @@ static int _sd_recvmsg(
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ret = (*ud->sd_recvmsg)(ud, sock->lo, msg, flags);
+        goto done;
+    }
+
+    if (_rb_use(sock, flags) && msg && msg->msg_controllen == 0)
+    {
+        if (msg->msg_iovlen < 0 || msg->msg_iovlen > IOV_MAX)
+            ERAISE(-EINVAL);
+
+        ECHECK((ret = _rb_recv(sock, msg->msg_iov, msg->msg_iovlen, flags)));
+        msg->msg_namelen = 0;
+        msg->msg_flags = 0;
+        goto done;
+    }
+
+    ECHECK(_wait_ready(sock, POLLIN, flags));
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, (long)msg, flags};
@@ -391,6 +1366,12 @@ static int _sd_shutdown(myst_sockdev_t* sd, myst_sock_t* sock, int how)
         ECHECK(myst_tcall(SYS_shutdown, params));
     }
 
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ECHECK((*ud->sd_shutdown)(ud, sock->lo, how));
+    }
+
 done:
     return ret;
 }
@@ -437,6 +1418,24 @@ static int _sd_setsockopt(
         ECHECK(myst_tcall(SYS_setsockopt, params));
     }
 
+    /* the timeouts also apply to the in-kernel data channel */
+    if (level == SOL_SOCKET &&
+        (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) &&
+        optlen >= sizeof(struct timeval))
+    {
+        if (optname == SO_RCVTIMEO)
+            memcpy(&sock->rcvtimeo, optval, sizeof(struct timeval));
+        else
+            memcpy(&sock->sndtimeo, optval, sizeof(struct timeval));
+
+        if (sock->lo)
+        {
+            myst_sockdev_t* ud = myst_udsdev_get();
+            (*ud->sd_setsockopt)(
+                ud, sock->lo, level, optname, optval, optlen);
+        }
+    }
+
 done:
     return ret;
 }
@@ -494,6 +1493,22 @@ static ssize_t _sd_read(
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ret = (*ud->sd_read)(ud, sock->lo, buf, count);
+        goto done;
+    }
+
+    if (sock->rbuf)
+    {
+        struct iovec iov = {.iov_base = buf, .iov_len = count};
+        ECHECK((ret = _rb_recv(sock, &iov, 1, 0)));
+        goto done;
+    }
+
+    ECHECK(_wait_ready(sock, POLLIN, 0));
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, (long)buf, count};
@@ -515,6 +1530,15 @@ static ssize_t _sd_write(
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ret = (*ud->sd_write)(ud, sock->lo, buf, count);
+        goto done;
+    }
+
+    ECHECK(_wait_ready(sock, POLLOUT, 0));
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, (long)buf, count};
@@ -536,6 +1560,13 @@ static ssize_t _sd_readv(
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ret = (*ud->sd_readv)(ud, sock->lo, iov, iovcnt);
+        goto done;
+    }
+
     ret = myst_fdops_readv(&sd->fdops, sock, iov, iovcnt);
     ECHECK(ret);
 
@@ -554,6 +1585,13 @@ static ssize_t _sd_writev(
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ret = (*ud->sd_writev)(ud, sock->lo, iov, iovcnt);
+        goto done;
+    }
+
     ret = myst_fdops_writev(&sd->fdops, sock, iov, iovcnt);
     ECHECK(ret);
 
@@ -592,12 +1630,35 @@ static int _sd_ioctl(
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    /* the bytes available are in the in-kernel data channel */
+    if (sock->lo && request == FIONREAD)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ret = (*ud->sd_ioctl)(ud, sock->lo, request, arg);
+        goto done;
+    }
+
     /* perform syscall */
     {
         long params[6] = {sock->fd, request, arg};
         ECHECK(myst_tcall(SYS_ioctl, params));
     }
 
+    /* add the bytes in the read-ahead buffer */
+    if (request == FIONREAD && sock->rbuf && arg)
+        *(int*)arg += (int)_rb_len(sock->rbuf);
+
+    if (request == FIONBIO && arg)
+    {
+        sock->nonblock = (*(const int*)arg != 0);
+
+        if (sock->lo)
+        {
+            myst_sockdev_t* ud = myst_udsdev_get();
+            (*ud->sd_ioctl)(ud, sock->lo, request, arg);
+        }
+    }
+
 done:
     return ret;
 }
@@ -615,6 +1676,17 @@ static int _sd_fcntl(myst_sockdev_t* sd, myst_sock_t* sock, int cmd, long arg)
         ECHECK((ret = myst_tcall(SYS_fcntl, params)));
     }
 
+    if (cmd == F_SETFL)
+    {
+        sock->nonblock = (arg & O_NONBLOCK);
+
+        if (sock->lo)
+        {
+            myst_sockdev_t* ud = myst_udsdev_get();
+            (*ud->sd_fcntl)(ud, sock->lo, cmd, arg & O_NONBLOCK);
+        }
+    }
+
 done:
     return ret;
 }
@@ -645,6 +1717,37 @@ static int _sd_dup(
 
     new_sock->magic = MAGIC;
     new_sock->fd = (int)fd;
+    new_sock->domain = sock->domain;
+    new_sock->type = sock->type;
+    new_sock->nonblock = sock->nonblock;
+    new_sock->observed = sock->observed;
+    new_sock->rcvtimeo = sock->rcvtimeo;
+    new_sock->sndtimeo = sock->sndtimeo;
+
+    /* the duplicate shares the data channel and the listener */
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+
+        if ((ret = (*ud->sd_dup)(ud, sock->lo, &new_sock->lo)) != 0)
+        {
+            long params[6] = {fd};
+            myst_tcall(SYS_close, params);
+            ERAISE(ret);
+        }
+    }
+
+    /* the duplicate shares the read-ahead buffer */
+    if ((new_sock->rbuf = sock->rbuf))
+        new_sock->rbuf->nrefs++;
+
+    if ((new_sock->listener = sock->listener))
+    {
+        myst_mutex_lock(&_lo.lock);
+        new_sock->listener->nrefs++;
+        myst_mutex_unlock(&_lo.lock);
+    }
+
     *sock_out = new_sock;
     new_sock = NULL;
 
@@ -669,6 +1772,17 @@ static int _sd_close(myst_sockdev_t* sd, myst_sock_t* sock)
         ECHECK((ret = myst_tcall(SYS_close, params)));
     }
 
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        (*ud->sd_close)(ud, sock->lo);
+    }
+
+    if (sock->listener)
+        _lo_unlisten(sock->listener);
+
+    _rb_release(sock->rbuf);
+
     memset(sock, 0, sizeof(myst_sock_t));
     free(sock);
 
@@ -696,12 +1810,76 @@ static int _sd_get_events(myst_sockdev_t* sd, myst_sock_t* sock)
     if (!sd || !_valid_sock(sock))
         ERAISE(-EINVAL);
 
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ret = (*ud->sd_get_events)(ud, sock->lo);
+        goto done;
+    }
+
+    /* the caller polls the host (see _lo_connect_begin()) */
+    sock->observed = true;
     ret = -ENOTSUP;
 
 done:
     return ret;
 }
 
+static myst_poll_wq_t* _sd_get_wq(myst_sockdev_t* sd, myst_sock_t* sock)
+{
+    myst_sockdev_t* ud = myst_udsdev_get();
+
+    if (!sd || !_valid_sock(sock))
+        return NULL;
+
+    if (sock->lo)
+        return (*ud->fdops.fd_get_wq)(ud, sock->lo);
+
+    /* publishes the input in the read-ahead buffer */
+    if (sock->rbuf)
+        return &sock->rbuf->wq;
+
+    return NULL;
+}
+
+static int _sd_get_buffered_events(myst_sockdev_t* sd, myst_sock_t* sock)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EINVAL);
+
+    if (sock->lo || !sock->rbuf)
+    {
+        ret = -ENOTSUP;
+        goto done;
+    }
+
+    if (_rb_len(sock->rbuf))
+        ret = POLLIN | POLLRDNORM;
+
+done:
+    return ret;
+}
+
+static int _sd_interrupt(myst_sockdev_t* sd, myst_sock_t* sock)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_sock(sock))
+        ERAISE(-EINVAL);
+
+    /* threads blocked on the host are not interrupted here */
+    if (sock->lo)
+    {
+        myst_sockdev_t* ud = myst_udsdev_get();
+        ret = (*ud->fdops.fd_interrupt)(ud, sock->lo);
+    }
+
+done:
+    return ret;
+}
+
 extern myst_sockdev_t* myst_sockdev_get(void)
 {
     // clang-format-off
@@ -716,8 +1894,11 @@ extern myst_sockdev_t* myst_sockdev_get(void)
             .fd_ioctl = (void*)_sd_ioctl,
             .fd_dup = (void*)_sd_dup,
             .fd_close = (void*)_sd_close,
+            .fd_interrupt = (void*)_sd_interrupt,
             .fd_target_fd = (void*)_sd_target_fd,
             .fd_get_events = (void*)_sd_get_events,
+            .fd_get_wq = (void*)_sd_get_wq,
+            .fd_get_buffered_events = (void*)_sd_get_buffered_events,
         },
         .sd_socket = _sd_socket,
         .sd_socketpair = _sd_socketpair,
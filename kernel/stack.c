@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <myst/fiber.h>
 #include <myst/kstack.h>
 #include <myst/spinlock.h>
 #include <myst/stack.h>
@@ -12,8 +13,10 @@ typedef struct stack
 } stack_t;
 
 // There is one entry stack, N kernel stacks, and N threads that may enter the
-// kernel from the host, where N == MYST_MAX_KSTACKS.
-#define MAX_STACKS (1 + MYST_MAX_KSTACKS + MYST_MAX_KSTACKS)
+// kernel from the host, where N == MYST_MAX_KSTACKS. Each fiber adds an entry
+// stack and a kernel stack.
+#define MAX_STACKS \
+    (1 + MYST_MAX_KSTACKS + MYST_MAX_KSTACKS + 2 * MYST_MAX_FIBERS)
 
 static stack_t _stacks[MAX_STACKS];
 static size_t _nstacks;
@@ -43,6 +43,7 @@
 #include <myst/ext2.h>
 #include <myst/fdops.h>
 #include <myst/fdtable.h>
+#include <myst/fiber.h>
 #include <myst/file.h>
 #include <myst/fs.h>
 #include <myst/fsgs.h>
@@ -814,7 +815,9 @@ long myst_syscall_open(const char* pathname, int flags, mode_t mode)
     ECHECK(myst_mount_resolve(pathname, locals->suffix, &fs));
     ECHECK((*fs->fs_open)(fs, locals->suffix, flags, mode, &fs_out, &file));
 
-    myst_assume(myst_is_hostfs(fs_out) || myst_is_lockfs(fs_out));
+    myst_assume(
+        myst_is_hostfs(fs_out) || myst_is_lockfs(fs_out) ||
+        myst_is_ramfs(fs_out) || myst_is_ext2fs(fs_out));
 
     if ((fd = myst_fdtable_assign(fdtable, fdtype, fs_out, file)) < 0)
     {
@@ -1080,6 +1083,7 @@ long myst_syscall_close(int fd)
     void* device = NULL;
     void* object = NULL;
     myst_fdops_t* fdops;
+    int r;
 
     ECHECK(myst_fdtable_get_any(fdtable, fd, &type, &device, &object));
     fdops = device;
@@ -1090,8 +1094,11 @@ long myst_syscall_close(int fd)
         myst_remove_fd_link(fd);
     }
 
-    ECHECK(myst_fdtable_remove(fdtable, fd));
-    ECHECK((*fdops->fd_close)(device, object));
+    ECHECK(r = myst_fdtable_remove(fdtable, fd));
+
+    /* a borrowed object still belongs to the parent (see fdtable.c) */
+    if (r == 0)
+        ECHECK((*fdops->fd_close)(device, object));
 
 done:
     return ret;
@@ -2169,6 +2176,10 @@ long myst_syscall_fcntl(int fd, int cmd, long arg)
         myst_fdtable_type_t type;
         myst_fdops_t* fdops;
 
+        /* FD_CLOEXEC must not change through a copy-on-write table */
+        if (cmd == F_SETFD)
+            ECHECK(myst_fdtable_unshare(fdtable, fd));
+
         ECHECK(myst_fdtable_get_any(fdtable, fd, &type, &device, &object));
         fdops = device;
         ret = (*fdops->fd_fcntl)(device, object, cmd, arg);
@@ -2224,7 +2235,12 @@ long myst_syscall_fchmod(int fd, mode_t mode)
 
     ECHECK(myst_fdtable_get_any(fdtable, fd, &type, &device, &object));
 
-    if (type == MYST_FDTABLE_TYPE_SOCK)
+    if (type == MYST_FDTABLE_TYPE_SOCK && ((myst_sockdev_t*)device)->sd_fchmod)
+    {
+        myst_sockdev_t* sd = device;
+        ret = (*sd->sd_fchmod)(sd, object, mode);
+    }
+    else if (type == MYST_FDTABLE_TYPE_SOCK)
     {
         uid_t host_uid;
         gid_t host_gid;
@@ -2370,6 +2386,101 @@ done:
     return ret;
 }
 
+long myst_syscall_timerfd_create(clockid_t clockid, int flags)
+{
+    long ret = 0;
+    const myst_fdtable_type_t type = MYST_FDTABLE_TYPE_TIMERFD;
+    myst_timerfddev_t* dev = myst_timerfddev_get();
+    myst_timerfd_t* obj = NULL;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    int fd;
+
+    ECHECK((*dev->td_timerfd_create)(dev, clockid, flags, &obj));
+
+    if ((fd = myst_fdtable_assign(fdtable, type, dev, obj)) < 0)
+    {
+        (*dev->td_close)(dev, obj);
+        ERAISE(fd);
+    }
+
+    ret = fd;
+
+done:
+    return ret;
+}
+
+long myst_syscall_timerfd_settime(
+    int fd,
+    int flags,
+    const struct itimerspec* new_value,
+    struct itimerspec* old_value)
+{
+    long ret = 0;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    myst_timerfddev_t* dev;
+    myst_timerfd_t* obj;
+
+    ECHECK(myst_fdtable_get_timerfd(fdtable, fd, &dev, &obj));
+    ECHECK((*dev->td_settime)(dev, obj, flags, new_value, old_value));
+
+done:
+    return ret;
+}
+
+long myst_syscall_timerfd_gettime(int fd, struct itimerspec* curr_value)
+{
+    long ret = 0;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    myst_timerfddev_t* dev;
+    myst_timerfd_t* obj;
+
+    ECHECK(myst_fdtable_get_timerfd(fdtable, fd, &dev, &obj));
+    ECHECK((*dev->td_gettime)(dev, obj, curr_value));
+
+done:
+    return ret;
+}
+
+long myst_syscall_signalfd(
+    int fd,
+    const sigset_t* mask,
+    size_t sizemask,
+    int flags)
+{
+    long ret = 0;
+    const myst_fdtable_type_t type = MYST_FDTABLE_TYPE_SIGNALFD;
+    myst_signalfddev_t* dev = myst_signalfddev_get();
+    myst_signalfd_t* obj = NULL;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+
+    if (!mask || sizemask != sizeof(uint64_t))
+        ERAISE(-EINVAL);
+
+    /* update the mask of an existing signalfd */
+    if (fd != -1)
+    {
+        if (myst_fdtable_get_signalfd(fdtable, fd, &dev, &obj) != 0)
+            ERAISE(-EINVAL);
+
+        ECHECK((*dev->sd_set_mask)(dev, obj, mask));
+        ret = fd;
+        goto done;
+    }
+
+    ECHECK((*dev->sd_signalfd)(dev, mask, flags, &obj));
+
+    if ((fd = myst_fdtable_assign(fdtable, type, dev, obj)) < 0)
+    {
+        (*dev->sd_close)(dev, obj);
+        ERAISE(fd);
+    }
+
+    ret = fd;
+
+done:
+    return ret;
+}
+
 long myst_syscall_inotify_init1(int flags)
 {
     long ret = 0;
@@ -2493,6 +2604,10 @@ long myst_syscall_ioctl(int fd, unsigned long request, long arg)
     myst_fdtable_t* fdtable = myst_fdtable_current();
     myst_fdops_t* fdops;
 
+    /* FD_CLOEXEC must not change through a copy-on-write table */
+    if (request == FIOCLEX || request == FIONCLEX)
+        ECHECK(myst_fdtable_unshare(fdtable, fd));
+
     ECHECK(myst_fdtable_get_any(fdtable, fd, &type, &device, &object));
     fdops = device;
 
@@ -2585,10 +2700,19 @@ done:
     return ret;
 }
 
+/* AF_UNIX sockets never leave the kernel; other domains go to the host */
+static myst_sockdev_t* _get_sockdev(int domain)
+{
+    if (domain == AF_UNIX)
+        return myst_udsdev_get();
+
+    return myst_sockdev_get();
+}
+
 long myst_syscall_socket(int domain, int type, int protocol)
 {
     long ret = 0;
-    myst_sockdev_t* sd = myst_sockdev_get();
+    myst_sockdev_t* sd = _get_sockdev(domain);
     myst_fdtable_t* fdtable = myst_fdtable_current();
     myst_sock_t* sock = NULL;
     int sockfd;
@@ -2700,7 +2824,7 @@ long myst_syscall_socketpair(int domain, int type, int protocol, int sv[2])
     int fd1;
     myst_sock_t* pair[2];
     myst_fdtable_t* fdtable = myst_fdtable_current();
-    myst_sockdev_t* sd = myst_sockdev_get();
+    myst_sockdev_t* sd = _get_sockdev(domain);
     const myst_fdtable_type_t fdtype = MYST_FDTABLE_TYPE_SOCK;
 
     ECHECK((*sd->sd_socketpair)(sd, domain, type, protocol, pair));
@@ -2824,12 +2948,21 @@ done:
 long myst_syscall_sched_yield(void)
 {
     long params[6] = {0};
+
+    if (myst_fiber_self())
+        return myst_fiber_yield();
+
     return myst_tcall(SYS_sched_yield, params);
 }
 
 long myst_syscall_nanosleep(const struct timespec* req, struct timespec* rem)
 {
     long params[6] = {(long)req, (long)rem};
+
+    /* park a fiber rather than its carrier thread */
+    if (myst_fiber_self())
+        return myst_fiber_sleep(req, rem);
+
     return _forward_syscall(SYS_nanosleep, params);
 }
 #define NANO_IN_SECOND 1000000000
@@ -2970,7 +3103,43 @@ done:
 long myst_syscall_sync(void)
 {
     myst_fdtable_t* fdtable = myst_fdtable_current();
-    return myst_fdtable_sync(fdtable);
+    long ret;
+    long r;
+
+    /* sync the open files (of any file system), then write back the caches
+     * of every mounted file system (even if the former fails) */
+    ret = myst_fdtable_sync(fdtable);
+
+    if ((r = myst_mount_sync()) != 0 && ret == 0)
+        ret = r;
+
+    return ret;
+}
+
+long myst_syscall_syncfs(int fd)
+{
+    long ret = 0;
+    void* device = NULL;
+    void* object = NULL;
+    myst_fdtable_type_t type;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+
+    if (fd < 0)
+        ERAISE(-EBADF);
+
+    ECHECK(myst_fdtable_get_any(fdtable, fd, &type, &device, &object));
+
+    /* other descriptors belong to file systems without caches */
+    if (type != MYST_FDTABLE_TYPE_FILE)
+        goto done;
+
+    if (myst_is_ext2fs(device))
+        ECHECK(ext2_sync(device));
+    else
+        ECHECK(((myst_fs_t*)device)->fs_fsync(device, (myst_file_t*)object));
+
+done:
+    return ret;
 }
 
 long myst_syscall_utimensat(
@@ -3646,8 +3815,12 @@ static long _syscall(void* args_)
                 fd,
                 offset);
 
+            /* reuse the mapping of an exited thread if one fits */
+            long ret = myst_stack_cache_mmap(addr, length, prot, flags);
+
             /* this can return (void*)-errno */
-            long ret = (long)myst_mmap(addr, length, prot, flags, fd, offset);
+            if (ret == 0)
+                ret = (long)myst_mmap(addr, length, prot, flags, fd, offset);
 
             // ATTN : temporary workaround for myst_mmap()  inaccurate return
             // value issue
@@ -3711,6 +3884,10 @@ static long _syscall(void* args_)
                 }
             }
 
+            /* keep the mapping of a joined thread for reuse */
+            if (myst_stack_cache_munmap(addr, length) == 0)
+                BREAK(_return(n, 0));
+
             long ret = (long)myst_munmap(addr, length);
 
             if (ret == 0)
@@ -4039,6 +4216,7 @@ static long _syscall(void* args_)
             pid_t* ptid = (pid_t*)args[4];
             void* newtls = (void*)args[5];
             pid_t* ctid = (void*)args[6];
+            long options = x2;
 
             _strace(
                 n,
@@ -4048,19 +4226,23 @@ static long _syscall(void* args_)
                 "arg=%p "
                 "ptid=%p "
                 "newtls=%p "
-                "ctid=%p",
+                "ctid=%p "
+                "options=%lx",
                 fn,
                 child_stack,
                 flags,
                 arg,
                 ptid,
                 newtls,
-                ctid);
+                ctid,
+                options);
 
             long ret = myst_syscall_clone(
-                fn, child_stack, flags, arg, ptid, newtls, ctid);
+                fn, child_stack, flags, arg, ptid, newtls, ctid, options);
 
-            if ((flags & CLONE_VFORK))
+            /* the child has already exec'd or exited if the caller waited */
+            if ((flags & CLONE_VFORK) &&
+                !(options & MYST_CLONE_WAIT_EXEC_EXIT))
             {
                 // ATTN: give the thread a little time to start to avoid a
                 // syncyhronization error. This suppresses a failure in the
@@ -4083,7 +4265,8 @@ static long _syscall(void* args_)
         {
             int ret = 0;
             _strace(n, NULL);
-            myst_futex_wait(&thread->fork_exec_futex_wait, 0, NULL);
+
+            myst_fork_exec_futex_wait(thread);
             BREAK(_return(n, ret));
         }
         case SYS_myst_kill_wait_child_forks:
@@ -5151,15 +5334,66 @@ static long _syscall(void* args_)
             BREAK(_return(n, 0));
         }
         case SYS_timer_create:
-            break;
+        {
+            clockid_t clockid = (clockid_t)x1;
+            struct sigevent* sevp = (struct sigevent*)x2;
+            int* timerid = (int*)x3;
+
+            _strace(
+                n,
+                "clockid=%d sevp=%p timerid=%p",
+                clockid,
+                sevp,
+                timerid);
+
+            BREAK(_return(
+                n, myst_syscall_timer_create(clockid, sevp, timerid)));
+        }
         case SYS_timer_settime:
-            break;
+        {
+            int timerid = (int)x1;
+            int flags = (int)x2;
+            const struct itimerspec* new_value = (void*)x3;
+            struct itimerspec* old_value = (void*)x4;
+
+            _strace(
+                n,
+                "timerid=%d flags=%d new_value=%p old_value=%p",
+                timerid,
+                flags,
+                new_value,
+                old_value);
+
+            BREAK(_return(
+                n,
+                myst_syscall_timer_settime(
+                    timerid, flags, new_value, old_value)));
+        }
         case SYS_timer_gettime:
-            break;
+        {
+            int timerid = (int)x1;
+            struct itimerspec* curr_value = (void*)x2;
+
+            _strace(n, "timerid=%d curr_value=%p", timerid, curr_value);
+
+            BREAK(_return(n, myst_syscall_timer_gettime(timerid, curr_value)));
+        }
         case SYS_timer_getoverrun:
-            break;
+        {
+            int timerid = (int)x1;
+
+            _strace(n, "timerid=%d", timerid);
+
+            BREAK(_return(n, myst_syscall_timer_getoverrun(timerid)));
+        }
         case SYS_timer_delete:
-            break;
+        {
+            int timerid = (int)x1;
+
+            _strace(n, "timerid=%d", timerid);
+
+            BREAK(_return(n, myst_syscall_timer_delete(timerid)));
+        }
         case SYS_clock_settime:
         {
             clockid_t clk_id = (clockid_t)x1;
@@ -5597,9 +5831,24 @@ static long _syscall(void* args_)
             BREAK(_return(n, ret));
         }
         case SYS_signalfd:
-            break;
+        {
+            int fd = (int)x1;
+            const sigset_t* mask = (const sigset_t*)x2;
+            size_t sizemask = (size_t)x3;
+
+            _strace(n, "fd=%d mask=%p sizemask=%zu", fd, mask, sizemask);
+
+            BREAK(_return(n, myst_syscall_signalfd(fd, mask, sizemask, 0)));
+        }
         case SYS_timerfd_create:
-            break;
+        {
+            clockid_t clockid = (clockid_t)x1;
+            int flags = (int)x2;
+
+            _strace(n, "clockid=%d flags=%d", clockid, flags);
+
+            BREAK(_return(n, myst_syscall_timerfd_create(clockid, flags)));
+        }
         case SYS_eventfd:
             break;
         case SYS_fallocate:
@@ -5616,9 +5865,34 @@ static long _syscall(void* args_)
             BREAK(_return(n, 0));
         }
         case SYS_timerfd_settime:
-            break;
+        {
+            int fd = (int)x1;
+            int flags = (int)x2;
+            const struct itimerspec* new_value = (void*)x3;
+            struct itimerspec* old_value = (void*)x4;
+
+            _strace(
+                n,
+                "fd=%d flags=%d new_value=%p old_value=%p",
+                fd,
+                flags,
+                new_value,
+                old_value);
+
+            BREAK(_return(
+                n,
+                myst_syscall_timerfd_settime(
+                    fd, flags, new_value, old_value)));
+        }
         case SYS_timerfd_gettime:
-            break;
+        {
+            int fd = (int)x1;
+            struct itimerspec* curr_value = (void*)x2;
+
+            _strace(n, "fd=%d curr_value=%p", fd, curr_value);
+
+            BREAK(_return(n, myst_syscall_timerfd_gettime(fd, curr_value)));
+        }
         case SYS_accept4:
         {
             int sockfd = (int)x1;
@@ -5646,7 +5920,23 @@ static long _syscall(void* args_)
             BREAK(_return(n, ret));
         }
         case SYS_signalfd4:
-            break;
+        {
+            int fd = (int)x1;
+            const sigset_t* mask = (const sigset_t*)x2;
+            size_t sizemask = (size_t)x3;
+            int flags = (int)x4;
+
+            _strace(
+                n,
+                "fd=%d mask=%p sizemask=%zu flags=%d",
+                fd,
+                mask,
+                sizemask,
+                flags);
+
+            BREAK(_return(
+                n, myst_syscall_signalfd(fd, mask, sizemask, flags)));
+        }
         case SYS_eventfd2:
         {
             unsigned int initval = (unsigned int)x1;
@@ -5777,7 +6067,13 @@ static long _syscall(void* args_)
         case SYS_clock_adjtime:
             break;
         case SYS_syncfs:
-            break;
+        {
+            int fd = (int)x1;
+
+            _strace(n, "fd=%d", fd);
+
+            BREAK(_return(n, myst_syscall_syncfs(fd)));
+        }
         case SYS_sendmmsg:
         {
             int sockfd = (int)x1;
@@ -6014,10 +6310,7 @@ static long _syscall(void* args_)
                     struct timespec req;
                     req.tv_sec = 0;
                     req.tv_nsec = 1000000000 / 10;
-                    long args[6];
-                    args[0] = (long)&req;
-                    args[1] = (long)NULL;
-                    _forward_syscall(SYS_nanosleep, args);
+                    myst_syscall_nanosleep(&req, NULL);
                     continue;
                 }
             }
@@ -6376,7 +6669,6 @@ long myst_syscall(long n, long params[6])
 **==============================================================================
 */
 
-static myst_spinlock_t _get_time_lock = MYST_SPINLOCK_INITIALIZER;
 static myst_spinlock_t _set_time_lock = MYST_SPINLOCK_INITIALIZER;
 
 long myst_syscall_clock_gettime(clockid_t clk_id, struct timespec* tp)
@@ -6411,10 +6703,31 @@ long myst_syscall_clock_gettime(clockid_t clk_id, struct timespec* tp)
         return 0;
     }
 
-    myst_spin_lock(&_get_time_lock);
     long params[6] = {(long)clk_id, (long)tp};
     long ret = myst_tcall(MYST_TCALL_CLOCK_GETTIME, params);
-    myst_spin_unlock(&_get_time_lock);
+
+    /* the clock may be read on different CPUs: never go backward per thread */
+    if (ret == 0 && (clk_id == CLOCK_MONOTONIC || clk_id == CLOCK_BOOTTIME))
+    {
+        uint64_t value;
+        myst_thread_t* thread;
+
+        if (myst_tcall_get_tsd(&value) == 0 &&
+            myst_valid_thread(thread = (myst_thread_t*)value))
+        {
+            long now = tp->tv_sec * NANO_IN_SECOND + tp->tv_nsec;
+
+            if (now < thread->monotime_last)
+            {
+                now = thread->monotime_last;
+                tp->tv_sec = now / NANO_IN_SECOND;
+                tp->tv_nsec = now % NANO_IN_SECOND;
+            }
+
+            thread->monotime_last = now;
+        }
+    }
+
     return ret;
 }
 
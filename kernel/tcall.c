@@ -6,6 +6,7 @@
 #include <unistd.h>
 
 #include <myst/blockdevice.h>
+#include <myst/fiber.h>
 #include <myst/fsgs.h>
 #include <myst/luks.h>
 #include <myst/sha256.h>
@@ -62,6 +63,11 @@ long myst_tcall_create_thread(uint64_t cookie)
 long myst_tcall_wait(uint64_t event, const struct timespec* timeout)
 {
     long params[6] = {0};
+
+    /* fibers wait in the kernel scheduler rather than on the host */
+    if (myst_is_fiber_event(event))
+        return myst_fiber_wait(event, timeout);
+
     params[0] = (long)event;
     params[1] = (long)timeout;
     long ret = myst_tcall(MYST_TCALL_WAIT, params);
@@ -71,6 +77,10 @@ long myst_tcall_wait(uint64_t event, const struct timespec* timeout)
 long myst_tcall_wake(uint64_t event)
 {
     long params[6] = {0};
+
+    if (myst_is_fiber_event(event))
+        return myst_fiber_wake(event);
+
     params[0] = (long)event;
     return myst_tcall(MYST_TCALL_WAKE, params);
 }
@@ -81,6 +91,18 @@ long myst_tcall_wake_wait(
     const struct timespec* timeout)
 {
     long params[6] = {0};
+
+    /* split the operation if either side is a fiber */
+    if (myst_is_fiber_event(waiter_event) || myst_is_fiber_event(self_event))
+    {
+        long ret;
+
+        if ((ret = myst_tcall_wake(waiter_event)) < 0 && ret != -EAGAIN)
+            return ret;
+
+        return myst_tcall_wait(self_event, timeout);
+    }
+
     params[0] = (long)waiter_event;
     params[1] = (long)self_event;
     params[2] = (long)timeout;
@@ -120,12 +142,21 @@ long myst_tcall_get_errno_location(int** ptr)
 long myst_tcall_poll_wake(void)
 {
     long params[6] = {0};
+
+    /* fibers poll on the host thread of their carrier */
+    myst_fiber_poll_wake();
+
     return myst_tcall(MYST_TCALL_POLL_WAKE, params);
 }
 
 long myst_tcall_poll(struct pollfd* fds, nfds_t nfds, int timeout)
 {
     long params[6] = {(long)fds, nfds, timeout};
+
+    /* a blocking host poll would stall every fiber on the carrier */
+    if (timeout != 0 && myst_fiber_self())
+        return myst_fiber_poll(fds, nfds, timeout);
+
     return myst_tcall(SYS_poll, params);
 }
 
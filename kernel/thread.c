@@ -14,6 +14,7 @@
 #include <myst/cond.h>
 #include <myst/eraise.h>
 #include <myst/fdtable.h>
+#include <myst/fiber.h>
 #include <myst/file.h>
 #include <myst/fsgs.h>
 #include <myst/futex.h>
@@ -23,6 +24,7 @@
 #include <myst/mmanutils.h>
 #include <myst/options.h>
 #include <myst/panic.h>
+#include <myst/poll.h>
 #include <myst/printf.h>
 #include <myst/procfs.h>
 #include <myst/setjmp.h>
@@ -89,6 +91,75 @@ pid_t myst_generate_tid(void)
 #define PROCESS_ENTRY_STACK_SIZE 65536
 #define THREAD_ENTRY_STACK_SIZE 8192
 
+/* Released thread entry stacks are kept here for reuse by new threads */
+#define MAX_CACHED_ENTRY_STACKS 64
+
+static void* _entry_stack_cache[MAX_CACHED_ENTRY_STACKS];
+static size_t _entry_stack_cache_size;
+static myst_spinlock_t _entry_stack_cache_lock = MYST_SPINLOCK_INITIALIZER;
+
+static void _free_entry_stack_cache(void* arg)
+{
+    (void)arg;
+
+    myst_spin_lock(&_entry_stack_cache_lock);
+    {
+        while (_entry_stack_cache_size)
+            free(_entry_stack_cache[--_entry_stack_cache_size]);
+    }
+    myst_spin_unlock(&_entry_stack_cache_lock);
+}
+
+static void* _alloc_entry_stack(size_t stack_size)
+{
+    void* stack = NULL;
+
+    if (stack_size == THREAD_ENTRY_STACK_SIZE)
+    {
+        myst_spin_lock(&_entry_stack_cache_lock);
+        {
+            if (_entry_stack_cache_size)
+                stack = _entry_stack_cache[--_entry_stack_cache_size];
+        }
+        myst_spin_unlock(&_entry_stack_cache_lock);
+
+        if (stack)
+            return stack;
+    }
+
+    return memalign(ENTRY_STACK_ALIGNMENT, stack_size);
+}
+
+static void _release_entry_stack(void* stack, size_t stack_size)
+{
+    if (stack_size == THREAD_ENTRY_STACK_SIZE)
+    {
+        static bool _initialized;
+        bool cached = false;
+
+        myst_spin_lock(&_entry_stack_cache_lock);
+        {
+            if (!_initialized)
+            {
+                myst_atexit(_free_entry_stack_cache, NULL);
+                _initialized = true;
+            }
+
+            if (_entry_stack_cache_size < MAX_CACHED_ENTRY_STACKS)
+            {
+                _entry_stack_cache[_entry_stack_cache_size++] = stack;
+                cached = true;
+            }
+        }
+        myst_spin_unlock(&_entry_stack_cache_lock);
+
+        if (cached)
+            return;
+    }
+
+    free(stack);
+}
+
 static long _get_entry_stack(myst_thread_t* thread)
 {
     long ret = 0;
@@ -100,7 +171,7 @@ static long _get_entry_stack(myst_thread_t* thread)
         stack_size = THREAD_ENTRY_STACK_SIZE;
 
     /* allocate a new stack since the OE caller stack is very small */
-    if (!(thread->entry_stack = memalign(ENTRY_STACK_ALIGNMENT, stack_size)))
+    if (!(thread->entry_stack = _alloc_entry_stack(stack_size)))
         ERAISE(-ENOMEM);
     thread->entry_stack_size = stack_size;
 
@@ -109,7 +180,8 @@ static long _get_entry_stack(myst_thread_t* thread)
 done:
     if (ret < 0)
     {
-        free(thread->entry_stack);
+        if (thread->entry_stack)
+            _release_entry_stack(thread->entry_stack, stack_size);
         thread->entry_stack = NULL;
         thread->entry_stack_size = 0;
     }
@@ -785,6 +857,25 @@ done:
     return;
 }
 
+void myst_fork_exec_futex_wait(myst_thread_t* thread)
+{
+    const uint64_t mask = thread->signal.mask;
+
+    /* Like vfork, stay suspended until the child execs or exits: the child
+     * may borrow this process's descriptors meanwhile (see
+     * myst_fdtable_clone). So signals other than SIGKILL are only handled
+     * afterwards (on return from the syscall). */
+    thread->signal.mask = ~(uint64_t)0;
+
+    while (!__atomic_load_n(&thread->fork_exec_futex_wait, __ATOMIC_ACQUIRE) &&
+           !myst_signal_has_active_signals(thread))
+    {
+        myst_futex_wait(&thread->fork_exec_futex_wait, 0, NULL);
+    }
+
+    thread->signal.mask = mask;
+}
+
 /*
 **==============================================================================
 **
@@ -814,6 +905,24 @@ myst_process_t* myst_process_self(void)
     return myst_thread_self()->process;
 }
 
+/* find the unmap-on-exit entry that contains the C-runtime thread descriptor
+ * (this is the mapping for the stack, guard page, and TLS of a detached
+ * thread, deferred by __unmapself()) */
+static struct unmap_on_exit* _find_crt_mapping(myst_thread_t* thread)
+{
+    const uint8_t* td = (const uint8_t*)thread->crt_td;
+
+    for (size_t i = 0; i < thread->unmap_on_exit_used; i++)
+    {
+        const uint8_t* p = thread->unmap_on_exit[i].ptr;
+
+        if (td >= p && td < p + thread->unmap_on_exit[i].size)
+            return &thread->unmap_on_exit[i];
+    }
+
+    return NULL;
+}
+
 /* Force the caller stack to be aligned */
 __attribute__((force_align_arg_pointer)) static long _call_thread_fn(void* arg)
 {
@@ -914,6 +1023,12 @@ static long _run_thread(void* arg_)
             thread->exec_kstack = NULL;
         }
 
+        if (is_child_thread && !_find_crt_mapping(thread))
+        {
+            /* the joining thread will unmap the C-runtime thread mapping */
+            myst_stack_cache_expect(process->pid, thread->crt_td);
+        }
+
         if (is_child_thread)
         {
             /* Wake up any thread waiting on ctid */
@@ -961,6 +1076,9 @@ static long _run_thread(void* arg_)
 
             procfs_pid_cleanup(process->pid);
 
+            /* disarm any timers that would signal this process */
+            myst_release_process_timers(process->pid);
+
             /* Send SIGHUP to all our children */
             myst_send_sighup_child_processes(process);
 
@@ -992,22 +1110,28 @@ static long _run_thread(void* arg_)
         /* Free up the thread unmap-on-exit for child threads. */
         if (is_child_thread)
         {
+            struct unmap_on_exit* crt_mapping = _find_crt_mapping(thread);
             size_t i = thread->unmap_on_exit_used;
             while (i)
             {
-                if (!myst_munmap(
-                        thread->unmap_on_exit[i - 1].ptr,
-                        thread->unmap_on_exit[i - 1].size))
+                struct unmap_on_exit* p = &thread->unmap_on_exit[i - 1];
+
+                /* keep the C-runtime thread mapping for reuse (if enabled) */
+                if (p == crt_mapping &&
+                    myst_stack_cache_put(p->ptr, p->size) == 0)
+                {
+                    i--;
+                    continue;
+                }
+
+                if (!myst_munmap(p->ptr, p->size))
                 {
                     /* App process might have invoked SYS_mmap, which marks the
                      * memory as owned by the calling app process, and then
                      * SYS_myst_unmap_on_exit on the memory region. Clear the
                      * pid vector to make sure the unmapped memory is marked as
                      * not owned by any app process */
-                    myst_mman_pids_set(
-                        thread->unmap_on_exit[i - 1].ptr,
-                        thread->unmap_on_exit[i - 1].size,
-                        0);
+                    myst_mman_pids_set(p->ptr, p->size, 0);
                 }
                 i--;
             }
@@ -1026,6 +1150,7 @@ static long _run_thread(void* arg_)
         }
 
         myst_signal_free_siginfos(thread);
+        myst_poll_free_buffers(thread);
         free(thread);
 
         /* Return to target, which will exit this thread */
@@ -1060,13 +1185,13 @@ static long _run_thread(void* arg_)
     return 0;
 }
 
-long myst_run_thread(uint64_t cookie, uint64_t event, pid_t target_tid)
+static long _run_thread_on_entry_stack(
+    myst_thread_t* thread,
+    uint64_t cookie,
+    uint64_t event,
+    pid_t target_tid)
 {
     long ret = 0;
-    myst_thread_t* thread;
-    /* get the thread corresponding to this cookie */
-    if (!(thread = _put_cookie(cookie)))
-        ERAISE(-EINVAL);
 
     /* run the thread on the transient stack */
     struct run_thread_arg arg = {thread, cookie, event, target_tid};
@@ -1081,7 +1206,53 @@ long myst_run_thread(uint64_t cookie, uint64_t event, pid_t target_tid)
     ECHECK(myst_call_on_stack((void*)stack_end, _run_thread, &arg));
 
     myst_unregister_stack(stack, stack_size);
-    free(stack);
+    _release_entry_stack(stack, stack_size);
+
+done:
+    return ret;
+}
+
+long myst_run_thread(uint64_t cookie, uint64_t event, pid_t target_tid)
+{
+    long ret = 0;
+    myst_thread_t* thread;
+
+    /* the target is starting a fiber carrier rather than a thread */
+    if (myst_is_fiber_carrier_cookie(cookie))
+        return myst_fiber_run_carrier(cookie, event, target_tid);
+
+    /* get the thread corresponding to this cookie */
+    if (!(thread = _put_cookie(cookie)))
+        ERAISE(-EINVAL);
+
+    ret = _run_thread_on_entry_stack(thread, cookie, event, target_tid);
+
+done:
+    return ret;
+}
+
+long myst_run_fiber(myst_thread_t* thread, uint64_t event, pid_t target_tid)
+{
+    return _run_thread_on_entry_stack(thread, 0, event, target_tid);
+}
+
+/* start the new thread on a host thread, or on a fiber if the host threads are
+ * used up */
+static long _start_thread(myst_thread_t* thread, bool as_fiber)
+{
+    long ret = 0;
+
+    if (as_fiber)
+    {
+        ECHECK(myst_fiber_create(thread));
+    }
+    else
+    {
+        uint64_t cookie = _get_cookie(thread);
+
+        if (myst_tcall_create_thread(cookie) != 0)
+            ERAISE(-EINVAL);
+    }
 
 done:
     return ret;
@@ -1097,7 +1268,7 @@ static long _syscall_clone(
     pid_t* ctid)
 {
     long ret = 0;
-    uint64_t cookie = 0;
+    bool as_fiber = false;
     myst_thread_t* current_thread = myst_thread_self();
     myst_process_t* current_process = myst_process_self();
     myst_thread_t* new_thread;
@@ -1110,9 +1281,11 @@ static long _syscall_clone(
 
     /* Check whether the maximum number of threads has been reached */
     {
-        /* if too many threads already running */
-        if (_num_threads == __myst_kernel_args.max_threads)
-            ERAISE(-EAGAIN);
+        int r;
+
+        /* if too many threads already running (or spill over onto a fiber) */
+        ECHECK((r = myst_fiber_select(_num_threads)));
+        as_fiber = (r == 1);
 
         _num_threads++;
     }
@@ -1159,10 +1332,7 @@ static long _syscall_clone(
         ECHECK(_get_entry_stack(new_thread));
     }
 
-    cookie = _get_cookie(new_thread);
-
-    if (myst_tcall_create_thread(cookie) != 0)
-        ERAISE(-EINVAL);
+    ECHECK(_start_thread(new_thread, as_fiber));
 
 done:
     return ret;
@@ -1173,10 +1343,11 @@ static long _syscall_clone_vfork(
     int (*fn)(void*),
     void* child_stack,
     int flags,
-    void* arg)
+    void* arg,
+    bool wait_exec_exit)
 {
     long ret = 0;
-    uint64_t cookie = 0;
+    bool as_fiber = false;
     myst_thread_t* parent_thread = myst_thread_self();
     myst_process_t* parent_process = myst_process_self();
     myst_thread_t* child_thread = NULL;
@@ -1188,9 +1359,11 @@ static long _syscall_clone_vfork(
 
     /* Check whether the maximum number of threads has been reached */
     {
-        /* if too many threads already running */
-        if (_num_threads == __myst_kernel_args.max_threads)
-            ERAISE(-EAGAIN);
+        int r;
+
+        /* if too many threads already running (or spill over onto a fiber) */
+        ECHECK((r = myst_fiber_select(_num_threads)));
+        as_fiber = (r == 1);
 
         _num_threads++;
     }
@@ -1253,9 +1426,28 @@ static long _syscall_clone_vfork(
         /* inherit process group ID */
         child_process->pgid = parent_process->pgid;
 
-        if (myst_fdtable_clone(
-                parent_process->fdtable, &child_process->fdtable) != 0)
-            ERAISE(-ENOMEM);
+        /* borrow the parent's descriptors until the child execs (or changes
+         * them), so that exec does not dup only to close CLOEXEC ones; only
+         * if the parent is suspended until then (see myst_fdtable_clone):
+         * this call suspends it (see myst_syscall_clone), but posix_spawn()
+         * and pseudo fork() keep running after a CLONE_VFORK clone, and so
+         * do other threads of the parent */
+        {
+            bool borrow = false;
+
+            if (wait_exec_exit)
+            {
+                myst_spin_lock(&parent_process->thread_group_lock);
+                borrow = !parent_process->main_process_thread->group_next;
+                myst_spin_unlock(&parent_process->thread_group_lock);
+            }
+
+            if (myst_fdtable_clone(
+                    parent_process->fdtable,
+                    borrow,
+                    &child_process->fdtable) != 0)
+                ERAISE(-ENOMEM);
+        }
 
         if (myst_signal_clone(parent_thread, child_thread) != 0)
             ERAISE(-ENOMEM);
@@ -1295,10 +1487,7 @@ static long _syscall_clone_vfork(
         ECHECK(_get_entry_stack(child_thread));
     }
 
-    cookie = _get_cookie(child_thread);
-
-    if (myst_tcall_create_thread(cookie) != 0)
-        ERAISE(-EINVAL);
+    ECHECK(_start_thread(child_thread, as_fiber));
 
     ret = child_process->pid;
 
@@ -1339,10 +1528,19 @@ long myst_syscall_clone(
     void* arg,
     pid_t* ptid,
     void* newtls,
-    pid_t* ctid)
+    pid_t* ctid,
+    long options)
 {
     if (flags & CLONE_VFORK)
-        return _syscall_clone_vfork(fn, child_stack, flags, arg);
+    {
+        const bool wait = (options & MYST_CLONE_WAIT_EXEC_EXIT);
+        long ret = _syscall_clone_vfork(fn, child_stack, flags, arg, wait);
+
+        if (ret > 0 && wait)
+            myst_fork_exec_futex_wait(myst_thread_self());
+
+        return ret;
+    }
     else
         return _syscall_clone(fn, child_stack, flags, arg, ptid, newtls, ctid);
 }
@@ -1,6 +1,7 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#include <myst/fiber.h>
 #include <myst/syscall.h>
 #include <myst/tcall.h>
 #include <myst/time.h>
@@ -16,6 +17,13 @@ void myst_sleep_msec(uint64_t milliseconds)
     ts.tv_sec = (time_t)(milliseconds / _SEC_TO_MSEC);
     ts.tv_nsec = (long)((milliseconds % _SEC_TO_MSEC) * _MSEC_TO_NSEC);
 
+    /* park a fiber rather than its carrier thread */
+    if (myst_fiber_self())
+    {
+        myst_fiber_sleep(req, NULL);
+        return;
+    }
+
     params[0] = (long)req;
     params[1] = (long)NULL;
 
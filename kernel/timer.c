@@ -0,0 +1,349 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/cond.h>
+#include <myst/mutex.h>
+#include <myst/panic.h>
+#include <myst/syscall.h>
+#include <myst/thread.h>
+#include <myst/timer.h>
+#include <myst/times.h>
+
+/* the thread servicing the timers and the timer whose callback it runs */
+typedef struct servicer
+{
+    myst_thread_t* thread;
+    myst_timer_t* running;
+} servicer_t;
+
+static myst_mutex_t _mutex;
+static myst_cond_t _cond;    /* signaled when the earliest deadline changes */
+static myst_cond_t _done;    /* signaled when a callback finishes */
+static myst_cond_t _standby; /* signaled when the servicer exits */
+
+/* min-heap of armed timers ordered by deadline */
+static myst_timer_t** _heap;
+static size_t _heap_size;
+static size_t _heap_capacity;
+
+/* the one thread that services the timers (others stand by) */
+static servicer_t* _servicer;
+
+uint64_t myst_timer_now(void)
+{
+    struct timespec ts;
+
+    if (myst_syscall_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        myst_panic("clock_gettime() failed");
+
+    return (uint64_t)timespec_to_nanos(&ts);
+}
+
+uint64_t myst_timer_deadline(
+    clockid_t clockid,
+    const struct timespec* value,
+    bool absolute)
+{
+    uint64_t now = myst_timer_now();
+    uint64_t nanos = (uint64_t)timespec_to_nanos(value);
+    uint64_t base = now;
+
+    if (!absolute)
+        return now + nanos;
+
+    /* CLOCK_MONOTONIC and CLOCK_BOOTTIME are the same clock here */
+    if (clockid == CLOCK_REALTIME)
+    {
+        struct timespec ts;
+
+        if (myst_syscall_clock_gettime(CLOCK_REALTIME, &ts) != 0)
+            myst_panic("clock_gettime() failed");
+
+        base = (uint64_t)timespec_to_nanos(&ts);
+    }
+
+    return (nanos > base) ? now + (nanos - base) : now;
+}
+
+/*
+**==============================================================================
+**
+** heap operations (called with _mutex held):
+**
+**==============================================================================
+*/
+
+static void _heap_set(size_t i, myst_timer_t* timer)
+{
+    _heap[i] = timer;
+    timer->index = i + 1;
+}
+
+static void _sift_up(size_t i)
+{
+    myst_timer_t* timer = _heap[i];
+
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+
+        if (_heap[parent]->deadline <= timer->deadline)
+            break;
+
+        _heap_set(i, _heap[parent]);
+        i = parent;
+    }
+
+    _heap_set(i, timer);
+}
+
+static void _sift_down(size_t i)
+{
+    myst_timer_t* timer = _heap[i];
+
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+
+        if (child >= _heap_size)
+            break;
+
+        if (child + 1 < _heap_size &&
+            _heap[child + 1]->deadline < _heap[child]->deadline)
+        {
+            child++;
+        }
+
+        if (timer->deadline <= _heap[child]->deadline)
+            break;
+
+        _heap_set(i, _heap[child]);
+        i = child;
+    }
+
+    _heap_set(i, timer);
+}
+
+static int _heap_insert(myst_timer_t* timer)
+{
+    if (_heap_size == _heap_capacity)
+    {
+        size_t capacity = _heap_capacity ? _heap_capacity * 2 : 64;
+        myst_timer_t** heap;
+
+        if (!(heap = realloc(_heap, capacity * sizeof(myst_timer_t*))))
+            return -ENOMEM;
+
+        _heap = heap;
+        _heap_capacity = capacity;
+    }
+
+    _heap_set(_heap_size++, timer);
+    _sift_up(_heap_size - 1);
+
+    return 0;
+}
+
+static void _heap_remove(myst_timer_t* timer)
+{
+    size_t i = timer->index - 1;
+    myst_timer_t* last = _heap[--_heap_size];
+
+    timer->index = 0;
+
+    if (i == _heap_size)
+        return;
+
+    _heap_set(i, last);
+
+    if (i > 0 && _heap[(i - 1) / 2]->deadline > last->deadline)
+        _sift_up(i);
+    else
+        _sift_down(i);
+}
+
+/*
+**==============================================================================
+**
+** public interface:
+**
+**==============================================================================
+*/
+
+void myst_timer_init(
+    myst_timer_t* timer,
+    myst_timer_callback_t callback,
+    void* arg)
+{
+    memset(timer, 0, sizeof(myst_timer_t));
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+int myst_timer_arm(myst_timer_t* timer, uint64_t deadline)
+{
+    int ret = 0;
+
+    if (!timer || !timer->callback)
+        return -EINVAL;
+
+    myst_mutex_lock(&_mutex);
+    {
+        if (timer->index)
+            _heap_remove(timer);
+
+        timer->deadline = deadline;
+
+        if ((ret = _heap_insert(timer)) == 0 && timer->index == 1)
+        {
+            /* this is the new earliest deadline */
+            myst_cond_signal(&_cond);
+        }
+    }
+    myst_mutex_unlock(&_mutex);
+
+    return ret;
+}
+
+bool myst_timer_disarm(myst_timer_t* timer)
+{
+    bool armed = false;
+
+    if (!timer)
+        return false;
+
+    myst_mutex_lock(&_mutex);
+    {
+        if (timer->index)
+        {
+            _heap_remove(timer);
+            armed = true;
+        }
+    }
+    myst_mutex_unlock(&_mutex);
+
+    return armed;
+}
+
+bool myst_timer_cancel(myst_timer_t* timer)
+{
+    bool armed = false;
+
+    if (!timer)
+        return false;
+
+    myst_mutex_lock(&_mutex);
+    {
+        if (timer->index)
+        {
+            _heap_remove(timer);
+            armed = true;
+        }
+
+        /* wait for the callback (unless called from the callback) */
+        while (_servicer && _servicer->running == timer &&
+               _servicer->thread != myst_thread_self())
+        {
+            myst_cond_wait(&_done, &_mutex);
+        }
+    }
+    myst_mutex_unlock(&_mutex);
+
+    return armed;
+}
+
+bool myst_timer_armed(myst_timer_t* timer)
+{
+    bool armed;
+
+    myst_mutex_lock(&_mutex);
+    armed = timer->index != 0;
+    myst_mutex_unlock(&_mutex);
+
+    return armed;
+}
+
+/* called when the servicing (or a standby) thread is killed */
+static void _servicer_sig_handler(unsigned signum, void* arg)
+{
+    servicer_t* servicer = arg;
+
+    (void)signum;
+
+    myst_mutex_lock(&_mutex);
+    {
+        /* let a standby thread take over */
+        if (_servicer == servicer)
+        {
+            _servicer = NULL;
+            myst_cond_signal(&_standby);
+        }
+
+        /* release the cancellers waiting for an interrupted callback */
+        servicer->running = NULL;
+        myst_cond_broadcast(&_done, SIZE_MAX);
+    }
+    myst_mutex_unlock(&_mutex);
+}
+
+long myst_run_timers(void)
+{
+    servicer_t servicer = {.thread = myst_thread_self()};
+    myst_thread_sig_handler_t sig_handler;
+
+    /* the thread exits with its process (possibly running a callback) */
+    myst_thread_sig_handler_install(
+        &sig_handler, _servicer_sig_handler, &servicer);
+
+    myst_mutex_lock(&_mutex);
+
+    /* every process that uses timers starts a timer thread, but only one
+     * services the heap; the others wait to take over when it exits */
+    while (_servicer)
+        myst_cond_wait(&_standby, &_mutex);
+
+    _servicer = &servicer;
+
+    for (;;)
+    {
+        struct timespec buf;
+        struct timespec* to = NULL;
+        uint64_t now = myst_timer_now();
+
+        /* run the callbacks of the expired timers */
+        while (_heap_size && _heap[0]->deadline <= now)
+        {
+            myst_timer_t* timer = _heap[0];
+
+            _heap_remove(timer);
+            servicer.running = timer;
+            myst_mutex_unlock(&_mutex);
+
+            timer->callback(timer, timer->arg);
+
+            myst_mutex_lock(&_mutex);
+            servicer.running = NULL;
+            myst_cond_broadcast(&_done, SIZE_MAX);
+
+            now = myst_timer_now();
+        }
+
+        /* sleep until the earliest deadline (or until signaled) */
+        if (_heap_size)
+        {
+            nanos_to_timespec(&buf, (long)(_heap[0]->deadline - now));
+            to = &buf;
+        }
+
+        myst_cond_timedwait(&_cond, &_mutex, to);
+    }
+
+    /* unreachable */
+    myst_mutex_unlock(&_mutex);
+    myst_thread_sig_handler_uninstall(&sig_handler);
+    return 0;
+}
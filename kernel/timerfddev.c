@@ -0,0 +1,594 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+
+#include <myst/cond.h>
+#include <myst/eraise.h>
+#include <myst/mutex.h>
+#include <myst/poll.h>
+#include <myst/signal.h>
+#include <myst/thread.h>
+#include <myst/timer.h>
+#include <myst/timerfddev.h>
+#include <myst/times.h>
+
+#define MAGIC 0x4c3a9e51
+
+/* The timer state shared by all file descriptors that refer to the same
+ * timerfd (see dup). The expirations are counted here (there is no host
+ * descriptor): the timer callback wakes blocked readers through the condition
+ * variable and poll(), select(), and epoll through the wake queue. */
+typedef struct timerfd_state
+{
+    _Atomic(size_t) nrefs;
+    myst_mutex_t lock;
+    myst_timer_t timer;
+    clockid_t clockid;
+    int status_flags; /* O_NONBLOCK */
+
+    /* the monotonic time of the next expiration (zero if disarmed) */
+    uint64_t expires;
+    uint64_t interval;
+
+    /* expirations since the last read */
+    uint64_t ticks;
+
+    /* signaled when ticks becomes non-zero (under lock) */
+    myst_cond_t cond;
+    myst_poll_wq_t wq;
+} timerfd_state_t;
+
+struct myst_timerfd
+{
+    uint32_t magic;
+    int fd_flags; /* FD_CLOEXEC */
+    timerfd_state_t* state;
+};
+
+MYST_INLINE bool _valid_timerfd(const myst_timerfd_t* timerfd)
+{
+    return timerfd && timerfd->magic == MAGIC;
+}
+
+/* wake the readers and the pollers (called with state->lock held, so that
+ * the state cannot be released meanwhile) */
+static void _signal_readable(timerfd_state_t* state)
+{
+    myst_cond_broadcast(&state->cond, SIZE_MAX);
+    myst_poll_wq_wake(&state->wq);
+}
+
+/* the kernel timer callback (runs on the timer thread) */
+static void _expired(myst_timer_t* timer, void* arg)
+{
+    timerfd_state_t* state = (timerfd_state_t*)arg;
+    uint64_t now;
+    uint64_t ticks;
+
+    (void)timer;
+
+    myst_mutex_lock(&state->lock);
+    {
+        if (state->expires == 0)
+            goto unlock;
+
+        if ((now = myst_timer_now()) < state->expires)
+        {
+            myst_timer_arm(&state->timer, state->expires);
+            goto unlock;
+        }
+
+        ticks = state->ticks;
+
+        if (state->interval)
+        {
+            uint64_t missed = (now - state->expires) / state->interval;
+
+            ticks += missed + 1;
+            state->expires += (missed + 1) * state->interval;
+            myst_timer_arm(&state->timer, state->expires);
+        }
+        else
+        {
+            ticks++;
+            state->expires = 0;
+        }
+
+        /* publish the count before waking (see _td_get_events()) */
+        if (__atomic_exchange_n(&state->ticks, ticks, __ATOMIC_RELEASE) == 0)
+            _signal_readable(state);
+    }
+unlock:
+    myst_mutex_unlock(&state->lock);
+}
+
+static void _get_value(timerfd_state_t* state, struct itimerspec* value)
+{
+    uint64_t remaining = 0;
+
+    if (state->expires)
+    {
+        uint64_t now = myst_timer_now();
+        remaining = (state->expires > now) ? state->expires - now : 1;
+    }
+
+    nanos_to_timespec(&value->it_interval, (long)state->interval);
+    nanos_to_timespec(&value->it_value, (long)remaining);
+}
+
+static void _release_state(timerfd_state_t* state)
+{
+    if (--state->nrefs == 0)
+    {
+        /* disarm under the lock first: a callback that is already running
+         * then finds the timer expired and does not re-arm it */
+        myst_mutex_lock(&state->lock);
+        state->expires = 0;
+        myst_timer_disarm(&state->timer);
+        myst_mutex_unlock(&state->lock);
+
+        /* wait for the callback in case it is running */
+        myst_timer_cancel(&state->timer);
+        myst_poll_wq_release(&state->wq);
+        myst_cond_destroy(&state->cond);
+        memset(state, 0, sizeof(timerfd_state_t));
+        free(state);
+    }
+}
+
+static int _td_timerfd_create(
+    myst_timerfddev_t* dev,
+    clockid_t clockid,
+    int flags,
+    myst_timerfd_t** obj_out)
+{
+    int ret = 0;
+    myst_timerfd_t* timerfd = NULL;
+    timerfd_state_t* state = NULL;
+
+    if (obj_out)
+        *obj_out = NULL;
+
+    if (!dev || !obj_out)
+        ERAISE(-EINVAL);
+
+    if (flags & ~(TFD_NONBLOCK | TFD_CLOEXEC))
+        ERAISE(-EINVAL);
+
+    switch (clockid)
+    {
+        case CLOCK_REALTIME:
+        case CLOCK_MONOTONIC:
+        case CLOCK_BOOTTIME:
+            break;
+        default:
+            ERAISE(-EINVAL);
+    }
+
+    if (!(timerfd = calloc(1, sizeof(myst_timerfd_t))))
+        ERAISE(-ENOMEM);
+
+    if (!(state = calloc(1, sizeof(timerfd_state_t))))
+        ERAISE(-ENOMEM);
+
+    ECHECK(myst_cond_init(&state->cond));
+
+    state->nrefs = 1;
+    state->clockid = clockid;
+    state->status_flags = (flags & TFD_NONBLOCK) ? O_NONBLOCK : 0;
+    myst_timer_init(&state->timer, _expired, state);
+
+    timerfd->magic = MAGIC;
+    timerfd->fd_flags = (flags & TFD_CLOEXEC) ? FD_CLOEXEC : 0;
+    timerfd->state = state;
+    state = NULL;
+
+    *obj_out = timerfd;
+    timerfd = NULL;
+
+done:
+
+    if (state)
+        free(state);
+
+    if (timerfd)
+        free(timerfd);
+
+    return ret;
+}
+
+static int _td_settime(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* timerfd,
+    int flags,
+    const struct itimerspec* new_value,
+    struct itimerspec* old_value)
+{
+    int ret = 0;
+    timerfd_state_t* state;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EBADF);
+
+    if (!new_value || !is_timespec_valid(&new_value->it_value) ||
+        !is_timespec_valid(&new_value->it_interval))
+    {
+        ERAISE(-EINVAL);
+    }
+
+    if (flags & ~(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET))
+        ERAISE(-EINVAL);
+
+    state = timerfd->state;
+
+    myst_mutex_lock(&state->lock);
+    {
+        if (old_value)
+            _get_value(state, old_value);
+
+        /* setting the timer discards any unread expirations */
+        state->ticks = 0;
+
+        state->interval = (uint64_t)timespec_to_nanos(&new_value->it_interval);
+
+        if (new_value->it_value.tv_sec == 0 && new_value->it_value.tv_nsec == 0)
+        {
+            state->expires = 0;
+            myst_timer_disarm(&state->timer);
+        }
+        else
+        {
+            state->expires = myst_timer_deadline(
+                state->clockid,
+                &new_value->it_value,
+                flags & TFD_TIMER_ABSTIME);
+            myst_timer_arm(&state->timer, state->expires);
+        }
+    }
+    myst_mutex_unlock(&state->lock);
+
+done:
+    return ret;
+}
+
+static int _td_gettime(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* timerfd,
+    struct itimerspec* curr_value)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EBADF);
+
+    if (!curr_value)
+        ERAISE(-EINVAL);
+
+    myst_mutex_lock(&timerfd->state->lock);
+    _get_value(timerfd->state, curr_value);
+    myst_mutex_unlock(&timerfd->state->lock);
+
+done:
+    return ret;
+}
+
+static ssize_t _td_read(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* timerfd,
+    void* buf,
+    size_t count)
+{
+    ssize_t ret = 0;
+    timerfd_state_t* state;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EBADF);
+
+    if (!buf || count < sizeof(uint64_t))
+        ERAISE(-EINVAL);
+
+    state = timerfd->state;
+
+    myst_mutex_lock(&state->lock);
+    {
+        uint64_t ticks;
+
+        /* wait for the next expiration (or a signal) */
+        while (!(ticks = state->ticks))
+        {
+            if (state->status_flags & O_NONBLOCK)
+                ret = -EAGAIN;
+            else if (myst_signal_has_active_signals(myst_thread_self()))
+                ret = -EINTR;
+            else
+                myst_cond_wait(&state->cond, &state->lock);
+
+            if (ret < 0)
+                break;
+        }
+
+        if (ticks)
+        {
+            state->ticks = 0;
+            memcpy(buf, &ticks, sizeof(ticks));
+            ret = sizeof(ticks);
+        }
+    }
+    myst_mutex_unlock(&state->lock);
+
+done:
+    return ret;
+}
+
+static ssize_t _td_write(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* timerfd,
+    const void* buf,
+    size_t count)
+{
+    ssize_t ret = 0;
+
+    (void)buf;
+    (void)count;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EBADF);
+
+    ERAISE(-EINVAL);
+
+done:
+    return ret;
+}
+
+static ssize_t _td_readv(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* timerfd,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    ssize_t ret = 0;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EBADF);
+
+    ret = myst_fdops_readv(&dev->fdops, timerfd, iov, iovcnt);
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static ssize_t _td_writev(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* timerfd,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    ssize_t ret = 0;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EBADF);
+
+    ret = myst_fdops_writev(&dev->fdops, timerfd, iov, iovcnt);
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static int _td_fstat(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* timerfd,
+    struct stat* statbuf)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_timerfd(timerfd) || !statbuf)
+        ERAISE(-EINVAL);
+
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_mode = S_IRUSR | S_IWUSR;
+    statbuf->st_nlink = 1;
+    statbuf->st_blksize = 4096;
+
+done:
+    return ret;
+}
+
+static int _td_fcntl(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* timerfd,
+    int cmd,
+    long arg)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EBADF);
+
+    switch (cmd)
+    {
+        case F_GETFD:
+            ret = timerfd->fd_flags;
+            break;
+        case F_SETFD:
+            timerfd->fd_flags = (int)(arg & FD_CLOEXEC);
+            break;
+        case F_GETFL:
+            ret = O_RDWR | timerfd->state->status_flags;
+            break;
+        case F_SETFL:
+            timerfd->state->status_flags = (int)(arg & O_NONBLOCK);
+            break;
+        default:
+            ERAISE(-EINVAL);
+    }
+
+done:
+    return ret;
+}
+
+static int _td_ioctl(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* timerfd,
+    unsigned long request,
+    long arg)
+{
+    int ret = 0;
+
+    (void)arg;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EBADF);
+
+    if (request == TIOCGWINSZ)
+        ERAISE(-EINVAL);
+
+    ERAISE(-ENOTSUP);
+
+done:
+    return ret;
+}
+
+static int _td_dup(
+    myst_timerfddev_t* dev,
+    const myst_timerfd_t* timerfd,
+    myst_timerfd_t** timerfd_out)
+{
+    int ret = 0;
+    myst_timerfd_t* new_timerfd = NULL;
+
+    if (timerfd_out)
+        *timerfd_out = NULL;
+
+    if (!dev || !_valid_timerfd(timerfd) || !timerfd_out)
+        ERAISE(-EINVAL);
+
+    if (!(new_timerfd = calloc(1, sizeof(myst_timerfd_t))))
+        ERAISE(-ENOMEM);
+
+    /* the new file descriptor refers to the same timer */
+    new_timerfd->magic = MAGIC;
+    new_timerfd->state = timerfd->state;
+    new_timerfd->state->nrefs++;
+
+    *timerfd_out = new_timerfd;
+
+done:
+    return ret;
+}
+
+static int _td_close(myst_timerfddev_t* dev, myst_timerfd_t* timerfd)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EBADF);
+
+    _release_state(timerfd->state);
+
+    memset(timerfd, 0, sizeof(myst_timerfd_t));
+    free(timerfd);
+
+done:
+    return ret;
+}
+
+static int _td_interrupt(myst_timerfddev_t* dev, myst_timerfd_t* timerfd)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EBADF);
+
+    /* wake any threads blocked on read (the caller holds a spinlock, so do
+     * not take the timerfd lock) */
+    myst_cond_broadcast(&timerfd->state->cond, SIZE_MAX);
+
+done:
+    return ret;
+}
+
+static int _td_target_fd(myst_timerfddev_t* dev, myst_timerfd_t* timerfd)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EINVAL);
+
+    /* there is no host descriptor (see _td_get_events()) */
+    ret = -ENOTSUP;
+
+done:
+    return ret;
+}
+
+static int _td_get_events(myst_timerfddev_t* dev, myst_timerfd_t* timerfd)
+{
+    int ret = 0;
+
+    if (!dev || !_valid_timerfd(timerfd))
+        ERAISE(-EINVAL);
+
+    if (__atomic_load_n(&timerfd->state->ticks, __ATOMIC_ACQUIRE))
+        ret = POLLIN;
+
+done:
+    return ret;
+}
+
+static myst_poll_wq_t* _td_get_wq(
+    myst_timerfddev_t* dev,
+    myst_timerfd_t* timerfd)
+{
+    if (!dev || !_valid_timerfd(timerfd))
+        return NULL;
+
+    return &timerfd->state->wq;
+}
+
+extern myst_timerfddev_t* myst_timerfddev_get(void)
+{
+    // clang-format off
+    static myst_timerfddev_t _dev =
+    {
+        {
+            .fd_read = (void*)_td_read,
+            .fd_write = (void*)_td_write,
+            .fd_readv = (void*)_td_readv,
+            .fd_writev = (void*)_td_writev,
+            .fd_fstat = (void*)_td_fstat,
+            .fd_fcntl = (void*)_td_fcntl,
+            .fd_ioctl = (void*)_td_ioctl,
+            .fd_dup = (void*)_td_dup,
+            .fd_close = (void*)_td_close,
+            .fd_interrupt = (void*)_td_interrupt,
+            .fd_target_fd = (void*)_td_target_fd,
+            .fd_get_events = (void*)_td_get_events,
+            .fd_get_wq = (void*)_td_get_wq,
+        },
+        .td_timerfd_create = _td_timerfd_create,
+        .td_settime = _td_settime,
+        .td_gettime = _td_gettime,
+        .td_read = _td_read,
+        .td_write = _td_write,
+        .td_readv = _td_readv,
+        .td_writev = _td_writev,
+        .td_fstat = _td_fstat,
+        .td_fcntl = _td_fcntl,
+        .td_ioctl = _td_ioctl,
+        .td_dup = _td_dup,
+        .td_close = _td_close,
+        .td_target_fd = _td_target_fd,
+        .td_get_events = _td_get_events,
+        .td_get_wq = _td_get_wq,
+    };
+    // clang-format on
+
+    return &_dev;
+}
@@ -0,0 +1,2509 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <myst/cond.h>
+#include <myst/eraise.h>
+#include <myst/fdtable.h>
+#include <myst/mount.h>
+#include <myst/mutex.h>
+#include <myst/poll.h>
+#include <myst/process.h>
+#include <myst/signal.h>
+#include <myst/sockdev.h>
+#include <myst/spinlock.h>
+#include <myst/syscall.h>
+#include <myst/timer.h>
+#include <myst/times.h>
+
+/*
+**==============================================================================
+**
+** AF_UNIX sockets (SOCK_STREAM, SOCK_DGRAM, and SOCK_SEQPACKET) implemented
+** within the kernel. Data sent between two such sockets is copied from the
+** sender into a message queue of the receiver and never leaves the enclave.
+**
+** Each socket (uds_t) is shared by its descriptors (myst_uds_t), which hold
+** a single reference between them. A connected socket also references its
+** peer, and a sender holds a reference on the receiver while delivering.
+**
+** Each socket has a mutex that guards its receive queue and its state. A
+** blocked reader waits on the condition variable of its own socket and a
+** blocked writer waits on the condition variable of the receiving socket.
+** Changes of readiness also wake the wake queue of the socket so that poll()
+** and epoll() observe the events computed by _uds_get_events().
+**
+** Bound names are kept in a kernel-wide registry. An abstract name is the
+** name itself. A pathname is bound by creating a socket node in the file
+** system; connect() resolves the pathname and matches the node (file system
+** and inode number), so unlinking the node makes the name unreachable.
+**
+** File descriptors passed with SCM_RIGHTS travel as duplicates of their
+** objects and are assigned to the file descriptor table of the receiver.
+**
+**==============================================================================
+*/
+
+#define MAGIC 0x5d1e0a7c
+
+/* same as the default SO_SNDBUF and SO_RCVBUF on Linux */
+#define DEFAULT_BUF_SIZE (208 * 1024)
+#define MIN_BUF_SIZE 4608
+#define MAX_BUF_SIZE (4 * 1024 * 1024)
+
+/* stream messages are coalesced into chunks of at least this size */
+#define MIN_CHUNK_SIZE 2048
+
+/* the maximum number of descriptors in a single SCM_RIGHTS message */
+#define MAX_RIGHTS 253
+
+#define SUN_PATH_OFFSET offsetof(struct sockaddr_un, sun_path)
+
+typedef enum uds_state
+{
+    UDS_UNCONNECTED,
+    UDS_LISTENING,
+    UDS_CONNECTED,
+    UDS_CLOSED,
+} uds_state_t;
+
+/* file descriptors in flight (SCM_RIGHTS) */
+typedef struct rights
+{
+    size_t count;
+    struct
+    {
+        myst_fdtable_type_t type;
+        myst_fdops_t* device;
+        void* object;
+    } fds[];
+} rights_t;
+
+typedef struct msg
+{
+    struct msg* next;
+    size_t size;     /* bytes of data */
+    size_t capacity; /* bytes allocated for data */
+    size_t offset;   /* bytes already read (SOCK_STREAM) */
+    rights_t* rights;
+    struct sockaddr_un from; /* the sender (SOCK_DGRAM) */
+    socklen_t fromlen;
+    uint8_t data[];
+} msg_t;
+
+typedef struct queue
+{
+    msg_t* head;
+    msg_t* tail;
+    size_t nbytes;
+} queue_t;
+
+typedef struct uds uds_t;
+
+struct uds
+{
+    _Atomic(size_t) nrefs;
+    size_t nfds; /* descriptors open on this socket */
+    int type;
+    uds_state_t state;
+    int status_flags; /* O_NONBLOCK */
+    myst_mutex_t lock;
+    myst_cond_t cond;
+    ino_t ino;
+    mode_t mode; /* fchmod() */
+
+    /* the connected peer (or the default destination of SOCK_DGRAM) */
+    uds_t* peer;
+    struct ucred cred;
+    struct ucred peer_cred;
+
+    /* no more data will be received (rx) or may be sent (tx) */
+    bool rx_shut;
+    bool tx_shut;
+
+    queue_t rx;
+    size_t rcvbuf;
+    size_t sndbuf;
+    struct timeval rcvtimeo;
+    struct timeval sndtimeo;
+    bool passcred;
+
+    /* connections waiting for accept() (UDS_LISTENING) */
+    int backlog;
+    size_t nconns;
+    uds_t* conns_head;
+    uds_t* conns_tail;
+    uds_t* conns_next;
+
+    /* the bound name (addrlen is zero if unbound) */
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+    bool registered;
+    myst_fs_t* fs; /* the file system of a pathname node */
+    ino_t fs_ino;  /* the inode number of a pathname node */
+    uds_t* names_next;
+
+    myst_poll_wq_t wq;
+};
+
+typedef struct myst_uds
+{
+    uint32_t magic; /* MAGIC */
+    int fd_flags;   /* FD_CLOEXEC */
+    uds_t* uds;
+} myst_uds_t;
+
+static struct
+{
+    myst_spinlock_t lock;
+    uds_t* head;
+    uint32_t autobind;
+} _names = {MYST_SPINLOCK_INITIALIZER};
+
+static ino_t _next_ino;
+
+MYST_INLINE bool _valid_uds(const myst_uds_t* sock)
+{
+    return sock && sock->magic == MAGIC;
+}
+
+MYST_INLINE size_t _min(size_t x, size_t y)
+{
+    return (x < y) ? x : y;
+}
+
+MYST_INLINE bool _is_connection_oriented(const uds_t* uds)
+{
+    return uds->type != SOCK_DGRAM;
+}
+
+MYST_INLINE size_t _space(const uds_t* uds)
+{
+    const size_t nbytes = __atomic_load_n(&uds->rx.nbytes, __ATOMIC_RELAXED);
+    return (nbytes < uds->rcvbuf) ? uds->rcvbuf - nbytes : 0;
+}
+
+static void _get_cred(struct ucred* cred)
+{
+    cred->pid = myst_getpid();
+    cred->uid = myst_syscall_geteuid();
+    cred->gid = myst_syscall_getegid();
+}
+
+/*
+**==============================================================================
+**
+** messages and rights:
+**
+**==============================================================================
+*/
+
+static void _free_rights(rights_t* rights)
+{
+    if (rights)
+    {
+        for (size_t i = 0; i < rights->count; i++)
+        {
+            myst_fdops_t* device = rights->fds[i].device;
+            (*device->fd_close)(device, rights->fds[i].object);
+        }
+
+        free(rights);
+    }
+}
+
+/* free a list of messages (closing any descriptors in flight) */
+static void _free_msgs(msg_t* msg)
+{
+    while (msg)
+    {
+        msg_t* next = msg->next;
+        _free_rights(msg->rights);
+        free(msg);
+        msg = next;
+    }
+}
+
+static msg_t* _new_msg(size_t capacity)
+{
+    msg_t* msg;
+
+    if (!(msg = malloc(sizeof(msg_t) + capacity)))
+        return NULL;
+
+    msg->next = NULL;
+    msg->size = 0;
+    msg->capacity = capacity;
+    msg->offset = 0;
+    msg->rights = NULL;
+    msg->fromlen = 0;
+
+    return msg;
+}
+
+static void _enqueue(queue_t* queue, msg_t* msg)
+{
+    if (queue->tail)
+        queue->tail->next = msg;
+    else
+        queue->head = msg;
+
+    queue->tail = msg;
+    __atomic_add_fetch(&queue->nbytes, msg->size, __ATOMIC_RELAXED);
+}
+
+static msg_t* _dequeue(queue_t* queue)
+{
+    msg_t* msg;
+
+    if ((msg = queue->head))
+    {
+        if (!(queue->head = msg->next))
+            queue->tail = NULL;
+
+        msg->next = NULL;
+        __atomic_sub_fetch(
+            &queue->nbytes, msg->size - msg->offset, __ATOMIC_RELAXED);
+    }
+
+    return msg;
+}
+
+/* duplicate the descriptors of the SCM_RIGHTS control messages */
+static int _get_rights(const struct msghdr* msg, rights_t** rights_out)
+{
+    int ret = 0;
+    rights_t* rights = NULL;
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    struct cmsghdr* cmsg;
+
+    *rights_out = NULL;
+
+    if (!msg->msg_control || msg->msg_controllen < sizeof(struct cmsghdr))
+        goto done;
+
+    for (cmsg = CMSG_FIRSTHDR((struct msghdr*)msg); cmsg;
+         cmsg = CMSG_NXTHDR((struct msghdr*)msg, cmsg))
+    {
+        const int* fds = (const int*)CMSG_DATA(cmsg);
+        size_t count;
+        size_t size;
+
+        if (cmsg->cmsg_len < CMSG_LEN(0) || cmsg->cmsg_level != SOL_SOCKET)
+            ERAISE(-EINVAL);
+
+        /* credentials are implied (see SO_PEERCRED) */
+        if (cmsg->cmsg_type == SCM_CREDENTIALS)
+            continue;
+
+        if (cmsg->cmsg_type != SCM_RIGHTS || rights)
+            ERAISE(-EINVAL);
+
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        if (count == 0)
+            continue;
+
+        if (count > MAX_RIGHTS)
+            ERAISE(-EINVAL);
+
+        size = sizeof(rights_t) + count * sizeof(rights->fds[0]);
+
+        if (!(rights = calloc(1, size)))
+            ERAISE(-ENOMEM);
+
+        /* the duplicates keep the objects open while in flight */
+        for (size_t i = 0; i < count; i++)
+        {
+            myst_fdtable_type_t type;
+            myst_fdops_t* device;
+            void* object;
+            void* dup = NULL;
+
+            ECHECK(myst_fdtable_get_any(
+                fdtable, fds[i], &type, (void**)&device, &object));
+            ECHECK((*device->fd_dup)(device, object, &dup));
+
+            rights->fds[i].type = type;
+            rights->fds[i].device = device;
+            rights->fds[i].object = dup;
+            rights->count++;
+        }
+    }
+
+    *rights_out = rights;
+    rights = NULL;
+
+done:
+
+    if (rights)
+        _free_rights(rights);
+
+    return ret;
+}
+
+/* assign the descriptors in flight to the receiver's descriptor table */
+static void _put_rights(rights_t* rights, struct msghdr* msg, int flags)
+{
+    myst_fdtable_t* fdtable = myst_fdtable_current();
+    struct cmsghdr* cmsg = NULL;
+    size_t max = 0;
+    size_t n = 0;
+
+    if (msg && msg->msg_control && msg->msg_controllen >= CMSG_LEN(0))
+    {
+        cmsg = (struct cmsghdr*)msg->msg_control;
+        max = (msg->msg_controllen - CMSG_LEN(0)) / sizeof(int);
+    }
+
+    for (size_t i = 0; i < rights->count; i++)
+    {
+        myst_fdops_t* device = rights->fds[i].device;
+        void* object = rights->fds[i].object;
+        int fd = -1;
+
+        if (n < max)
+        {
+            fd = myst_fdtable_assign(
+                fdtable, rights->fds[i].type, device, object);
+        }
+
+        if (fd < 0)
+        {
+            (*device->fd_close)(device, object);
+
+            if (msg)
+                msg->msg_flags |= MSG_CTRUNC;
+
+            continue;
+        }
+
+        if (flags & MSG_CMSG_CLOEXEC)
+            (*device->fd_fcntl)(device, object, F_SETFD, FD_CLOEXEC);
+
+        ((int*)CMSG_DATA(cmsg))[n++] = fd;
+    }
+
+    if (n)
+    {
+        const size_t space = CMSG_SPACE(n * sizeof(int));
+
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+        msg->msg_controllen = _min(msg->msg_controllen, space);
+    }
+    else if (msg)
+    {
+        msg->msg_controllen = 0;
+    }
+
+    free(rights);
+}
+
+/*
+**==============================================================================
+**
+** sockets:
+**
+**==============================================================================
+*/
+
+static int _new_uds(int type, uds_t** uds_out)
+{
+    int ret = 0;
+    uds_t* uds;
+
+    if (!(uds = calloc(1, sizeof(uds_t))))
+        ERAISE(-ENOMEM);
+
+    uds->nrefs = 1;
+    uds->type = type;
+    uds->state = UDS_UNCONNECTED;
+    uds->rcvbuf = DEFAULT_BUF_SIZE;
+    uds->sndbuf = DEFAULT_BUF_SIZE;
+    uds->ino = __atomic_add_fetch(&_next_ino, 1, __ATOMIC_RELAXED);
+    uds->mode = S_IRWXU | S_IRWXG | S_IRWXO;
+    _get_cred(&uds->cred);
+
+    if ((ret = myst_cond_init(&uds->cond)) != 0)
+    {
+        free(uds);
+        ERAISE(ret);
+    }
+
+    *uds_out = uds;
+
+done:
+    return ret;
+}
+
+static void _ref(uds_t* uds)
+{
+    uds->nrefs++;
+}
+
+static void _unref(uds_t* uds)
+{
+    if (--uds->nrefs == 0)
+    {
+        myst_poll_wq_release(&uds->wq);
+        myst_cond_destroy(&uds->cond);
+        _free_msgs(uds->rx.head);
+        free(uds);
+    }
+}
+
+/* wake the threads blocked on uds (the caller holds uds->lock) */
+static void _signal(uds_t* uds)
+{
+    myst_cond_broadcast(&uds->cond, SIZE_MAX);
+}
+
+/* the monotonic deadline of an operation with the given timeout (SO_RCVTIMEO
+ * or SO_SNDTIMEO), or zero if the timeout is zero (wait forever) */
+static uint64_t _deadline(const struct timeval* tv)
+{
+    if (!tv->tv_sec && !tv->tv_usec)
+        return 0;
+
+    return myst_timer_now() + (uint64_t)tv->tv_sec * 1000000000UL +
+           (uint64_t)tv->tv_usec * 1000UL;
+}
+
+/* wait on uds->cond until the deadline of the whole operation (obtained from
+ * _deadline() when the operation started); the caller holds uds->lock */
+static int _wait(uds_t* uds, uint64_t deadline)
+{
+    int ret = 0;
+
+    if (deadline)
+    {
+        const uint64_t now = myst_timer_now();
+        struct timespec ts;
+
+        if (now >= deadline)
+            ERAISE(-EAGAIN);
+
+        /* myst_cond_timedwait() takes a relative timeout */
+        nanos_to_timespec(&ts, (long)(deadline - now));
+
+        if (myst_cond_timedwait(&uds->cond, &uds->lock, &ts) == -ETIMEDOUT)
+            ERAISE(-EAGAIN);
+    }
+    else
+    {
+        myst_cond_wait(&uds->cond, &uds->lock);
+    }
+
+    if (myst_signal_has_active_signals(myst_thread_self()))
+        ERAISE(-EINTR);
+
+done:
+    return ret;
+}
+
+static int _new_desc(uds_t* uds, int flags, myst_uds_t** sock_out)
+{
+    int ret = 0;
+    myst_uds_t* sock;
+
+    if (!(sock = calloc(1, sizeof(myst_uds_t))))
+        ERAISE(-ENOMEM);
+
+    sock->magic = MAGIC;
+    sock->fd_flags = (flags & SOCK_CLOEXEC) ? FD_CLOEXEC : 0;
+    sock->uds = uds;
+
+    uds->nfds = 1;
+    uds->status_flags = (flags & SOCK_NONBLOCK) ? O_NONBLOCK : 0;
+
+    *sock_out = sock;
+
+done:
+    return ret;
+}
+
+static void _unregister(uds_t* uds)
+{
+    myst_spin_lock(&_names.lock);
+
+    if (uds->registered)
+    {
+        for (uds_t** p = &_names.head; *p; p = &(*p)->names_next)
+        {
+            if (*p == uds)
+            {
+                *p = uds->names_next;
+                break;
+            }
+        }
+
+        uds->registered = false;
+    }
+
+    myst_spin_unlock(&_names.lock);
+}
+
+/* take down a socket that no descriptor refers to any more */
+static void _shutdown_uds(uds_t* uds)
+{
+    uds_t* peer;
+    uds_t* conns;
+    msg_t* msgs;
+
+    _unregister(uds);
+
+    myst_mutex_lock(&uds->lock);
+    {
+        uds->state = UDS_CLOSED;
+        uds->rx_shut = true;
+        uds->tx_shut = true;
+        peer = uds->peer;
+        uds->peer = NULL;
+        conns = uds->conns_head;
+        uds->conns_head = NULL;
+        uds->conns_tail = NULL;
+        uds->nconns = 0;
+        msgs = uds->rx.head;
+        uds->rx.head = NULL;
+        uds->rx.tail = NULL;
+        uds->rx.nbytes = 0;
+
+        /* blocked senders see rx_shut */
+        _signal(uds);
+    }
+    myst_mutex_unlock(&uds->lock);
+    myst_poll_wq_wake(&uds->wq);
+
+    /* the peer of a connection sees end-of-file and EPIPE */
+    if (peer)
+    {
+        if (_is_connection_oriented(uds))
+        {
+            myst_mutex_lock(&peer->lock);
+            peer->rx_shut = true;
+            peer->tx_shut = true;
+            _signal(peer);
+            myst_mutex_unlock(&peer->lock);
+            myst_poll_wq_wake(&peer->wq);
+        }
+
+        _unref(peer);
+    }
+
+    /* refuse the connections that were never accepted */
+    while (conns)
+    {
+        uds_t* next = conns->conns_next;
+        _shutdown_uds(conns);
+        _unref(conns);
+        conns = next;
+    }
+
+    /* close the descriptors in flight outside of the lock */
+    _free_msgs(msgs);
+}
+
+/*
+**==============================================================================
+**
+** names:
+**
+**==============================================================================
+*/
+
+static int _check_addr(const struct sockaddr* addr, socklen_t addrlen)
+{
+    int ret = 0;
+
+    if (!addr)
+        ERAISE(-EFAULT);
+
+    if (addrlen < sizeof(sa_family_t) || addrlen > sizeof(struct sockaddr_un))
+        ERAISE(-EINVAL);
+
+    if (addr->sa_family != AF_UNIX)
+        ERAISE(-EINVAL);
+
+done:
+    return ret;
+}
+
+MYST_INLINE bool _is_abstract(const struct sockaddr_un* addr, socklen_t len)
+{
+    return len > SUN_PATH_OFFSET && addr->sun_path[0] == '\0';
+}
+
+/* check whether the socket is bound to the given abstract name */
+static bool _has_abstract_name(
+    const uds_t* uds,
+    const struct sockaddr_un* addr,
+    socklen_t addrlen)
+{
+    const size_t n = addrlen - SUN_PATH_OFFSET;
+
+    if (uds->fs || uds->addrlen != addrlen)
+        return false;
+
+    return memcmp(uds->addr.sun_path, addr->sun_path, n) == 0;
+}
+
+/* resolve a pathname to the file system and inode number of its node */
+static int _resolve_path(
+    const struct sockaddr_un* addr,
+    socklen_t addrlen,
+    bool create,
+    myst_fs_t** fs_out,
+    ino_t* ino_out)
+{
+    int ret = 0;
+    myst_fs_t* fs;
+    struct locals
+    {
+        char path[sizeof(addr->sun_path) + 1];
+        char suffix[PATH_MAX];
+        struct stat statbuf;
+    };
+    struct locals* locals = NULL;
+    const size_t max = addrlen - SUN_PATH_OFFSET;
+
+    if (!(locals = malloc(sizeof(struct locals))))
+        ERAISE(-ENOMEM);
+
+    memcpy(locals->path, addr->sun_path, max);
+    locals->path[max] = '\0';
+
+    if (locals->path[0] == '\0')
+        ERAISE(-ENOENT);
+
+    /* relative paths are resolved against the current directory */
+    ECHECK(myst_mount_resolve(locals->path, locals->suffix, &fs));
+
+    if (create)
+    {
+        myst_process_t* process = myst_process_self();
+        mode_t mode = 0777;
+        myst_fs_t* fs_out;
+        myst_file_t* file;
+        const int flags = O_CREAT | O_EXCL | O_WRONLY;
+        int r;
+
+        myst_spin_lock(&process->umask_lock);
+        mode &= ~process->umask;
+        myst_spin_unlock(&process->umask_lock);
+
+        /* create the socket node (fails if the name is taken) */
+        r = (*fs->fs_open)(
+            fs, locals->suffix, flags, S_IFSOCK | mode, &fs_out, &file);
+
+        if (r == -EEXIST)
+            ERAISE(-EADDRINUSE);
+
+        ECHECK(r);
+        r = (*fs_out->fs_fstat)(fs_out, file, &locals->statbuf);
+        (*fs_out->fs_close)(fs_out, file);
+        ECHECK(r);
+    }
+    else
+    {
+        ECHECK((*fs->fs_stat)(fs, locals->suffix, &locals->statbuf));
+    }
+
+    *fs_out = fs;
+    *ino_out = locals->statbuf.st_ino;
+
+done:
+
+    if (locals)
+        free(locals);
+
+    return ret;
+}
+
+/* find the socket bound to the address and take a reference to it */
+static int _lookup(
+    const struct sockaddr* addr,
+    socklen_t addrlen,
+    uds_t** uds_out)
+{
+    int ret = 0;
+    const struct sockaddr_un* sun = (const struct sockaddr_un*)addr;
+    myst_fs_t* fs = NULL;
+    ino_t ino = 0;
+    uds_t* uds;
+
+    ECHECK(_check_addr(addr, addrlen));
+
+    if (addrlen <= SUN_PATH_OFFSET)
+        ERAISE(-EINVAL);
+
+    if (!_is_abstract(sun, addrlen))
+        ECHECK(_resolve_path(sun, addrlen, false, &fs, &ino));
+
+    myst_spin_lock(&_names.lock);
+    {
+        for (uds = _names.head; uds; uds = uds->names_next)
+        {
+            if (fs)
+            {
+                if (uds->fs == fs && uds->fs_ino == ino)
+                    break;
+            }
+            else if (_has_abstract_name(uds, sun, addrlen))
+            {
+                break;
+            }
+        }
+
+        if (uds)
+            _ref(uds);
+    }
+    myst_spin_unlock(&_names.lock);
+
+    if (!uds)
+        ERAISE(-ECONNREFUSED);
+
+    *uds_out = uds;
+
+done:
+    return ret;
+}
+
+static int _bind(uds_t* uds, const struct sockaddr* addr, socklen_t addrlen)
+{
+    int ret = 0;
+    const struct sockaddr_un* sun = (const struct sockaddr_un*)addr;
+    struct sockaddr_un name;
+    myst_fs_t* fs = NULL;
+    ino_t ino = 0;
+    bool locked = false;
+
+    ECHECK(_check_addr(addr, addrlen));
+
+    if (uds->addrlen)
+        ERAISE(-EINVAL);
+
+    memset(&name, 0, sizeof(name));
+    name.sun_family = AF_UNIX;
+
+    if (addrlen == sizeof(sa_family_t))
+    {
+        uint32_t n;
+
+        /* autobind: choose a unique abstract name */
+        myst_spin_lock(&_names.lock);
+        n = ++_names.autobind;
+        myst_spin_unlock(&_names.lock);
+
+        snprintf(name.sun_path + 1, sizeof(name.sun_path) - 1, "%05x", n);
+        addrlen = SUN_PATH_OFFSET + 6;
+    }
+    else if (_is_abstract(sun, addrlen))
+    {
+        memcpy(name.sun_path, sun->sun_path, addrlen - SUN_PATH_OFFSET);
+    }
+    else
+    {
+        const size_t max = addrlen - SUN_PATH_OFFSET;
+        const size_t len = strnlen(sun->sun_path, max);
+
+        ECHECK(_resolve_path(sun, addrlen, true, &fs, &ino));
+        memcpy(name.sun_path, sun->sun_path, len);
+        addrlen = SUN_PATH_OFFSET + len + 1;
+    }
+
+    myst_spin_lock(&_names.lock);
+    locked = true;
+
+    if (!fs)
+    {
+        for (uds_t* p = _names.head; p; p = p->names_next)
+        {
+            if (_has_abstract_name(p, &name, addrlen))
+                ERAISE(-EADDRINUSE);
+        }
+    }
+
+    uds->addr = name;
+    uds->addrlen = addrlen;
+    uds->fs = fs;
+    uds->fs_ino = ino;
+    uds->registered = true;
+    uds->names_next = _names.head;
+    _names.head = uds;
+
+done:
+
+    if (locked)
+        myst_spin_unlock(&_names.lock);
+
+    return ret;
+}
+
+static void _get_name(
+    const struct sockaddr_un* name,
+    socklen_t namelen,
+    struct sockaddr* addr,
+    socklen_t* addrlen)
+{
+    struct sockaddr_un unnamed = {.sun_family = AF_UNIX};
+
+    if (!namelen)
+    {
+        name = &unnamed;
+        namelen = sizeof(sa_family_t);
+    }
+
+    if (addr && addrlen)
+        memcpy(addr, name, _min(*addrlen, namelen));
+
+    if (addrlen)
+        *addrlen = namelen;
+}
+
+/*
+**==============================================================================
+**
+** data transfer:
+**
+**==============================================================================
+*/
+
+/* copy n bytes to or from the I/O vector starting at byte offset off */
+static void _iov_copy(
+    const struct iovec* iov,
+    size_t iovlen,
+    size_t off,
+    uint8_t* data,
+    size_t n,
+    bool to_iov)
+{
+    for (size_t i = 0; i < iovlen && n; i++)
+    {
+        if (off >= iov[i].iov_len)
+        {
+            off -= iov[i].iov_len;
+            continue;
+        }
+
+        const size_t m = _min(n, iov[i].iov_len - off);
+        uint8_t* base = (uint8_t*)iov[i].iov_base + off;
+
+        if (to_iov)
+            memcpy(base, data, m);
+        else
+            memcpy(data, base, m);
+
+        data += m;
+        n -= m;
+        off = 0;
+    }
+}
+
+static ssize_t _iov_len(const struct msghdr* msg)
+{
+    ssize_t ret = 0;
+    size_t len = 0;
+
+    if (msg->msg_iovlen > IOV_MAX)
+        ERAISE(-EMSGSIZE);
+
+    if (msg->msg_iovlen && !msg->msg_iov)
+        ERAISE(-EFAULT);
+
+    for (size_t i = 0; i < msg->msg_iovlen; i++)
+    {
+        if (msg->msg_iov[i].iov_len > SSIZE_MAX - len)
+            ERAISE(-EINVAL);
+
+        len += msg->msg_iov[i].iov_len;
+    }
+
+    ret = (ssize_t)len;
+
+done:
+    return ret;
+}
+
+static ssize_t _send(
+    myst_uds_t* sock,
+    const struct msghdr* msg,
+    int flags,
+    const struct sockaddr* dest,
+    socklen_t destlen)
+{
+    ssize_t ret = 0;
+    uds_t* uds = sock->uds;
+    uds_t* target = NULL;
+    rights_t* rights = NULL;
+    bool locked = false;
+    size_t len;
+    size_t nsent = 0;
+    uint64_t deadline;
+    bool nonblock;
+
+    ECHECK(ret = _iov_len(msg));
+    len = (size_t)ret;
+    ret = 0;
+
+    ECHECK(_get_rights(msg, &rights));
+
+    /* find the receiving socket */
+    if (_is_connection_oriented(uds))
+    {
+        myst_mutex_lock(&uds->lock);
+
+        if (dest && uds->state != UDS_CONNECTED)
+            ret = -EOPNOTSUPP;
+        else if (dest)
+            ret = -EISCONN;
+        else if (uds->tx_shut)
+            ret = -EPIPE;
+        else if (!uds->peer)
+            ret = -ENOTCONN;
+        else
+            _ref(target = uds->peer);
+
+        myst_mutex_unlock(&uds->lock);
+        ECHECK(ret);
+    }
+    else if (dest)
+    {
+        ECHECK(_lookup(dest, destlen, &target));
+
+        if (target->type != SOCK_DGRAM)
+            ERAISE(-EPROTOTYPE);
+    }
+    else
+    {
+        myst_mutex_lock(&uds->lock);
+
+        if (uds->tx_shut)
+            ret = -EPIPE;
+        else if (!uds->peer)
+            ret = -ENOTCONN;
+        else
+            _ref(target = uds->peer);
+
+        myst_mutex_unlock(&uds->lock);
+        ECHECK(ret);
+    }
+
+    /* like Linux, a stream sends nothing (not even the rights) for an empty
+     * buffer; records may be empty */
+    if (uds->type == SOCK_STREAM && len == 0)
+        goto done;
+
+    if (!_is_connection_oriented(uds) || uds->type == SOCK_SEQPACKET)
+    {
+        /* a record must fit into the receive buffer as a whole */
+        if (len > uds->sndbuf || len > target->rcvbuf)
+            ERAISE(-EMSGSIZE);
+    }
+
+    deadline = _deadline(&uds->sndtimeo);
+    nonblock = (uds->status_flags & O_NONBLOCK) || (flags & MSG_DONTWAIT);
+
+    myst_mutex_lock(&target->lock);
+    locked = true;
+
+    for (;;)
+    {
+        const bool record = (uds->type != SOCK_STREAM);
+        const size_t rem = len - nsent;
+        const size_t space = _space(target);
+        msg_t* m;
+
+        if (target->rx_shut || target->state == UDS_CLOSED)
+        {
+            if (nsent)
+                break;
+
+            if (uds->type == SOCK_DGRAM)
+                ERAISE(-ECONNREFUSED);
+
+            ERAISE(-EPIPE);
+        }
+
+        if (record ? (space >= len || target->rx.nbytes == 0) : space > 0)
+        {
+            const size_t n = record ? len : _min(rem, space);
+            msg_t* tail = target->rx.tail;
+
+            /* append small writes to the last chunk of a stream */
+            if (!record && !rights && tail && !tail->rights &&
+                tail->capacity - tail->size >= n)
+            {
+                _iov_copy(
+                    msg->msg_iov,
+                    msg->msg_iovlen,
+                    nsent,
+                    tail->data + tail->size,
+                    n,
+                    false);
+                tail->size += n;
+                __atomic_add_fetch(&target->rx.nbytes, n, __ATOMIC_RELAXED);
+            }
+            else
+            {
+                const size_t capacity = record ? n : n + MIN_CHUNK_SIZE;
+
+                if (!(m = _new_msg(capacity)))
+                    ERAISE(-ENOMEM);
+
+                _iov_copy(
+                    msg->msg_iov, msg->msg_iovlen, nsent, m->data, n, false);
+                m->size = n;
+                m->rights = rights;
+                rights = NULL;
+
+                if (uds->type == SOCK_DGRAM)
+                {
+                    m->from = uds->addr;
+                    m->fromlen = uds->addrlen;
+                }
+
+                _enqueue(&target->rx, m);
+            }
+
+            nsent += n;
+            _signal(target);
+
+            if (nsent == len)
+                break;
+
+            continue;
+        }
+
+        if (nonblock)
+        {
+            if (nsent)
+                break;
+
+            ERAISE(-EAGAIN);
+        }
+
+        if ((ret = _wait(target, deadline)) < 0)
+        {
+            if (nsent)
+                break;
+
+            ERAISE(ret);
+        }
+    }
+
+    ret = (ssize_t)nsent;
+
+done:
+
+    if (locked)
+        myst_mutex_unlock(&target->lock);
+
+    if (target)
+    {
+        if (nsent)
+            myst_poll_wq_wake(&target->wq);
+
+        _unref(target);
+    }
+
+    if (rights)
+        _free_rights(rights);
+
+    if (ret == -EPIPE && !(flags & MSG_NOSIGNAL))
+        myst_syscall_kill(myst_getpid(), SIGPIPE);
+
+    return ret;
+}
+
+/* copy stream bytes into the I/O vector (the caller holds uds->lock) */
+static size_t _recv_stream(
+    uds_t* uds,
+    const struct iovec* iov,
+    size_t iovlen,
+    size_t nread,
+    size_t len,
+    bool peek,
+    rights_t** rights)
+{
+    msg_t* m = uds->rx.head;
+
+    /* stop at the next message that carries rights */
+    while (m && nread < len && !(m->rights && nread))
+    {
+        const size_t n = _min(len - nread, m->size - m->offset);
+        const bool has_rights = (m->rights != NULL);
+
+        _iov_copy(iov, iovlen, nread, m->data + m->offset, n, true);
+        nread += n;
+
+        if (peek)
+        {
+            if (has_rights)
+                break;
+
+            m = m->next;
+            continue;
+        }
+
+        if (has_rights)
+        {
+            *rights = m->rights;
+            m->rights = NULL;
+        }
+
+        m->offset += n;
+        __atomic_sub_fetch(&uds->rx.nbytes, n, __ATOMIC_RELAXED);
+
+        if (m->offset == m->size)
+            free(_dequeue(&uds->rx));
+
+        if (has_rights)
+            break;
+
+        m = uds->rx.head;
+    }
+
+    return nread;
+}
+
+static ssize_t _recv(
+    myst_uds_t* sock,
+    struct msghdr* msg,
+    int flags,
+    struct sockaddr* src,
+    socklen_t* srclen)
+{
+    ssize_t ret = 0;
+    uds_t* uds = sock->uds;
+    uds_t* peer = NULL;
+    rights_t* rights = NULL;
+    bool locked = false;
+    size_t len;
+    size_t nread = 0;
+    uint64_t deadline;
+    bool nonblock;
+    const bool peek = (flags & MSG_PEEK);
+    struct sockaddr_un from;
+    socklen_t fromlen = 0;
+
+    ECHECK(ret = _iov_len(msg));
+    len = (size_t)ret;
+    ret = 0;
+
+    msg->msg_flags = 0;
+    nonblock = (uds->status_flags & O_NONBLOCK) || (flags & MSG_DONTWAIT);
+
+    myst_mutex_lock(&uds->lock);
+    locked = true;
+
+    deadline = _deadline(&uds->rcvtimeo);
+
+    if (uds->state == UDS_LISTENING)
+        ERAISE(-EINVAL);
+
+    if (_is_connection_oriented(uds) && uds->state == UDS_UNCONNECTED)
+        ERAISE(-ENOTCONN);
+
+    for (;;)
+    {
+        msg_t* m = uds->rx.head;
+
+        if (m && uds->type != SOCK_STREAM)
+        {
+            /* receive one record (truncating it if necessary) */
+            const size_t n = _min(len, m->size);
+
+            _iov_copy(msg->msg_iov, msg->msg_iovlen, 0, m->data, n, true);
+            nread = (flags & MSG_TRUNC) ? m->size : n;
+
+            if (n < m->size)
+                msg->msg_flags |= MSG_TRUNC;
+
+            from = m->from;
+            fromlen = m->fromlen;
+
+            if (!peek)
+            {
+                _dequeue(&uds->rx);
+                rights = m->rights;
+                free(m);
+            }
+
+            break;
+        }
+
+        if (m)
+        {
+            nread = _recv_stream(uds, msg->msg_iov, msg->msg_iovlen, nread, len,
+                peek, &rights);
+
+            /* MSG_WAITALL keeps reading until the buffer is full */
+            if (!(flags & MSG_WAITALL) || nread == len || peek || rights)
+                break;
+        }
+
+        if (uds->rx_shut || uds->state == UDS_CLOSED)
+            break;
+
+        if (nonblock)
+        {
+            if (nread)
+                break;
+
+            ERAISE(-EAGAIN);
+        }
+
+        if ((ret = _wait(uds, deadline)) < 0)
+        {
+            if (nread)
+                break;
+
+            ERAISE(ret);
+        }
+    }
+
+    /* writers may be waiting for space in this socket */
+    if (!peek && nread)
+    {
+        _signal(uds);
+
+        if ((peer = uds->peer))
+            _ref(peer);
+    }
+
+    ret = (ssize_t)nread;
+
+done:
+
+    if (locked)
+        myst_mutex_unlock(&uds->lock);
+
+    if (peer)
+    {
+        myst_poll_wq_wake(&peer->wq);
+        _unref(peer);
+    }
+
+    if (ret >= 0)
+    {
+        if (rights)
+            _put_rights(rights, msg, flags);
+        else if (msg->msg_control)
+            msg->msg_controllen = 0;
+
+        if (uds->type == SOCK_DGRAM)
+            _get_name(&from, fromlen, src, srclen);
+        else if (srclen)
+            *srclen = 0;
+    }
+    else if (rights)
+    {
+        _free_rights(rights);
+    }
+
+    return ret;
+}
+
+/*
+**==============================================================================
+**
+** myst_sockdev_t operations:
+**
+**==============================================================================
+*/
+
+static int _ud_socket(
+    myst_sockdev_t* sd,
+    int domain,
+    int type,
+    int protocol,
+    myst_sock_t** sock_out)
+{
+    int ret = 0;
+    const int flags = type & (SOCK_NONBLOCK | SOCK_CLOEXEC);
+    uds_t* uds = NULL;
+    myst_uds_t* sock = NULL;
+
+    if (sock_out)
+        *sock_out = NULL;
+
+    if (!sd || !sock_out)
+        ERAISE(-EINVAL);
+
+    if (domain != AF_UNIX)
+        ERAISE(-EAFNOSUPPORT);
+
+    if (protocol != 0 && protocol != PF_UNIX)
+        ERAISE(-EPROTONOSUPPORT);
+
+    type &= ~flags;
+
+    if (type != SOCK_STREAM && type != SOCK_DGRAM && type != SOCK_SEQPACKET)
+        ERAISE(-ESOCKTNOSUPPORT);
+
+    ECHECK(_new_uds(type, &uds));
+    ECHECK(_new_desc(uds, flags, &sock));
+    uds = NULL;
+
+    *sock_out = (myst_sock_t*)sock;
+
+done:
+
+    if (uds)
+        _unref(uds);
+
+    return ret;
+}
+
+static int _ud_socketpair(
+    myst_sockdev_t* sd,
+    int domain,
+    int type,
+    int protocol,
+    myst_sock_t* pair[2])
+{
+    int ret = 0;
+    myst_sock_t* sock0 = NULL;
+    myst_sock_t* sock1 = NULL;
+    uds_t* uds0;
+    uds_t* uds1;
+
+    if (!sd || !pair)
+        ERAISE(-EINVAL);
+
+    ECHECK(_ud_socket(sd, domain, type, protocol, &sock0));
+    ECHECK(_ud_socket(sd, domain, type, protocol, &sock1));
+
+    uds0 = ((myst_uds_t*)sock0)->uds;
+    uds1 = ((myst_uds_t*)sock1)->uds;
+
+    /* each end references the other */
+    _ref(uds0->peer = uds1);
+    _ref(uds1->peer = uds0);
+    uds0->state = UDS_CONNECTED;
+    uds1->state = UDS_CONNECTED;
+    uds0->peer_cred = uds1->cred;
+    uds1->peer_cred = uds0->cred;
+
+    pair[0] = sock0;
+    pair[1] = sock1;
+    sock0 = NULL;
+    sock1 = NULL;
+
+done:
+
+    if (sock0)
+        (*sd->sd_close)(sd, sock0);
+
+    if (sock1)
+        (*sd->sd_close)(sd, sock1);
+
+    return ret;
+}
+
+/* connect a datagram socket (or dissolve the association) */
+static int _connect_dgram(
+    uds_t* uds,
+    const struct sockaddr* addr,
+    socklen_t addrlen)
+{
+    int ret = 0;
+    uds_t* target = NULL;
+    uds_t* old;
+
+    if (addrlen >= sizeof(sa_family_t) && addr->sa_family == AF_UNSPEC)
+    {
+        target = NULL;
+    }
+    else
+    {
+        ECHECK(_lookup(addr, addrlen, &target));
+
+        if (target->type != SOCK_DGRAM)
+            ERAISE(-EPROTOTYPE);
+    }
+
+    myst_mutex_lock(&uds->lock);
+    {
+        old = uds->peer;
+        uds->peer = target;
+        uds->state = target ? UDS_CONNECTED : UDS_UNCONNECTED;
+
+        if (target)
+            uds->peer_cred = target->cred;
+    }
+    myst_mutex_unlock(&uds->lock);
+
+    /* the reference now belongs to uds->peer */
+    target = old;
+
+done:
+
+    if (target)
+        _unref(target);
+
+    return ret;
+}
+
+static int _ud_connect(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    const struct sockaddr* addr,
+    socklen_t addrlen)
+{
+    int ret = 0;
+    uds_t* uds;
+    uds_t* listener = NULL;
+    uds_t* conn = NULL;
+    bool locked = false;
+    uint64_t deadline;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!addr)
+        ERAISE(-EFAULT);
+
+    uds = sock->uds;
+
+    if (uds->type == SOCK_DGRAM)
+    {
+        ECHECK(_connect_dgram(uds, addr, addrlen));
+        goto done;
+    }
+
+    ECHECK(_lookup(addr, addrlen, &listener));
+
+    if (listener->type != uds->type)
+        ERAISE(-EPROTOTYPE);
+
+    /* the server end of the connection (returned by accept) */
+    ECHECK(_new_uds(uds->type, &conn));
+
+    deadline = _deadline(&uds->sndtimeo);
+
+    myst_mutex_lock(&listener->lock);
+    locked = true;
+
+    /* wait for room in the backlog */
+    for (;;)
+    {
+        if (listener->state != UDS_LISTENING)
+            ERAISE(-ECONNREFUSED);
+
+        if (listener->nconns <= (size_t)listener->backlog)
+            break;
+
+        if (uds->status_flags & O_NONBLOCK)
+            ERAISE(-EAGAIN);
+
+        ECHECK(_wait(listener, deadline));
+    }
+
+    /* the connecting socket is never a listener (no lock inversion) */
+    myst_mutex_lock(&uds->lock);
+    {
+        if (uds->state == UDS_CONNECTED)
+            ret = -EISCONN;
+        else if (uds->state != UDS_UNCONNECTED)
+            ret = -EINVAL;
+        else
+        {
+            _ref(uds->peer = conn);
+            _ref(conn->peer = uds);
+            uds->state = UDS_CONNECTED;
+            conn->state = UDS_CONNECTED;
+            uds->peer_cred = listener->cred;
+            conn->peer_cred = uds->cred;
+            conn->cred = listener->cred;
+            conn->addr = listener->addr;
+            conn->addrlen = listener->addrlen;
+        }
+    }
+    myst_mutex_unlock(&uds->lock);
+    ECHECK(ret);
+
+    /* the accept queue takes over the reference of conn */
+    if (listener->conns_tail)
+        listener->conns_tail->conns_next = conn;
+    else
+        listener->conns_head = conn;
+
+    listener->conns_tail = conn;
+    listener->nconns++;
+    conn = NULL;
+
+    _signal(listener);
+    myst_mutex_unlock(&listener->lock);
+    locked = false;
+    myst_poll_wq_wake(&listener->wq);
+    myst_poll_wq_wake(&uds->wq);
+
+done:
+
+    if (locked)
+        myst_mutex_unlock(&listener->lock);
+
+    if (conn)
+        _unref(conn);
+
+    if (listener)
+        _unref(listener);
+
+    return ret;
+}
+
+static int _ud_accept4(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    struct sockaddr* addr,
+    socklen_t* addrlen,
+    int flags,
+    myst_sock_t** new_sock_out)
+{
+    int ret = 0;
+    uds_t* uds;
+    uds_t* conn = NULL;
+    myst_uds_t* new_sock = NULL;
+    bool locked = false;
+    uint64_t deadline;
+
+    if (new_sock_out)
+        *new_sock_out = NULL;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!new_sock_out || (flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)))
+        ERAISE(-EINVAL);
+
+    uds = sock->uds;
+
+    if (uds->type == SOCK_DGRAM)
+        ERAISE(-EOPNOTSUPP);
+
+    myst_mutex_lock(&uds->lock);
+    locked = true;
+
+    deadline = _deadline(&uds->rcvtimeo);
+
+    for (;;)
+    {
+        if (uds->state != UDS_LISTENING)
+            ERAISE(-EINVAL);
+
+        if ((conn = uds->conns_head))
+            break;
+
+        if (uds->status_flags & O_NONBLOCK)
+            ERAISE(-EAGAIN);
+
+        ECHECK(_wait(uds, deadline));
+    }
+
+    if (!(uds->conns_head = conn->conns_next))
+        uds->conns_tail = NULL;
+
+    conn->conns_next = NULL;
+    uds->nconns--;
+
+    /* wake connectors waiting for room in the backlog */
+    _signal(uds);
+    myst_mutex_unlock(&uds->lock);
+    locked = false;
+
+    ECHECK(_new_desc(conn, flags, &new_sock));
+    conn = NULL;
+
+    /* return the name of the connecting socket */
+    if (addr || addrlen)
+    {
+        uds_t* s = new_sock->uds;
+        uds_t* peer;
+        struct sockaddr_un name;
+        socklen_t namelen = 0;
+
+        myst_mutex_lock(&s->lock);
+
+        if ((peer = s->peer))
+        {
+            name = peer->addr;
+            namelen = peer->addrlen;
+        }
+
+        myst_mutex_unlock(&s->lock);
+        _get_name(&name, namelen, addr, addrlen);
+    }
+
+    *new_sock_out = (myst_sock_t*)new_sock;
+
+done:
+
+    if (locked)
+        myst_mutex_unlock(&uds->lock);
+
+    if (conn)
+    {
+        _shutdown_uds(conn);
+        _unref(conn);
+    }
+
+    return ret;
+}
+
+static int _ud_bind(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    const struct sockaddr* addr,
+    socklen_t addrlen)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    ECHECK(_bind(sock->uds, addr, addrlen));
+
+done:
+    return ret;
+}
+
+static int _ud_listen(myst_sockdev_t* sd, myst_uds_t* sock, int backlog)
+{
+    int ret = 0;
+    uds_t* uds;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    uds = sock->uds;
+
+    if (uds->type == SOCK_DGRAM)
+        ERAISE(-EOPNOTSUPP);
+
+    if (backlog < 0 || backlog > SOMAXCONN)
+        backlog = SOMAXCONN;
+
+    myst_mutex_lock(&uds->lock);
+    {
+        if (uds->state != UDS_UNCONNECTED && uds->state != UDS_LISTENING)
+            ret = -EINVAL;
+        else if (!uds->addrlen)
+            ret = -EINVAL;
+        else
+        {
+            uds->state = UDS_LISTENING;
+            uds->backlog = backlog;
+
+            /* a larger backlog may admit waiting connectors */
+            _signal(uds);
+        }
+    }
+    myst_mutex_unlock(&uds->lock);
+    ECHECK(ret);
+
+done:
+    return ret;
+}
+
+static ssize_t _ud_sendto(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    const void* buf,
+    size_t len,
+    int flags,
+    const struct sockaddr* dest_addr,
+    socklen_t addrlen)
+{
+    ssize_t ret = 0;
+    struct iovec iov = {(void*)buf, len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!buf && len)
+        ERAISE(-EFAULT);
+
+    ret = _send(sock, &msg, flags, dest_addr, addrlen);
+
+done:
+    return ret;
+}
+
+static ssize_t _ud_recvfrom(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    void* buf,
+    size_t len,
+    int flags,
+    struct sockaddr* src_addr,
+    socklen_t* addrlen)
+{
+    ssize_t ret = 0;
+    struct iovec iov = {buf, len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!buf && len)
+        ERAISE(-EFAULT);
+
+    ret = _recv(sock, &msg, flags, src_addr, addrlen);
+
+done:
+    return ret;
+}
+
+static int _ud_sendmsg(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    const struct msghdr* msg,
+    int flags)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!msg)
+        ERAISE(-EFAULT);
+
+    ret = (int)_send(sock, msg, flags, msg->msg_name, msg->msg_namelen);
+
+done:
+    return ret;
+}
+
+static int _ud_recvmsg(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    struct msghdr* msg,
+    int flags)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!msg)
+        ERAISE(-EFAULT);
+
+    ret = (int)_recv(sock, msg, flags, msg->msg_name, &msg->msg_namelen);
+
+done:
+    return ret;
+}
+
+static int _ud_shutdown(myst_sockdev_t* sd, myst_uds_t* sock, int how)
+{
+    int ret = 0;
+    uds_t* uds;
+    uds_t* peer = NULL;
+    const bool rd = (how == SHUT_RD || how == SHUT_RDWR);
+    const bool wr = (how == SHUT_WR || how == SHUT_RDWR);
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!rd && !wr)
+        ERAISE(-EINVAL);
+
+    uds = sock->uds;
+
+    myst_mutex_lock(&uds->lock);
+    {
+        if (_is_connection_oriented(uds) && uds->state != UDS_CONNECTED)
+            ret = -ENOTCONN;
+        else
+        {
+            uds->rx_shut |= rd;
+            uds->tx_shut |= wr;
+            _signal(uds);
+
+            if (_is_connection_oriented(uds) && (peer = uds->peer))
+                _ref(peer);
+        }
+    }
+    myst_mutex_unlock(&uds->lock);
+    ECHECK(ret);
+    myst_poll_wq_wake(&uds->wq);
+
+    /* the peer sees end-of-file (SHUT_WR) or EPIPE (SHUT_RD) */
+    if (peer)
+    {
+        myst_mutex_lock(&peer->lock);
+        peer->rx_shut |= wr;
+        peer->tx_shut |= rd;
+        _signal(peer);
+        myst_mutex_unlock(&peer->lock);
+        myst_poll_wq_wake(&peer->wq);
+        _unref(peer);
+    }
+
+done:
+    return ret;
+}
+
+static int _get_int(int value, void* optval, socklen_t* optlen)
+{
+    int ret = 0;
+
+    if (!optval || !optlen)
+        ERAISE(-EFAULT);
+
+    if (*optlen > sizeof(int))
+        *optlen = sizeof(int);
+
+    memcpy(optval, &value, *optlen);
+
+done:
+    return ret;
+}
+
+static int _ud_getsockopt(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    int level,
+    int optname,
+    void* optval,
+    socklen_t* optlen)
+{
+    int ret = 0;
+    uds_t* uds;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!optval || !optlen)
+        ERAISE(-EFAULT);
+
+    if (level != SOL_SOCKET)
+        ERAISE(-ENOPROTOOPT);
+
+    uds = sock->uds;
+
+    switch (optname)
+    {
+        case SO_TYPE:
+            ECHECK(_get_int(uds->type, optval, optlen));
+            break;
+        case SO_DOMAIN:
+            ECHECK(_get_int(AF_UNIX, optval, optlen));
+            break;
+        case SO_PROTOCOL:
+        case SO_ERROR:
+            ECHECK(_get_int(0, optval, optlen));
+            break;
+        case SO_ACCEPTCONN:
+        {
+            const bool listening = (uds->state == UDS_LISTENING);
+            ECHECK(_get_int(listening, optval, optlen));
+            break;
+        }
+        case SO_SNDBUF:
+            ECHECK(_get_int((int)uds->sndbuf, optval, optlen));
+            break;
+        case SO_RCVBUF:
+            ECHECK(_get_int((int)uds->rcvbuf, optval, optlen));
+            break;
+        case SO_PASSCRED:
+            ECHECK(_get_int(uds->passcred, optval, optlen));
+            break;
+        case SO_PEERCRED:
+        {
+            struct ucred cred = {0, (uid_t)-1, (gid_t)-1};
+
+            myst_mutex_lock(&uds->lock);
+
+            if (uds->peer)
+                cred = uds->peer_cred;
+
+            myst_mutex_unlock(&uds->lock);
+
+            *optlen = _min(*optlen, sizeof(cred));
+            memcpy(optval, &cred, *optlen);
+            break;
+        }
+        case SO_RCVTIMEO:
+        case SO_SNDTIMEO:
+        {
+            const struct timeval* tv =
+                (optname == SO_RCVTIMEO) ? &uds->rcvtimeo : &uds->sndtimeo;
+
+            *optlen = _min(*optlen, sizeof(struct timeval));
+            memcpy(optval, tv, *optlen);
+            break;
+        }
+        default:
+            ERAISE(-ENOPROTOOPT);
+    }
+
+done:
+    return ret;
+}
+
+static int _ud_setsockopt(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    int level,
+    int optname,
+    const void* optval,
+    socklen_t optlen)
+{
+    int ret = 0;
+    uds_t* uds;
+    int value = 0;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!optval)
+        ERAISE(-EFAULT);
+
+    if (level != SOL_SOCKET)
+        ERAISE(-ENOPROTOOPT);
+
+    uds = sock->uds;
+
+    if (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO)
+    {
+        struct timeval tv;
+
+        if (optlen < sizeof(struct timeval))
+            ERAISE(-EINVAL);
+
+        memcpy(&tv, optval, sizeof(tv));
+
+        if (tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1000000)
+            ERAISE(-EDOM);
+
+        if (optname == SO_RCVTIMEO)
+            uds->rcvtimeo = tv;
+        else
+            uds->sndtimeo = tv;
+
+        goto done;
+    }
+
+    if (optlen < sizeof(int))
+        ERAISE(-EINVAL);
+
+    memcpy(&value, optval, sizeof(int));
+
+    switch (optname)
+    {
+        case SO_SNDBUF:
+        case SO_RCVBUF:
+        {
+            /* Linux doubles the value (to allow for bookkeeping overhead) */
+            size_t size = (value < 0) ? 0 : (size_t)value * 2;
+
+            if (size < MIN_BUF_SIZE)
+                size = MIN_BUF_SIZE;
+
+            if (size > MAX_BUF_SIZE)
+                size = MAX_BUF_SIZE;
+
+            myst_mutex_lock(&uds->lock);
+
+            if (optname == SO_SNDBUF)
+                uds->sndbuf = size;
+            else
+                uds->rcvbuf = size;
+
+            /* a larger buffer may admit waiting writers */
+            _signal(uds);
+            myst_mutex_unlock(&uds->lock);
+            break;
+        }
+        case SO_PASSCRED:
+            uds->passcred = (value != 0);
+            break;
+        default:
+            /* accept (and ignore) the other socket-level options */
+            break;
+    }
+
+done:
+    return ret;
+}
+
+static int _ud_getpeername(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    struct sockaddr* addr,
+    socklen_t* addrlen)
+{
+    int ret = 0;
+    uds_t* uds;
+    struct sockaddr_un name;
+    socklen_t namelen = 0;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!addr || !addrlen)
+        ERAISE(-EFAULT);
+
+    uds = sock->uds;
+
+    myst_mutex_lock(&uds->lock);
+    {
+        if (!uds->peer)
+            ret = -ENOTCONN;
+        else
+        {
+            name = uds->peer->addr;
+            namelen = uds->peer->addrlen;
+        }
+    }
+    myst_mutex_unlock(&uds->lock);
+    ECHECK(ret);
+
+    _get_name(&name, namelen, addr, addrlen);
+
+done:
+    return ret;
+}
+
+static int _ud_getsockname(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    struct sockaddr* addr,
+    socklen_t* addrlen)
+{
+    int ret = 0;
+    uds_t* uds;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (!addr || !addrlen)
+        ERAISE(-EFAULT);
+
+    uds = sock->uds;
+    _get_name(&uds->addr, uds->addrlen, addr, addrlen);
+
+done:
+    return ret;
+}
+
+static ssize_t _ud_read(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    void* buf,
+    size_t count)
+{
+    return _ud_recvfrom(sd, sock, buf, count, 0, NULL, NULL);
+}
+
+static ssize_t _ud_write(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    const void* buf,
+    size_t count)
+{
+    return _ud_sendto(sd, sock, buf, count, 0, NULL, 0);
+}
+
+static ssize_t _ud_readv(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    ssize_t ret = 0;
+    struct msghdr msg = {.msg_iov = (struct iovec*)iov};
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (iovcnt < 0)
+        ERAISE(-EINVAL);
+
+    msg.msg_iovlen = (size_t)iovcnt;
+    ret = _recv(sock, &msg, 0, NULL, NULL);
+
+done:
+    return ret;
+}
+
+static ssize_t _ud_writev(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    const struct iovec* iov,
+    int iovcnt)
+{
+    ssize_t ret = 0;
+    struct msghdr msg = {.msg_iov = (struct iovec*)iov};
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    if (iovcnt < 0)
+        ERAISE(-EINVAL);
+
+    msg.msg_iovlen = (size_t)iovcnt;
+    ret = _send(sock, &msg, 0, NULL, 0);
+
+done:
+    return ret;
+}
+
+static int _ud_fstat(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    struct stat* statbuf)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_uds(sock) || !statbuf)
+        ERAISE(-EINVAL);
+
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_ino = sock->uds->ino;
+    statbuf->st_mode = S_IFSOCK | sock->uds->mode;
+    statbuf->st_nlink = 1;
+    statbuf->st_uid = myst_syscall_geteuid();
+    statbuf->st_gid = myst_syscall_getegid();
+    statbuf->st_blksize = 4096;
+
+done:
+    return ret;
+}
+
+static int _ud_fchmod(myst_sockdev_t* sd, myst_uds_t* sock, mode_t mode)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    sock->uds->mode = mode & 07777;
+
+done:
+    return ret;
+}
+
+static int _ud_ioctl(
+    myst_sockdev_t* sd,
+    myst_uds_t* sock,
+    unsigned long request,
+    long arg)
+{
+    int ret = 0;
+    uds_t* uds;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    uds = sock->uds;
+
+    switch (request)
+    {
+        case FIONREAD:
+        {
+            int* val = (int*)arg;
+            size_t n = 0;
+
+            if (!val)
+                ERAISE(-EFAULT);
+
+            myst_mutex_lock(&uds->lock);
+            {
+                if (uds->state == UDS_LISTENING)
+                    ret = -EINVAL;
+                else if (uds->type == SOCK_STREAM)
+                    n = uds->rx.nbytes;
+                else if (uds->rx.head)
+                    n = uds->rx.head->size;
+            }
+            myst_mutex_unlock(&uds->lock);
+            ECHECK(ret);
+
+            *val = (n > INT_MAX) ? INT_MAX : (int)n;
+            break;
+        }
+        case FIONBIO:
+        {
+            const int* val = (const int*)arg;
+
+            if (!val)
+                ERAISE(-EFAULT);
+
+            if (*val)
+                uds->status_flags |= O_NONBLOCK;
+            else
+                uds->status_flags &= ~O_NONBLOCK;
+
+            break;
+        }
+        default:
+        {
+            ERAISE(-ENOTTY);
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _ud_fcntl(myst_sockdev_t* sd, myst_uds_t* sock, int cmd, long arg)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    switch (cmd)
+    {
+        case F_GETFD:
+        {
+            ret = sock->fd_flags;
+            break;
+        }
+        case F_SETFD:
+        {
+            sock->fd_flags = (int)(arg & FD_CLOEXEC);
+            break;
+        }
+        case F_GETFL:
+        {
+            ret = O_RDWR | sock->uds->status_flags;
+            break;
+        }
+        case F_SETFL:
+        {
+            sock->uds->status_flags = (int)(arg & O_NONBLOCK);
+            break;
+        }
+        default:
+        {
+            ERAISE(-EINVAL);
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _ud_dup(
+    myst_sockdev_t* sd,
+    const myst_uds_t* sock,
+    myst_uds_t** sock_out)
+{
+    int ret = 0;
+    myst_uds_t* new_sock = NULL;
+    uds_t* uds;
+
+    if (sock_out)
+        *sock_out = NULL;
+
+    if (!sd || !_valid_uds(sock) || !sock_out)
+        ERAISE(-EINVAL);
+
+    if (!(new_sock = calloc(1, sizeof(myst_uds_t))))
+        ERAISE(-ENOMEM);
+
+    uds = sock->uds;
+
+    myst_mutex_lock(&uds->lock);
+    uds->nfds++;
+    myst_mutex_unlock(&uds->lock);
+
+    /* file descriptor flags are not shared by duplicates */
+    new_sock->magic = MAGIC;
+    new_sock->fd_flags = 0;
+    new_sock->uds = uds;
+
+    *sock_out = new_sock;
+
+done:
+    return ret;
+}
+
+static int _ud_close(myst_sockdev_t* sd, myst_uds_t* sock)
+{
+    int ret = 0;
+    uds_t* uds;
+    bool last;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    uds = sock->uds;
+
+    myst_mutex_lock(&uds->lock);
+    last = (--uds->nfds == 0);
+    myst_mutex_unlock(&uds->lock);
+
+    if (last)
+    {
+        _shutdown_uds(uds);
+        _unref(uds);
+    }
+
+    memset(sock, 0, sizeof(myst_uds_t));
+    free(sock);
+
+done:
+    return ret;
+}
+
+static int _ud_interrupt(myst_sockdev_t* sd, myst_uds_t* sock)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EBADF);
+
+    /* called with the fdtable spinlock held (so do not take uds->lock) */
+    myst_cond_broadcast(&sock->uds->cond, SIZE_MAX);
+
+done:
+    return ret;
+}
+
+static int _ud_target_fd(myst_sockdev_t* sd, myst_uds_t* sock)
+{
+    int ret = 0;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EINVAL);
+
+    /* there is no host descriptor (see _ud_get_events()) */
+    ret = -ENOTSUP;
+
+done:
+    return ret;
+}
+
+static int _ud_get_events(myst_sockdev_t* sd, myst_uds_t* sock)
+{
+    int ret = 0;
+    uds_t* uds;
+
+    if (!sd || !_valid_uds(sock))
+        ERAISE(-EINVAL);
+
+    uds = sock->uds;
+
+    myst_mutex_lock(&uds->lock);
+
+    if (uds->state == UDS_LISTENING)
+    {
+        if (uds->conns_head)
+            ret |= POLLIN | POLLRDNORM;
+    }
+    else
+    {
+        const bool unconnected = (uds->state != UDS_CONNECTED);
+
+        if (uds->rx.head)
+            ret |= POLLIN | POLLRDNORM;
+
+        if (uds->rx_shut)
+            ret |= POLLIN | POLLRDNORM | POLLRDHUP;
+
+        if (uds->rx_shut && uds->tx_shut)
+            ret |= POLLHUP;
+
+        if (_is_connection_oriented(uds))
+        {
+            if (unconnected)
+                ret |= POLLHUP;
+
+            if (uds->tx_shut || unconnected)
+                ret |= POLLOUT | POLLWRNORM;
+            else if (uds->peer && _space(uds->peer) > 0)
+                ret |= POLLOUT | POLLWRNORM;
+        }
+        else
+        {
+            /* a datagram socket is writable unless its peer is full */
+            if (!uds->peer || _space(uds->peer) > 0)
+                ret |= POLLOUT | POLLWRNORM;
+        }
+    }
+
+    myst_mutex_unlock(&uds->lock);
+
+done:
+    return ret;
+}
+
+static myst_poll_wq_t* _ud_get_wq(myst_sockdev_t* sd, myst_uds_t* sock)
+{
+    if (!sd || !_valid_uds(sock))
+        return NULL;
+
+    return &sock->uds->wq;
+}
+
+extern myst_sockdev_t* myst_udsdev_get(void)
+{
+    // clang-format-off
+    static myst_sockdev_t _udsdev = {
+        {
+            .fd_read = (void*)_ud_read,
+            .fd_write = (void*)_ud_write,
+            .fd_readv = (void*)_ud_readv,
+            .fd_writev = (void*)_ud_writev,
+            .fd_fstat = (void*)_ud_fstat,
+            .fd_fcntl = (void*)_ud_fcntl,
+            .fd_ioctl = (void*)_ud_ioctl,
+            .fd_dup = (void*)_ud_dup,
+            .fd_close = (void*)_ud_close,
+            .fd_interrupt = (void*)_ud_interrupt,
+            .fd_target_fd = (void*)_ud_target_fd,
+            .fd_get_events = (void*)_ud_get_events,
+            .fd_get_wq = (void*)_ud_get_wq,
+        },
+        .sd_socket = (void*)_ud_socket,
+        .sd_socketpair = (void*)_ud_socketpair,
+        .sd_connect = (void*)_ud_connect,
+        .sd_accept4 = (void*)_ud_accept4,
+        .sd_bind = (void*)_ud_bind,
+        .sd_listen = (void*)_ud_listen,
+        .sd_sendto = (void*)_ud_sendto,
+        .sd_recvfrom = (void*)_ud_recvfrom,
+        .sd_sendmsg = (void*)_ud_sendmsg,
+        .sd_recvmsg = (void*)_ud_recvmsg,
+        .sd_shutdown = (void*)_ud_shutdown,
+        .sd_getsockopt = (void*)_ud_getsockopt,
+        .sd_setsockopt = (void*)_ud_setsockopt,
+        .sd_getpeername = (void*)_ud_getpeername,
+        .sd_getsockname = (void*)_ud_getsockname,
+        .sd_read = (void*)_ud_read,
+        .sd_write = (void*)_ud_write,
+        .sd_readv = (void*)_ud_readv,
+        .sd_writev = (void*)_ud_writev,
+        .sd_fstat = (void*)_ud_fstat,
+        .sd_fcntl = (void*)_ud_fcntl,
+        .sd_ioctl = (void*)_ud_ioctl,
+        .sd_dup = (void*)_ud_dup,
+        .sd_close = (void*)_ud_close,
+        .sd_target_fd = (void*)_ud_target_fd,
+        .sd_get_events = (void*)_ud_get_events,
+        .sd_fchmod = (void*)_ud_fchmod,
+    };
+    // clang-format-on
+
+    return &_udsdev;
+}
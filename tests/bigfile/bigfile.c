@@ -8,6 +8,7 @@
 #include <stdlib.h>
 
 #include <myst/blkdev.h>
+#include <myst/dcache.h>
 #include <myst/ext2.h>
 #include <myst/fs.h>
 #include <myst/fssig.h>
@@ -36,6 +37,70 @@ myst_thread_t* myst_thread_self()
     return NULL;
 }
 
+/* this program is single-threaded: the ext2 locks are no-ops */
+
+int myst_mutex_init(void* m)
+{
+    return 0;
+}
+
+int myst_mutex_lock(void* m)
+{
+    return 0;
+}
+
+int myst_mutex_unlock(void* m)
+{
+    return 0;
+}
+
+int myst_rwlock_init(void* rw)
+{
+    return 0;
+}
+
+int myst_rwlock_rdlock(void* rw)
+{
+    return 0;
+}
+
+int myst_rwlock_wrlock(void* rw)
+{
+    return 0;
+}
+
+int myst_rwlock_unlock(void* rw)
+{
+    return 0;
+}
+
+/* the dentry cache is a kernel service: every lookup misses */
+
+bool myst_dcache_lookup(
+    const void* fs,
+    uint64_t parent,
+    const char* name,
+    uint64_t* value)
+{
+    return false;
+}
+
+void myst_dcache_insert(
+    const void* fs,
+    uint64_t parent,
+    const char* name,
+    uint64_t value)
+{
+}
+
+void myst_dcache_invalidate(const void* fs, uint64_t parent, const char* name)
+{
+}
+
+void myst_dcache_invalidate_fs(const void* fs)
+{
+}
+
 int main(int argc, const char* argv[])
 {
     uint8_t buf[4096];
@@ -0,0 +1,302 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/blkdev.h>
+
+#define NBLOCKS 1024
+
+/* an in-memory device that counts the calls made to it */
+typedef struct memdev
+{
+    myst_blkdev_t base;
+    uint8_t blocks[NBLOCKS][MYST_BLKSIZE];
+    size_t gets;
+    size_t puts;
+    size_t flushes;
+    size_t transfers; /* multi-block transfers */
+    bool closed;
+} memdev_t;
+
+static memdev_t _memdev;
+
+static int _close(myst_blkdev_t* dev)
+{
+    ((memdev_t*)dev)->closed = true;
+    return 0;
+}
+
+static int _get(myst_blkdev_t* dev, uint64_t blkno, void* data)
+{
+    memdev_t* p = (memdev_t*)dev;
+
+    if (blkno >= NBLOCKS)
+        return -EIO;
+
+    memcpy(data, p->blocks[blkno], MYST_BLKSIZE);
+    p->gets++;
+    return 0;
+}
+
+static int _put(myst_blkdev_t* dev, uint64_t blkno, const void* data)
+{
+    memdev_t* p = (memdev_t*)dev;
+
+    if (blkno >= NBLOCKS)
+        return -EIO;
+
+    memcpy(p->blocks[blkno], data, MYST_BLKSIZE);
+    p->puts++;
+    return 0;
+}
+
+static int _flush(myst_blkdev_t* dev)
+{
+    ((memdev_t*)dev)->flushes++;
+    return 0;
+}
+
+static int _get_blocks(
+    myst_blkdev_t* dev,
+    uint64_t blkno,
+    void* data,
+    size_t count)
+{
+    memdev_t* p = (memdev_t*)dev;
+
+    if (blkno + count > NBLOCKS)
+        return -EIO;
+
+    memcpy(data, p->blocks[blkno], count * MYST_BLKSIZE);
+    p->transfers++;
+    return 0;
+}
+
+static int _put_blocks(
+    myst_blkdev_t* dev,
+    uint64_t blkno,
+    const void* data,
+    size_t count)
+{
+    memdev_t* p = (memdev_t*)dev;
+
+    if (blkno + count > NBLOCKS)
+        return -EIO;
+
+    memcpy(p->blocks[blkno], data, count * MYST_BLKSIZE);
+    p->transfers++;
+    return 0;
+}
+
+static myst_blkdev_t* _open(size_t max_blocks)
+{
+    myst_blkdev_t* dev;
+
+    memset(&_memdev, 0, sizeof(_memdev));
+    _memdev.base.close = _close;
+    _memdev.base.get = _get;
+    _memdev.base.put = _put;
+    _memdev.base.flush = _flush;
+    _memdev.base.get_blocks = _get_blocks;
+    _memdev.base.put_blocks = _put_blocks;
+
+    for (size_t i = 0; i < NBLOCKS; i++)
+        memset(_memdev.blocks[i], (int)(i % 251), MYST_BLKSIZE);
+
+    assert(myst_cacheblkdev_open(&_memdev.base, max_blocks, &dev) == 0);
+    return dev;
+}
+
+static void _check(myst_blkdev_t* dev, uint64_t blkno, int c)
+{
+    uint8_t data[MYST_BLKSIZE];
+    uint8_t expect[MYST_BLKSIZE];
+
+    memset(expect, c, sizeof(expect));
+    assert(dev->get(dev, blkno, data) == 0);
+    assert(memcmp(data, expect, sizeof(data)) == 0);
+}
+
+static void _write(myst_blkdev_t* dev, uint64_t blkno, int c)
+{
+    uint8_t data[MYST_BLKSIZE];
+
+    memset(data, c, sizeof(data));
+    assert(dev->put(dev, blkno, data) == 0);
+}
+
+static void test_hits(void)
+{
+    myst_blkdev_t* dev = _open(64);
+    myst_cacheblkdev_stats_t stats;
+
+    /* scattered reads are not read ahead */
+    _check(dev, 10, 10);
+    _check(dev, 20, 20);
+    _check(dev, 10, 10);
+    _check(dev, 20, 20);
+
+    assert(myst_cacheblkdev_stats(dev, &stats) == 0);
+    assert(stats.hits == 2);
+    assert(stats.misses == 2);
+    assert(stats.readaheads == 0);
+    assert(_memdev.gets == 2);
+
+    assert(dev->close(dev) == 0);
+    assert(_memdev.closed);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_write_back(void)
+{
+    myst_blkdev_t* dev = _open(8);
+    myst_cacheblkdev_stats_t stats;
+
+    /* writes stay in the cache */
+    _write(dev, 1, 'a');
+    _write(dev, 2, 'b');
+    _write(dev, 1, 'c');
+    assert(_memdev.puts == 0);
+    _check(dev, 1, 'c');
+    assert(_memdev.gets == 0);
+
+    /* until they are flushed */
+    assert(dev->flush(dev) == 0);
+    assert(_memdev.puts == 2);
+    assert(_memdev.flushes == 1);
+    assert(_memdev.blocks[1][0] == 'c');
+    assert(_memdev.blocks[2][0] == 'b');
+
+    /* clean blocks are not written again */
+    assert(dev->flush(dev) == 0);
+    assert(_memdev.puts == 2);
+
+    /* or evicted (the least recently used first) */
+    _write(dev, 3, 'd');
+
+    for (uint64_t i = 100; i < 100 + 8; i += 2)
+        _check(dev, i, (int)(i % 251));
+
+    _check(dev, 1, 'c');
+    _check(dev, 2, 'b');
+
+    for (uint64_t i = 200; i < 200 + 8; i += 2)
+        _check(dev, i, (int)(i % 251));
+
+    assert(_memdev.puts == 3);
+    assert(_memdev.blocks[3][0] == 'd');
+
+    assert(myst_cacheblkdev_stats(dev, &stats) == 0);
+    assert(stats.writebacks == 3);
+    assert(stats.evictions > 0);
+
+    /* closing writes back what is left */
+    _write(dev, 4, 'e');
+    assert(dev->close(dev) == 0);
+    assert(_memdev.blocks[4][0] == 'e');
+    assert(_memdev.flushes == 3);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_readahead(void)
+{
+    myst_blkdev_t* dev = _open(256);
+    myst_cacheblkdev_stats_t stats;
+
+    /* a sequential scan reads ahead with a growing window */
+    for (uint64_t i = 0; i < 200; i++)
+        _check(dev, i, (int)(i % 251));
+
+    assert(myst_cacheblkdev_stats(dev, &stats) == 0);
+    assert(stats.hits + stats.misses == 200);
+    assert(stats.misses < 10);
+    assert(stats.readaheads > 0);
+
+    /* reading ahead stops quietly at the end of the device */
+    for (uint64_t i = NBLOCKS - 4; i < NBLOCKS; i++)
+        _check(dev, i, (int)(i % 251));
+
+    /* explicit hints */
+    assert(dev->readahead(dev, 500, 16) == 0);
+    assert(myst_cacheblkdev_stats(dev, &stats) == 0);
+    {
+        const size_t hits = stats.hits;
+
+        for (uint64_t i = 500; i < 516; i++)
+            _check(dev, i, (int)(i % 251));
+
+        assert(myst_cacheblkdev_stats(dev, &stats) == 0);
+        assert(stats.hits == hits + 16);
+    }
+
+    /* reads past the end still fail */
+    {
+        uint8_t data[MYST_BLKSIZE];
+        assert(dev->get(dev, NBLOCKS, data) == -EIO);
+    }
+
+    assert(dev->close(dev) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_multi_block(void)
+{
+    myst_blkdev_t* dev = _open(256);
+    myst_cacheblkdev_stats_t stats;
+    static uint8_t data[512][MYST_BLKSIZE];
+
+    /* a dirty block within a large read comes from the cache */
+    _write(dev, 300, 'x');
+    assert(dev->get_blocks(dev, 200, data, 512) == 0);
+    assert(_memdev.transfers == 2);
+    assert(data[0][0] == 200 % 251);
+    assert(data[100][0] == 'x');
+    assert(data[101][0] == 301 % 251);
+
+    /* large reads are not cached */
+    assert(myst_cacheblkdev_stats(dev, &stats) == 0);
+    assert(stats.hits == 1);
+    assert(stats.misses == 511);
+    _check(dev, 250, 250 % 251);
+    assert(_memdev.gets == 1);
+
+    /* large writes go straight to the device and update cached copies */
+    memset(data, 'y', sizeof(data));
+    assert(dev->put_blocks(dev, 200, data, 512) == 0);
+    assert(_memdev.transfers == 3);
+    assert(_memdev.blocks[300][0] == 'y');
+    _check(dev, 300, 'y');
+    assert(dev->flush(dev) == 0);
+    assert(_memdev.puts == 0);
+
+    /* small transfers go through the cache */
+    assert(dev->get_blocks(dev, 0, data, 4) == 0);
+    assert(dev->put_blocks(dev, 0, data, 4) == 0);
+    assert(_memdev.transfers == 3);
+    assert(_memdev.puts == 0);
+
+    assert(dev->close(dev) == 0);
+    assert(_memdev.puts == 4);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    test_hits();
+    test_write_back();
+    test_readahead();
+    test_multi_block();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -173,6 +174,39 @@ static int test_clock_getres()
     return 0;
 }
 
+static void* _monotonic_thread(void* arg)
+{
+    long prev = 0;
+
+    for (size_t i = 0; i < 100000; i++)
+    {
+        struct timespec tp;
+        long now;
+
+        assert(clock_gettime(CLOCK_MONOTONIC, &tp) == 0);
+        now = tp.tv_sec * NANO_IN_SECOND + tp.tv_nsec;
+        assert(now >= prev);
+        prev = now;
+    }
+
+    return arg;
+}
+
+static int test_clock_monotonic()
+{
+    pthread_t threads[4];
+    size_t n = sizeof(threads) / sizeof(threads[0]);
+
+    /* the monotonic clock must never go backward on any thread */
+    for (size_t i = 0; i < n; i++)
+        assert(pthread_create(&threads[i], NULL, _monotonic_thread, NULL) == 0);
+
+    for (size_t i = 0; i < n; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    return 0;
+}
+
 int main(int argc, const char* argv[])
 {
     assert(argc == 3);
@@ -190,6 +224,8 @@ int main(int argc, const char* argv[])
 
     assert(test_clock_getres() == 0);
 
+    assert(test_clock_monotonic() == 0);
+
     printf("=== passed test (%s)\n", argv[0]);
 
     return 0;
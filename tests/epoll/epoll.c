@@ -77,10 +77,92 @@ static void test_epoll_fcntl()
     printf("=== passed test (%s)\n", __FUNCTION__);
 }
 
+static void test_epoll_ctl()
+{
+    int epfd = epoll_create1(0);
+    int pipefd[2];
+    struct epoll_event ev = {.events = EPOLLIN};
+    struct epoll_event out[2];
+
+    assert(epfd >= 0);
+    assert(pipe(pipefd) == 0);
+
+    /* an instance cannot watch itself */
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, epfd, &ev) == -1);
+    assert(errno == EINVAL);
+
+    ev.data.u64 = 1234;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, pipefd[0], &ev) == 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, pipefd[0], &ev) == -1);
+    assert(errno == EEXIST);
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, pipefd[1], &ev) == -1);
+    assert(errno == ENOENT);
+
+    /* one-shot: reported once until re-armed */
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, pipefd[0], &ev) == 0);
+    assert(write(pipefd[1], "x", 1) == 1);
+    assert(epoll_wait(epfd, out, 2, 1000) == 1);
+    assert(out[0].data.u64 == 1234);
+    assert(epoll_wait(epfd, out, 2, 0) == 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, pipefd[0], &ev) == 0);
+    assert(epoll_wait(epfd, out, 2, 0) == 1);
+
+    /* the event argument may be null for EPOLL_CTL_DEL */
+    assert(epoll_ctl(epfd, EPOLL_CTL_DEL, pipefd[0], NULL) == 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_DEL, pipefd[0], NULL) == -1);
+    assert(errno == ENOENT);
+    assert(epoll_wait(epfd, out, 2, 0) == 0);
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    close(epfd);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void test_epoll_nested()
+{
+    int inner = epoll_create1(0);
+    int outer = epoll_create1(0);
+    int pipefd[2];
+    struct epoll_event ev = {.events = EPOLLIN};
+    struct epoll_event out[2];
+
+    assert(inner >= 0 && outer >= 0);
+    assert(pipe(pipefd) == 0);
+
+    ev.data.fd = pipefd[0];
+    assert(epoll_ctl(inner, EPOLL_CTL_ADD, pipefd[0], &ev) == 0);
+    ev.data.fd = inner;
+    assert(epoll_ctl(outer, EPOLL_CTL_ADD, inner, &ev) == 0);
+
+    assert(epoll_wait(outer, out, 2, 0) == 0);
+    assert(write(pipefd[1], "x", 1) == 1);
+    assert(epoll_wait(outer, out, 2, 1000) == 1);
+    assert(out[0].data.fd == inner);
+    assert(epoll_wait(inner, out, 2, 0) == 1);
+    assert(out[0].data.fd == pipefd[0]);
+
+    /* loops are rejected */
+    ev.data.fd = outer;
+    assert(epoll_ctl(inner, EPOLL_CTL_ADD, outer, &ev) == -1);
+    assert(errno == ELOOP);
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    close(outer);
+    close(inner);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 int main(int argc, const char* argv[])
 {
     test_epoll_on_regular_files_unsupp();
     test_epoll_fcntl();
+    test_epoll_ctl();
+    test_epoll_nested();
 
     pthread_t sthread;
     pthread_t cthread1;
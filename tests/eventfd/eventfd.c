@@ -4,7 +4,9 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -164,10 +166,44 @@ void test2(void)
     printf("=== passed test (%s)\n", __FUNCTION__);
 }
 
+void test3(void)
+{
+    uint64_t val;
+    struct pollfd pollfd;
+
+    fd = eventfd(2, EFD_NONBLOCK | EFD_SEMAPHORE);
+    assert(fd >= 0);
+    assert(fcntl(fd, F_GETFL) & O_NONBLOCK);
+
+    /* a semaphore is decremented by one per read */
+    assert(read(fd, &val, sizeof(val)) == sizeof(val) && val == 1);
+    assert(read(fd, &val, sizeof(val)) == sizeof(val) && val == 1);
+    assert(read(fd, &val, sizeof(val)) == -1 && errno == EAGAIN);
+
+    /* an empty counter is writable but not readable */
+    pollfd.fd = fd;
+    pollfd.events = POLLIN | POLLOUT;
+    assert(poll(&pollfd, 1, 0) == 1 && pollfd.revents == POLLOUT);
+
+    /* the counter cannot exceed 0xfffffffffffffffe */
+    val = UINT64_MAX;
+    assert(write(fd, &val, sizeof(val)) == -1 && errno == EINVAL);
+    val = UINT64_MAX - 1;
+    assert(write(fd, &val, sizeof(val)) == sizeof(val));
+    val = 1;
+    assert(write(fd, &val, sizeof(val)) == -1 && errno == EAGAIN);
+    assert(poll(&pollfd, 1, 0) == 1 && pollfd.revents == POLLIN);
+
+    close(fd);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 int main(int argc, const char* argv[])
 {
     test1();
     test2();
+    test3();
 
     printf("=== passed test (%s)\n", argv[0]);
 
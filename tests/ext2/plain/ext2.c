@@ -8,6 +8,7 @@
 #include <string.h>
 
 #include <myst/blkdev.h>
+#include <myst/dcache.h>
 #include <myst/ext2.h>
 
 uid_t myst_syscall_geteuid(void)
@@ -34,6 +35,108 @@ myst_thread_t* myst_thread_self()
     return NULL;
 }
 
+/* this program is single-threaded: the ext2 locks are no-ops */
+
+int myst_mutex_init(void* m)
+{
+    return 0;
+}
+
+int myst_mutex_lock(void* m)
+{
+    return 0;
+}
+
+int myst_mutex_unlock(void* m)
+{
+    return 0;
+}
+
+int myst_rwlock_init(void* rw)
+{
+    return 0;
+}
+
+int myst_rwlock_rdlock(void* rw)
+{
+    return 0;
+}
+
+int myst_rwlock_wrlock(void* rw)
+{
+    return 0;
+}
+
+int myst_rwlock_unlock(void* rw)
+{
+    return 0;
+}
+
+/* the dentry cache is a kernel service: every lookup misses */
+
+bool myst_dcache_lookup(
+    const void* fs,
+    uint64_t parent,
+    const char* name,
+    uint64_t* value)
+{
+    return false;
+}
+
+void myst_dcache_insert(
+    const void* fs,
+    uint64_t parent,
+    const char* name,
+    uint64_t value)
+{
+}
+
+void myst_dcache_invalidate(const void* fs, uint64_t parent, const char* name)
+{
+}
+
+void myst_dcache_invalidate_fs(const void* fs)
+{
+}
+
+/* a device that shares the blocks of another (and does not close it) */
+typedef struct
+{
+    myst_blkdev_t base;
+    myst_blkdev_t* dev;
+} view_t;
+
+static int _view_close(myst_blkdev_t* dev)
+{
+    free(dev);
+    return 0;
+}
+
+static int _view_get(myst_blkdev_t* dev, uint64_t blkno, void* data)
+{
+    myst_blkdev_t* shared = ((view_t*)dev)->dev;
+    return (*shared->get)(shared, blkno, data);
+}
+
+static int _view_put(myst_blkdev_t* dev, uint64_t blkno, const void* data)
+{
+    myst_blkdev_t* shared = ((view_t*)dev)->dev;
+    return (*shared->put)(shared, blkno, data);
+}
+
+static myst_blkdev_t* _new_view(myst_blkdev_t* dev)
+{
+    view_t* view;
+
+    assert((view = calloc(1, sizeof(view_t))));
+    view->base.close = _view_close;
+    view->base.get = _view_get;
+    view->base.put = _view_put;
+    view->dev = dev;
+
+    return &view->base;
+}
+
 static void _dump_stat_buf(struct stat* buf)
 {
     printf("=== _dump_stat_buf\n");
@@ -286,6 +389,274 @@ static void _test_dir_entries(myst_fs_t* fs)
     assert(ext2_rmdir(fs, path) == 0);
 }
 
+/* the inode changes made through the inode cache survive sync and remount */
+static void _test_inode_cache(const char* path)
+{
+    myst_blkdev_t* dev;
+    myst_blkdev_t* cached;
+    myst_fs_t* fs1;
+    myst_fs_t* fs2;
+    myst_file_t* file;
+    const char alpha[] = "abcdefghijklmnopqrstuvwxyz";
+    const struct timespec times[2] = {{1000, 0}, {2000, 0}};
+    const size_t size = 5000;
+    struct stat buf;
+    char data[8192];
+
+    assert(myst_rawblkdev_open(path, true, 0, &dev) == 0);
+    assert(myst_cacheblkdev_open(_new_view(dev), 4096, &cached) == 0);
+    assert(ext2_create(cached, &fs1, mock_mount_resolve) == 0);
+
+    /* change the size, mode, and times of a file */
+    memset(data, 'x', sizeof(data));
+    assert(_create_file(fs1, "/icache", 0666, data, sizeof(data)) == 0);
+    assert(ext2_open(fs1, "/icache", O_RDWR, 0, NULL, &file) == 0);
+    assert(ext2_ftruncate(fs1, file, sizeof(alpha)) == 0);
+    assert(ext2_lseek(fs1, file, 0, SEEK_SET) == 0);
+    assert(ext2_write(fs1, file, alpha, sizeof(alpha)) == sizeof(alpha));
+    assert(fs1->fs_fchmod(fs1, file, 0600) == 0);
+    assert(ext2_close(fs1, file) == 0);
+    assert(ext2_truncate(fs1, "/icache", size) == 0);
+    assert(fs1->fs_chmod(fs1, "/icache", 0604) == 0);
+    assert(ext2_open(fs1, "/icache", O_RDONLY, 0, NULL, &file) == 0);
+    assert(fs1->fs_futimens(fs1, file, times) == 0);
+    assert(ext2_close(fs1, file) == 0);
+    assert(ext2_sync(fs1) == 0);
+
+    /* a second instance sees the synced inode, then a remount does */
+    for (size_t i = 0; i < 2; i++)
+    {
+        assert(ext2_create(_new_view(dev), &fs2, mock_mount_resolve) == 0);
+        assert(ext2_check((ext2_t*)fs2) == 0);
+
+        assert(ext2_stat(fs2, "/icache", &buf) == 0);
+        assert(buf.st_size == (off_t)size);
+        assert(buf.st_mode == (S_IFREG | 0604));
+        assert(buf.st_atim.tv_sec == times[0].tv_sec);
+        assert(buf.st_mtim.tv_sec == times[1].tv_sec);
+
+        assert(ext2_open(fs2, "/icache", O_RDONLY, 0, NULL, &file) == 0);
+        assert(ext2_read(fs2, file, data, sizeof(data)) == (ssize_t)size);
+        assert(memcmp(data, alpha, sizeof(alpha)) == 0);
+
+        for (size_t j = sizeof(alpha); j < size; j++)
+            assert(data[j] == '\0');
+
+        assert(ext2_close(fs2, file) == 0);
+        ext2_release(fs2);
+
+        if (i == 0)
+            ext2_release(fs1);
+    }
+
+    dev->close(dev);
+}
+
+static void _fill(uint8_t* data, size_t size, uint8_t seed)
+{
+    for (size_t i = 0; i < size; i++)
+        data[i] = (uint8_t)(i * 7 + seed);
+}
+
+static void _check_contents(
+    myst_fs_t* fs,
+    myst_file_t* file,
+    const uint8_t* expect,
+    size_t size)
+{
+    static uint8_t data[64 * 1024];
+
+    assert(_ffilesize(fs, file) == size);
+    assert(ext2_lseek(fs, file, 0, SEEK_SET) == 0);
+    assert(ext2_read(fs, file, data, sizeof(data)) == (ssize_t)size);
+    assert(memcmp(data, expect, size) == 0);
+}
+
+/* reads see the blocks of a file after it is truncated, extended, and
+ * rewritten (the block runs cached by the reads follow the changes) */
+static void _test_block_runs(const char* path)
+{
+    myst_blkdev_t* dev;
+    myst_fs_t* fs;
+    myst_file_t* file;
+    static uint8_t expect[64 * 1024];
+    const size_t size = 40 * 1024; /* direct and indirect blocks */
+    const size_t truncated = 5000;
+    const size_t extended = 30000;
+    const size_t rewritten = 20000;
+    size_t n = size;
+
+    assert(myst_rawblkdev_open(path, true, 0, &dev) == 0);
+    assert(ext2_create(_new_view(dev), &fs, mock_mount_resolve) == 0);
+
+    _fill(expect, size, 1);
+    assert(_create_file(fs, "/runs", 0666, expect, size) == 0);
+    assert(ext2_open(fs, "/runs", O_RDWR, 0, NULL, &file) == 0);
+    _check_contents(fs, file, expect, n);
+
+    /* truncate within a block */
+    assert(ext2_ftruncate(fs, file, truncated) == 0);
+    n = truncated;
+    _check_contents(fs, file, expect, n);
+
+    /* extend with a hole, then write past it */
+    assert(ext2_ftruncate(fs, file, extended) == 0);
+    memset(expect + n, 0, extended - n);
+    n = extended;
+    _check_contents(fs, file, expect, n);
+
+    assert(ext2_lseek(fs, file, n, SEEK_SET) == (off_t)n);
+    _fill(expect + n, size - n, 2);
+    assert(ext2_write(fs, file, expect + n, size - n) == (ssize_t)(size - n));
+    n = size;
+    _check_contents(fs, file, expect, n);
+
+    /* rewrite the middle, across the truncated and extended parts */
+    {
+        const off_t offset = 2000;
+        uint8_t* data = expect + offset;
+
+        assert(ext2_lseek(fs, file, offset, SEEK_SET) == offset);
+        _fill(data, rewritten, 3);
+        assert(ext2_write(fs, file, data, rewritten) == (ssize_t)rewritten);
+    }
+    _check_contents(fs, file, expect, n);
+
+    assert(ext2_close(fs, file) == 0);
+    ext2_release(fs);
+
+    /* the blocks are the same after a remount */
+    assert(ext2_create(_new_view(dev), &fs, mock_mount_resolve) == 0);
+    assert(ext2_check((ext2_t*)fs) == 0);
+    assert(ext2_open(fs, "/runs", O_RDONLY, 0, NULL, &file) == 0);
+    _check_contents(fs, file, expect, n);
+    assert(ext2_close(fs, file) == 0);
+    ext2_release(fs);
+
+    dev->close(dev);
+}
+
+static bool _block_in_use(const ext2_t* ext2, uint32_t blkno)
+{
+    const uint32_t first = ext2->sb.s_first_data_block;
+    const uint32_t per_group = ext2->sb.s_blocks_per_group;
+    const uint32_t grpno = (blkno - first) / per_group;
+    const uint32_t lblkno = (blkno - first) % per_group;
+    ext2_block_t bitmap;
+
+    assert(ext2_read_block_bitmap(ext2, grpno, &bitmap) == 0);
+    assert(lblkno / 8 < bitmap.size);
+
+    return bitmap.data[lblkno / 8] & (1 << (lblkno % 8));
+}
+
+/* the number of runs of contiguous blocks (all direct) of a file */
+static size_t _count_runs(const ext2_t* ext2, ext2_ino_t ino, size_t nblocks)
+{
+    ext2_inode_t inode;
+    size_t nruns = 1;
+
+    assert(ext2_read_inode(ext2, ino, &inode) == 0);
+
+    for (size_t i = 0; i < nblocks; i++)
+    {
+        assert(_block_in_use(ext2, inode.i_block[i]));
+
+        if (i && inode.i_block[i] != inode.i_block[i - 1] + 1)
+            nruns++;
+    }
+
+    /* the blocks reserved after the last one were given back */
+    assert(!_block_in_use(ext2, inode.i_block[nblocks - 1] + 1));
+
+    return nruns;
+}
+
+/* files appended to in turn get contiguous runs of blocks, and the blocks
+ * reserved for the appends never reach the device */
+static void _test_alloc_windows(const char* path)
+{
+    myst_blkdev_t* dev;
+    myst_fs_t* fs1;
+    myst_fs_t* fs2;
+    myst_file_t* files[2];
+    ext2_ino_t inos[2];
+    const char* paths[] = {"/append1", "/append2"};
+    const int flags = O_CREAT | O_TRUNC | O_WRONLY;
+    const size_t nblocks = 12; /* direct blocks only */
+    const size_t nwindow = 8;  /* the blocks an append allocates */
+    uint32_t free_blocks;
+    uint8_t data[EXT2_MAX_BLOCK_SIZE];
+    struct stat buf;
+
+    assert(myst_rawblkdev_open(path, true, 0, &dev) == 0);
+    assert(ext2_create(_new_view(dev), &fs1, mock_mount_resolve) == 0);
+    free_blocks = ((ext2_t*)fs1)->sb.s_free_blocks_count;
+    memset(data, 0xab, sizeof(data));
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        assert(ext2_open(fs1, paths[i], flags, 0666, NULL, &files[i]) == 0);
+        assert(ext2_fstat(fs1, files[i], &buf) == 0);
+        inos[i] = buf.st_ino;
+    }
+
+    /* append a block to each file in turn */
+    for (size_t n = 0; n < nblocks; n++)
+    {
+        for (size_t i = 0; i < 2; i++)
+        {
+            const size_t size = ((ext2_t*)fs1)->block_size;
+            assert(ext2_write(fs1, files[i], data, size) == (ssize_t)size);
+        }
+    }
+
+    /* check the device after fsync, and again after unmount */
+    for (size_t pass = 0; pass < 2; pass++)
+    {
+        if (pass == 0)
+        {
+            assert(fs1->fs_fsync(fs1, files[0]) == 0);
+        }
+        else
+        {
+            for (size_t i = 0; i < 2; i++)
+                assert(ext2_close(fs1, files[i]) == 0);
+
+            ext2_release(fs1);
+        }
+
+        assert(ext2_create(_new_view(dev), &fs2, mock_mount_resolve) == 0);
+        assert(ext2_check((ext2_t*)fs2) == 0);
+        assert(
+            ((ext2_t*)fs2)->sb.s_free_blocks_count ==
+            free_blocks - 2 * nblocks);
+
+        for (size_t i = 0; i < 2; i++)
+        {
+            const size_t nruns = _count_runs((ext2_t*)fs2, inos[i], nblocks);
+            assert(nruns <= (nblocks + nwindow - 1) / nwindow);
+        }
+
+        ext2_release(fs2);
+    }
+
+    /* the blocks are all free again after the files are removed */
+    assert(ext2_create(_new_view(dev), &fs1, mock_mount_resolve) == 0);
+
+    for (size_t i = 0; i < 2; i++)
+        assert(ext2_unlink(fs1, paths[i]) == 0);
+
+    ext2_release(fs1);
+
+    assert(ext2_create(_new_view(dev), &fs2, mock_mount_resolve) == 0);
+    assert(ext2_check((ext2_t*)fs2) == 0);
+    assert(((ext2_t*)fs2)->sb.s_free_blocks_count == free_blocks);
+    ext2_release(fs2);
+
+    dev->close(dev);
+}
+
 int main(int argc, const char* argv[])
 {
     myst_blkdev_t* dev;
@@ -1214,6 +1585,38 @@ int main(int argc, const char* argv[])
     /* check superblock against original superblock */
     assert(memcmp(&sb, &__ext2->sb, sizeof(sb)) == 0);
 
+    /* ext2_sync() writes back the caches of ext2 and of the device: a
+     * second instance sees the file written through a caching device */
+    {
+        myst_blkdev_t* cached;
+        myst_fs_t* fs1;
+        myst_fs_t* fs2;
+        myst_file_t* file;
+        char buf[sizeof(alpha)];
+
+        assert(ext2_sync(fs) == 0);
+
+        assert(myst_cacheblkdev_open(_new_view(dev), 4096, &cached) == 0);
+        assert(ext2_create(cached, &fs1, mock_mount_resolve) == 0);
+        assert(_create_file(fs1, "/synced", mode, alpha, sizeof(alpha)) == 0);
+        assert(ext2_sync(fs1) == 0);
+
+        assert(ext2_create(_new_view(dev), &fs2, mock_mount_resolve) == 0);
+        assert(ext2_check((ext2_t*)fs2) == 0);
+        assert(ext2_open(fs2, "/synced", O_RDONLY, 0, NULL, &file) == 0);
+        assert(ext2_read(fs2, file, buf, sizeof(buf)) == sizeof(alpha));
+        assert(memcmp(buf, alpha, sizeof(alpha)) == 0);
+        ext2_close(fs2, file);
+        ext2_release(fs2);
+
+        assert(ext2_unlink(fs1, "/synced") == 0);
+        ext2_release(fs1);
+    }
+
+    _test_inode_cache(argv[1]);
+    _test_block_runs(argv[1]);
+    _test_alloc_windows(argv[1]);
+
     ext2_release(fs);
     // dev->close(dev);
 
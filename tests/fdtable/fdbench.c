@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+** Multi-threaded read/write microbenchmark: each thread does pwrite/pread
+** pairs on its own file, so the threads share nothing but the fdtable.
+** With lock-free descriptor lookups, throughput should scale with the
+** number of threads (up to the number of CPUs).
+*/
+
+#define MAX_THREADS 64
+
+static size_t _iterations = 100000;
+
+static uint64_t _now_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* _thread(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    char buf[64];
+
+    memset(buf, 'x', sizeof(buf));
+
+    for (size_t i = 0; i < _iterations; i++)
+    {
+        assert(pwrite(fd, buf, sizeof(buf), 0) == sizeof(buf));
+        assert(pread(fd, buf, sizeof(buf), 0) == sizeof(buf));
+    }
+
+    return NULL;
+}
+
+static double _run(size_t nthreads)
+{
+    pthread_t threads[MAX_THREADS];
+    int fds[MAX_THREADS];
+    uint64_t start;
+    uint64_t elapsed;
+
+    for (size_t i = 0; i < nthreads; i++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/fdbench.%zu", i);
+        assert((fds[i] = open(path, O_CREAT | O_RDWR | O_TRUNC, 0666)) >= 0);
+    }
+
+    start = _now_nsec();
+
+    for (size_t i = 0; i < nthreads; i++)
+    {
+        void* arg = (void*)(intptr_t)fds[i];
+        assert(pthread_create(&threads[i], NULL, _thread, arg) == 0);
+    }
+
+    for (size_t i = 0; i < nthreads; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    elapsed = _now_nsec() - start;
+
+    for (size_t i = 0; i < nthreads; i++)
+        close(fds[i]);
+
+    /* millions of I/O operations per second */
+    return (2.0 * nthreads * _iterations) / (elapsed / 1000.0);
+}
+
+int main(int argc, const char* argv[])
+{
+    size_t max_threads = 8;
+    double base = 0;
+
+    if (argc > 1)
+        max_threads = strtoul(argv[1], NULL, 10);
+
+    if (argc > 2)
+        _iterations = strtoul(argv[2], NULL, 10);
+
+    assert(max_threads > 0 && max_threads <= MAX_THREADS);
+
+    for (size_t n = 1; n <= max_threads; n *= 2)
+    {
+        double mops = _run(n);
+
+        if (n == 1)
+            base = mops;
+
+        printf(
+            "threads=%-3zu %8.2f Mops/sec  scaling=%.2fx\n",
+            n,
+            mops,
+            mops / base);
+    }
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
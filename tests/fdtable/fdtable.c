@@ -0,0 +1,345 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define NUM_FDS 5000
+#define HIGH_FD 65000
+#define LIMIT 70000
+
+static void _set_nofile(rlim_t cur, rlim_t max)
+{
+    struct rlimit rlim = {.rlim_cur = cur, .rlim_max = max};
+    assert(setrlimit(RLIMIT_NOFILE, &rlim) == 0);
+}
+
+static void _test_limit(int fd)
+{
+    struct rlimit rlim;
+
+    /* descriptors at or above the soft limit are rejected */
+    assert(getrlimit(RLIMIT_NOFILE, &rlim) == 0);
+    assert(rlim.rlim_cur == 1024);
+    assert(dup2(fd, 2000) == -1 && errno == EBADF);
+    assert(fcntl(fd, F_DUPFD, 2000) == -1 && errno == EINVAL);
+
+    /* the hard limit cannot exceed the maximum table size */
+    rlim.rlim_cur = LIMIT;
+    rlim.rlim_max = 2 * 1024 * 1024;
+    assert(setrlimit(RLIMIT_NOFILE, &rlim) == -1 && errno == EPERM);
+
+    _set_nofile(LIMIT, LIMIT);
+    assert(getrlimit(RLIMIT_NOFILE, &rlim) == 0);
+    assert(rlim.rlim_cur == LIMIT && rlim.rlim_max == LIMIT);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_grow(int fd)
+{
+    static int fds[NUM_FDS];
+
+    /* the table grows to hold a high descriptor */
+    assert(dup2(fd, HIGH_FD) == HIGH_FD);
+    assert(fcntl(HIGH_FD, F_GETFD) == 0);
+
+    /* descriptors are assigned lowest first across several chunks */
+    for (size_t i = 0; i < NUM_FDS; i++)
+    {
+        assert((fds[i] = dup(fd)) >= 0);
+
+        if (i > 0)
+            assert(fds[i] == fds[i - 1] + 1);
+    }
+
+    /* a hole is reused before any higher descriptor */
+    assert(close(fds[1234]) == 0);
+    assert(close(fds[4321]) == 0);
+    assert(dup(fd) == fds[1234]);
+    assert(dup(fd) == fds[4321]);
+
+    /* F_DUPFD finds the lowest free descriptor at or above its argument */
+    assert(fcntl(fd, F_DUPFD, HIGH_FD) == HIGH_FD + 1);
+    assert(fcntl(fd, F_DUPFD_CLOEXEC, 40000) == 40000);
+    assert(fcntl(40000, F_GETFD) == FD_CLOEXEC);
+
+    /* a fork child inherits the whole table */
+    {
+        pid_t pid = fork();
+        int status;
+
+        assert(pid >= 0);
+
+        if (pid == 0)
+        {
+            assert(fcntl(HIGH_FD, F_GETFD) == 0);
+            assert(fcntl(fds[NUM_FDS - 1], F_GETFD) == 0);
+            assert(fcntl(40000, F_GETFD) == FD_CLOEXEC);
+            _exit(0);
+        }
+
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    for (size_t i = 0; i < NUM_FDS; i++)
+        assert(close(fds[i]) == 0);
+
+    assert(close(HIGH_FD) == 0);
+    assert(close(HIGH_FD + 1) == 0);
+    assert(close(40000) == 0);
+    assert(fcntl(HIGH_FD, F_GETFD) == -1 && errno == EBADF);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_emfile(int fd)
+{
+    int high;
+
+    /* descriptors above a lowered limit stay open */
+    assert((high = dup2(fd, 3000)) == 3000);
+    _set_nofile(64, LIMIT);
+    assert(fcntl(high, F_GETFD) == 0);
+
+    /* running out of descriptors below the limit fails with EMFILE */
+    for (;;)
+    {
+        int r = dup(fd);
+
+        if (r == -1)
+        {
+            assert(errno == EMFILE);
+            break;
+        }
+
+        assert(r < 64);
+    }
+
+    for (int i = fd + 1; i < 64; i++)
+        close(i);
+
+    close(high);
+    _set_nofile(1024, LIMIT);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_vfork(int fd)
+{
+    int pfd[2];
+    int cloexec_fd;
+    pid_t pid;
+    int status;
+    char buf[8];
+
+    assert(pipe(pfd) == 0);
+    assert((cloexec_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) >= 0);
+
+    /* a vfork child that closes and replaces descriptors and exits */
+    if ((pid = vfork()) == 0)
+    {
+        close(pfd[0]);
+        dup2(fd, pfd[1]);
+        fcntl(cloexec_fd, F_SETFD, 0);
+        _exit(0);
+    }
+
+    assert(pid > 0);
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    /* the parent's descriptors are unaffected */
+    assert(write(pfd[1], "x", 1) == 1);
+    assert(read(pfd[0], buf, 1) == 1 && buf[0] == 'x');
+    assert(fcntl(cloexec_fd, F_GETFD) == FD_CLOEXEC);
+
+    /* an exec'd child keeps only the descriptors without FD_CLOEXEC */
+    {
+        char wfd[16];
+        char cfd[16];
+        char* argv[] = {"/bin/fdtable", "child", wfd, cfd, NULL};
+        extern char** environ;
+
+        snprintf(wfd, sizeof(wfd), "%d", pfd[1]);
+        snprintf(cfd, sizeof(cfd), "%d", cloexec_fd);
+
+        assert(posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) == 0);
+        assert(close(pfd[1]) == 0);
+
+        assert(read(pfd[0], buf, sizeof(buf)) == 2);
+        assert(memcmp(buf, "ok", 2) == 0);
+
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    close(pfd[0]);
+    close(cloexec_fd);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static volatile int _stop;
+
+/* close and replace descriptors while a fork child uses the table */
+static void* _churn_thread(void* arg)
+{
+    int fd = (int)(long)arg;
+
+    while (!_stop)
+    {
+        int tmp;
+
+        assert((tmp = dup(fd)) >= 0);
+        assert(dup2(fd, tmp) == tmp);
+        assert(close(tmp) == 0);
+    }
+
+    return NULL;
+}
+
+static void _test_fork_concurrent_parent(int fd)
+{
+    pthread_t thread;
+    int pfd[2];
+    pid_t pid;
+    int status;
+
+    assert(pipe(pfd) == 0);
+
+    /* another thread of the parent keeps running while the child uses the
+     * inherited pipe, so the child must not borrow the parent's objects */
+    _stop = 0;
+    assert(pthread_create(&thread, NULL, _churn_thread, (void*)(long)fd) == 0);
+
+    for (size_t i = 0; i < 10; i++)
+    {
+        if ((pid = fork()) == 0)
+        {
+            char buf[64];
+
+            for (size_t j = 0; j < 1000; j++)
+            {
+                if (write(pfd[1], "x", 1) != 1)
+                    _exit(1);
+
+                if (read(pfd[0], buf, sizeof(buf)) != 1 || buf[0] != 'x')
+                    _exit(2);
+            }
+
+            _exit(0);
+        }
+
+        assert(pid > 0);
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    _stop = 1;
+    assert(pthread_join(thread, NULL) == 0);
+
+    /* the parent's pipe still works */
+    {
+        char c;
+
+        assert(write(pfd[1], "y", 1) == 1);
+        assert(read(pfd[0], &c, 1) == 1 && c == 'y');
+    }
+
+    close(pfd[0]);
+    close(pfd[1]);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* posix_spawn() clones with CLONE_VFORK but keeps running (it closes its
+ * end of the exec status pipe right away), so the parent must be able to
+ * close descriptors while the child is still running */
+static void _test_spawn_close(int fd)
+{
+    extern char** environ;
+    char* argv[] = {"/bin/fdtable", "spawned", NULL};
+
+    for (size_t i = 0; i < 50; i++)
+    {
+        posix_spawn_file_actions_t actions;
+        int pfd[2];
+        int tmp[8];
+        pid_t pid;
+        int status;
+        char buf[8];
+
+        assert(pipe(pfd) == 0);
+        assert(posix_spawn_file_actions_init(&actions) == 0);
+        assert(posix_spawn_file_actions_adddup2(&actions, pfd[1], 1) == 0);
+
+        assert(posix_spawn(&pid, argv[0], &actions, NULL, argv, environ) == 0);
+
+        /* close and replace descriptors while the child may still run */
+        assert(close(pfd[1]) == 0);
+
+        for (size_t j = 0; j < sizeof(tmp) / sizeof(tmp[0]); j++)
+            assert((tmp[j] = dup(fd)) >= 0);
+
+        for (size_t j = 0; j < sizeof(tmp) / sizeof(tmp[0]); j++)
+            assert(close(tmp[j]) == 0);
+
+        assert(read(pfd[0], buf, sizeof(buf)) == 2);
+        assert(memcmp(buf, "ok", 2) == 0);
+
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+        posix_spawn_file_actions_destroy(&actions);
+        close(pfd[0]);
+    }
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* run by _test_vfork() after exec */
+static int _child(const char* wfd, const char* cfd)
+{
+    assert(fcntl(atoi(cfd), F_GETFD) == -1 && errno == EBADF);
+    assert(write(atoi(wfd), "ok", 2) == 2);
+    return 0;
+}
+
+int main(int argc, const char* argv[])
+{
+    int fd;
+
+    if (argc == 4 && strcmp(argv[1], "child") == 0)
+        return _child(argv[2], argv[3]);
+
+    /* run by _test_spawn_close() */
+    if (argc == 2 && strcmp(argv[1], "spawned") == 0)
+        return write(STDOUT_FILENO, "ok", 2) == 2 ? 0 : 1;
+
+    assert((fd = open("/tmp/fdtable", O_CREAT | O_RDWR, 0666)) >= 0);
+
+    _test_limit(fd);
+    _test_grow(fd);
+    _test_emfile(fd);
+    _test_vfork(fd);
+    _test_fork_concurrent_parent(fd);
+    _test_spawn_close(fd);
+
+    close(fd);
+
+    printf("=== passed all tests (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,326 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* config.json allows 4 host-backed threads, so most of these are fibers */
+#define NUM_THREADS 32
+#define NUM_INCREMENTS 1000
+
+static pthread_barrier_t _barrier;
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _cond = PTHREAD_COND_INITIALIZER;
+static size_t _counter;
+static int _release;
+
+static void* _worker(void* arg)
+{
+    (void)arg;
+
+    /* every thread must be blocked at the same time to get past this */
+    pthread_barrier_wait(&_barrier);
+
+    for (size_t i = 0; i < NUM_INCREMENTS; i++)
+    {
+        pthread_mutex_lock(&_mutex);
+        _counter++;
+        pthread_mutex_unlock(&_mutex);
+
+        if (i % 100 == 0)
+            sched_yield();
+    }
+
+    usleep(1000);
+
+    return NULL;
+}
+
+static void _test_barrier_and_mutex(void)
+{
+    pthread_t threads[NUM_THREADS];
+
+    assert(pthread_barrier_init(&_barrier, NULL, NUM_THREADS) == 0);
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, _worker, NULL) == 0);
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    assert(_counter == NUM_THREADS * NUM_INCREMENTS);
+    pthread_barrier_destroy(&_barrier);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void* _timed_waiter(void* arg)
+{
+    struct timespec ts;
+    int r;
+
+    (void)arg;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 10 * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    r = pthread_cond_timedwait(&_cond, &_mutex, &ts);
+    pthread_mutex_unlock(&_mutex);
+
+    assert(r == ETIMEDOUT);
+    return NULL;
+}
+
+static void _test_timed_wait(void)
+{
+    pthread_t threads[NUM_THREADS];
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, _timed_waiter, NULL) == 0);
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void* _reader(void* arg)
+{
+    int fd = *(int*)arg;
+    char buf[16];
+
+    /* blocks until the writer (possibly on the same carrier) runs */
+    assert(recv(fd, buf, sizeof(buf), 0) == 5);
+    assert(memcmp(buf, "hello", 5) == 0);
+    assert(send(fd, "world", 5, 0) == 5);
+
+    return NULL;
+}
+
+static void _test_blocking_socket(void)
+{
+    pthread_t readers[NUM_THREADS];
+    int sv[NUM_THREADS][2];
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+    {
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]) == 0);
+        assert(pthread_create(&readers[i], NULL, _reader, &sv[i][1]) == 0);
+    }
+
+    /* let the readers block first */
+    usleep(10000);
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+    {
+        char buf[16];
+
+        assert(send(sv[i][0], "hello", 5, 0) == 5);
+        assert(recv(sv[i][0], buf, sizeof(buf), 0) == 5);
+        assert(memcmp(buf, "world", 5) == 0);
+    }
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+    {
+        assert(pthread_join(readers[i], NULL) == 0);
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+typedef struct poller
+{
+    int sock; /* a host descriptor */
+    int pipe; /* a kernel object */
+    int which;
+} poller_t;
+
+static void* _poller(void* arg)
+{
+    poller_t* p = arg;
+    struct pollfd fds[2] = {
+        {.fd = p->sock, .events = POLLIN},
+        {.fd = p->pipe, .events = POLLIN},
+    };
+
+    /* a short timeout expires while nothing is ready */
+    assert(poll(fds, 2, 20) == 0);
+
+    /* parks until the main thread writes one of the descriptors */
+    assert(poll(fds, 2, -1) == 1);
+
+    if (p->which == 0)
+        assert(fds[0].revents == POLLIN && fds[1].revents == 0);
+    else
+        assert(fds[0].revents == 0 && fds[1].revents == POLLIN);
+
+    return NULL;
+}
+
+static void _test_blocking_poll(void)
+{
+    pthread_t threads[NUM_THREADS];
+    poller_t pollers[NUM_THREADS];
+    int sv[NUM_THREADS][2];
+    int pipes[NUM_THREADS][2];
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+    {
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]) == 0);
+        assert(pipe(pipes[i]) == 0);
+        pollers[i].sock = sv[i][1];
+        pollers[i].pipe = pipes[i][0];
+        pollers[i].which = i % 2;
+        assert(pthread_create(&threads[i], NULL, _poller, &pollers[i]) == 0);
+    }
+
+    /* let the pollers time out once and park again */
+    usleep(50000);
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+    {
+        if (pollers[i].which == 0)
+            assert(send(sv[i][0], "x", 1, 0) == 1);
+        else
+            assert(write(pipes[i][1], "x", 1) == 1);
+    }
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+    {
+        assert(pthread_join(threads[i], NULL) == 0);
+        close(sv[i][0]);
+        close(sv[i][1]);
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _sigusr1(int sig)
+{
+    (void)sig;
+}
+
+static void* _sleeper(void* arg)
+{
+    struct timespec req = {.tv_sec = 10};
+    struct timespec rem;
+
+    (void)arg;
+
+    pthread_barrier_wait(&_barrier);
+
+    /* a signal interrupts the sleep and reports the time left */
+    assert(nanosleep(&req, &rem) == -1);
+    assert(errno == EINTR);
+    assert(rem.tv_sec > 0 && rem.tv_sec <= 10);
+
+    return NULL;
+}
+
+static void _test_interrupted_sleep(void)
+{
+    pthread_t threads[NUM_THREADS];
+    struct sigaction sa = {.sa_handler = _sigusr1};
+
+    assert(sigaction(SIGUSR1, &sa, NULL) == 0);
+    assert(pthread_barrier_init(&_barrier, NULL, NUM_THREADS + 1) == 0);
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, _sleeper, NULL) == 0);
+
+    /* let the sleepers park */
+    pthread_barrier_wait(&_barrier);
+    usleep(10000);
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+        assert(pthread_kill(threads[i], SIGUSR1) == 0);
+
+    for (size_t i = 0; i < NUM_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    pthread_barrier_destroy(&_barrier);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void* _parked(void* arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&_mutex);
+    while (!_release)
+        pthread_cond_wait(&_cond, &_mutex);
+    pthread_mutex_unlock(&_mutex);
+
+    return NULL;
+}
+
+static void _test_max_fibers(void)
+{
+    static pthread_t threads[1024];
+    pthread_attr_t attr;
+    size_t n = 0;
+    int r;
+
+    assert(pthread_attr_init(&attr) == 0);
+    assert(pthread_attr_setstacksize(&attr, 64 * 1024) == 0);
+
+    /* give the fibers of the earlier tests time to be reclaimed */
+    usleep(100000);
+
+    /* create threads until both host threads and fibers run out */
+    while ((r = pthread_create(&threads[n], &attr, _parked, NULL)) == 0)
+        assert(++n < sizeof(threads) / sizeof(threads[0]));
+
+    assert(r == EAGAIN);
+
+    /* MaxFibers is 128 (plus a few host-backed threads) */
+    assert(n >= 128 && n < 128 + 4);
+
+    pthread_mutex_lock(&_mutex);
+    _release = 1;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+
+    for (size_t i = 0; i < n; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    pthread_attr_destroy(&attr);
+
+    printf("=== passed test (%s: %zu threads)\n", __FUNCTION__, n);
+}
+
+int main(int argc, const char* argv[])
+{
+    _test_barrier_and_mutex();
+    _test_timed_wait();
+    _test_blocking_socket();
+    _test_blocking_poll();
+    _test_interrupted_sleep();
+    _test_max_fibers();
+
+    printf("=== passed all tests (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -546,6 +546,51 @@ void test_pread_pwrite(void)
     _passed(__FUNCTION__);
 }
 
+void test_sparse_file(void)
+{
+    const off_t hole = 3 * 4096 + 100;
+    const char data[] = "sparse";
+    char buf[sizeof(data)];
+    char zeros[4096];
+    char tmp[4096];
+    struct stat st;
+    int fd;
+
+    memset(zeros, 0, sizeof(zeros));
+
+    assert((fd = open("/sparse", O_CREAT | O_RDWR, 0600)) >= 0);
+
+    /* writing beyond the end of the file leaves a hole of zeros */
+    assert(pwrite(fd, data, sizeof(data), hole) == sizeof(data));
+    assert(fstat(fd, &st) == 0);
+    assert(st.st_size == hole + (off_t)sizeof(data));
+
+    for (off_t off = 0; off < hole; off += sizeof(tmp))
+    {
+        size_t n = (hole - off < sizeof(tmp)) ? hole - off : sizeof(tmp);
+        assert(pread(fd, tmp, n, off) == (ssize_t)n);
+        assert(memcmp(tmp, zeros, n) == 0);
+    }
+
+    assert(pread(fd, buf, sizeof(buf), hole) == sizeof(buf));
+    assert(memcmp(buf, data, sizeof(data)) == 0);
+
+    /* shrinking then growing the file reads back zeros */
+    assert(ftruncate(fd, hole + 2) == 0);
+    assert(ftruncate(fd, hole + sizeof(data)) == 0);
+    assert(pread(fd, buf, sizeof(buf), hole) == sizeof(buf));
+    assert(memcmp(buf, "sp", 2) == 0);
+    assert(memcmp(buf + 2, zeros, sizeof(buf) - 2) == 0);
+
+    assert(ftruncate(fd, 0) == 0);
+    assert(pread(fd, buf, sizeof(buf), 0) == 0);
+
+    assert(close(fd) == 0);
+    assert(unlink("/sparse") == 0);
+
+    _passed(__FUNCTION__);
+}
+
 void test_fstatat(void)
 {
     int dirfd;
@@ -1032,6 +1077,104 @@ static void test_sync()
     _passed(__FUNCTION__);
 }
 
+static void test_large_dir(void)
+{
+    const size_t n = 1000;
+    char path[PATH_MAX];
+    struct stat st;
+    DIR* dir;
+    struct dirent* ent;
+    size_t i = 0;
+
+    assert(mkdir("/large_dir", 0777) == 0);
+
+    for (size_t j = 0; j < n; j++)
+    {
+        snprintf(path, sizeof(path), "/large_dir/file%zu", j);
+        assert(_touch(path, 0666) == 0);
+    }
+
+    for (size_t j = 0; j < n; j++)
+    {
+        snprintf(path, sizeof(path), "/large_dir/file%zu", j);
+        assert(stat(path, &st) == 0);
+        assert(S_ISREG(st.st_mode));
+    }
+
+    /* remove the odd entries */
+    for (size_t j = 1; j < n; j += 2)
+    {
+        snprintf(path, sizeof(path), "/large_dir/file%zu", j);
+        assert(unlink(path) == 0);
+        assert(stat(path, &st) == -1 && errno == ENOENT);
+    }
+
+    /* the remaining entries are listed (in creation order on ramfs) */
+    assert((dir = opendir("/large_dir")));
+
+    while ((ent = readdir(dir)))
+    {
+        size_t k;
+
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        assert(sscanf(ent->d_name, "file%zu", &k) == 1);
+        assert(k % 2 == 0);
+
+        if (strcmp(fstype, "ramfs") == 0)
+            assert(k == i * 2);
+
+        i++;
+    }
+
+    assert(i == n / 2);
+    assert(closedir(dir) == 0);
+
+    for (size_t j = 0; j < n; j += 2)
+    {
+        snprintf(path, sizeof(path), "/large_dir/file%zu", j);
+        assert(unlink(path) == 0);
+    }
+
+    assert(rmdir("/large_dir") == 0);
+
+    _passed(__FUNCTION__);
+}
+
+/* repeated lookups of names that come and go (see the dentry cache) */
+static void test_negative_lookups(void)
+{
+    struct stat st;
+
+    assert(mkdir("/negative", 0777) == 0);
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        assert(stat("/negative/name", &st) == -1 && errno == ENOENT);
+        assert(stat("/negative/name", &st) == -1 && errno == ENOENT);
+
+        assert(_touch("/negative/name", 0666) == 0);
+        assert(stat("/negative/name", &st) == 0 && S_ISREG(st.st_mode));
+
+        assert(rename("/negative/name", "/negative/other") == 0);
+        assert(stat("/negative/name", &st) == -1 && errno == ENOENT);
+        assert(stat("/negative/other", &st) == 0 && S_ISREG(st.st_mode));
+
+        assert(unlink("/negative/other") == 0);
+        assert(stat("/negative/other", &st) == -1 && errno == ENOENT);
+
+        assert(mkdir("/negative/name", 0777) == 0);
+        assert(stat("/negative/name", &st) == 0 && S_ISDIR(st.st_mode));
+        assert(stat("/negative/name/x", &st) == -1 && errno == ENOENT);
+        assert(rmdir("/negative/name") == 0);
+    }
+
+    assert(rmdir("/negative") == 0);
+
+    _passed(__FUNCTION__);
+}
+
 int main(int argc, const char* argv[])
 {
     if (argc != 2)
@@ -1061,6 +1204,8 @@ int main(int argc, const char* argv[])
     test_mkdir();
     test_rmdir();
     test_readdir();
+    test_large_dir();
+    test_negative_lookups();
     test_link();
     test_access();
     test_rename();
@@ -1069,6 +1214,10 @@ int main(int argc, const char* argv[])
     test_symlink();
     test_tmpfile();
     test_pread_pwrite();
+
+    if (strcmp(fstype, "ramfs") == 0)
+        test_sparse_file();
+
     test_sendfile(true);
     test_sendfile(false);
     test_statfs(argv[0]);
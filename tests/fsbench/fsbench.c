@@ -0,0 +1,147 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+** Multi-threaded file-system microbenchmark: every thread does stat/pread
+** pairs on the same file, so the threads contend for the same directory-tree
+** and inode locks, which they only take shared. With reader/writer locks
+** whose read side needs no mutex, throughput should scale with the number of
+** threads (up to the number of CPUs). A writer thread rewrites the file
+** meanwhile; it must keep making progress (writers must not starve).
+*/
+
+#define MAX_THREADS 64
+
+#define PATH "/data/fsbench"
+
+static size_t _iterations = 100000;
+
+static volatile int _stop;
+
+static uint64_t _now_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* _reader(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    struct stat st;
+    char buf[64];
+
+    for (size_t i = 0; i < _iterations; i++)
+    {
+        assert(stat(PATH, &st) == 0);
+        assert(pread(fd, buf, sizeof(buf), 0) == sizeof(buf));
+    }
+
+    return NULL;
+}
+
+static void* _writer(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    size_t nwrites = 0;
+    char buf[64];
+
+    memset(buf, 'y', sizeof(buf));
+
+    while (!__atomic_load_n(&_stop, __ATOMIC_RELAXED))
+    {
+        assert(pwrite(fd, buf, sizeof(buf), 0) == sizeof(buf));
+        nwrites++;
+        usleep(100);
+    }
+
+    return (void*)nwrites;
+}
+
+static double _run(size_t nthreads, size_t* nwrites)
+{
+    pthread_t threads[MAX_THREADS];
+    pthread_t writer;
+    void* result;
+    char buf[64];
+    int fd;
+    uint64_t start;
+    uint64_t elapsed;
+
+    memset(buf, 'x', sizeof(buf));
+    assert((fd = open(PATH, O_CREAT | O_RDWR | O_TRUNC, 0666)) >= 0);
+    assert(write(fd, buf, sizeof(buf)) == sizeof(buf));
+
+    _stop = 0;
+    assert(pthread_create(&writer, NULL, _writer, (void*)(intptr_t)fd) == 0);
+
+    start = _now_nsec();
+
+    for (size_t i = 0; i < nthreads; i++)
+    {
+        void* arg = (void*)(intptr_t)fd;
+        assert(pthread_create(&threads[i], NULL, _reader, arg) == 0);
+    }
+
+    for (size_t i = 0; i < nthreads; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    elapsed = _now_nsec() - start;
+
+    __atomic_store_n(&_stop, 1, __ATOMIC_RELAXED);
+    assert(pthread_join(writer, &result) == 0);
+    *nwrites = (size_t)result;
+
+    close(fd);
+
+    /* millions of operations per second */
+    return (2.0 * nthreads * _iterations) / (elapsed / 1000.0);
+}
+
+int main(int argc, const char* argv[])
+{
+    size_t max_threads = 8;
+    double base = 0;
+
+    if (argc > 1)
+        max_threads = strtoul(argv[1], NULL, 10);
+
+    if (argc > 2)
+        _iterations = strtoul(argv[2], NULL, 10);
+
+    assert(max_threads > 0 && max_threads <= MAX_THREADS);
+
+    for (size_t n = 1; n <= max_threads; n *= 2)
+    {
+        size_t nwrites;
+        double mops = _run(n, &nwrites);
+
+        if (n == 1)
+            base = mops;
+
+        printf(
+            "threads=%-3zu %8.2f Mops/sec  scaling=%.2fx  writes=%zu\n",
+            n,
+            mops,
+            mops / base,
+            nwrites);
+
+        /* the writer got the lock while the readers were running */
+        assert(nwrites > 0);
+    }
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+** Checks the CPIO root file system, whose entries ramfs creates lazily (see
+** myst_ramfs_load_cpio()). Each directory is first accessed by the operation
+** under test, since that access is what loads its entries.
+*/
+
+static void _check_file(const char* path, const char* data)
+{
+    char buf[64];
+    int fd;
+    ssize_t n;
+
+    assert((fd = open(path, O_RDONLY)) >= 0);
+    assert((n = read(fd, buf, sizeof(buf))) == (ssize_t)strlen(data));
+    assert(memcmp(buf, data, n) == 0);
+    close(fd);
+}
+
+static int _compare(const void* p1, const void* p2)
+{
+    return strcmp((const char*)p1, (const char*)p2);
+}
+
+/* the names of a directory (other than "." and "..") in sorted order */
+static size_t _list(const char* path, char names[][32], size_t max)
+{
+    DIR* dir;
+    struct dirent* ent;
+    size_t n = 0;
+
+    assert((dir = opendir(path)));
+
+    while ((ent = readdir(dir)))
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        assert(n < max);
+        assert(strlen(ent->d_name) < sizeof(names[n]));
+        strcpy(names[n++], ent->d_name);
+    }
+
+    closedir(dir);
+
+    qsort(names, n, sizeof(names[0]), _compare);
+
+    return n;
+}
+
+/* the archive's entries merge with the directories made before the load */
+static void _test_merge(void)
+{
+    char names[8][32];
+    size_t n;
+
+    /* /usr/local/etc is created by the kernel and implied by the archive */
+    n = _list("/usr/local", names, 8);
+    assert(n == 1);
+    assert(strcmp(names[0], "etc") == 0);
+
+    _check_file("/usr/local/etc/lazycpio.conf", "lazycpio\n");
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* getdents on a directory whose entries were never loaded */
+static void _test_getdents(void)
+{
+    char names[8][32];
+    size_t n;
+
+    n = _list("/data/implied", names, 8);
+    assert(n == 3);
+    assert(strcmp(names[0], "a.txt") == 0);
+    assert(strcmp(names[1], "b.txt") == 0);
+    assert(strcmp(names[2], "sub") == 0);
+
+    /* listing twice does not load the entries twice */
+    n = _list("/data/implied", names, 8);
+    assert(n == 3);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* directories that the archive implies but does not list */
+static void _test_implied(void)
+{
+    struct stat st;
+
+    assert(stat("/data", &st) == 0);
+    assert(S_ISDIR(st.st_mode));
+    assert((st.st_mode & 07777) == 0755);
+
+    assert(stat("/data/implied/sub", &st) == 0);
+    assert(S_ISDIR(st.st_mode));
+    assert((st.st_mode & 07777) == 0755);
+    _check_file("/data/implied/sub/c.txt", "gamma\n");
+
+    /* a listed directory keeps its mode */
+    assert(stat("/data/listed", &st) == 0);
+    assert(S_ISDIR(st.st_mode));
+    assert((st.st_mode & 07777) == 0700);
+    _check_file("/data/listed/d.txt", "delta\n");
+
+    assert(stat("/data/implied/none", &st) == -1);
+    assert(errno == ENOENT);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* rmdir checks the emptiness of a directory whose entries were never loaded */
+static void _test_rmdir(void)
+{
+    struct stat st;
+
+    assert(rmdir("/data/full") == -1);
+    assert(errno == ENOTEMPTY);
+
+    assert(unlink("/data/full/e.txt") == 0);
+    assert(rmdir("/data/full") == 0);
+    assert(stat("/data/full", &st) == -1);
+    assert(errno == ENOENT);
+
+    /* a listed empty directory */
+    assert(rmdir("/data/empty") == 0);
+
+    /* a directory created over the archive's */
+    assert(mkdir("/data/empty", 0755) == 0);
+    assert(mkdir("/data/implied", 0755) == -1);
+    assert(errno == EEXIST);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+/* files are backed by the archive until written */
+static void _test_write(void)
+{
+    struct stat st;
+    char buf[64];
+    int fd;
+
+    assert((fd = open("/data/implied/a.txt", O_RDWR)) >= 0);
+    assert(pwrite(fd, "ALP", 3, 0) == 3);
+    assert(pread(fd, buf, sizeof(buf), 0) == 6);
+    assert(memcmp(buf, "ALPha\n", 6) == 0);
+
+    /* extend the file past the archive data */
+    assert(pwrite(fd, "omega\n", 6, 6) == 6);
+    assert(fstat(fd, &st) == 0);
+    assert(st.st_size == 12);
+    close(fd);
+
+    _check_file("/data/implied/a.txt", "ALPha\nomega\n");
+
+    /* the file with the same content is unchanged */
+    _check_file("/data/implied/b.txt", "alpha\n");
+
+    /* truncate a file backed by the archive */
+    assert((fd = open("/data/implied/b.txt", O_WRONLY | O_TRUNC)) >= 0);
+    assert(fstat(fd, &st) == 0);
+    assert(st.st_size == 0);
+    assert(write(fd, "beta\n", 5) == 5);
+    close(fd);
+    _check_file("/data/implied/b.txt", "beta\n");
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    _test_merge();
+    _test_getdents();
+    _test_implied();
+    _test_rmdir();
+    _test_write();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <myst/cpio.h>
+
+/*
+** Creates a CPIO archive of a directory that lists the files but only the
+** given subdirectories, so that the other directories are implied by the
+** paths of their entries (as with "find . -type f | cpio -o").
+**
+** Usage: mkarchive <dir> <archive> [<listed-subdir>...]
+*/
+
+static myst_cpio_t* _cpio;
+static size_t _rootlen;
+static int _nlisted;
+static const char** _listed;
+
+static int _append(
+    const char* path,
+    const struct stat* st,
+    int flag,
+    struct FTW* f)
+{
+    const char* name = path + _rootlen;
+    myst_cpio_entry_t ent;
+    char buf[4096];
+    ssize_t n;
+    int fd;
+
+    (void)flag;
+    (void)f;
+
+    if (*name == '/')
+        name++;
+
+    if (*name == '\0')
+        return 0;
+
+    if (S_ISDIR(st->st_mode))
+    {
+        int i;
+
+        for (i = 0; i < _nlisted; i++)
+        {
+            if (strcmp(name, _listed[i]) == 0)
+                break;
+        }
+
+        if (i == _nlisted)
+            return 0;
+    }
+    else if (!S_ISREG(st->st_mode))
+    {
+        return 0;
+    }
+
+    memset(&ent, 0, sizeof(ent));
+    ent.mode = st->st_mode;
+    ent.size = S_ISREG(st->st_mode) ? (size_t)st->st_size : 0;
+
+    if (snprintf(ent.name, sizeof(ent.name), "%s", name) >= sizeof(ent.name))
+        return -1;
+
+    if (myst_cpio_write_entry(_cpio, &ent) != 0)
+        return -1;
+
+    if (S_ISREG(st->st_mode))
+    {
+        if ((fd = open(path, O_RDONLY)) < 0)
+            return -1;
+
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+        {
+            if (myst_cpio_write_data(_cpio, buf, (size_t)n) != 0)
+            {
+                close(fd);
+                return -1;
+            }
+        }
+
+        close(fd);
+    }
+
+    /* pad the entry */
+    if (myst_cpio_write_data(_cpio, NULL, 0) != 0)
+        return -1;
+
+    return 0;
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <dir> <archive> [<subdir>...]\n", argv[0]);
+        exit(1);
+    }
+
+    _rootlen = strlen(argv[1]);
+    _listed = argv + 3;
+    _nlisted = argc - 3;
+
+    if (!(_cpio = myst_cpio_open(argv[2], MYST_CPIO_FLAG_CREATE)))
+    {
+        fprintf(stderr, "%s: cannot create %s\n", argv[0], argv[2]);
+        exit(1);
+    }
+
+    if (nftw(argv[1], _append, 16, FTW_PHYS) != 0)
+    {
+        fprintf(stderr, "%s: cannot archive %s\n", argv[0], argv[1]);
+        exit(1);
+    }
+
+    if (myst_cpio_close(_cpio) != 0)
+    {
+        fprintf(stderr, "%s: cannot close %s\n", argv[0], argv[2]);
+        exit(1);
+    }
+
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include <limits.h>
 #include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -402,6 +403,77 @@ void test_multiple_readers_writers(bool slow_write, bool slow_read)
     printf("=== passed test (%s: %s/%s)\n", __FUNCTION__, msg1, msg2);
 }
 
+/*
+**==============================================================================
+**
+** test_flags_and_hangup()
+**
+**==============================================================================
+*/
+
+void test_flags_and_hangup(void)
+{
+    int fds[2];
+    char buf[PIPE_BUF];
+    size_t n = 0;
+    ssize_t r;
+    struct stat st;
+
+    printf("=== start test (%s)\n", __FUNCTION__);
+
+    assert(pipe2(fds, O_NONBLOCK) == 0);
+    assert(fstat(fds[0], &st) == 0);
+    assert(S_ISFIFO(st.st_mode));
+
+    /* the read end is empty */
+    assert(read(fds[0], buf, sizeof(buf)) == -1 && errno == EAGAIN);
+
+    /* clearing O_NONBLOCK on the read end leaves the write end alone */
+    assert(fcntl(fds[0], F_GETFL) & O_NONBLOCK);
+    assert(fcntl(fds[0], F_SETFL, 0) == 0);
+    assert(!(fcntl(fds[0], F_GETFL) & O_NONBLOCK));
+    assert(fcntl(fds[1], F_GETFL) & O_NONBLOCK);
+
+    /* fill the pipe until the write end would block */
+    memset(buf, 'x', sizeof(buf));
+    while ((r = write(fds[1], buf, sizeof(buf))) > 0)
+        n += r;
+
+    assert(r == -1 && errno == EAGAIN);
+    assert(n == fcntl(fds[1], F_GETPIPE_SZ));
+
+    /* the pipe cannot shrink below the data it holds */
+    assert(fcntl(fds[1], F_SETPIPE_SZ, PIPE_BUF) == -1 && errno == EBUSY);
+
+    /* closing the write end delivers the data and then end-of-file */
+    close(fds[1]);
+    while ((r = read(fds[0], buf, sizeof(buf))) > 0)
+        n -= r;
+
+    assert(r == 0 && n == 0);
+    {
+        struct pollfd pollfd = {.fd = fds[0], .events = POLLIN};
+        assert(poll(&pollfd, 1, 0) == 1);
+        assert(pollfd.revents == POLLHUP);
+    }
+    close(fds[0]);
+
+    /* writing with no readers fails with EPIPE */
+    assert(pipe(fds) == 0);
+    close(fds[0]);
+    signal(SIGPIPE, SIG_IGN);
+    assert(write(fds[1], buf, 1) == -1 && errno == EPIPE);
+    signal(SIGPIPE, SIG_DFL);
+    {
+        struct pollfd pollfd = {.fd = fds[1], .events = POLLOUT};
+        assert(poll(&pollfd, 1, 0) == 1);
+        assert(pollfd.revents & POLLERR);
+    }
+    close(fds[1]);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 /*
 **==============================================================================
 **
@@ -421,6 +493,9 @@ int main(int argc, const char* argv[])
     /* test whether pipe size can be determined through polling */
     test_pipe_size();
 
+    /* test O_NONBLOCK, F_SETPIPE_SZ, and the hangup of either end */
+    test_flags_and_hangup();
+
     /* test multiple readers/writers in all combinations of fast/slow */
     test_multiple_readers_writers(false, false);
     test_multiple_readers_writers(false, true);
@@ -74,6 +74,39 @@ int main(int argc, const char* argv[])
         assert(fds[1].revents == POLLIN);
     }
 
+    /* Test that negative fds are ignored and stale revents are cleared */
+    {
+        int pipefd[2];
+        struct pollfd fds[2];
+        assert(pipe(pipefd) == 0);
+        fds[0].fd = -1;
+        fds[0].events = POLLIN;
+        fds[0].revents = POLLIN;
+        fds[1].fd = pipefd[0];
+        fds[1].events = POLLIN;
+        fds[1].revents = POLLIN;
+
+        /* the whole timeout elapses when nothing becomes ready */
+        struct timeval tv0 = {0L, 0L};
+        assert(gettimeofday(&tv0, NULL) == 0);
+        assert(poll(fds, 2, 200) == 0);
+        struct timeval tv1 = {0L, 0L};
+        assert(gettimeofday(&tv1, NULL) == 0);
+        const uint64_t t0 = tv0.tv_sec * 1000000 + tv0.tv_usec;
+        const uint64_t t1 = tv1.tv_sec * 1000000 + tv1.tv_usec;
+        assert(t1 - t0 >= 190000);
+        assert(fds[0].revents == 0);
+        assert(fds[1].revents == 0);
+
+        assert(write(pipefd[1], "x", 1) == 1);
+        assert(poll(fds, 2, -1) == 1);
+        assert(fds[0].revents == 0);
+        assert(fds[1].revents == POLLIN);
+
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+
     /* Test poll() with illegal parameters */
     assert(poll(NULL, 1, 0) == -1);
     assert(errno == EFAULT);
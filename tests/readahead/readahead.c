@@ -0,0 +1,265 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define PORT 12347
+
+/* the test runs with "SocketReadAheadKB": 4 */
+#define READ_AHEAD_SIZE 4096
+
+static int _client;
+static int _server;
+
+static void _connect(void)
+{
+    struct sockaddr_in addr;
+    struct pollfd pfd;
+    int listener;
+    const int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert((listener = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ==
+        0);
+    assert(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert(listen(listener, 1) == 0);
+
+    assert((_client = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+
+    /* a socket polled before connect() keeps the host data path (rather
+     * than being paired with the listener within the kernel) */
+    pfd.fd = _client;
+    pfd.events = POLLOUT;
+    assert(poll(&pfd, 1, 0) >= 0);
+
+    assert(connect(_client, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert((_server = accept(listener, NULL, NULL)) >= 0);
+    close(listener);
+}
+
+static void _send(const char* str)
+{
+    const size_t len = strlen(str);
+
+    assert(send(_server, str, len, 0) == (ssize_t)len);
+
+    /* let the data arrive */
+    usleep(10000);
+}
+
+static void* _send_later_thread(void* arg)
+{
+    usleep(50000);
+    _send((const char*)arg);
+    return NULL;
+}
+
+static void _send_later(const char* str)
+{
+    pthread_t thread;
+
+    assert(pthread_create(&thread, NULL, _send_later_thread, (void*)str) == 0);
+    assert(pthread_detach(thread) == 0);
+}
+
+static void _recv(int flags, size_t len, const char* expect)
+{
+    char buf[READ_AHEAD_SIZE];
+    const size_t n = strlen(expect);
+
+    assert(len <= sizeof(buf));
+    assert(recv(_client, buf, len, flags) == (ssize_t)n);
+    assert(memcmp(buf, expect, n) == 0);
+}
+
+static void _test_small_reads(void)
+{
+    int n;
+
+    _send("GET / HTTP/1.1\r\n");
+
+    /* the first read buffers the whole line */
+    _recv(0, 4, "GET ");
+    assert(ioctl(_client, FIONREAD, &n) == 0);
+    assert(n == 12);
+
+    _recv(MSG_PEEK, 2, "/ ");
+    _recv(0, 2, "/ ");
+    _recv(0, 100, "HTTP/1.1\r\n");
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_poll(void)
+{
+    struct pollfd pfd = {.fd = _client, .events = POLLIN};
+
+    assert(poll(&pfd, 1, 0) == 0);
+
+    _send("abcdef");
+    _recv(0, 1, "a");
+
+    /* the host has nothing left to report */
+    assert(poll(&pfd, 1, 0) == 1);
+    assert(pfd.revents == POLLIN);
+
+    /* the host events are still reported */
+    pfd.events = POLLIN | POLLOUT;
+    assert(poll(&pfd, 1, 0) == 1);
+    assert(pfd.revents == (POLLIN | POLLOUT));
+
+    pfd.events = POLLOUT;
+    assert(poll(&pfd, 1, 0) == 1);
+    assert(pfd.revents == POLLOUT);
+
+    _recv(0, 10, "bcdef");
+
+    pfd.events = POLLIN;
+    assert(poll(&pfd, 1, 0) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_epoll(void)
+{
+    struct epoll_event ev = {.events = EPOLLIN};
+    struct epoll_event events[4];
+    int epfd;
+
+    assert((epfd = epoll_create1(0)) >= 0);
+    ev.data.fd = _client;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, _client, &ev) == 0);
+    assert(epoll_wait(epfd, events, 4, 0) == 0);
+
+    _send_later("0123456789");
+    assert(epoll_wait(epfd, events, 4, 1000) == 1);
+    assert(events[0].events == EPOLLIN);
+    assert(events[0].data.fd == _client);
+
+    /* level-triggered: reported until the buffer is drained */
+    _recv(0, 4, "0123");
+    assert(epoll_wait(epfd, events, 4, 0) == 1);
+    assert(events[0].events == EPOLLIN);
+    assert(epoll_wait(epfd, events, 4, 0) == 1);
+    _recv(0, 6, "456789");
+    assert(epoll_wait(epfd, events, 4, 0) == 0);
+
+    /* one-shot: reported once (buffered or not) until re-armed */
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, _client, &ev) == 0);
+    _send("xyz");
+    assert(epoll_wait(epfd, events, 4, 0) == 1);
+    _recv(0, 1, "x");
+    assert(epoll_wait(epfd, events, 4, 0) == 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, _client, &ev) == 0);
+    assert(epoll_wait(epfd, events, 4, 0) == 1);
+    _recv(0, 2, "yz");
+
+    close(epfd);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_waitall(void)
+{
+    /* part from the buffer, the rest from the host */
+    _send("hello");
+    _recv(0, 1, "h");
+    _send_later(" world");
+    _recv(MSG_WAITALL, 10, "ello world");
+
+    /* a peek waits for all of the bytes too */
+    _send("12");
+    _send_later("345");
+    _recv(MSG_PEEK | MSG_WAITALL, 5, "12345");
+    _recv(0, 5, "12345");
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_nonblocking(void)
+{
+    char c;
+    const int flags = fcntl(_client, F_GETFL);
+
+    assert(fcntl(_client, F_SETFL, flags | O_NONBLOCK) == 0);
+    assert(recv(_client, &c, 1, 0) == -1 && errno == EAGAIN);
+
+    _send("ab");
+    _recv(0, 1, "a");
+    _recv(0, 1, "b");
+    assert(recv(_client, &c, 1, 0) == -1 && errno == EAGAIN);
+
+    assert(fcntl(_client, F_SETFL, flags) == 0);
+
+    _send("cd");
+    _recv(0, 1, "c");
+    assert(recv(_client, &c, 1, MSG_DONTWAIT) == 1 && c == 'd');
+    assert(recv(_client, &c, 1, MSG_DONTWAIT) == -1 && errno == EAGAIN);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_dup(void)
+{
+    int fd;
+
+    /* duplicates share the buffered input */
+    assert((fd = dup(_client)) >= 0);
+    _send("12345678");
+    _recv(0, 3, "123");
+    assert(read(fd, (char[8]){0}, 5) == 5);
+    close(fd);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_eof(void)
+{
+    char c;
+
+    _send("end");
+    close(_server);
+    _recv(0, 1, "e");
+    _recv(0, 10, "nd");
+    assert(recv(_client, &c, 1, 0) == 0);
+    close(_client);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    _connect();
+    _test_small_reads();
+    _test_poll();
+    _test_epoll();
+    _test_waitall();
+    _test_nonblocking();
+    _test_dup();
+    _test_eof();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -59,7 +59,7 @@ int main(int argc, char* argv[])
     assert_rlimit(RLIMIT_CORE, "RLIMIT_CORE", 0, 0);
     assert_rlimit(RLIMIT_RSS, "RLIMIT_RSS", RLIM_INFINITY, RLIM_INFINITY);
     assert_rlimit(RLIMIT_NPROC, "RLIMIT_NPROC", 1024, 1024);
-    assert_rlimit(RLIMIT_NOFILE, "RLIMIT_NOFILE", 1024, 1024);
+    assert_rlimit(RLIMIT_NOFILE, "RLIMIT_NOFILE", 1024, 1048576);
     assert_error(RLIMIT_MEMLOCK, "RLIMIT_MEMLOCK");
     assert_rlimit(RLIMIT_AS, "RLIMIT_AS", RLIM_INFINITY, RLIM_INFINITY);
     assert_rlimit(RLIMIT_LOCKS, "RLIMIT_LOCKS", RLIM_INFINITY, RLIM_INFINITY);
@@ -4,13 +4,18 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
@@ -81,6 +86,10 @@ static void* _srv_thread_func(void* arg)
         assert((buf.st_mode & 0x000001ff) == 0777);
 
         assert(bind(lsock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+        /* the name is a socket node in the enclave file system */
+        assert(stat(args->path, &buf) == 0);
+        assert(S_ISSOCK(buf.st_mode));
     }
     else
     {
@@ -195,6 +204,291 @@ void test_sockets(args_t* args)
     printf("=== passed test (test_sockets: domain=%d)\n", args->domain);
 }
 
+static void _send_fd(int sock, int fd)
+{
+    char data = 'x';
+    struct iovec iov = {&data, 1};
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = {0};
+    struct cmsghdr* cmsg;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = sizeof(buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    assert(sendmsg(sock, &msg, 0) == 1);
+}
+
+static int _recv_fd(int sock)
+{
+    char data;
+    struct iovec iov = {&data, 1};
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = {0};
+    struct cmsghdr* cmsg;
+    int fd;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = sizeof(buf);
+
+    assert(recvmsg(sock, &msg, 0) == 1);
+    assert(data == 'x');
+    assert(!(msg.msg_flags & MSG_CTRUNC));
+    assert((cmsg = CMSG_FIRSTHDR(&msg)));
+    assert(cmsg->cmsg_level == SOL_SOCKET);
+    assert(cmsg->cmsg_type == SCM_RIGHTS);
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+    return fd;
+}
+
+void test_socketpair(int type)
+{
+    int sv[2];
+    int pipefd[2];
+    char buf[64];
+    int fd;
+
+    assert(socketpair(AF_UNIX, type, 0, sv) == 0);
+
+    /* records keep their boundaries, streams do not */
+    assert(send(sv[0], "abc", 3, 0) == 3);
+    assert(send(sv[0], "defgh", 5, 0) == 5);
+
+    if (type == SOCK_STREAM)
+    {
+        assert(recv(sv[1], buf, sizeof(buf), MSG_WAITALL | MSG_DONTWAIT) == 8);
+        assert(memcmp(buf, "abcdefgh", 8) == 0);
+    }
+    else
+    {
+        assert(recv(sv[1], buf, 2, 0) == 2);
+        assert(recv(sv[1], buf, sizeof(buf), 0) == 5);
+        assert(memcmp(buf, "defgh", 5) == 0);
+    }
+
+    assert(recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) == -1);
+    assert(errno == EAGAIN);
+
+    if (type == SOCK_STREAM)
+    {
+        struct timeval tv = {.tv_sec = 0, .tv_usec = 50000};
+        const socklen_t len = sizeof(tv);
+        struct timespec start;
+        struct timespec end;
+        long msec;
+
+        /* an empty write sends nothing */
+        assert(send(sv[0], "", 0, 0) == 0);
+        assert(recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) == -1);
+        assert(errno == EAGAIN);
+
+        /* a receive timeout bounds the whole call */
+        assert(setsockopt(sv[1], SOL_SOCKET, SO_RCVTIMEO, &tv, len) == 0);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        assert(recv(sv[1], buf, sizeof(buf), 0) == -1);
+        assert(errno == EAGAIN || errno == EWOULDBLOCK);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        msec = (end.tv_sec - start.tv_sec) * 1000 +
+               (end.tv_nsec - start.tv_nsec) / 1000000;
+        assert(msec >= 40 && msec < 5000);
+
+        tv.tv_usec = 0;
+        assert(setsockopt(sv[1], SOL_SOCKET, SO_RCVTIMEO, &tv, len) == 0);
+    }
+
+    /* pass the write end of a pipe and write to it from the other side */
+    assert(pipe(pipefd) == 0);
+    _send_fd(sv[0], pipefd[1]);
+    close(pipefd[1]);
+    fd = _recv_fd(sv[1]);
+    assert(write(fd, "pipe", 4) == 4);
+    close(fd);
+    assert(read(pipefd[0], buf, sizeof(buf)) == 4);
+    assert(memcmp(buf, "pipe", 4) == 0);
+    assert(read(pipefd[0], buf, sizeof(buf)) == 0);
+    close(pipefd[0]);
+
+    /* the peer sees end-of-file once the other end is closed */
+    close(sv[0]);
+
+    if (type != SOCK_DGRAM)
+        assert(recv(sv[1], buf, sizeof(buf), 0) == 0);
+
+    close(sv[1]);
+
+    printf("=== passed test (test_socketpair: type=%d)\n", type);
+}
+
+static void _wait_epoll(int fd, uint32_t events)
+{
+    int epfd;
+    struct epoll_event ev = {.events = events, .data.fd = fd};
+
+    assert((epfd = epoll_create1(0)) >= 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0);
+    memset(&ev, 0, sizeof(ev));
+    assert(epoll_wait(epfd, &ev, 1, 5000) == 1);
+    assert(ev.data.fd == fd);
+    assert(ev.events & events);
+    close(epfd);
+}
+
+/* exchange data between a connected client and its accepted peer */
+static void _check_pair(int cli, int srv)
+{
+    struct sockaddr_in cli_addr;
+    struct sockaddr_in srv_addr;
+    struct sockaddr_in addr;
+    socklen_t len;
+    char buf[64];
+
+    /* the addresses of either end agree */
+    len = sizeof(cli_addr);
+    assert(getsockname(cli, (struct sockaddr*)&cli_addr, &len) == 0);
+    len = sizeof(addr);
+    assert(getpeername(srv, (struct sockaddr*)&addr, &len) == 0);
+    assert(addr.sin_port == cli_addr.sin_port);
+    assert(addr.sin_addr.s_addr == cli_addr.sin_addr.s_addr);
+    assert(cli_addr.sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+
+    len = sizeof(srv_addr);
+    assert(getsockname(srv, (struct sockaddr*)&srv_addr, &len) == 0);
+    len = sizeof(addr);
+    assert(getpeername(cli, (struct sockaddr*)&addr, &len) == 0);
+    assert(addr.sin_port == srv_addr.sin_port);
+    assert(srv_addr.sin_port == htons(port + 1));
+
+    /* data in both directions, with epoll readiness on both ends */
+    assert(send(cli, alpha, sizeof(alpha), 0) == sizeof(alpha));
+    _wait_epoll(srv, EPOLLIN);
+    assert(recv(srv, buf, sizeof(alpha), MSG_WAITALL) == sizeof(alpha));
+    assert(memcmp(buf, alpha, sizeof(alpha)) == 0);
+
+    assert(send(srv, "reply", 5, 0) == 5);
+    _wait_epoll(cli, EPOLLIN);
+    assert(recv(cli, buf, sizeof(buf), 0) == 5);
+    assert(memcmp(buf, "reply", 5) == 0);
+    _wait_epoll(cli, EPOLLOUT);
+
+    /* shutdown of the client's write side: the peer sees end-of-file but
+     * may still send */
+    assert(shutdown(cli, SHUT_WR) == 0);
+    _wait_epoll(srv, EPOLLIN);
+    assert(recv(srv, buf, sizeof(buf), 0) == 0);
+    assert(send(srv, "more", 4, 0) == 4);
+    assert(recv(cli, buf, sizeof(buf), 0) == 4);
+    assert(memcmp(buf, "more", 4) == 0);
+
+    /* close of the peer: the client sees end-of-file */
+    close(srv);
+    _wait_epoll(cli, EPOLLIN);
+    assert(recv(cli, buf, sizeof(buf), 0) == 0);
+    close(cli);
+}
+
+static int _lo_connect(bool nonblock)
+{
+    struct sockaddr_in addr;
+    int sock;
+    int type = SOCK_STREAM | (nonblock ? SOCK_NONBLOCK : 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port + 1);
+
+    assert((sock = socket(AF_INET, type, 0)) >= 0);
+
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        struct pollfd fds = {.fd = sock, .events = POLLOUT};
+        int err = -1;
+        socklen_t len = sizeof(err);
+
+        assert(nonblock && errno == EINPROGRESS);
+        assert(poll(&fds, 1, 5000) == 1);
+        assert(fds.revents & POLLOUT);
+        assert(getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) == 0);
+        assert(err == 0);
+    }
+
+    return sock;
+}
+
+/* TCP connections to a listener of this process over the loopback address */
+void test_loopback_tcp(void)
+{
+    struct sockaddr_in addr;
+    const int on = 1;
+    int listener;
+    int cli;
+    int srv;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port + 1);
+
+    assert((listener = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    assert(
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0);
+    assert(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert(listen(listener, 8) == 0);
+
+    /* blocking connect */
+    cli = _lo_connect(false);
+    assert((srv = accept(listener, NULL, NULL)) >= 0);
+    _check_pair(cli, srv);
+
+    /* non-blocking connect */
+    cli = _lo_connect(true);
+    assert((srv = accept(listener, NULL, NULL)) >= 0);
+    assert(fcntl(cli, F_SETFL, 0) == 0);
+    _check_pair(cli, srv);
+
+    /* a non-blocking listener never waits */
+    assert(fcntl(listener, F_SETFL, O_NONBLOCK) == 0);
+    assert(accept(listener, NULL, NULL) == -1);
+    assert(errno == EAGAIN || errno == EWOULDBLOCK);
+
+    cli = _lo_connect(false);
+    _wait_epoll(listener, EPOLLIN);
+    assert((srv = accept(listener, NULL, NULL)) >= 0);
+    _check_pair(cli, srv);
+    assert(fcntl(listener, F_SETFL, 0) == 0);
+
+    /* a client watched by epoll before connect() keeps the host connection,
+     * so its peer is accepted as a host connection */
+    {
+        int epfd;
+        struct epoll_event ev = {.events = EPOLLIN};
+
+        assert((cli = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+        assert((epfd = epoll_create1(0)) >= 0);
+        ev.data.fd = cli;
+        assert(epoll_ctl(epfd, EPOLL_CTL_ADD, cli, &ev) == 0);
+        assert(epoll_wait(epfd, &ev, 1, 0) >= 0);
+        close(epfd);
+
+        assert(connect(cli, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        assert((srv = accept(listener, NULL, NULL)) >= 0);
+        _check_pair(cli, srv);
+    }
+
+    close(listener);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
 int main(int argc, const char* argv[])
 {
     if (argc != 2)
@@ -208,6 +502,10 @@ int main(int argc, const char* argv[])
 
     test_sockets(&inet_args);
     test_sockets(&unix_args);
+    test_socketpair(SOCK_STREAM);
+    test_socketpair(SOCK_DGRAM);
+    test_socketpair(SOCK_SEQPACKET);
+    test_loopback_tcp();
 
     printf("=== passed test (%s)\n", argv[0]);
     return 0;
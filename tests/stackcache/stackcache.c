@@ -0,0 +1,129 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_ITERATIONS 256
+#define NUM_THREADS 4
+
+static __thread int _tls_value;
+static __thread char _tls_buf[256];
+static volatile int _num_detached;
+
+static void _check_fresh_thread(void)
+{
+    /* a recycled stack must not leak the TLS of the previous thread */
+    assert(_tls_value == 0);
+
+    for (size_t i = 0; i < sizeof(_tls_buf); i++)
+        assert(_tls_buf[i] == 0);
+
+    _tls_value = 0x12345678;
+    memset(_tls_buf, 0xab, sizeof(_tls_buf));
+}
+
+static void* _joinable_start(void* arg)
+{
+    char buf[4096];
+
+    _check_fresh_thread();
+
+    /* dirty the stack */
+    memset(buf, 0xcd, sizeof(buf));
+    __asm__ __volatile__("" : : "r"(buf) : "memory");
+
+    return arg;
+}
+
+static void* _detached_start(void* arg)
+{
+    _check_fresh_thread();
+    __sync_fetch_and_add(&_num_detached, 1);
+    return arg;
+}
+
+static void _test_joinable(void)
+{
+    for (size_t i = 0; i < NUM_ITERATIONS; i++)
+    {
+        pthread_t threads[NUM_THREADS];
+
+        for (size_t j = 0; j < NUM_THREADS; j++)
+        {
+            void* arg = (void*)(j + 1);
+            int r = pthread_create(&threads[j], NULL, _joinable_start, arg);
+            assert(r == 0);
+        }
+
+        for (size_t j = 0; j < NUM_THREADS; j++)
+        {
+            void* retval = NULL;
+            assert(pthread_join(threads[j], &retval) == 0);
+            assert(retval == (void*)(j + 1));
+        }
+    }
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_detached(void)
+{
+    pthread_attr_t attr;
+
+    assert(pthread_attr_init(&attr) == 0);
+    assert(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0);
+
+    for (size_t i = 0; i < NUM_ITERATIONS; i++)
+    {
+        pthread_t thread;
+        const int n = _num_detached;
+
+        assert(pthread_create(&thread, &attr, _detached_start, NULL) == 0);
+
+        while (_num_detached == n)
+            usleep(100);
+    }
+
+    pthread_attr_destroy(&attr);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_guard_size(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    /* vary the guard size so differently-sized mappings are requested */
+    assert(pthread_attr_init(&attr) == 0);
+    assert(pthread_attr_setguardsize(&attr, 2 * 4096) == 0);
+
+    for (size_t i = 0; i < NUM_ITERATIONS; i++)
+    {
+        assert(pthread_create(&thread, &attr, _joinable_start, NULL) == 0);
+        assert(pthread_join(thread, NULL) == 0);
+        assert(pthread_create(&thread, NULL, _joinable_start, NULL) == 0);
+        assert(pthread_join(thread, NULL) == 0);
+    }
+
+    pthread_attr_destroy(&attr);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    _test_joinable();
+    _test_detached();
+    _test_guard_size();
+
+    printf("=== passed test (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,283 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t _now_msec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void _test_timerfd_read(void)
+{
+    struct itimerspec its;
+    uint64_t ticks;
+    uint64_t start = _now_msec();
+    int fd;
+
+    assert((fd = timerfd_create(CLOCK_MONOTONIC, 0)) >= 0);
+
+    /* fire every 10 milliseconds */
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = 10 * 1000000;
+    its.it_interval.tv_nsec = 10 * 1000000;
+    assert(timerfd_settime(fd, 0, &its, NULL) == 0);
+
+    /* a blocking read waits for the first expiration */
+    assert(read(fd, &ticks, sizeof(ticks)) == sizeof(ticks));
+    assert(ticks >= 1);
+    assert(_now_msec() - start >= 10);
+
+    /* expirations accumulate between reads */
+    usleep(55000);
+    assert(read(fd, &ticks, sizeof(ticks)) == sizeof(ticks));
+    assert(ticks >= 4);
+
+    assert(timerfd_gettime(fd, &its) == 0);
+    assert(its.it_interval.tv_nsec == 10 * 1000000);
+
+    /* disarming discards unread expirations */
+    memset(&its, 0, sizeof(its));
+    assert(timerfd_settime(fd, 0, &its, NULL) == 0);
+    assert(fcntl(fd, F_SETFL, O_NONBLOCK) == 0);
+    assert(read(fd, &ticks, sizeof(ticks)) == -1 && errno == EAGAIN);
+
+    /* reads smaller than eight bytes fail */
+    assert(read(fd, &ticks, 4) == -1 && errno == EINVAL);
+
+    close(fd);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_timerfd_poll(void)
+{
+    struct itimerspec its;
+    struct pollfd pfd;
+    uint64_t ticks;
+    int fd;
+
+    assert((fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK)) >= 0);
+
+    /* not readable while disarmed */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    assert(poll(&pfd, 1, 20) == 0);
+
+    /* one-shot absolute expiration 30 milliseconds from now */
+    memset(&its, 0, sizeof(its));
+    clock_gettime(CLOCK_REALTIME, &its.it_value);
+    its.it_value.tv_nsec += 30 * 1000000;
+    if (its.it_value.tv_nsec >= 1000000000)
+    {
+        its.it_value.tv_sec++;
+        its.it_value.tv_nsec -= 1000000000;
+    }
+
+    assert(timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) == 0);
+
+    assert(poll(&pfd, 1, 5000) == 1);
+    assert(pfd.revents & POLLIN);
+    assert(read(fd, &ticks, sizeof(ticks)) == sizeof(ticks));
+    assert(ticks == 1);
+
+    /* the one-shot timer is now disarmed */
+    assert(timerfd_gettime(fd, &its) == 0);
+    assert(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0);
+    assert(poll(&pfd, 1, 0) == 0);
+
+    close(fd);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_timerfd_epoll(void)
+{
+    struct itimerspec its;
+    struct epoll_event ev;
+    uint64_t ticks;
+    int epfd;
+    int fd;
+    int dupfd;
+
+    assert((fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) >= 0);
+    assert(fcntl(fd, F_GETFD) == FD_CLOEXEC);
+    assert((epfd = epoll_create1(0)) >= 0);
+
+    /* a duplicate refers to the same timer */
+    assert((dupfd = dup(fd)) >= 0);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = dupfd;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, dupfd, &ev) == 0);
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = 20 * 1000000;
+    assert(timerfd_settime(fd, 0, &its, NULL) == 0);
+
+    memset(&ev, 0, sizeof(ev));
+    assert(epoll_wait(epfd, &ev, 1, 5000) == 1);
+    assert(ev.data.fd == dupfd);
+    assert(read(dupfd, &ticks, sizeof(ticks)) == sizeof(ticks));
+    assert(ticks == 1);
+
+    close(dupfd);
+    close(epfd);
+    close(fd);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_timerfd_close_periodic(void)
+{
+    struct itimerspec its;
+
+    /* close periodic timers while they are firing (the timer callback must
+     * not re-arm a released timer) */
+    for (size_t i = 0; i < 100; i++)
+    {
+        int fd;
+
+        assert((fd = timerfd_create(CLOCK_MONOTONIC, 0)) >= 0);
+
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_nsec = 1000;
+        its.it_interval.tv_nsec = 1000;
+        assert(timerfd_settime(fd, 0, &its, NULL) == 0);
+
+        usleep(i % 10 * 100);
+        close(fd);
+    }
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void* _kill_thread(void* arg)
+{
+    usleep(20000);
+    assert(kill(getpid(), (int)(long)arg) == 0);
+    return NULL;
+}
+
+static void _test_signalfd_blocking(void)
+{
+    struct signalfd_siginfo ssi;
+    struct epoll_event ev;
+    pthread_t thread;
+    sigset_t mask;
+    int epfd;
+    int fd;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    assert(sigprocmask(SIG_BLOCK, &mask, NULL) == 0);
+
+    assert((fd = signalfd(-1, &mask, 0)) >= 0);
+
+    /* a blocking read is woken by a signal sent from another thread */
+    assert(pthread_create(&thread, NULL, _kill_thread, (void*)SIGUSR1) == 0);
+    assert(read(fd, &ssi, sizeof(ssi)) == sizeof(ssi));
+    assert(ssi.ssi_signo == SIGUSR1);
+    assert(pthread_join(thread, NULL) == 0);
+
+    /* so is epoll_wait() */
+    assert((epfd = epoll_create1(0)) >= 0);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0);
+
+    assert(epoll_wait(epfd, &ev, 1, 0) == 0);
+    assert(pthread_create(&thread, NULL, _kill_thread, (void*)SIGUSR1) == 0);
+    assert(epoll_wait(epfd, &ev, 1, 5000) == 1);
+    assert(ev.data.fd == fd);
+    assert(pthread_join(thread, NULL) == 0);
+
+    assert(read(fd, &ssi, sizeof(ssi)) == sizeof(ssi));
+    assert(ssi.ssi_signo == SIGUSR1);
+
+    close(epfd);
+    close(fd);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_signalfd(void)
+{
+    struct signalfd_siginfo ssi[2];
+    struct pollfd pfd;
+    sigset_t mask;
+    int fd;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    assert(sigprocmask(SIG_BLOCK, &mask, NULL) == 0);
+
+    assert((fd = signalfd(-1, &mask, SFD_NONBLOCK)) >= 0);
+
+    /* nothing pending yet */
+    assert(read(fd, ssi, sizeof(ssi)) == -1 && errno == EAGAIN);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    assert(poll(&pfd, 1, 0) == 0);
+
+    assert(kill(getpid(), SIGUSR1) == 0);
+    assert(kill(getpid(), SIGUSR2) == 0);
+
+    assert(poll(&pfd, 1, 5000) == 1);
+    assert(pfd.revents & POLLIN);
+
+    /* both signals are returned by one read */
+    assert(read(fd, ssi, sizeof(ssi)) == 2 * sizeof(ssi[0]));
+    assert(ssi[0].ssi_signo == SIGUSR1);
+    assert(ssi[1].ssi_signo == SIGUSR2);
+    assert(ssi[0].ssi_pid == (uint32_t)getpid());
+
+    /* the signals were consumed */
+    assert(read(fd, ssi, sizeof(ssi)) == -1 && errno == EAGAIN);
+
+    /* change the mask of the existing signalfd */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+    assert(signalfd(fd, &mask, 0) == fd);
+
+    assert(kill(getpid(), SIGUSR2) == 0);
+    assert(read(fd, ssi, sizeof(ssi)) == sizeof(ssi[0]));
+    assert(ssi[0].ssi_signo == SIGUSR2);
+
+    close(fd);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    _test_timerfd_read();
+    _test_timerfd_poll();
+    _test_timerfd_epoll();
+    _test_timerfd_close_periodic();
+    _test_signalfd();
+    _test_signalfd_blocking();
+
+    printf("=== passed all tests (%s)\n", argv[0]);
+
+    return 0;
+}
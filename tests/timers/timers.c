@@ -0,0 +1,281 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t _count;
+static volatile sig_atomic_t _value;
+static volatile sig_atomic_t _code;
+static volatile sig_atomic_t _got_sigprof;
+
+static void _handler(int signo, siginfo_t* si, void* context)
+{
+    (void)signo;
+    (void)context;
+
+    _count++;
+    _value = si->si_value.sival_int;
+    _code = si->si_code;
+}
+
+static void _sigprof_handler(int signo)
+{
+    if (signo == SIGPROF)
+        _got_sigprof = 1;
+}
+
+static uint64_t _now_msec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void _sleep_msec(uint64_t msec)
+{
+    struct timespec req = {msec / 1000, (msec % 1000) * 1000000};
+    struct timespec rem;
+
+    while (nanosleep(&req, &rem) != 0 && errno == EINTR)
+        req = rem;
+}
+
+static volatile sig_atomic_t _got_sigalrm;
+
+static void _sigalrm_handler(int signo)
+{
+    if (signo == SIGALRM)
+        _got_sigalrm = 1;
+}
+
+/* wait for SIGALRM from a one-shot ITIMER_REAL timer */
+static void _alarm(uint64_t msec)
+{
+    struct itimerval itv = {.it_value = {0, msec * 1000}};
+    uint64_t start = _now_msec();
+
+    _got_sigalrm = 0;
+    assert(signal(SIGALRM, _sigalrm_handler) != SIG_ERR);
+    assert(setitimer(ITIMER_REAL, &itv, NULL) == 0);
+
+    while (!_got_sigalrm)
+    {
+        assert(_now_msec() - start < 5000);
+        _sleep_msec(1);
+    }
+}
+
+/* the child starts the timer thread and exits while the parent uses timers */
+static int _child(int rfd, int wfd)
+{
+    char c = 0;
+
+    _alarm(10);
+
+    /* the parent's timer thread now stands by */
+    assert(write(wfd, &c, 1) == 1);
+    assert(read(rfd, &c, 1) == 1);
+
+    return 0;
+}
+
+static void _test_timer_thread_handover(const char* argv0)
+{
+    int p2c[2];
+    int c2p[2];
+    char rfd[16];
+    char wfd[16];
+    pid_t pid;
+    int status;
+    char c = 0;
+
+    assert(pipe(p2c) == 0);
+    assert(pipe(c2p) == 0);
+
+    snprintf(rfd, sizeof(rfd), "%d", p2c[0]);
+    snprintf(wfd, sizeof(wfd), "%d", c2p[1]);
+
+    {
+        char* args[] = {(char*)argv0, "child", rfd, wfd, NULL};
+        assert(posix_spawn(&pid, argv0, NULL, NULL, args, NULL) == 0);
+    }
+
+    /* wait until the child's timer thread services the timers */
+    assert(read(c2p[0], &c, 1) == 1);
+
+    /* this process's timer thread stands by while the child's runs */
+    {
+        struct itimerval itv = {.it_value = {0, 200 * 1000}};
+        _got_sigalrm = 0;
+        assert(signal(SIGALRM, _sigalrm_handler) != SIG_ERR);
+        assert(setitimer(ITIMER_REAL, &itv, NULL) == 0);
+    }
+
+    /* let the child exit (with its timer thread) before the timer expires */
+    assert(write(p2c[1], &c, 1) == 1);
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    /* the standby thread took over and delivers this process's timers */
+    {
+        uint64_t start = _now_msec();
+
+        while (!_got_sigalrm)
+        {
+            assert(_now_msec() - start < 5000);
+            _sleep_msec(1);
+        }
+    }
+
+    _alarm(10);
+
+    close(p2c[0]);
+    close(p2c[1]);
+    close(c2p[0]);
+    close(c2p[1]);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_periodic_timer(void)
+{
+    struct sigaction sa;
+    struct sigevent sev;
+    struct itimerspec its;
+    timer_t timer;
+    int count;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = _handler;
+    sa.sa_flags = SA_SIGINFO;
+    assert(sigaction(SIGRTMIN, &sa, NULL) == 0);
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGRTMIN;
+    sev.sigev_value.sival_int = 42;
+    assert(timer_create(CLOCK_MONOTONIC, &sev, &timer) == 0);
+
+    /* a disarmed timer reports zero */
+    assert(timer_gettime(timer, &its) == 0);
+    assert(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0);
+
+    /* fire every 10 milliseconds */
+    its.it_value.tv_sec = 0;
+    its.it_value.tv_nsec = 10 * 1000000;
+    its.it_interval = its.it_value;
+    assert(timer_settime(timer, 0, &its, NULL) == 0);
+
+    _sleep_msec(200);
+
+    assert(timer_gettime(timer, &its) == 0);
+    assert(its.it_interval.tv_nsec == 10 * 1000000);
+    assert(its.it_value.tv_sec == 0);
+    assert(its.it_value.tv_nsec <= 10 * 1000000);
+    assert(timer_getoverrun(timer) >= 0);
+
+    assert(timer_delete(timer) == 0);
+    count = _count;
+
+    /* about 20 expirations in 200 milliseconds (allowing for delays) */
+    assert(count >= 10 && count <= 22);
+    assert(_value == 42);
+    assert(_code == SI_TIMER);
+
+    /* no more signals after deletion */
+    _sleep_msec(50);
+    assert(_count == count);
+
+    /* the deleted timer id is no longer valid */
+    assert(timer_gettime(timer, &its) == -1 && errno == EINVAL);
+
+    printf("=== passed test (%s: %d expirations)\n", __FUNCTION__, count);
+}
+
+static void _test_absolute_timer(void)
+{
+    struct sigevent sev;
+    struct itimerspec its;
+    timer_t timer;
+    uint64_t start = _now_msec();
+
+    _count = 0;
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGRTMIN;
+    assert(timer_create(CLOCK_REALTIME, &sev, &timer) == 0);
+
+    /* expire 50 milliseconds from now (one-shot) */
+    memset(&its, 0, sizeof(its));
+    clock_gettime(CLOCK_REALTIME, &its.it_value);
+    its.it_value.tv_nsec += 50 * 1000000;
+    if (its.it_value.tv_nsec >= 1000000000)
+    {
+        its.it_value.tv_sec++;
+        its.it_value.tv_nsec -= 1000000000;
+    }
+
+    assert(timer_settime(timer, TIMER_ABSTIME, &its, NULL) == 0);
+
+    while (_count == 0)
+    {
+        assert(_now_msec() - start < 5000);
+        _sleep_msec(1);
+    }
+
+    assert(_now_msec() - start >= 50);
+    assert(timer_delete(timer) == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+static void _test_itimer_prof(void)
+{
+    struct itimerval it = {{0, 0}, {0, 50000}};
+    uint64_t start = _now_msec();
+    volatile uint64_t spin = 0;
+
+    assert(signal(SIGPROF, _sigprof_handler) != SIG_ERR);
+    assert(setitimer(ITIMER_PROF, &it, NULL) == 0);
+
+    /* consume CPU time until the profiling timer expires */
+    while (!_got_sigprof)
+    {
+        assert(_now_msec() - start < 10000);
+        spin++;
+    }
+
+    assert(getitimer(ITIMER_PROF, &it) == 0);
+    assert(it.it_value.tv_sec == 0 && it.it_value.tv_usec == 0);
+
+    printf("=== passed test (%s)\n", __FUNCTION__);
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc == 4 && strcmp(argv[1], "child") == 0)
+        return _child(atoi(argv[2]), atoi(argv[3]));
+
+    /* first, so the child starts the timer thread that services the timers */
+    _test_timer_thread_handover(argv[0]);
+    _test_periodic_timer();
+    _test_absolute_timer();
+    _test_itimer_prof();
+
+    printf("=== passed all tests (%s)\n", argv[0]);
+
+    return 0;
+}
@@ -2,9 +2,12 @@
 // Licensed under the MIT License.
 
 #include <memory.h>
+#include <myst/fiber.h>
+#include <myst/ext2.h>
 #include <myst/file.h>
 #include <myst/kernel.h>
 #include <myst/round.h>
+#include <myst/sockdev.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -212,6 +215,69 @@ static json_result_t _json_read_callback(
 
                 parsed_data->max_affinity_cpus = (size_t)un->integer;
             }
+            else if (json_match(parser, "ThreadStackCacheSize") == JSON_OK)
+            {
+                if (type != JSON_TYPE_INTEGER)
+                    CONFIG_RAISE(JSON_TYPE_MISMATCH);
+
+                if (un->integer < 0)
+                    CONFIG_RAISE(JSON_OUT_OF_BOUNDS);
+
+                parsed_data->thread_stack_cache_size = (size_t)un->integer;
+            }
+            else if (json_match(parser, "FiberCarrierThreads") == JSON_OK)
+            {
+                if (type != JSON_TYPE_INTEGER)
+                    CONFIG_RAISE(JSON_TYPE_MISMATCH);
+
+                if (un->integer < 0 || un->integer > MYST_MAX_FIBER_CARRIERS)
+                    CONFIG_RAISE(JSON_OUT_OF_BOUNDS);
+
+                parsed_data->fiber_carriers = (size_t)un->integer;
+            }
+            else if (json_match(parser, "FiberThreshold") == JSON_OK)
+            {
+                if (type != JSON_TYPE_INTEGER)
+                    CONFIG_RAISE(JSON_TYPE_MISMATCH);
+
+                if (un->integer < 0)
+                    CONFIG_RAISE(JSON_OUT_OF_BOUNDS);
+
+                parsed_data->fiber_threshold = (size_t)un->integer;
+            }
+            else if (json_match(parser, "MaxFibers") == JSON_OK)
+            {
+                if (type != JSON_TYPE_INTEGER)
+                    CONFIG_RAISE(JSON_TYPE_MISMATCH);
+
+                if (un->integer < 0 || un->integer > MYST_MAX_FIBERS)
+                    CONFIG_RAISE(JSON_OUT_OF_BOUNDS);
+
+                parsed_data->max_fibers = (size_t)un->integer;
+            }
+            else if (json_match(parser, "SocketReadAheadKB") == JSON_OK)
+            {
+                if (type != JSON_TYPE_INTEGER)
+                    CONFIG_RAISE(JSON_TYPE_MISMATCH);
+
+                if (un->integer < 0 ||
+                    un->integer > MYST_MAX_SOCKET_READ_AHEAD_KB)
+                {
+                    CONFIG_RAISE(JSON_OUT_OF_BOUNDS);
+                }
+
+                parsed_data->socket_read_ahead_kb = (size_t)un->integer;
+            }
+            else if (json_match(parser, "Ext2CacheKB") == JSON_OK)
+            {
+                if (type != JSON_TYPE_INTEGER)
+                    CONFIG_RAISE(JSON_TYPE_MISMATCH);
+
+                if (un->integer < 0 || un->integer > EXT2_MAX_CACHE_KB)
+                    CONFIG_RAISE(JSON_OUT_OF_BOUNDS);
+
+                parsed_data->ext2_cache_kb = (size_t)un->integer;
+            }
             else if (json_match(parser, "NoBrk") == JSON_OK)
             {
                 if (type == JSON_TYPE_BOOLEAN)
@@ -83,6 +83,16 @@ typedef struct _config_parsed_data_t
     size_t main_stack_size;
     /* maximum number of CPUs in the kernel (for thread affinity) */
     size_t max_affinity_cpus;
+    /* number of exited thread stacks kept for reuse (zero disables) */
+    size_t thread_stack_cache_size;
+    /* M:N fiber scheduler settings (zero carriers disables fibers) */
+    size_t fiber_carriers;
+    size_t fiber_threshold;
+    size_t max_fibers;
+    /* TCP read-ahead buffer size in KB (zero disables read-ahead) */
+    size_t socket_read_ahead_kb;
+    /* ext2 block cache size in KB per mount (zero selects the default) */
+    size_t ext2_cache_kb;
 
     // Internal data
     void* buffer;
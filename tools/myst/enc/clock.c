@@ -5,7 +5,10 @@
 
 #include <errno.h>
 #include <myst/clock.h>
+#include <myst/defs.h>
 #include <myst/syscall.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 static long _realtime0 = 0;
@@ -13,6 +16,120 @@ static long _monotime0 = 0;
 static volatile long* _monotime_now = 0;
 static long _realtime_delta = 0;
 static long enc_clock_res = 0;
+static struct clock_ctrl* _ctrl = 0;
+
+/*
+**==============================================================================
+**
+** TSC clock:
+**
+**     When RDTSC executes natively in the enclave, the monotonic clock is
+**     derived from the TSC as:
+**
+**         ns = base_ns + ((tsc - base_tsc) * mult) >> MULT_SHIFT
+**
+**     The scale (mult) is calibrated against the (tsc, now) pairs that the
+**     host clock thread publishes, measured from the first pair observed at
+**     startup. Every RECALIBRATE_NSEC, one thread re-measures the scale and
+**     slews the clock toward the host clock over the next interval, keeping
+**     it continuous. Past the interval (when no thread has read the clock
+**     to recalibrate it), the clock runs at the measured scale rather than
+**     the slewed one, so an idle period does not multiply the last slew.
+**     Readers never take a lock: the parameters are published with a
+**     sequence counter. Until the first calibration (or if RDTSC traps) the
+**     clock falls back to the host-updated ctrl->now value.
+**
+**==============================================================================
+*/
+
+#define MULT_SHIFT 32
+
+/* the minimum host time between the calibration samples */
+#define CALIBRATE_NSEC (50 * 1000 * 1000L)
+
+/* how often to correct drift from the host clock */
+#define RECALIBRATE_NSEC (1000 * 1000 * 1000L)
+
+/* reject TSC frequencies outside of [100 MHz, 10 GHz] */
+#define MIN_MULT ((1UL << MULT_SHIFT) / 10)
+#define MAX_MULT ((1UL << MULT_SHIFT) * 10)
+
+/* set by the exception handler when it emulates RDTSC (see enc.c) */
+volatile int myst_rdtsc_emulated;
+
+static bool _tsc_usable;
+
+/* the host sample that calibration is measured from */
+static long _anchor_ns;
+static uint64_t _anchor_tsc;
+
+typedef struct clock_params
+{
+    uint64_t base_tsc;
+    long base_ns;
+    uint64_t mult;            /* the slewed scale (until recalibrate_tsc) */
+    uint64_t base_mult;       /* the measured scale (after recalibrate_tsc) */
+    uint64_t recalibrate_tsc; /* recalibrate when the TSC passes this */
+} clock_params_t;
+
+/* the clock parameters (written under seq) */
+static struct
+{
+    volatile uint64_t seq;
+    clock_params_t p;
+} _params;
+
+static volatile int _calibrating;
+
+/* the latest fallback value (to keep the transition monotonic) */
+static volatile long _fallback_prev;
+
+MYST_INLINE uint64_t _rdtsc(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* read a consistent (now, tsc) pair published by the host clock thread */
+static bool _read_host_sample(long* ns, uint64_t* tsc)
+{
+    for (size_t i = 0; i < 100; i++)
+    {
+        uint64_t seq = __atomic_load_n(&_ctrl->seq, __ATOMIC_ACQUIRE);
+
+        if (seq & 1)
+            continue;
+
+        *ns = _ctrl->now;
+        *tsc = _ctrl->tsc;
+
+        if (__atomic_load_n(&_ctrl->seq, __ATOMIC_ACQUIRE) == seq)
+            return *tsc != 0;
+    }
+
+    return false;
+}
+
+MYST_INLINE long _scale(uint64_t ticks, uint64_t mult)
+{
+    return (long)(((unsigned __int128)ticks * mult) >> MULT_SHIFT);
+}
+
+/* the clock at the given TSC: slewed up to the end of the interval, then
+ * at the measured scale */
+static long _tsc_to_ns(const clock_params_t* p, uint64_t tsc)
+{
+    if (tsc < p->base_tsc)
+        return p->base_ns;
+
+    if (tsc <= p->recalibrate_tsc)
+        return p->base_ns + _scale(tsc - p->base_tsc, p->mult);
+
+    return p->base_ns + _scale(p->recalibrate_tsc - p->base_tsc, p->mult) +
+           _scale(tsc - p->recalibrate_tsc, p->base_mult);
+}
 
 int myst_setup_clock(struct clock_ctrl* ctrl)
 {
@@ -38,9 +155,24 @@ int myst_setup_clock(struct clock_ctrl* ctrl)
         // to, decreaing the value over time, i.e., a clock goes backward. Both
         // _get_monotime and _get_realtime are guarded against such attacks.
         _monotime_now = &ctrl->now;
+        _ctrl = ctrl;
+        _fallback_prev = _monotime0;
 
         enc_clock_res = (long)ctrl->interval;
 
+        // Use the TSC only if RDTSC does not trap (it traps on SGX1, where
+        // the exception handler emulates it with an expensive OCALL).
+        {
+            myst_rdtsc_emulated = 0;
+            _rdtsc();
+
+            if (!myst_rdtsc_emulated &&
+                _read_host_sample(&_anchor_ns, &_anchor_tsc))
+            {
+                _tsc_usable = true;
+            }
+        }
+
         ret = 0;
     }
 done:
@@ -56,24 +188,153 @@ static void _check(bool overflowed)
     }
 }
 
-/* Return monotonic clock in nanoseconds since a starting point */
-static long _get_monotime()
+/* Return the host-updated monotonic clock (never decreasing) */
+static long _get_host_monotime()
 {
-    static long prev = 0;
-    if (prev == 0)
-        prev = _monotime0;
     long now = *_monotime_now;
-    if (now > prev)
+    long prev = __atomic_load_n(&_fallback_prev, __ATOMIC_RELAXED);
+
+    // maintain monotonicity without a lock: only advance the shared value
+    while (now > prev)
     {
-        prev = now;
-        return now;
+        if (__atomic_compare_exchange_n(
+                &_fallback_prev,
+                &prev,
+                now,
+                false,
+                __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED))
+        {
+            return now;
+        }
+    }
+
+    // TODO: issue a warning if now < prev. Host might be playing tricks.
+    return prev;
+}
+
+/* compute new clock parameters from the latest host sample */
+static void _calibrate(uint64_t tsc)
+{
+    long host_ns;
+    uint64_t host_tsc;
+    uint64_t mult;
+    long current;
+    long target;
+    long error;
+    uint64_t seq;
+
+    if (!_read_host_sample(&host_ns, &host_tsc))
+        return;
+
+    // The host sample must precede this TSC read and follow the anchor.
+    if (host_tsc > tsc || host_tsc <= _anchor_tsc ||
+        host_ns - _anchor_ns < CALIBRATE_NSEC)
+    {
+        return;
+    }
+
+    mult = (uint64_t)(
+        ((unsigned __int128)(host_ns - _anchor_ns) << MULT_SHIFT) /
+        (host_tsc - _anchor_tsc));
+
+    if (mult < MIN_MULT || mult > MAX_MULT)
+        return;
+
+    // Where the host clock says we are now.
+    target = host_ns + _scale(tsc - host_tsc, mult);
+
+    if (_params.p.mult == 0)
+    {
+        // First calibration: continue from the fallback clock.
+        current = __atomic_load_n(&_fallback_prev, __ATOMIC_RELAXED);
+
+        if (target > current)
+            current = target;
+
+        error = 0;
     }
     else
     {
-        // maintain monotonicity.
-        // TODO: issue a warning. Host might be playing tricks.
-        return ++prev;
+        current = _tsc_to_ns(&_params.p, tsc);
+        error = target - current;
+
+        // Step forward over large gaps but never step backward; otherwise
+        // slew by at most half of the interval so that time keeps moving.
+        if (error > RECALIBRATE_NSEC)
+        {
+            current = target;
+            error = 0;
+        }
+        else if (error < -RECALIBRATE_NSEC / 2)
+        {
+            error = -RECALIBRATE_NSEC / 2;
+        }
+    }
+
+    // Absorb the error over the next interval by adjusting the slope.
+    {
+        uint64_t ticks = (uint64_t)(
+            ((unsigned __int128)RECALIBRATE_NSEC << MULT_SHIFT) / mult);
+        uint64_t slewed = (uint64_t)(
+            ((unsigned __int128)(RECALIBRATE_NSEC + error) << MULT_SHIFT) /
+            ticks);
+
+        seq = _params.seq;
+        __atomic_store_n(&_params.seq, seq + 1, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        _params.p.base_tsc = tsc;
+        _params.p.base_ns = current;
+        _params.p.mult = slewed;
+        _params.p.base_mult = mult;
+        _params.p.recalibrate_tsc = tsc + ticks;
+        __atomic_store_n(&_params.seq, seq + 2, __ATOMIC_RELEASE);
+    }
+}
+
+/* Return the TSC-derived clock or -1 if it is not calibrated yet */
+static long _get_tsc_monotime()
+{
+    uint64_t tsc = _rdtsc();
+    uint64_t seq;
+    clock_params_t p;
+
+    do
+    {
+        seq = __atomic_load_n(&_params.seq, __ATOMIC_ACQUIRE);
+        p = _params.p;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) ||
+             __atomic_load_n(&_params.seq, __ATOMIC_RELAXED) != seq);
+
+    // Recalibrate when due (one thread does it; the others carry on).
+    if (p.mult == 0 || tsc >= p.recalibrate_tsc)
+    {
+        if (__atomic_exchange_n(&_calibrating, 1, __ATOMIC_ACQUIRE) == 0)
+        {
+            _calibrate(tsc);
+            __atomic_store_n(&_calibrating, 0, __ATOMIC_RELEASE);
+        }
+
+        if (p.mult == 0)
+            return -1;
     }
+
+    return _tsc_to_ns(&p, tsc);
+}
+
+/* Return monotonic clock in nanoseconds since a starting point */
+static long _get_monotime()
+{
+    if (_tsc_usable)
+    {
+        long now = _get_tsc_monotime();
+
+        if (now >= 0)
+            return now;
+    }
+
+    return _get_host_monotime();
 }
 
 static long _get_boottime()
@@ -96,9 +357,17 @@ static long _get_realtime()
 
 long myst_tcall_clock_getres(clockid_t clk_id, struct timespec* res)
 {
-    (void)clk_id;
-    res->tv_sec = enc_clock_res / NANO_IN_SECOND;
-    res->tv_nsec = enc_clock_res % NANO_IN_SECOND;
+    long resolution = enc_clock_res;
+
+    /* the coarse clocks and the uncalibrated clock use the host tick */
+    if (_tsc_usable && _params.p.mult && clk_id != CLOCK_MONOTONIC_COARSE &&
+        clk_id != CLOCK_REALTIME_COARSE)
+    {
+        resolution = 1;
+    }
+
+    res->tv_sec = resolution / NANO_IN_SECOND;
+    res->tv_nsec = resolution % NANO_IN_SECOND;
     return 0;
 }
 
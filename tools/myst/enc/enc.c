@@ -192,6 +192,9 @@ static size_t _get_num_tcs(void)
 
 int myst_setup_clock(struct clock_ctrl*);
 
+/* set when RDTSC is emulated (see clock.c) */
+extern volatile int myst_rdtsc_emulated;
+
 static void _sanitize_xsave_area_fields(uint64_t* rbx, uint64_t* rcx)
 {
     assert(rbx && rcx);
@@ -305,6 +308,7 @@ static uint64_t _vectored_handler(oe_exception_record_t* er)
 
                 er->context->rax = rax;
                 er->context->rdx = rdx;
+                myst_rdtsc_emulated = 1;
 
                 /* Skip over the illegal instruction. */
                 er->context->rip += 2;
@@ -782,6 +786,18 @@ static long _enter(void* arg_)
         _kargs.main_stack_size =
             main_stack_size ? main_stack_size : MYST_PROCESS_INIT_STACK_SIZE;
 
+        if (have_config)
+        {
+            _kargs.thread_stack_cache_size =
+                parsed_config.thread_stack_cache_size;
+            _kargs.fiber_carriers = parsed_config.fiber_carriers;
+            _kargs.fiber_threshold = parsed_config.fiber_threshold;
+            _kargs.max_fibers = parsed_config.max_fibers;
+            _kargs.socket_read_ahead_size =
+                parsed_config.socket_read_ahead_kb * 1024;
+            _kargs.ext2_cache_size = parsed_config.ext2_cache_kb * 1024;
+        }
+
         /* whether user-space FSGSBASE instructions are supported */
         _kargs.have_fsgsbase_instructions = options->have_fsgsbase_instructions;
 
@@ -472,6 +472,16 @@ static int _enter_kernel(
     kernel_args.main_stack_size =
         main_stack_size ? main_stack_size : MYST_PROCESS_INIT_STACK_SIZE;
 
+    if (have_config)
+    {
+        kernel_args.thread_stack_cache_size = pd.thread_stack_cache_size;
+        kernel_args.fiber_carriers = pd.fiber_carriers;
+        kernel_args.fiber_threshold = pd.fiber_threshold;
+        kernel_args.max_fibers = pd.max_fibers;
+        kernel_args.socket_read_ahead_size = pd.socket_read_ahead_kb * 1024;
+        kernel_args.ext2_cache_size = pd.ext2_cache_kb * 1024;
+    }
+
     /* Resolve the the kernel entry point */
     const elf_ehdr_t* ehdr = kernel_args.kernel_data;
     entry = (myst_kernel_entry_t)((uint8_t*)ehdr + ehdr->e_entry);
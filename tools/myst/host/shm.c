@@ -8,9 +8,49 @@
 
 static pthread_t _clock_thread;
 
+static unsigned long _rdtsc(void)
+{
+    unsigned int lo;
+    unsigned int hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long)hi << 32) | lo;
+}
+
+/* publish a (now, tsc) pair that the enclave uses to calibrate the TSC */
+static void _update_clock(struct clock_ctrl* ctrl)
+{
+    struct timespec tp;
+    unsigned long seq = ctrl->seq;
+    unsigned long best = (unsigned long)-1;
+    unsigned long tsc = 0;
+    long now = 0;
+
+    // Keep the sample with the tightest TSC bracket so that a preemption
+    // between the two reads does not skew the calibration.
+    for (size_t i = 0; i < 3; i++)
+    {
+        unsigned long before = _rdtsc();
+        clock_gettime(CLOCK_MONOTONIC, &tp);
+        unsigned long after = _rdtsc();
+
+        if (after - before < best)
+        {
+            best = after - before;
+            tsc = before + best / 2;
+            now = tp.tv_sec * NANO_IN_SECOND + tp.tv_nsec;
+        }
+    }
+
+    __atomic_store_n(&ctrl->seq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    ctrl->tsc = tsc;
+    ctrl->now = now;
+    __atomic_store_n(&ctrl->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
 static void* _host_clock_task(void* args)
 {
-    struct timespec tp, sleep_tp;
+    struct timespec sleep_tp;
     struct clock_ctrl* ctrl = (struct clock_ctrl*)args;
 
     // Set up sleep interval
@@ -22,8 +62,7 @@ static void* _host_clock_task(void* args)
     while (__atomic_load_n(&ctrl->done, __ATOMIC_ACQUIRE) == 0)
     {
         nanosleep(&sleep_tp, NULL);
-        clock_gettime(CLOCK_MONOTONIC, &tp);
-        ctrl->now = tp.tv_sec * NANO_IN_SECOND + tp.tv_nsec;
+        _update_clock(ctrl);
     }
     return NULL;
 }
@@ -50,6 +89,7 @@ int shm_create_clock(struct myst_shm* shm, unsigned long clock_tick)
     clock_gettime(CLOCK_MONOTONIC, &tp);
     shm->clock->monotime0 = tp.tv_sec * NANO_IN_SECOND + tp.tv_nsec;
     shm->clock->now = shm->clock->monotime0;
+    shm->clock->tsc = _rdtsc();
 
     if (pthread_create(&_clock_thread, 0, _host_clock_task, (void*)shm->clock))
     {
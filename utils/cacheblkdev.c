@@ -0,0 +1,524 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <myst/blkdev.h>
+#include <myst/eraise.h>
+#include <myst/list.h>
+
+/*
+**==============================================================================
+**
+** cacheblkdev: a write-back block cache layered over another block device
+**
+** Blocks are kept in a hash table and on a list ordered from the most to the
+** least recently used, from whose tail blocks are evicted once the cache is
+** full. Writes only update the cache and mark the block dirty; dirty blocks
+** reach the underlying device when they are evicted and when the cache is
+** flushed (on fsync, sync, and close).
+**
+** A miss that continues a sequential run of reads also reads ahead the blocks
+** that follow, with a window that doubles on each such miss.
+**
+** Large multi-block transfers bypass the cache (so that streaming through a
+** big file does not flush it): reads take the cached blocks from the cache
+** and the rest straight from the underlying device, and writes go straight
+** to the device after updating the cached copies.
+**
+** The cache does not lock: callers serialize access to the device (as ext2
+** does with its device lock).
+**
+**==============================================================================
+*/
+
+#define CACHEBLKDEV_MAGIC 0x8c4a3e2b9d5f4e17
+
+/* the initial and the largest read-ahead windows (in blocks) */
+#define MIN_READAHEAD 8
+#define MAX_READAHEAD 256
+
+/* multi-block transfers of at least this many blocks bypass the cache */
+#define BYPASS_BLOCKS 64
+
+typedef struct block block_t;
+
+struct block
+{
+    myst_list_node_t base; /* the LRU list */
+    block_t* next;         /* the hash chain */
+    uint64_t blkno;
+    bool dirty;
+    uint8_t data[MYST_BLKSIZE];
+};
+
+typedef struct blkdev
+{
+    myst_blkdev_t base;
+    uint64_t magic;
+    myst_blkdev_t* dev;
+    size_t max_blocks;
+    size_t max_readahead;
+    block_t** chains;
+    size_t nchains; /* a power of two */
+    myst_list_t lru; /* head is most recently used */
+    uint64_t next_blkno; /* the block that would continue a sequential run */
+    size_t window;
+    myst_cacheblkdev_stats_t stats;
+} blkdev_t;
+
+static bool _valid(const blkdev_t* impl)
+{
+    return impl && impl->magic == CACHEBLKDEV_MAGIC;
+}
+
+static block_t** _chain(blkdev_t* impl, uint64_t blkno)
+{
+    /* spread neighbouring blocks across the table */
+    const uint64_t hash = blkno * 0x9e3779b97f4a7c15;
+    return &impl->chains[(hash >> 32) & (impl->nchains - 1)];
+}
+
+static block_t* _find(blkdev_t* impl, uint64_t blkno)
+{
+    for (block_t* p = *_chain(impl, blkno); p; p = p->next)
+    {
+        if (p->blkno == blkno)
+            return p;
+    }
+
+    return NULL;
+}
+
+static void _touch(blkdev_t* impl, block_t* block)
+{
+    if (impl->lru.head != &block->base)
+    {
+        myst_list_remove(&impl->lru, &block->base);
+        myst_list_prepend(&impl->lru, &block->base);
+    }
+}
+
+static int _write_back(blkdev_t* impl, block_t* block)
+{
+    int ret = 0;
+
+    if (block->dirty)
+    {
+        ECHECK((*impl->dev->put)(impl->dev, block->blkno, block->data));
+        block->dirty = false;
+        impl->stats.writebacks++;
+    }
+
+done:
+    return ret;
+}
+
+/* remove a block from the cache (the caller frees or reuses it) */
+static void _remove(blkdev_t* impl, block_t* block)
+{
+    for (block_t** pp = _chain(impl, block->blkno); *pp; pp = &(*pp)->next)
+    {
+        if (*pp == block)
+        {
+            *pp = block->next;
+            break;
+        }
+    }
+
+    myst_list_remove(&impl->lru, &block->base);
+}
+
+/* get a block to hold blkno (evicting the least recently used if full) */
+static int _alloc(blkdev_t* impl, uint64_t blkno, block_t** block_out)
+{
+    int ret = 0;
+    block_t* block;
+    block_t** chain;
+
+    if (impl->lru.size < impl->max_blocks)
+    {
+        if (!(block = malloc(sizeof(block_t))))
+            ERAISE(-ENOMEM);
+    }
+    else
+    {
+        block = (block_t*)impl->lru.tail;
+        ECHECK(_write_back(impl, block));
+        _remove(impl, block);
+        impl->stats.evictions++;
+    }
+
+    block->blkno = blkno;
+    block->dirty = false;
+
+    chain = _chain(impl, blkno);
+    block->next = *chain;
+    *chain = block;
+    myst_list_prepend(&impl->lru, &block->base);
+
+    *block_out = block;
+
+done:
+    return ret;
+}
+
+/* read the uncached blocks of the range (stopping quietly at a failure) */
+static void _readahead(blkdev_t* impl, uint64_t blkno, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        block_t* block;
+
+        if (_find(impl, blkno + i))
+            continue;
+
+        if (_alloc(impl, blkno + i, &block) != 0)
+            break;
+
+        /* reading ahead may run past the end of the device */
+        if ((*impl->dev->get)(impl->dev, blkno + i, block->data) != 0)
+        {
+            _remove(impl, block);
+            free(block);
+            break;
+        }
+
+        impl->stats.readaheads++;
+    }
+}
+
+static int _flush(myst_blkdev_t* dev)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+
+    if (!_valid(impl))
+        ERAISE(-EINVAL);
+
+    for (myst_list_node_t* p = impl->lru.head; p; p = p->next)
+        ECHECK(_write_back(impl, (block_t*)p));
+
+    if (impl->dev->flush)
+        ECHECK((*impl->dev->flush)(impl->dev));
+
+done:
+    return ret;
+}
+
+static int _close(myst_blkdev_t* dev)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+
+    if (!_valid(impl))
+        ERAISE(-EINVAL);
+
+    /* closing the underlying device releases it even if the flush fails */
+    ret = _flush(dev);
+
+    myst_list_free(&impl->lru);
+    free(impl->chains);
+
+    {
+        int r = (*impl->dev->close)(impl->dev);
+
+        if (ret == 0)
+            ret = r;
+    }
+
+    impl->magic = 0;
+    free(impl);
+
+done:
+    return ret;
+}
+
+static int _get(myst_blkdev_t* dev, uint64_t blkno, void* data)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+    block_t* block;
+
+    if (!_valid(impl) || !data)
+        ERAISE(-EINVAL);
+
+    if ((block = _find(impl, blkno)))
+    {
+        _touch(impl, block);
+        impl->stats.hits++;
+    }
+    else
+    {
+        const bool sequential = (blkno == impl->next_blkno);
+
+        ECHECK(_alloc(impl, blkno, &block));
+
+        if ((ret = (*impl->dev->get)(impl->dev, blkno, block->data)) != 0)
+        {
+            _remove(impl, block);
+            free(block);
+            ERAISE(ret);
+        }
+
+        impl->stats.misses++;
+
+        if (sequential)
+        {
+            if (impl->window > impl->max_readahead)
+                impl->window = impl->max_readahead;
+
+            _readahead(impl, blkno + 1, impl->window);
+            impl->window *= 2;
+        }
+        else
+        {
+            impl->window = MIN_READAHEAD;
+        }
+    }
+
+    memcpy(data, block->data, MYST_BLKSIZE);
+    impl->next_blkno = blkno + 1;
+
+done:
+    return ret;
+}
+
+static int _put(myst_blkdev_t* dev, uint64_t blkno, const void* data)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+    block_t* block;
+
+    if (!_valid(impl) || !data)
+        ERAISE(-EINVAL);
+
+    if ((block = _find(impl, blkno)))
+        _touch(impl, block);
+    else
+        ECHECK(_alloc(impl, blkno, &block));
+
+    memcpy(block->data, data, MYST_BLKSIZE);
+    block->dirty = true;
+
+done:
+    return ret;
+}
+
+/* read consecutive blocks from the underlying device */
+static int _get_lower(blkdev_t* impl, uint64_t blkno, void* data, size_t count)
+{
+    int ret = 0;
+    myst_blkdev_t* dev = impl->dev;
+    uint8_t* ptr = (uint8_t*)data;
+
+    if (dev->get_blocks)
+    {
+        ECHECK((*dev->get_blocks)(dev, blkno, data, count));
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+            ECHECK((*dev->get)(dev, blkno + i, ptr + i * MYST_BLKSIZE));
+    }
+
+done:
+    return ret;
+}
+
+static int _get_blocks(
+    myst_blkdev_t* dev,
+    uint64_t blkno,
+    void* data,
+    size_t count)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+    uint8_t* ptr = (uint8_t*)data;
+
+    if (!_valid(impl) || !data)
+        ERAISE(-EINVAL);
+
+    if (count < BYPASS_BLOCKS)
+    {
+        for (size_t i = 0; i < count; i++)
+            ECHECK(_get(dev, blkno + i, ptr + i * MYST_BLKSIZE));
+
+        goto done;
+    }
+
+    for (size_t i = 0; i < count;)
+    {
+        block_t* block;
+
+        if ((block = _find(impl, blkno + i)))
+        {
+            /* the cached copy may be newer than the device */
+            memcpy(ptr + i * MYST_BLKSIZE, block->data, MYST_BLKSIZE);
+            impl->stats.hits++;
+            i++;
+        }
+        else
+        {
+            size_t n = 1;
+
+            /* read the uncached blocks up to the next cached one at once */
+            while (i + n < count && !_find(impl, blkno + i + n))
+                n++;
+
+            ECHECK(_get_lower(impl, blkno + i, ptr + i * MYST_BLKSIZE, n));
+            impl->stats.misses += n;
+            i += n;
+        }
+    }
+
+    impl->next_blkno = blkno + count;
+
+done:
+    return ret;
+}
+
+static int _put_blocks(
+    myst_blkdev_t* dev,
+    uint64_t blkno,
+    const void* data,
+    size_t count)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+    const uint8_t* ptr = (const uint8_t*)data;
+    myst_blkdev_t* lower;
+
+    if (!_valid(impl) || !data)
+        ERAISE(-EINVAL);
+
+    if (count < BYPASS_BLOCKS)
+    {
+        for (size_t i = 0; i < count; i++)
+            ECHECK(_put(dev, blkno + i, ptr + i * MYST_BLKSIZE));
+
+        goto done;
+    }
+
+    lower = impl->dev;
+
+    if (lower->put_blocks)
+    {
+        ECHECK((*lower->put_blocks)(lower, blkno, data, count));
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+            ECHECK((*lower->put)(lower, blkno + i, ptr + i * MYST_BLKSIZE));
+    }
+
+    /* the cached copies now match the device */
+    for (size_t i = 0; i < count; i++)
+    {
+        block_t* block;
+
+        if ((block = _find(impl, blkno + i)))
+        {
+            memcpy(block->data, ptr + i * MYST_BLKSIZE, MYST_BLKSIZE);
+            block->dirty = false;
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _readahead_hint(myst_blkdev_t* dev, uint64_t blkno, size_t count)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+
+    if (!_valid(impl))
+        ERAISE(-EINVAL);
+
+    /* leave room for the blocks already in use */
+    if (count > impl->max_readahead)
+        count = impl->max_readahead;
+
+    _readahead(impl, blkno, count);
+
+done:
+    return ret;
+}
+
+int myst_cacheblkdev_open(
+    myst_blkdev_t* dev,
+    size_t max_blocks,
+    myst_blkdev_t** blkdev)
+{
+    int ret = 0;
+    blkdev_t* impl = NULL;
+    size_t nchains = 1;
+
+    if (blkdev)
+        *blkdev = NULL;
+
+    if (!dev || !blkdev || max_blocks == 0)
+        ERAISE(-EINVAL);
+
+    if (!(impl = calloc(1, sizeof(blkdev_t))))
+        ERAISE(-ENOMEM);
+
+    while (nchains < max_blocks)
+        nchains *= 2;
+
+    if (!(impl->chains = calloc(nchains, sizeof(block_t*))))
+        ERAISE(-ENOMEM);
+
+    impl->magic = CACHEBLKDEV_MAGIC;
+    impl->dev = dev;
+    impl->max_blocks = max_blocks;
+    impl->nchains = nchains;
+    impl->next_blkno = UINT64_MAX;
+    impl->window = MIN_READAHEAD;
+
+    /* read-ahead may use at most a quarter of the cache */
+    impl->max_readahead = max_blocks / 4;
+
+    if (impl->max_readahead > MAX_READAHEAD)
+        impl->max_readahead = MAX_READAHEAD;
+
+    impl->base.close = _close;
+    impl->base.get = _get;
+    impl->base.put = _put;
+    impl->base.flush = _flush;
+    impl->base.readahead = _readahead_hint;
+    impl->base.get_blocks = _get_blocks;
+    impl->base.put_blocks = _put_blocks;
+
+    *blkdev = &impl->base;
+    impl = NULL;
+
+done:
+
+    if (impl)
+    {
+        free(impl->chains);
+        free(impl);
+    }
+
+    return ret;
+}
+
+int myst_cacheblkdev_stats(
+    myst_blkdev_t* blkdev,
+    myst_cacheblkdev_stats_t* stats)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)blkdev;
+
+    if (!_valid(impl) || !stats)
+        ERAISE(-EINVAL);
+
+    *stats = impl->stats;
+
+done:
+    return ret;
+}
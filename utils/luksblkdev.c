@@ -132,6 +132,70 @@ done:
     return ret;
 }
 
+/* read the encrypted sectors at once and decrypt them into place */
+static int _get_blocks(
+    myst_blkdev_t* dev_,
+    uint64_t blkno,
+    void* data,
+    size_t count)
+{
+    int ret = 0;
+    blkdev_t* dev = (blkdev_t*)dev_;
+    uint8_t* ptr = (uint8_t*)data;
+    struct locals
+    {
+        uint8_t buf[LUKS_SECTOR_SIZE];
+    };
+    struct locals* locals = NULL;
+
+    if (!_luksblkdev_valid(dev) || !data)
+        ERAISE(-EINVAL);
+
+    if (!(locals = malloc(sizeof(struct locals))))
+        ERAISE(-ENOMEM);
+
+    myst_blkdev_t* rawdev = dev->rawdev;
+    const uint64_t rawblkno = blkno + dev->phdr.payload_offset;
+
+    if (rawdev->get_blocks)
+    {
+        ECHECK((*rawdev->get_blocks)(rawdev, rawblkno, data, count));
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            void* p = ptr + i * LUKS_SECTOR_SIZE;
+            ECHECK((*rawdev->get)(rawdev, rawblkno + i, p));
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t* p = ptr + i * LUKS_SECTOR_SIZE;
+
+        memcpy(locals->buf, p, LUKS_SECTOR_SIZE);
+
+        if (myst_luks_decrypt(
+                &dev->phdr,
+                dev->masterkey,
+                locals->buf,
+                p,
+                LUKS_SECTOR_SIZE,
+                blkno + i) != 0)
+        {
+            ERAISE(-EIO);
+        }
+    }
+
+done:
+
+    if (locals)
+        free(locals);
+
+    return ret;
+}
+
 static void _fix_phdr_byte_order(luks_phdr_t* phdr)
 {
     if (!myst_is_big_endian())
@@ -240,6 +304,7 @@ int myst_luksblkdev_open(
     dev->base.close = _close;
     dev->base.put = _put;
     dev->base.get = _get;
+    dev->base.get_blocks = _get_blocks;
     dev->rawdev = rawdev;
     dev->magic = LUKSBLKDEV_MAGIC;
     dev->phdr = locals->phdr;
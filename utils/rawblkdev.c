@@ -22,6 +22,9 @@
 #define MAX_LRU_CHAINS 32
 #define FREE_LIST_SIZE 64
 
+/* the most blocks passed to the host in one transfer */
+#define MAX_TRANSFER_SIZE 2048
+
 typedef struct cache_block cache_block_t;
 
 struct cache_block
@@ -358,6 +361,45 @@ done:
     return ret;
 }
 
+/* drop the read caches of blocks written to the device */
+static void _invalidate(blkdev_t* impl, uint64_t blkno, size_t count)
+{
+    lookahead_buf_t* p = (lookahead_buf_t*)impl->lookahead.head;
+
+    while (p)
+    {
+        lookahead_buf_t* next = (lookahead_buf_t*)p->base.next;
+
+        if (p->blkno < blkno + count && blkno < p->blkno + LOOKAHEAD_SIZE)
+        {
+            myst_list_remove(&impl->lookahead, &p->base);
+            _put_lookahead_buf(p);
+        }
+
+        p = next;
+    }
+
+#ifdef USE_LRU
+    for (size_t i = 0; i < count && i < MAX_LRU_CHAINS; i++)
+    {
+        myst_list_t* list = &impl->lru[(blkno + i) % MAX_LRU_CHAINS];
+
+        for (node_t* q = (node_t*)list->head; q;)
+        {
+            node_t* next = (node_t*)q->base.next;
+
+            if (q->blkno >= blkno && q->blkno < blkno + count)
+            {
+                myst_list_remove(list, &q->base);
+                _put_node(q);
+            }
+
+            q = next;
+        }
+    }
+#endif /* USE_LRU */
+}
+
 static int _put(myst_blkdev_t* dev, uint64_t blkno, const void* data)
 {
     int ret = 0;
@@ -385,6 +427,93 @@ static int _put(myst_blkdev_t* dev, uint64_t blkno, const void* data)
 
     const uint64_t rawblkno = blkno + impl->blkno_offset;
     ECHECK(myst_write_block_device(impl->fd, rawblkno, data, 1));
+    _invalidate(impl, blkno, 1);
+
+done:
+    return ret;
+}
+
+/* read straight into the caller's buffer (bypassing the read caches) */
+static int _get_blocks(
+    myst_blkdev_t* dev,
+    uint64_t blkno,
+    void* data,
+    size_t count)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+    myst_block_t* blocks = (myst_block_t*)data;
+
+    if (!dev || !data)
+        ERAISE(-EINVAL);
+
+    for (size_t i = 0; i < count;)
+    {
+        const uint64_t rawblkno = blkno + i + impl->blkno_offset;
+        size_t n = count - i;
+        ssize_t r;
+
+        if (n > MAX_TRANSFER_SIZE)
+            n = MAX_TRANSFER_SIZE;
+
+        ECHECK(r = myst_read_block_device(impl->fd, rawblkno, &blocks[i], n));
+
+        if ((size_t)r != n)
+            ERAISE(-EIO);
+
+        i += n;
+    }
+
+    /* the written blocks of an ephemeral device only live in the cache */
+    if (impl->ephemeral)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const cache_block_t* cache_block;
+
+            if ((cache_block = _get_cache(impl, blkno + i)))
+                memcpy(&blocks[i], cache_block->data, MYST_BLKSIZE);
+        }
+    }
+
+done:
+    return ret;
+}
+
+static int _put_blocks(
+    myst_blkdev_t* dev,
+    uint64_t blkno,
+    const void* data,
+    size_t count)
+{
+    int ret = 0;
+    blkdev_t* impl = (blkdev_t*)dev;
+    const myst_block_t* blocks = (const myst_block_t*)data;
+
+    if (!dev || !data)
+        ERAISE(-EINVAL);
+
+    if (impl->ephemeral)
+    {
+        for (size_t i = 0; i < count; i++)
+            ECHECK(_put(dev, blkno + i, &blocks[i]));
+
+        goto done;
+    }
+
+    for (size_t i = 0; i < count;)
+    {
+        const uint64_t rawblkno = blkno + i + impl->blkno_offset;
+        size_t n = count - i;
+
+        if (n > MAX_TRANSFER_SIZE)
+            n = MAX_TRANSFER_SIZE;
+
+        ECHECK(myst_write_block_device(impl->fd, rawblkno, &blocks[i], n));
+        i += n;
+    }
+
+    _invalidate(impl, blkno, count);
 
 done:
     return ret;
@@ -415,6 +544,8 @@ int myst_rawblkdev_open(
     impl->base.close = _close;
     impl->base.get = _get;
     impl->base.put = _put;
+    impl->base.get_blocks = _get_blocks;
+    impl->base.put_blocks = _put_blocks;
     impl->ephemeral = ephemeral;
     impl->blkno_offset = blkno_offset;
     impl->fd = fd;